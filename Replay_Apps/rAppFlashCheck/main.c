@@ -14,6 +14,8 @@
 // for sprintf
 #include "printf.h"
 
+#include "../../Replay_Boot/crc32.h"
+
 __attribute__ ((noreturn)) void _call_bootloader(void)
 {
   // set PROG low to reset FPGA (open drain)
@@ -52,24 +54,6 @@ void _show(char *s, int line)  {
   OSD_WriteRC(line, 0, s, 0, 0x0F, 0);   // 0x09=blue, 0x00=black, 0x0F=white
 }
 
-static unsigned int crc32(volatile void* address, uint32_t length)
-{
-    uint32_t crc = 0xffffffff;
-    uint8_t* data = (uint8_t*)address;
-
-    for (uint32_t i = 0; i < length; ++i) {
-        uint32_t byte = *data++;
-        crc = crc ^ byte;
-
-        for (int j = 7; j >= 0; j--) {    // Do eight times.
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
-    }
-
-    return ~crc;
-}
-
 // Here we go!
 int main(void)
 {
@@ -95,12 +79,12 @@ int main(void)
   OSD_WriteRC(4, 0, "CRC32 Checksums:", 0, 0x0B, 0);
 
   // crc32 checksum of boot area
-  unsigned long blsum=crc32(boot, boot_size ? boot_size + 0x200 : loader - boot);
+  unsigned long blsum=CRC32_Update(CRC32_INIT, (const void*)boot, boot_size ? boot_size + 0x200 : loader - boot);
   sprintf(s,"Bootloader: 0x%08lx",blsum);
   _show(s,6);
 
   // crc32 checksum of loader area
-  unsigned long ldsum=crc32(loader, fw_size ? fw_size : end - loader);
+  unsigned long ldsum=CRC32_Update(CRC32_INIT, (const void*)loader, fw_size ? fw_size : end - loader);
   sprintf(s,"Replay Firmware: 0x%08lx",ldsum);
   _show(s,7);
 
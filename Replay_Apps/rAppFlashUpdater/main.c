@@ -28,6 +28,8 @@
 // for sprintf
 #include "printf.h"
 
+#include "../../Replay_Boot/crc32.h"
+
 __attribute__ ((noreturn)) void _call_bootloader(void)
 {
   // set PROG low to reset FPGA (open drain)
@@ -98,73 +100,72 @@ void _get_block(uint32_t base, void *buf)
   SPI_DisableFpga();
 }
 
-// reset with data = 0x00000000; length = 0xffffffff
-static unsigned int feed_crc32(uint32_t address, uint32_t length)
+// wait for the flash controller to finish, returns the status register
+static uint32_t _wait_flash(void)
 {
-    static uint32_t crc;
-    uint8_t* data = (uint8_t*)address;
+  uint32_t status;
+  while(!((status = AT91C_BASE_MC->MC_FSR) & AT91C_MC_FRDY));
+  return status;
+}
 
-    if (data == 0 && length == 0xffffffff) {
-        crc = length;
-        length = 0;
-    }
+// program one 256 byte page, unless it already holds the same data
+// returns 0 if the page was unchanged, 1 if it was written, -1 on error
+static int _flash_page(uint32_t address, const uint32_t *data)
+{
+  volatile uint32_t *page = (volatile uint32_t *)address;
+  volatile uint32_t *p = 0x0;
+  uint32_t j;
 
-    for (uint32_t i = 0; i < length; ++i) {
-        uint32_t byte = *data++;
-        crc = crc ^ byte;
+  for(j=0;j<64;j++) {
+    if (page[j]!=data[j]) break;
+  }
+  if (j==64) return 0;
 
-        for (int j = 7; j >= 0; j--) {    // Do eight times.
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
-    }
+  // also clears any stale error flags
+  _wait_flash();
 
-    return ~crc;
+  for(j=0;j<64;j++) {
+    p[j]=data[j];
+  }
+  AT91C_BASE_MC->MC_FCR = (0x5A000000L) |
+                          (address&0x3FF00L) |
+                          AT91C_MC_FCMD_START_PROG;
+  if (_wait_flash() & (AT91C_MC_LOCKE | AT91C_MC_PROGE)) return -1;
+
+  for(j=0;j<64;j++) {
+    if (page[j]!=data[j]) return -1;
+  }
+  return 1;
 }
 
-void flash(uint32_t base, uint32_t size)
+// returns the number of pages that failed to program
+uint32_t flash(uint32_t base, uint32_t size)
 {
   char s[256];
-  uint32_t i, j, l, length;
-  volatile uint32_t code;
-  length = size; l=0;
-  code   = base;
-  for(i=0;i<((length/512)+1);i++) {
+  uint32_t i, half;
+  uint32_t written = 0, failed = 0;
+  const uint32_t pages = ((size/512)+1)*2;
+  uint32_t code = base;
+
+  for(i=0;i<pages;i+=2) {
     uint32_t buf[128];
-    volatile uint32_t *p=0x0;
     _get_block(code,buf);
-    // write first page from buffer
-    for(j=0;j<64;j++) {
-      p[j]=buf[j];
-    l+=4;
+    // two flash pages per block
+    for(half=0;half<2;half++) {
+      int r = _flash_page(code,&buf[half*64]);
+      if (r>0) written++;
+      if (r<0) failed++;
+      code+=256;
     }
-    Timer_Wait(10); // we need this to delay, the following while is quite useless...?
-    while(!((AT91C_BASE_MC->MC_FSR) & AT91C_MC_FRDY));
-    AT91C_BASE_MC->MC_FCR = (0x5A000000L) |
-                            (code&0x3FF00L) |
-                            AT91C_MC_FCMD_START_PROG;
-    Timer_Wait(10); // we need this to delay, the following while is quite useless...?
-    while(!((AT91C_BASE_MC->MC_FSR) & AT91C_MC_FRDY));
-    code+=256;
-    // write second page from buffer
-    for(j=0;j<64;j++) {
-      p[j]=buf[j+64];
-      l+=4;
-    }
-    Timer_Wait(10); // we need this to delay, the following while is quite useless...?
-    while(!((AT91C_BASE_MC->MC_FSR) & AT91C_MC_FRDY));
-    AT91C_BASE_MC->MC_FCR = (0x5A000000L) |
-                            (code&0x3FF00L) |
-                            AT91C_MC_FCMD_START_PROG;
-    Timer_Wait(10); // we need this to delay, the following while is quite useless...?
-    while(!((AT91C_BASE_MC->MC_FSR) & AT91C_MC_FRDY));
-    code+=256;
     // show something on OSD...
-    if ((l&0xfff)==0) {
-      sprintf(s,"@0x%08x (%lu%% written)",code,100*l/length);
+    if (((i+2)&0xf)==0 || (i+2)==pages) {
+      sprintf(s,"@0x%08lx %3lu%% (%lu written)",code,100*(i+2)/pages,written);
       OSD_WriteRC(12, 2, s, 0, 0xF, 0);
     }
   }
+
+  printf("%lu of %lu pages written, %lu failed\r\n",written,pages,failed);
+  return failed;
 }
 
 // Here we go!
@@ -227,16 +228,14 @@ int main(void)
 
     bok=1, lok=1;
     length=bootlength; l=0;
-    feed_crc32(0x0,0xffffffff);
     const uint32_t current_bootlength = (*(uint32_t*)0x100208 == 0xb007c0de) ? *(uint32_t*)0x10020c + 0x200: bootlength;
-    uint32_t bsum=0, bfsum=feed_crc32(bootbase,current_bootlength);
+    uint32_t bsum=CRC32_INIT, bfsum=CRC32_Update(CRC32_INIT,(const void*)bootbase,current_bootlength);
     code   = bootbase;
-    feed_crc32(0x0,0xffffffff);
     for(i=0;i<((length/512)+1);i++) {
       uint32_t buf[128];
       _get_block(code,buf);
       for(j=0;j<128;j++) {
-        if (l<length) bsum=feed_crc32((uint32_t)&buf[j],sizeof(buf[j]));
+        if (l<length) bsum=CRC32_Update(bsum,&buf[j],sizeof(buf[j]));
         else break;
         l += 4;
       }
@@ -251,16 +250,14 @@ int main(void)
     _show(s,8);
 
     length=loaderlength; l=0;
-    feed_crc32(0x0,0xffffffff);
     const uint32_t current_loaderlength = (*(uint32_t*)0x102020 == 0x600dc0de) ? *(uint32_t*)0x102024 : loaderlength;
-    uint32_t lsum=0, lfsum=feed_crc32(loaderbase,current_loaderlength);
+    uint32_t lsum=CRC32_INIT, lfsum=CRC32_Update(CRC32_INIT,(const void*)loaderbase,current_loaderlength);
     code   = loaderbase;
-    feed_crc32(0x0,0xffffffff);
     for(i=0;i<((length/512)+1);i++) {
       uint32_t buf[128];
       _get_block(code,buf);
       for(j=0;j<128;j++) {
-        if (l<length) lsum=feed_crc32((uint32_t)&buf[j],sizeof(buf[j]));
+        if (l<length) lsum=CRC32_Update(lsum,&buf[j],sizeof(buf[j]));
         else break;
         l += 4;
       }
@@ -306,14 +303,20 @@ int main(void)
                               (48<<16);
 
       // flash the boot loader
+      uint32_t failed = 0;
       if (!bok) {
         printf("flashing bootloader\r\n");
-        flash(bootbase, bootlength);
+        failed += flash(bootbase, bootlength);
       }
       // flash the main loader
       if (!lok) {
         printf("flashing firmware\r\n");
-        flash(loaderbase, loaderlength);
+        failed += flash(loaderbase, loaderlength);
+      }
+      if (failed) {
+        sprintf(s,"%lu PAGES FAILED TO PROGRAM!",failed);
+        _showhi(s,12);
+        Timer_Wait(2000);
       }
     } else {
       // 
@@ -23,13 +23,116 @@
 #include "messaging.h"
 
 /*variables*/
-static uint8_t crc;
 static HARDWARE_TICK timeout;
 static uint8_t response;
 static uint8_t cardType;
 static uint8_t cardDetected = FALSE;
 static uint8_t writeStateActive = FALSE;
 
+// With CRC_ON (CMD59) the card rejects commands and data blocks with a bad CRC,
+// and we check the CRC of every block read into memory. A failed block is
+// transferred again, up to CRC_RETRIES times. Direct to FPGA reads are not
+// checked; the data never passes through here.
+#ifndef CARD_CRC
+#define CARD_CRC            1
+#endif
+#define CRC_RETRIES         3
+
+#define R1_COM_CRC_ERROR    0x08
+#define DATA_RESPONSE_CRC   0x0B
+
+static uint8_t crcEnabled = FALSE;
+
+// CRC7 of the command, kept in the upper 7 bits
+static const uint8_t crc7_table[256] = {
+    0x00, 0x12, 0x24, 0x36, 0x48, 0x5a, 0x6c, 0x7e, 0x90, 0x82, 0xb4, 0xa6, 0xd8, 0xca, 0xfc, 0xee,
+    0x32, 0x20, 0x16, 0x04, 0x7a, 0x68, 0x5e, 0x4c, 0xa2, 0xb0, 0x86, 0x94, 0xea, 0xf8, 0xce, 0xdc,
+    0x64, 0x76, 0x40, 0x52, 0x2c, 0x3e, 0x08, 0x1a, 0xf4, 0xe6, 0xd0, 0xc2, 0xbc, 0xae, 0x98, 0x8a,
+    0x56, 0x44, 0x72, 0x60, 0x1e, 0x0c, 0x3a, 0x28, 0xc6, 0xd4, 0xe2, 0xf0, 0x8e, 0x9c, 0xaa, 0xb8,
+    0xc8, 0xda, 0xec, 0xfe, 0x80, 0x92, 0xa4, 0xb6, 0x58, 0x4a, 0x7c, 0x6e, 0x10, 0x02, 0x34, 0x26,
+    0xfa, 0xe8, 0xde, 0xcc, 0xb2, 0xa0, 0x96, 0x84, 0x6a, 0x78, 0x4e, 0x5c, 0x22, 0x30, 0x06, 0x14,
+    0xac, 0xbe, 0x88, 0x9a, 0xe4, 0xf6, 0xc0, 0xd2, 0x3c, 0x2e, 0x18, 0x0a, 0x74, 0x66, 0x50, 0x42,
+    0x9e, 0x8c, 0xba, 0xa8, 0xd6, 0xc4, 0xf2, 0xe0, 0x0e, 0x1c, 0x2a, 0x38, 0x46, 0x54, 0x62, 0x70,
+    0x82, 0x90, 0xa6, 0xb4, 0xca, 0xd8, 0xee, 0xfc, 0x12, 0x00, 0x36, 0x24, 0x5a, 0x48, 0x7e, 0x6c,
+    0xb0, 0xa2, 0x94, 0x86, 0xf8, 0xea, 0xdc, 0xce, 0x20, 0x32, 0x04, 0x16, 0x68, 0x7a, 0x4c, 0x5e,
+    0xe6, 0xf4, 0xc2, 0xd0, 0xae, 0xbc, 0x8a, 0x98, 0x76, 0x64, 0x52, 0x40, 0x3e, 0x2c, 0x1a, 0x08,
+    0xd4, 0xc6, 0xf0, 0xe2, 0x9c, 0x8e, 0xb8, 0xaa, 0x44, 0x56, 0x60, 0x72, 0x0c, 0x1e, 0x28, 0x3a,
+    0x4a, 0x58, 0x6e, 0x7c, 0x02, 0x10, 0x26, 0x34, 0xda, 0xc8, 0xfe, 0xec, 0x92, 0x80, 0xb6, 0xa4,
+    0x78, 0x6a, 0x5c, 0x4e, 0x30, 0x22, 0x14, 0x06, 0xe8, 0xfa, 0xcc, 0xde, 0xa0, 0xb2, 0x84, 0x96,
+    0x2e, 0x3c, 0x0a, 0x18, 0x66, 0x74, 0x42, 0x50, 0xbe, 0xac, 0x9a, 0x88, 0xf6, 0xe4, 0xd2, 0xc0,
+    0x1c, 0x0e, 0x38, 0x2a, 0x54, 0x46, 0x70, 0x62, 0x8c, 0x9e, 0xa8, 0xba, 0xc4, 0xd6, 0xe0, 0xf2
+};
+
+// CRC16-CCITT of the data blocks
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7, 0x8108, 0x9129, 0xa14a, 0xb16b,
+    0xc18c, 0xd1ad, 0xe1ce, 0xf1ef, 0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de, 0x2462, 0x3443, 0x0420, 0x1401,
+    0x64e6, 0x74c7, 0x44a4, 0x5485, 0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4, 0xb75b, 0xa77a, 0x9719, 0x8738,
+    0xf7df, 0xe7fe, 0xd79d, 0xc7bc, 0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b, 0x5af5, 0x4ad4, 0x7ab7, 0x6a96,
+    0x1a71, 0x0a50, 0x3a33, 0x2a12, 0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41, 0xedae, 0xfd8f, 0xcdec, 0xddcd,
+    0xad2a, 0xbd0b, 0x8d68, 0x9d49, 0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78, 0x9188, 0x81a9, 0xb1ca, 0xa1eb,
+    0xd10c, 0xc12d, 0xf14e, 0xe16f, 0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e, 0x02b1, 0x1290, 0x22f3, 0x32d2,
+    0x4235, 0x5214, 0x6277, 0x7256, 0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405, 0xa7db, 0xb7fa, 0x8799, 0x97b8,
+    0xe75f, 0xf77e, 0xc71d, 0xd73c, 0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab, 0x5844, 0x4865, 0x7806, 0x6827,
+    0x18c0, 0x08e1, 0x3882, 0x28a3, 0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92, 0xfd2e, 0xed0f, 0xdd6c, 0xcd4d,
+    0xbdaa, 0xad8b, 0x9de8, 0x8dc9, 0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8, 0x6e17, 0x7e36, 0x4e55, 0x5e74,
+    0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+static inline uint8_t CRC7_Update(uint8_t crc, uint8_t c)
+{
+    return crc7_table[crc ^ c];
+}
+
+static inline uint16_t CRC16_Update(uint16_t crc, const uint8_t* p, uint32_t length)
+{
+    while (length--) {
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+    }
+
+    return crc;
+}
+
+// Open multi-block read (CMD18). Sequential Card_ReadM() calls continue the
+// transfer instead of issuing a new read command, followed by STOP and STATUS.
+// The card is deselected between calls; it simply waits for more clocks.
+#define READ_SESSION_IDLE_MS 50
+
+static struct {
+    uint8_t active;
+    uint32_t next;              // lba of the next block the card will send
+    HARDWARE_TICK idle;
+} readSession = { FALSE, 0, 0 };
+
+// Run while Card_ReadM() waits for a data token or the block DMA (see Card_SetReadHook)
+static void (*readHook)(void) = NULL;
+
+// Card_WriteM() returns once the card has accepted the last block; it programs
+// the flash while we do other things. The next card access waits for it and
+// checks CMD13 (Card_EndWrite), or Card_Update() does once the card is ready.
+// A failure found by Card_Update() is reported by the next read or write.
+// Card_Erase() leaves the card busy the same way, only for longer.
+#define WRITE_BUSY_MS       500
+#define ERASE_BUSY_MS       1000
+#define ERASE_MAX_SECTORS   8192    // per CMD38; keeps each erase inside ERASE_BUSY_MS
+
+static struct {
+    uint8_t pending;
+    uint8_t failed;
+    uint16_t busy_ms;
+    uint32_t lba;
+} writeSession = { FALSE, FALSE, WRITE_BUSY_MS, 0 };
+
 static const int32_t dma_buffer[512 / 4] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -104,7 +207,7 @@ static void PrintCommandHistory() {}
 // internal functions
 static uint8_t MMC_Command(uint8_t cmd, uint32_t arg);
 static uint8_t MMC_Command12(void);
-static void    MMC_CRC(uint8_t c);
+static uint8_t Card_GetStatus(void);
 
 uint8_t Card_Detect(void)
 {
@@ -309,6 +412,11 @@ uint8_t Card_TryInit(void)
 
     DEBUG(3, "SPI:Card_TryInit()");
 
+    readSession.active = FALSE;
+    writeSession.pending = FALSE;
+    writeSession.failed = FALSE;
+    crcEnabled = FALSE;
+
     SPI_SetFreq400kHz(); //init clock 100-400 kHz
 
     SPI_DisableCard();
@@ -432,6 +540,18 @@ uint8_t Card_TryInit(void)
         }
     }
 
+#if CARD_CRC
+
+    if (cardType != CARDTYPE_NONE) {
+        crcEnabled = MMC_Command(CMD59, 1) == 0x00;
+
+        if (!crcEnabled) {
+            WARNING("SPI:Card_Init CMD59 (CRC_ON_OFF) failed!");
+        }
+    }
+
+#endif
+
     SPI_DisableCard();
 
     if (cardType == (CARDTYPE_NONE)) {
@@ -478,6 +598,9 @@ uint64_t Card_GetCapacity(void)
 
     DEBUG(3, "SPI:Card_GetCapacity()");
 
+    Card_EndRead();
+    Card_EndWrite();
+
     SPI_EnableCard();
 
     timeout = Timer_Get(100);      // 100 ms timeout
@@ -533,9 +656,9 @@ uint64_t Card_GetCapacity(void)
     return capacity;
 }
 
-static uint8_t Card_WaitXfer()
+static uint8_t Card_WaitBusy(uint32_t ms)
 {
-    timeout = Timer_Get(500);      // timeout
+    timeout = Timer_Get(ms);
 
     while (rSPI(0xFF) == 0x00) {
         if (Timer_Check(timeout)) {
@@ -546,7 +669,12 @@ static uint8_t Card_WaitXfer()
     return TRUE;
 }
 
-static uint8_t Card_GetStatus()
+static uint8_t Card_WaitXfer()
+{
+    return Card_WaitBusy(WRITE_BUSY_MS);
+}
+
+static uint8_t Card_GetStatus(void)
 {
     if (MMC_Command(CMD13, 0)) {
         WARNING("SPI:Card_CMD13 - invalid response 0x%02X", response);
@@ -565,6 +693,81 @@ static uint8_t Card_GetStatus()
     return TRUE;
 }
 
+FF_T_SINT32 Card_EndRead(void)
+{
+    if (!readSession.active) {
+        return FF_ERR_NONE;
+    }
+
+    readSession.active = FALSE;
+
+    SPI_EnableCard();
+    MMC_Command12(); // stop multi block transmission
+
+    if (!Card_GetStatus()) {
+        WARNING("SPI:Card_EndRead - SEND_STATUS error! (lba=%lu)", readSession.next);
+        SPI_DisableCard();
+        return FF_ERR_DEVICE_DRIVER_FAILED;
+    }
+
+    SPI_DisableCard();
+    return FF_ERR_NONE;
+}
+
+FF_T_SINT32 Card_EndWrite(void)
+{
+    if (!writeSession.pending) {
+        if (writeSession.failed) {
+            writeSession.failed = FALSE;
+            return FF_ERR_DEVICE_DRIVER_FAILED;
+        }
+
+        return FF_ERR_NONE;
+    }
+
+    writeSession.pending = FALSE;
+
+    SPI_EnableCard();
+
+    if (!Card_WaitBusy(writeSession.busy_ms)) {
+        WARNING("SPI:Card_EndWrite - busy timeout! (lba=%lu)", writeSession.lba);
+        SPI_DisableCard();
+        return FF_ERR_DEVICE_DRIVER_FAILED;
+    }
+
+    if (!Card_GetStatus()) {
+        WARNING("SPI:Card_EndWrite - SEND_STATUS error! (lba=%lu)", writeSession.lba);
+        SPI_DisableCard();
+        return FF_ERR_DEVICE_DRIVER_FAILED;
+    }
+
+    SPI_DisableCard();
+    return FF_ERR_NONE;
+}
+
+void Card_SetReadHook(void (*hook)(void))
+{
+    readHook = hook;
+}
+
+void Card_Update(void)
+{
+    if (readSession.active && Timer_Check(readSession.idle)) {
+        Card_EndRead();
+    }
+
+    if (writeSession.pending) {
+        // the card holds DO low while programming; only finish once it let go
+        SPI_EnableCard();
+        const uint8_t busy = (rSPI(0xFF) == 0x00);
+        SPI_DisableCard();
+
+        if (!busy && Card_EndWrite() != FF_ERR_NONE) {
+            writeSession.failed = TRUE;
+        }
+    }
+}
+
 // Ok, this is a bit of a nuclear option; bear with me:
 // After hours of debugging I've finally managed to isolate repro steps to
 // completely crash the SDCARD (So far only repro'ed with SDXC type cards).
@@ -600,12 +803,24 @@ static void Card_TriggerFillRead(void)
 static FF_T_SINT32 SignalError(FF_T_SINT32 err)
 {
     // IO_ClearOutputData(PIN_CARD_DAT1);
+    if (readSession.active) {
+        // best effort; leave the card ready for the next command
+        readSession.active = FALSE;
+        SPI_EnableCard();
+        MMC_Command12();
+        SPI_DisableCard();
+    }
+
     PrintCommandHistory();
     return err;
 }
 
 FF_T_SINT32 Card_ReadM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam)
 {
+    if (Card_EndWrite() != FF_ERR_NONE) {
+        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+    }
+
     if (writeStateActive) {
         writeStateActive = FALSE;
 
@@ -616,45 +831,54 @@ FF_T_SINT32 Card_ReadM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numS
 
     uint32_t sectorCount = numSectors;
     uint32_t dma_end     = 0;
+    uint8_t  retries     = 0;
 
     DEBUG(3, "SPI:Card_ReadM(%08x, %lu, %lu, %08x)", pBuffer, sector, numSectors, pParam);
 
-    SPI_EnableCard();
-
-    if (!Card_WaitXfer()) {
-        WARNING("SPI:Card_ReadM - WaitXfer timeout! (lba=%lu, %ld sectors)", sector, numSectors);
-        SPI_DisableCard();
-        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+    if (readSession.active && readSession.next != sector) {
+        if (Card_EndRead() != FF_ERR_NONE) {
+            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+        }
     }
 
-    if (cardType != CARDTYPE_SDHC) { // SDHC cards are addressed in sectors not bytes
-        sector = sector << 9;    // calculate byte address
-    }
+    const uint32_t lba = sector;
 
-    if (numSectors == 1) {
-        // single sector
-        if (MMC_Command(CMD17, sector)) {
-            WARNING("SPI:Card_ReadM CMD17 - invalid response 0x%02X (lba=%lu)", response, sector);
+    SPI_EnableCard();
+
+    if (!readSession.active) {
+        if (!Card_WaitXfer()) {
+            WARNING("SPI:Card_ReadM - WaitXfer timeout! (lba=%lu, %ld sectors)", sector, numSectors);
             SPI_DisableCard();
             return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
         }
 
-    } else {
-        // multiple sector
+        if (cardType != CARDTYPE_SDHC) { // SDHC cards are addressed in sectors not bytes
+            sector = sector << 9;    // calculate byte address
+        }
+
+        // always multiple sector; the read is left open for the next request
         if (MMC_Command(CMD18, sector)) {
             WARNING("SPI:Card_ReadM CMD18 - invalid response 0x%02X (lba=%lu)", response, sector);
             SPI_DisableCard();
             return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
         }
+
+        readSession.active = TRUE;
     }
 
     AddParamToPreviousCommand(numSectors);
 
     while (sectorCount--) {
+        uint16_t dataCrc = 0;
+        uint32_t checked = 0;           // bytes covered by dataCrc
 
         timeout = Timer_Get(250);      // timeout
 
         while (rSPI(0xFF) != 0xFE) {
+            if (readHook) {
+                readHook();
+            }
+
             if (Timer_Check(timeout)) {
                 WARNING("SPI:Card_ReadM - no data token! (lba=%lu)", sector);
                 SPI_DisableCard();
@@ -706,6 +930,16 @@ FF_T_SINT32 Card_ReadM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numS
 
         /*while ( (AT91C_BASE_SPI->SPI_SR & (AT91C_SPI_ENDTX | AT91C_SPI_ENDRX)) != (AT91C_SPI_ENDTX | AT91C_SPI_ENDRX) ) {*/
         while ( (AT91C_BASE_SPI->SPI_SR & dma_end) != dma_end) {
+            // check what has arrived so far; the CRC is done when the DMA is
+            if (crcEnabled && pBuffer) {
+                const uint32_t received = 512 - AT91C_BASE_SPI->SPI_RCR;
+                dataCrc = CRC16_Update(dataCrc, pBuffer + checked, received - checked);
+                checked = received;
+            }
+
+            if (readHook) {
+                readHook();
+            }
 
             if (Timer_Check(timeout)) {
                 WARNING("SPI:Card_ReadM DMA Timeout! (lba=%lu)", sector);
@@ -753,28 +987,89 @@ FF_T_SINT32 Card_ReadM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numS
 
         if (!pBuffer) {
             SPI_DisableFileIO();
+        }
 
-        } else {
+        uint16_t crc = rSPI(0xFF) << 8; // read CRC hi byte
+        crc |= rSPI(0xFF);              // read CRC lo byte
+
+        if (crcEnabled && pBuffer) {
+            dataCrc = CRC16_Update(dataCrc, pBuffer + checked, 512 - checked);
+
+            if (crc != dataCrc) {
+                const uint32_t failed = lba + numSectors - 1 - sectorCount;
+
+                if (retries++ == CRC_RETRIES) {
+                    WARNING("SPI:Card_ReadM - CRC error! (lba=%lu)", failed);
+                    SPI_DisableCard();
+                    return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+                }
+
+                WARNING("SPI:Card_ReadM - CRC error, retrying (lba=%lu)", failed);
+
+                // start over at the failed block
+                MMC_Command12();
+
+                if (MMC_Command(CMD18, cardType != CARDTYPE_SDHC ? failed << 9 : failed)) {
+                    WARNING("SPI:Card_ReadM CMD18 - invalid response 0x%02X (lba=%lu)", response, failed);
+                    SPI_DisableCard();
+                    return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+                }
+
+                sectorCount++;
+                continue;
+            }
+        }
+
+        if (pBuffer) {
             pBuffer += 512;    // point to next sector
         }
+    }
+
+    readSession.next = lba + numSectors;
+    readSession.idle = Timer_Get(READ_SESSION_IDLE_MS);
 
-        rSPI(0xFF); // read CRC lo byte
-        rSPI(0xFF); // read CRC hi byte
-        // ? check CRC
+    SPI_DisableCard();
+    return (FF_ERR_NONE);
+}
+
+// CMD24, or CMD25 with the number of blocks to pre-erase (ACMD23)
+static uint8_t Card_StartWrite(uint32_t lba, uint32_t numSectors)
+{
+    uint32_t sector = lba;
+
+    if (cardType != CARDTYPE_SDHC) { // SDHC cards are addressed in sectors not bytes
+        sector = sector << 9;    // calculate byte address
     }
 
-    if (numSectors != 1) {
-        MMC_Command12(); // stop multi block transmission
+    if (numSectors == 1) {
+        // single sector
+        if (MMC_Command(CMD24, sector)) {
+            WARNING("SPI:Card_WriteM CMD24 - invalid response 0x%02X (lba=%lu)", response, lba);
+            return FALSE;
+        }
+
+        return TRUE;
     }
 
-    if (!Card_GetStatus()) {
-        WARNING("SPI:Card_ReadM - SEND_STATUS error! (lba=%lu, %ld sectors)", sector, numSectors);
-        SPI_DisableCard();
-        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+    // multiple sectors
+    if ( cardType != CARDTYPE_MMC) {
+        if (MMC_Command(CMD55, 0)) {
+            WARNING("SPI:Card_WriteM CMD55 - invalid response 0x%02X", response);
+            return FALSE;
+        }
     }
 
-    SPI_DisableCard();
-    return (FF_ERR_NONE);
+    if (MMC_Command(CMD23, numSectors)) {
+        WARNING("SPI:Card_WriteM CMD23 - invalid response 0x%02X (numSectors=%lu)", response, numSectors);
+        return FALSE;
+    }
+
+    if (MMC_Command(CMD25, sector)) {
+        WARNING("SPI:Card_WriteM CMD25 - invalid response 0x%02X (lba=%lu)", response, lba);
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam)
@@ -784,9 +1079,14 @@ FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 num
         writeStateActive = TRUE;
     }
 
+    if (Card_EndRead() != FF_ERR_NONE || Card_EndWrite() != FF_ERR_NONE) {
+        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+    }
+
     DEBUG(3, "SPI:Card_WriteM(%08x, %lu, %lu, %08x)", pBuffer, sector, numSectors, pParam);
 
     uint32_t sectorCount = numSectors;
+    const uint32_t lba = sector;
 
     SPI_EnableCard();
 
@@ -797,61 +1097,40 @@ FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 num
     }
 
 
-    if (cardType != CARDTYPE_SDHC) { // SDHC cards are addressed in sectors not bytes
-        sector = sector << 9;    // calculate byte address
-
-    }
-
-    if (numSectors == 1) {
-        // single sector
-        if (MMC_Command(CMD24, sector)) {
-            WARNING("SPI:Card_WriteM CMD24 - invalid response 0x%02X (lba=%lu)", response, sector);
-            SPI_DisableCard();
-            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
-        }
-
-    } else {
-        // multiple sectors
-        if ( cardType != CARDTYPE_MMC) {
-            if (MMC_Command(CMD55, 0)) {
-                WARNING("SPI:Card_WriteM CMD55 - invalid response 0x%02X", response);
-                SPI_DisableCard();
-                return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
-            }
-        }
-
-        if (MMC_Command(CMD23, numSectors)) {
-            WARNING("SPI:Card_WriteM CMD23 - invalid response 0x%02X (numSectors=%lu)", response, numSectors);
-            SPI_DisableCard();
-            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
-        }
-
-        if (MMC_Command(CMD25, sector)) {
-            WARNING("SPI:Card_WriteM CMD25 - invalid response 0x%02X (lba=%lu)", response, sector);
-            SPI_DisableCard();
-            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
-        }
+    if (!Card_StartWrite(sector, numSectors)) {
+        SPI_DisableCard();
+        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
     }
 
     AddParamToPreviousCommand(numSectors);
 
+    uint8_t multi = numSectors != 1;
+    uint8_t retries = 0;
+
     while (sectorCount--) {
-        rSPI(0xFF); // one byte gap
-        rSPI(numSectors == 1 ? 0xFE : 0xFC); // send Data Token
+        uint16_t crc = 0xFFFF;
 
 #if defined(AT91SAM7S256)
+        // gap and data token, then the sector, in one chained PDC transfer
+        uint8_t token[2] = { 0xFF, multi ? 0xFC : 0xFE };
 
         Assert((AT91C_BASE_SPI->SPI_PTSR & (AT91C_PDC_TXTEN | AT91C_PDC_RXTEN)) == 0);
 
-        AT91C_BASE_SPI->SPI_TPR  = (uint32_t) pBuffer;
-        AT91C_BASE_SPI->SPI_TCR  = 512;
-        AT91C_BASE_SPI->SPI_TNCR = 0;
+        AT91C_BASE_SPI->SPI_TPR  = (uint32_t) token;
+        AT91C_BASE_SPI->SPI_TCR  = sizeof(token);
+        AT91C_BASE_SPI->SPI_TNPR = (uint32_t) pBuffer;
+        AT91C_BASE_SPI->SPI_TNCR = 512;
 
         AT91C_BASE_SPI->SPI_RPR  = (uint32_t) 0x00102000;   // just sink the data into the .text (ROM)
-        AT91C_BASE_SPI->SPI_RCR  = 512;
+        AT91C_BASE_SPI->SPI_RCR  = sizeof(token) + 512;
         AT91C_BASE_SPI->SPI_RNCR = 0;
         AT91C_BASE_SPI->SPI_PTCR = AT91C_PDC_TXTEN | AT91C_PDC_RXTEN; // start DMA transfer
-        uint32_t dma_end         = AT91C_SPI_ENDTX | AT91C_SPI_ENDRX;
+        uint32_t dma_end         = AT91C_SPI_TXBUFE | AT91C_SPI_RXBUFF;
+
+        // while the block goes out
+        if (crcEnabled) {
+            crc = CRC16_Update(0, pBuffer, 512);
+        }
 
         // wait for tranfer end
         timeout = Timer_Get(100);      // 100 ms timeout
@@ -873,22 +1152,33 @@ FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 num
 
 #elif defined(ARDUINO_SAMD_MKRVIDOR4000)
 
-        void SPI_DMA(const void* out, void* in, uint16_t length);
+        void SPI_DMA(const void* out, void* in, uint16_t length);
+
+        if (crcEnabled) {
+            crc = CRC16_Update(0, pBuffer, 512);
+        }
 
+        rSPI(0xFF); // one byte gap
+        rSPI(multi ? 0xFC : 0xFE); // send Data Token
         SPI_DMA(pBuffer, NULL, 512);
 
 #else
+
+        if (crcEnabled) {
+            crc = CRC16_Update(0, pBuffer, 512);
+        }
+
+        rSPI(0xFF); // one byte gap
+        rSPI(multi ? 0xFC : 0xFE); // send Data Token
+
         for (uint32_t offset = 0; offset < 512; offset++) {
             rSPI(pBuffer[offset]);
         }
 
 #endif
 
-        pBuffer += 512;    // point to next sector
-
-        // calc CRC????
-        rSPI(0xFF); // send CRC lo byte
-        rSPI(0xFF); // send CRC hi byte
+        rSPI(crc >> 8);     // send CRC hi byte
+        rSPI(crc & 0xFF);   // send CRC lo byte
 
         response = rSPI(0xFF); // read packet response
         // Status codes
@@ -897,13 +1187,49 @@ FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 num
         // 110 = Data rejected due to write error
         response &= 0x1F;
 
+        if (response == DATA_RESPONSE_CRC && retries++ < CRC_RETRIES) {
+            const uint32_t failed = lba + numSectors - 1 - sectorCount;
+            WARNING("SPI:Card_WriteM - CRC error, retrying (lba=%lu)", failed);
+
+            // the card dropped the block and the write; start over with it
+            if (!Card_WaitXfer()) {
+                WARNING("SPI:Card_WriteM - Loop timeout! (lba=%lu, %ld sectors)", failed, numSectors);
+                SPI_DisableCard();
+                return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+            }
+
+            if (multi) {
+                rSPI(0xFD); // send Data Stop Token
+                rSPI(0xFF); // one byte gap
+
+                if (!Card_WaitXfer()) {
+                    WARNING("SPI:Card_WriteM - Loop timeout! (lba=%lu, %ld sectors)", failed, numSectors);
+                    SPI_DisableCard();
+                    return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+                }
+            }
+
+            sectorCount++;
+            multi = sectorCount != 1;
+
+            if (!Card_StartWrite(failed, sectorCount)) {
+                SPI_DisableCard();
+                return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+            }
+
+            continue;
+        }
+
         if (response != 0x05) {
             WARNING("SPI:Card_WriteM - invalid status 0x%02X (lba=%lu)", response, sector);
             SPI_DisableCard();
             return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
         }
 
-        if (!Card_WaitXfer()) {
+        pBuffer += 512;    // point to next sector
+
+        // the card takes no further token until it is done with this block
+        if (sectorCount && !Card_WaitXfer()) {
             WARNING("SPI:Card_WriteM - Loop timeout! (lba=%lu, %ld sectors)", sector, numSectors);
             SPI_DisableCard();
             return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
@@ -912,63 +1238,117 @@ FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 num
         // sector loop
     }
 
-    rSPI(numSectors == 1 ? 0xFF : 0xFD); // send Data Stop Token
-    rSPI(0xFF); // one byte gap
+    if (multi) {
+        // the stop token has to wait for the last block, too
+        if (!Card_WaitXfer()) {
+            WARNING("SPI:Card_WriteM - Loop timeout! (lba=%lu, %ld sectors)", sector, numSectors);
+            SPI_DisableCard();
+            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+        }
 
-    if (!Card_WaitXfer()) {
-        WARNING("SPI:Card_WriteM - Done timeout! (lba=%lu, %ld sectors)", sector, numSectors);
-        SPI_DisableCard();
-        return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+        rSPI(0xFD); // send Data Stop Token
+        rSPI(0xFF); // one byte gap
     }
 
-    if (!Card_GetStatus()) {
-        WARNING("SPI:Card_WriteM - SEND_STATUS error! (lba=%lu, %ld sectors)", sector, numSectors);
-        SPI_DisableCard();
+    // programming finishes in the background, see writeSession
+    writeSession.pending = TRUE;
+    writeSession.busy_ms = WRITE_BUSY_MS;
+    writeSession.lba = lba;
+
+    SPI_DisableCard();
+    return (FF_ERR_NONE);
+}
+
+FF_T_SINT32 Card_Erase(FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam)
+{
+    if (Card_EndRead() != FF_ERR_NONE || Card_EndWrite() != FF_ERR_NONE) {
         return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
     }
 
+    // MMC erases whole groups (CMD35/36); the hint is not worth that
+    if (numSectors == 0 || cardType == CARDTYPE_MMC) {
+        return FF_ERR_NONE;
+    }
+
+    DEBUG(3, "SPI:Card_Erase(%lu, %lu)", sector, numSectors);
+
+    SPI_EnableCard();
+
+    while (numSectors) {
+        const uint32_t n = numSectors < ERASE_MAX_SECTORS ? numSectors : ERASE_MAX_SECTORS;
+        uint32_t first = sector;
+        uint32_t last = sector + n - 1;
+
+        if (cardType != CARDTYPE_SDHC) { // SDHC cards are addressed in sectors not bytes
+            first = first << 9;
+            last = last << 9;
+        }
+
+        // the previous CMD38 of a long range
+        if (!Card_WaitBusy(ERASE_BUSY_MS)) {
+            WARNING("SPI:Card_Erase - busy timeout! (lba=%lu)", sector);
+            SPI_DisableCard();
+            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+        }
+
+        if (MMC_Command(CMD32, first) || MMC_Command(CMD33, last) || MMC_Command(CMD38, 0)) {
+            WARNING("SPI:Card_Erase - invalid response 0x%02X (lba=%lu, %lu sectors)", response, sector, n);
+            SPI_DisableCard();
+            return SignalError(FF_ERR_DEVICE_DRIVER_FAILED);
+        }
+
+        sector += n;
+        numSectors -= n;
+    }
+
+    // erasing finishes in the background, see writeSession
+    writeSession.pending = TRUE;
+    writeSession.busy_ms = ERASE_BUSY_MS;
+    writeSession.lba = sector;
+
     SPI_DisableCard();
     return (FF_ERR_NONE);
 }
 
 uint8_t MMC_Command(uint8_t cmd, uint32_t arg)
 {
-    uint8_t c;
-    /*flush SPI-bus*/
-    uint8_t attempts = 100;
+    const uint8_t frame[5] = { cmd, (uint8_t)(arg >> 24), (uint8_t)(arg >> 16), (uint8_t)(arg >> 8), (uint8_t)arg };
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < sizeof(frame); i++) {
+        crc = CRC7_Update(crc, frame[i]);
+    }
 
     SaveCommandHistory(cmd, arg);
 
-    do {
-        response = rSPI(0xFF); // get response
-    } while (response != 0xFF && attempts--);
-
-    // this gives a minimum of 8 clocks between response and command (nRC)
-    crc = 0;
-    rSPI(cmd);
-    MMC_CRC(cmd);
-    c = (uint8_t)(arg >> 24);
-    rSPI(c);
-    MMC_CRC(c);
-    c = (uint8_t)(arg >> 16);
-    rSPI(c);
-    MMC_CRC(c);
-    c = (uint8_t)(arg >>  8);
-    rSPI(c);
-    MMC_CRC(c);
-    c = (uint8_t)(arg      );
-    rSPI(c);
-    MMC_CRC(c);
-
-    crc = crc << 1; // *shift all bits 1 position to the left, to free position 0
-    crc ++;     // set LSB to '1'
-    rSPI(crc);
-
-    attempts = 100;
-
-    do {
-        response = rSPI(0xFF); // get response
-    } while (response == 0xFF && attempts--);
+    // a command the card did not receive intact was not executed; send it once more
+    for (uint8_t retry = 0; retry < 2; retry++) {
+        /*flush SPI-bus*/
+        uint8_t attempts = 100;
+
+        do {
+            response = rSPI(0xFF); // get response
+        } while (response != 0xFF && attempts--);
+
+        // this gives a minimum of 8 clocks between response and command (nRC)
+        for (uint8_t i = 0; i < sizeof(frame); i++) {
+            rSPI(frame[i]);
+        }
+
+        rSPI(crc | 1);  // CRC7 and the end bit
+
+        attempts = 100;
+
+        do {
+            response = rSPI(0xFF); // get response
+        } while (response == 0xFF && attempts--);
+
+        if (!crcEnabled || response == 0xFF || !(response & R1_COM_CRC_ERROR)) {
+            break;
+        }
+
+        WARNING("SPI:CMD%u - command CRC error", cmd - CMD0);
+    }
 
     DEBUG(3, "response %02X to CMD%u", response, cmd - CMD0);
     return response;
@@ -995,23 +1375,4 @@ static uint8_t MMC_Command12(void)
     return response;
 }
 
-void MMC_CRC(uint8_t c)
-{
-    uint8_t i;
-
-    for (i = 0; i < 8; i++) {
-        crc = crc << 1;
-
-        if (  c & 0x80) {
-            crc ^= 0x09;
-        }
-
-        if (crc & 0x80) {
-            crc ^= 0x09;
-        }
-
-        c = c << 1;
-    }
-}
-
 
@@ -25,6 +25,16 @@ uint8_t Card_Init(void);
 uint64_t Card_GetCapacity(void);
 FF_T_SINT32 Card_ReadM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam) __fastrun;
 FF_T_SINT32 Card_WriteM(FF_T_UINT8* pBuffer, FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam);
+// Discards blocks (CMD32/33/38); they read back as zero or 0xFF afterwards, depending on the card
+FF_T_SINT32 Card_Erase(FF_T_UINT32 sector, FF_T_UINT32 numSectors, void* pParam);
+// Card_ReadM leaves a multi-block read open for sequential requests; these close it
+FF_T_SINT32 Card_EndRead(void);
+// Card_WriteM returns while the card is still programming; this waits for it and checks the status
+FF_T_SINT32 Card_EndWrite(void);
+// The hook is called while Card_ReadM() waits for the card, to move data read
+// earlier elsewhere in the meantime (USB). It must not access the card.
+void Card_SetReadHook(void (*hook)(void));
+void Card_Update(void);     // ends the open read after READ_SESSION_IDLE_MS, completes a finished write
 
 
 #define CARDTYPE_NONE 0
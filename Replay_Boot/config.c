@@ -1026,6 +1026,7 @@ void CFG_set_status_defaults(status_t* currentStatus, uint8_t init)
     currentStatus->verify_dl        = 0;
     currentStatus->last_rom_adr     = 0;
     currentStatus->dram_phase       = 0;
+    currentStatus->dram_test        = DRAMTEST_QUICK;
     currentStatus->clockmon         = 0;
     currentStatus->config_s         = 0;
     currentStatus->config_d         = 0;
@@ -1186,7 +1187,7 @@ static uint8_t _CFG_handle_SETUP_PHASE(status_t* pStatus, const ini_symbols_t na
     ini_list_t valueList[8];
     uint16_t entries = ParseList(value, valueList, 8);
 
-    if (entries == 1) {
+    if (entries == 1 && valueList[0].intval >= 0 && valueList[0].intval <= 0xFF) {
         pStatus->dram_phase = valueList[0].intval;
         DEBUG(1, "DRAM phase: %d", pStatus->dram_phase);
         return 0;
@@ -1293,6 +1294,25 @@ static uint8_t _CFG_handle_SETUP_HOTKEY(status_t* pStatus, const ini_symbols_t n
   return 0;
 }*/
 
+static uint8_t _CFG_handle_SETUP_DRAMTEST(status_t* pStatus, const ini_symbols_t name, const char* value)
+{
+    if (MATCH(value, "QUICK")) {
+        pStatus->dram_test = DRAMTEST_QUICK;
+
+    } else if (MATCH(value, "FULL")) {
+        pStatus->dram_test = DRAMTEST_FULL;
+
+    } else if (MATCH(value, "MARGIN")) {
+        pStatus->dram_test = DRAMTEST_MARGIN;
+
+    } else {
+        return 1;
+    }
+
+    DEBUG(1, "DRAM test: %s", value);
+    return 0;
+}
+
 static uint8_t _CFG_handle_SETUP_CLOCKMON(status_t* pStatus, const ini_symbols_t name, const char* value)
 {
     if (MATCH(value, "ENA")) {
@@ -2015,6 +2035,9 @@ uint8_t _CFG_pre_parse_handler(void* status, const ini_symbols_t section,
             case INI_CLOCKMON:
                 return _CFG_handle_SETUP_CLOCKMON((status_t*)status, name, value);
 
+            case INI_DRAMTEST:
+                return _CFG_handle_SETUP_DRAMTEST((status_t*)status, name, value);
+
             case INI_OSD_INIT:
                 return _CFG_handle_SETUP_OSD_INIT((status_t*)status, name, value);
 
@@ -2283,6 +2306,13 @@ uint8_t CFG_init(status_t* currentStatus, const char* iniFile)
     if (config_ver & 0x8000) {
         FPGA_DramTrain();
 
+        if (currentStatus->dram_test == DRAMTEST_FULL) {
+            FPGA_DramTest();
+
+        } else if (currentStatus->dram_test == DRAMTEST_MARGIN) {
+            FPGA_DramMargin(currentStatus->dram_phase ? currentStatus->dram_phase : kDRAM_PHASE);
+        }
+
         // Randomize the first 1MB
         HARDWARE_TICK ts = Timer_Get(0);
         const uint32_t per_run = 1024 << 4;
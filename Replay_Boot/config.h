@@ -81,6 +81,13 @@ typedef enum {
     BUTTON_RESET
 } button_t;
 
+/** DRAM test run at core start */
+typedef enum {
+    DRAMTEST_QUICK,     // probe addresses only
+    DRAMTEST_FULL,      // all patterns across the whole DRAM
+    DRAMTEST_MARGIN     // phase margin map
+} dramtest_t;
+
 typedef enum {
     OSD_INIT_OFF,
     OSD_INIT_ON,
@@ -293,7 +300,10 @@ typedef struct {
     uint32_t     last_rom_adr;
 
     /** set DRAM phase config - set by ini_post_read() */
-    int8_t       dram_phase;
+    uint8_t      dram_phase;
+
+    /** set DRAM test mode - set by ini_pre_read() */
+    uint8_t      dram_test;
 
     /** set CLOCKMON enable - set by ini_pre_read() */
     int8_t       clockmon;
@@ -335,6 +345,10 @@ typedef struct {
     uint8_t  delayed_filescan;
     HARDWARE_TICK filescan_timer;
 
+    /* type-ahead prefix in the file browser is extended until typeahead_timer expires */
+    uint8_t  typeahead;
+    HARDWARE_TICK typeahead_timer;
+
     /* indicated the current menu state (see typedef tOSDMenuState) READ-ONLY! */
     const tOSDMenuState menu_state;
 
@@ -0,0 +1,43 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+/** @file crc32.h */
+
+#ifndef CRC32_H_INCLUDED
+#define CRC32_H_INCLUDED
+
+#include <stdint.h>
+
+/*
+ CRC-32 as used by zlib, PNG and gzip (reflected, polynomial 0xEDB88320).
+
+ Start with CRC32_INIT and feed the data in as many pieces as needed:
+
+    uint32_t crc = CRC32_INIT;
+    crc = CRC32_Update(crc, first, first_len);
+    crc = CRC32_Update(crc, second, second_len);
+
+ The value returned is always the finished CRC of everything fed so far, so
+ CRC32_Update(CRC32_INIT, data, len) equals zlib's crc32(0, data, len).
+
+ Only depends on stdint.h; the rApps and the host tools build this file too.
+*/
+
+#define CRC32_INIT  0
+
+uint32_t CRC32_Update(uint32_t crc, const void* data, uint32_t length);
+
+#endif
@@ -43,6 +43,7 @@ void* ff_malloc(size_t size);
 void ff_free(void* ptr);
 
 #define FF_isERR(err) (err & (1<<31))
+#define FF_GETERROR(err) (err & 0xffff)
 
 #define FF_TRUE                                  0x00000001
 #define FF_SEEK                                  0x83120000
@@ -53,6 +54,7 @@ void ff_free(void* ptr);
 #define FF_ERR_NOT_ENOUGH_MEMORY                 0x00000003
 #define FF_ERR_NONE                              0x00000000
 #define FF_ERR_IOMAN_OUT_OF_BOUNDS_READ          0x00000017
+#define FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE         0x00000018
 #define FF_ERR_IOMAN_NO_MOUNTABLE_PARTITION      0x0000000e
 #define FF_ERR_IOMAN_NOT_FAT_FORMATTED           0x00000011
 #define FF_ERR_IOMAN_NOT_ENOUGH_FREE_SPACE       0x00000016
@@ -120,6 +122,7 @@ typedef struct _FF_DIRENT {
 
 typedef FF_T_SINT32 (*FF_WRITE_BLOCKS)    (FF_T_UINT8* pBuffer, FF_T_UINT32 SectorAddress, FF_T_UINT32 Count, void* pParam);
 typedef FF_T_SINT32 (*FF_READ_BLOCKS)     (FF_T_UINT8* pBuffer, FF_T_UINT32 SectorAddress, FF_T_UINT32 Count, void* pParam);
+typedef FF_T_SINT32 (*FF_ERASE_BLOCKS)    (FF_T_UINT32 SectorAddress, FF_T_UINT32 Count, void* pParam);
 
 typedef enum _FF_SizeType {
     eSizeIsQuota,
@@ -142,14 +145,18 @@ FF_IOMAN*   FF_CreateIOMAN             (FF_T_UINT8* pCacheMem, FF_T_UINT32 Size,
 FF_ERROR    FF_DestroyIOMAN            (FF_IOMAN* pIoman);
 FF_ERROR    FF_RegisterBlkDevice       (FF_IOMAN* pIoman, FF_T_UINT16 BlkSize, FF_WRITE_BLOCKS fnWriteBlocks, FF_READ_BLOCKS fnReadBlocks, void* pParam);
 FF_ERROR    FF_UnregisterBlkDevice     (FF_IOMAN* pIoman);
+FF_ERROR    FF_RegisterBlkErase        (FF_IOMAN* pIoman, FF_ERASE_BLOCKS fnEraseBlocks);    // optional; freed clusters are discarded
 FF_ERROR    FF_MountPartition          (FF_IOMAN* pIoman, FF_T_UINT8 PartitionNumber);
 FF_ERROR    FF_UnmountPartition        (FF_IOMAN* pIoman);
 FF_T_UINT32 FF_GetVolumeSize           (FF_IOMAN* pIoman);
 FF_ERROR    FF_FlushCache              (FF_IOMAN* pIoman);
 FF_T_BOOL   FF_Mounted                 (FF_IOMAN* pIoman);
+FF_ERROR    FF_InvalidateCache         (FF_IOMAN* pIoman);    // the volume was changed externally
+FF_T_UINT16 FF_FilesOpen                (FF_IOMAN* pIoman);
 FF_ERROR    FF_IncreaseFreeClusters    (FF_IOMAN* pIoman, FF_T_UINT32 Count);
 FF_T_SINT32 FF_GetPartitionBlockSize   (FF_IOMAN* pIoman);
 FF_T_UINT32 FF_GetFreeSize             (FF_IOMAN* pIoman, FF_ERROR* pError);
+FF_T_BOOL   FF_ScanFreeClusters        (FF_IOMAN* pIoman, FF_T_UINT32 MaxSectors);
 
 FF_ERROR    FF_Partition               (FF_IOMAN* pIoman, FF_PartitionParameters_t* pParams );
 FF_ERROR    FF_Format                  (FF_IOMAN* pIoman, int xPartitionNumber, int xPreferFAT16, int xSmallClusters );
@@ -183,8 +183,73 @@ static FF_T_UINT16 PreferredBlkSize = 0;
 static FF_T_UINT16 DriverBlkSize = 0;
 static FF_WRITE_BLOCKS DriverWriteBlockFunction = 0;
 static FF_READ_BLOCKS DriverReadBlockFunction = 0;
+static FF_ERASE_BLOCKS DriverEraseBlockFunction = 0;
 static void* DriverFunctionParam = 0;
 
+// Background free cluster count (see FF_ScanFreeClusters)
+static struct {
+    FF_T_BOOL active;
+    DWORD base;         // first FAT / allocation bitmap sector
+    DWORD sect;         // next sector to scan
+    DWORD clst;         // entries left to scan
+    DWORD total;        // entries to scan from base on
+    DWORD nfree;
+} FreeScan;
+
+// Free entries in one FAT / allocation bitmap sector, 'clst' entries at most
+static DWORD FreeScan_Count(const FATFS* fs, const BYTE* p, DWORD* clst)
+{
+    const BYTE* end = p + FF_MAX_SS;
+    DWORD n = *clst;
+    DWORD nfree = 0;
+
+#if FF_FS_EXFAT
+    if (fs->fs_type == FS_EXFAT) {
+        for (; p < end && n; ++p) {
+            for (BYTE b = 8, bm = *p; b && n; b--, n--, bm >>= 1) {
+                nfree += !(bm & 1);
+            }
+        }
+    } else
+#endif
+    if (fs->fs_type == FS_FAT16) {
+        for (; p < end && n; p += 2, n--) {
+            nfree += !(p[0] | p[1]);
+        }
+    } else {
+        for (; p < end && n; p += 4, n--) {
+            nfree += !(p[0] | p[1] | p[2] | (p[3] & 0x0f));
+        }
+    }
+
+    *clst = n;
+    return nfree;
+}
+
+// An allocation change in an already counted FAT / bitmap sector; replace its
+// old count with the new one rather than counting everything again
+static void FreeScan_Update(const BYTE* buff, DWORD sector)
+{
+    FATFS* fs = (FATFS*)(void*)CacheMem;
+    const DWORD per_sector = fs->fs_type == FS_EXFAT ? FF_MAX_SS * 8 : fs->fs_type == FS_FAT16 ? FF_MAX_SS / 2 : FF_MAX_SS / 4;
+    const DWORD first = (sector - FreeScan.base) * per_sector;
+    BYTE old[FF_MAX_SS];
+    DWORD clst;
+
+    if (FF_isERR(DriverReadBlockFunction(old, sector, 1, DriverFunctionParam))) {
+        // can't tell what changed; count again
+        FreeScan.clst = 0;
+        return;
+    }
+
+    clst = FreeScan.total - first;
+    FreeScan.nfree -= FreeScan_Count(fs, old, &clst);
+    clst = FreeScan.total - first;
+    FreeScan.nfree += FreeScan_Count(fs, buff, &clst);
+}
+
+static FF_T_UINT16 FilesOpen = 0;
+
 DSTATUS disk_status(BYTE pdrv)
 {
     return 0;//STA_NOINIT;
@@ -199,6 +264,17 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff)
         return RES_OK;
     }
 
+    if (cmd == CTRL_TRIM) {
+        // freed clusters; buff is the first and the last sector
+        const DWORD* range = (const DWORD*)buff;
+
+        if (!DriverEraseBlockFunction) {
+            return RES_OK;
+        }
+
+        return FF_isERR(DriverEraseBlockFunction(range[0], range[1] - range[0] + 1, DriverFunctionParam)) ? RES_ERROR : RES_OK;
+    }
+
     WARNING("Unknown IOCTL : 0x%02x", cmd);
     int* p = 0;
     *p = 3;
@@ -210,6 +286,15 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
 }
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
 {
+    // an allocation change in an already counted part of the FAT
+    if (FreeScan.active && FreeScan.clst) {
+        for (UINT i = 0; i < count; ++i) {
+            if (sector + i >= FreeScan.base && sector + i < FreeScan.sect) {
+                FreeScan_Update(buff + i * FF_MAX_SS, sector + i);
+            }
+        }
+    }
+
     return FF_isERR(DriverWriteBlockFunction((BYTE*)buff, sector, count, DriverFunctionParam)) ? RES_ERROR : RES_OK;
 }
 
@@ -245,9 +330,15 @@ FF_ERROR FF_UnregisterBlkDevice(FF_IOMAN* pIoman)
     DriverBlkSize = 0;
     DriverWriteBlockFunction = 0;
     DriverReadBlockFunction = 0;
+    DriverEraseBlockFunction = 0;
     DriverFunctionParam = 0;
     return 0;
 }
+FF_ERROR FF_RegisterBlkErase(FF_IOMAN* pIoman, FF_ERASE_BLOCKS fnEraseBlocks)
+{
+    DriverEraseBlockFunction = fnEraseBlocks;
+    return 0;
+}
 FF_ERROR FF_MountPartition (FF_IOMAN* pIoman, FF_T_UINT8 PartitionNumber)
 {
     Assert(CacheSize >= sizeof(FATFS));
@@ -255,6 +346,11 @@ FF_ERROR FF_MountPartition (FF_IOMAN* pIoman, FF_T_UINT8 PartitionNumber)
     FF_ERROR ret = mapError(f_mount(fs, "", 1));
     pIoman->pPartition->Type = fs->fs_type + FF_T_FAT12 - 1;
 
+    // without a valid FSInfo count (always the case on exFAT) the free clusters are counted in the background
+    FreeScan.active = ret == FF_ERR_NONE && fs->fs_type != FS_FAT12 && fs->free_clst > fs->n_fatent - 2;
+    FreeScan.sect = FreeScan.base = 0;
+    FreeScan.clst = 0;
+
     pIoman->pPartition->BlkSize = 512;//fs->ssize;
     pIoman->pPartition->SectorsPerCluster = fs->csize;
     pIoman->pPartition->BlkFactor = pIoman->pPartition->BlkSize / 512;
@@ -265,6 +361,7 @@ FF_ERROR FF_UnmountPartition(FF_IOMAN* pIoman)
 {
     FATFS* fs = 0;
     pIoman->pPartition->Type = 0;
+    FreeScan.active = FALSE;
     return mapError(f_mount(fs, "", 0));
 }
 
@@ -277,6 +374,37 @@ FF_T_BOOL FF_Mounted(FF_IOMAN* pIoman)
     return pIoman->pPartition->Type != 0;
 }
 
+// Someone else (USB mass storage) wrote to the volume behind our back. That is only
+// allowed while no file is open, so all that is cached here is the FAT/directory
+// window and the allocation state; drop both and count the free clusters again.
+FF_ERROR FF_InvalidateCache(FF_IOMAN* pIoman)
+{
+    FATFS* fs = (FATFS*)(void*)CacheMem;
+
+    if (!FF_Mounted(pIoman)) {
+        return FF_ERR_NONE;
+    }
+
+    if (fs->wflag) {
+        WARNING("FF: dirty window dropped (sector %lu)", fs->winsect);
+    }
+
+    fs->wflag = 0;
+    fs->winsect = (DWORD)~0;
+    fs->fsi_flag = 0;
+    fs->last_clst = fs->free_clst = 0xFFFFFFFF;
+
+    FreeScan.active = fs->fs_type != FS_FAT12;
+    FreeScan.sect = FreeScan.base = 0;
+    FreeScan.clst = 0;
+
+    return FF_ERR_NONE;
+}
+FF_T_UINT16 FF_FilesOpen(FF_IOMAN* pIoman)
+{
+    return FilesOpen;
+}
+
 FF_ERROR FF_IncreaseFreeClusters(FF_IOMAN* pIoman, FF_T_UINT32 Count)
 {
     return 0;
@@ -288,42 +416,98 @@ FF_T_SINT32 FF_GetPartitionBlockSize(FF_IOMAN* pIoman)
     return FF_MAX_SS;
 }
 
-static FRESULT get_total_and_free_mb(DWORD* fre_sect, DWORD* tot_sect)
+// f_getfree() scans the complete FAT (or exFAT allocation bitmap) when the free
+// cluster count is unknown, which takes seconds on large cards. Instead the scan is
+// done a few sectors at a time from the main loop. The sectors are read through the
+// FatFS window, so a dirty window (pending FAT update) simply postpones the step.
+// When done the count is handed to FatFS, which keeps it current from then on.
+FF_T_BOOL FF_ScanFreeClusters(FF_IOMAN* pIoman, FF_T_UINT32 MaxSectors)
 {
-    FATFS* fs = 0;
-    DWORD fre_clust;
-
-    FRESULT ret = mapError(f_getfree("0:", &fre_clust, &fs));
-    Assert(!ret);
+    FATFS* fs = (FATFS*)(void*)CacheMem;
 
-    if (ret) {
-        return ret;
+    if (!FreeScan.active || !FF_Mounted(pIoman)) {
+        return FALSE;
     }
 
-    Assert(FF_GetPartitionBlockSize(0) == 512);
+    if (!FreeScan.clst) {
+        // (re)start
+        FreeScan.nfree = 0;
+#if FF_FS_EXFAT
+        if (fs->fs_type == FS_EXFAT) {
+            FreeScan.base = fs->bitbase;
+            FreeScan.total = fs->n_fatent - 2;
+        } else
+#endif
+        {
+            FreeScan.base = fs->fatbase;
+            FreeScan.total = fs->n_fatent;
+        }
+
+        FreeScan.clst = FreeScan.total;
 
-    if (tot_sect) {
-        *tot_sect = (fs->n_fatent - 2) * fs->csize / (2 * 1024);
+        FreeScan.sect = FreeScan.base;
     }
 
-    if (fre_sect) {
-        *fre_sect = fre_clust * fs->csize / (2 * 1024);
+    while (MaxSectors-- && !fs->wflag) {
+        if (fs->winsect != FreeScan.sect) {
+            if (disk_read(fs->pdrv, fs->win, FreeScan.sect, 1) != RES_OK) {
+                fs->winsect = (DWORD)~0;
+                FreeScan.active = FALSE;
+                WARNING("FF: free cluster scan failed at %lu", FreeScan.sect);
+                return FALSE;
+            }
+
+            fs->winsect = FreeScan.sect;
+        }
+
+        FreeScan.nfree += FreeScan_Count(fs, fs->win, &FreeScan.clst);
+        FreeScan.sect++;
+
+        if (!FreeScan.clst) {
+            fs->free_clst = FreeScan.nfree;
+            fs->fsi_flag |= 1;      // FAT32: FSInfo is to be updated
+            FreeScan.active = FALSE;
+            DEBUG(1, "FF: %lu free clusters", FreeScan.nfree);
+            return FALSE;
+        }
     }
 
-    return ret;
+    return TRUE;
 }
 
 FF_T_UINT32 FF_GetVolumeSize(FF_IOMAN* pIoman)
 {
-    DWORD tot_mb = 0;
-    get_total_and_free_mb(0, &tot_mb);
-    return tot_mb;
+    FATFS* fs = (FATFS*)(void*)CacheMem;
+
+    if (!FF_Mounted(pIoman)) {
+        return 0;
+    }
+
+    Assert(FF_GetPartitionBlockSize(0) == 512);
+    return (fs->n_fatent - 2) * fs->csize / (2 * 1024);
 }
 FF_T_UINT32 FF_GetFreeSize(FF_IOMAN* pIoman, FF_ERROR* pError)
 {
-    DWORD free_mb = 0;
-    get_total_and_free_mb(&free_mb, 0);
-    return free_mb;
+    FATFS* fs = 0;
+    DWORD fre_clust = 0;
+
+    // finish a pending background count first; f_getfree() would start over
+    // (unless the FatFS window is dirty - then f_getfree() has to do the work)
+    while (FF_ScanFreeClusters(pIoman, 64) && !((FATFS*)(void*)CacheMem)->wflag)
+        ;
+
+    FF_ERROR ret = mapError(f_getfree("0:", &fre_clust, &fs));
+
+    if (pError) {
+        *pError = ret;
+    }
+
+    if (ret != FF_ERR_NONE) {
+        return 0;
+    }
+
+    Assert(FF_GetPartitionBlockSize(0) == 512);
+    return fre_clust * fs->csize / (2 * 1024);
 }
 
 #if FF_MULTI_PARTITION
@@ -500,6 +684,9 @@ FF_FILE* FF_Open(FF_IOMAN* pIoman, const FF_T_INT8* path, FF_T_UINT8 Mode, FF_ER
     if (result != FR_OK) {
         ff_free(fp);
         fp = NULL;
+
+    } else {
+        FilesOpen++;
     }
 
     return (FF_FILE*)fp;
@@ -510,6 +697,8 @@ FF_ERROR FF_Close(FF_FILE* pFile)
     if (!pFile)
         return FF_ERR_NULL_POINTER;
 
+    FilesOpen--;
+
     FF_ERROR ret = mapError(f_close((FIL*)pFile));
 
     if (pFile) {
@@ -30,6 +30,14 @@ extern FF_IOMAN* pIoman;
 fch_t fch_handle[2][FCH_MAX_NUM];
 uint8_t   fch_driver[2] = {0, 0};
 
+// a transfer waiting for the FIFO, see FileIO_FCh_Wait
+static struct {
+    uint8_t       flag;         // FILEIO_REQ_OK_xx_ARM, 0 if nothing is parked
+    uint8_t       drive_number;
+    uint8_t       abort_stat;   // completes the transfer if it is cancelled
+    HARDWARE_TICK timeout;
+} fch_park[2];
+
 //
 // MCh is memory chanel <> DRAM
 //
@@ -124,6 +132,8 @@ uint8_t FileIO_MCh_FileToMem(FF_FILE* pFile, uint32_t base, uint32_t size, uint3
             break;    // catch 0 len file error
         }
 
+        OSD_PollKeyboard();
+
         // clip to smallest of file and transfer length
         if (remaining_size < buf_tx_size) {
             buf_tx_size = remaining_size;
@@ -437,6 +447,41 @@ uint8_t FileIO_MCh_MemToBuf(uint8_t* pBuf, uint32_t base, uint32_t size)
     return (0) ;// no error
 }
 
+void FileIO_MCh_SetAddress(uint32_t base, uint8_t direction)
+// base - memory base address
+// direction - FILEIO_MCH_WRITE or FILEIO_MCH_READ
+{
+    SPI_EnableFileIO();
+    rSPI(0x80); // set address
+    rSPI((uint8_t)(base));
+    rSPI((uint8_t)(base >> 8));
+    rSPI((uint8_t)(base >> 16));
+    rSPI((uint8_t)(base >> 24));
+    SPI_DisableFileIO();
+
+    SPI_EnableFileIO();
+    rSPI(0x81); // set direction
+    rSPI(direction);
+    SPI_DisableFileIO();
+}
+
+uint8_t FileIO_MCh_ReadChunk(uint8_t* pBuf, uint16_t size)
+// reads the next chunk after FileIO_MCh_SetAddress(, FILEIO_MCH_READ)
+// size - must be <=FILEIO_MEMBUF_SIZE and even
+{
+    SPI_EnableFileIO();
+    rSPI(0x84); // do Read
+    rSPI((uint8_t)( size - 1)     );
+    rSPI((uint8_t)((size - 1) >> 8));
+    SPI_DisableFileIO();
+
+    if (FileIO_MCh_WaitStat(0x04, 0)) { // wait for read finish
+        return (1);
+    }
+
+    return FileIO_MCh_ReadBuffer(pBuf, size);
+}
+
 uint8_t FileIO_MCh_Randomize(uint32_t base, uint32_t size)
 {
     uint32_t buf_tx_size = size;
@@ -501,21 +546,69 @@ inline void FileIO_FCh_WriteStat(uint8_t ch, uint8_t stat)
     SPI_DisableFileIO();
 }
 
-inline uint8_t FileIO_FCh_WaitStat(uint8_t ch, uint8_t mask, uint8_t wanted)
+// Flow control between the chunks of a transfer. If 'flag' is not set the
+// transfer is parked instead of spinning: the driver keeps its position and
+// returns, and FileIO_FCh_Process calls it again once the flag is set (or after
+// 500 ms), so the other channel, the menu and USB keep running meanwhile.
+uint8_t FileIO_FCh_Wait(uint8_t ch, uint8_t drive_number, uint8_t flag)
 {
-    uint8_t  stat;
-    HARDWARE_TICK timeout = Timer_Get(500);      // 500 ms timeout
+    if (FileIO_FCh_GetStat(ch) & flag) {
+        fch_park[ch].flag = 0;
+        return FCH_WAIT_READY;
+    }
 
-    do {
-        stat = FileIO_FCh_GetStat(ch);
+    if (!fch_park[ch].flag) {
+        fch_park[ch].flag = flag;
+        fch_park[ch].drive_number = drive_number;
+        fch_park[ch].timeout = Timer_Get(500);      // 500 ms timeout
 
-        if (Timer_Check(timeout)) {
-            WARNING("FCh:Waitstat timeout.");
-            return (1);
-        }
-    } while ((stat & mask) != wanted);
+    } else if (Timer_Check(fch_park[ch].timeout)) {
+        WARNING("FCh:Waitstat timeout.");
+        fch_park[ch].flag = 0;
+        return FCH_WAIT_TIMEOUT;
+    }
 
-    return (0);
+    return FCH_WAIT_PARKED;
+}
+
+// FileIO_FCh_Wait for the next chunk of a transfer in direction 'dir'. On a
+// timeout the transfer is ended with 'abort_stat', which is also what
+// FileIO_FCh_Cancel sends if the parked transfer is dropped.
+uint8_t FileIO_FCh_WaitChunk(uint8_t ch, uint8_t drive_number, uint8_t dir, uint8_t abort_stat)
+{
+    uint8_t result = FileIO_FCh_Wait(ch, drive_number, dir ? FILEIO_REQ_OK_TO_ARM : FILEIO_REQ_OK_FM_ARM);
+
+    if (result == FCH_WAIT_PARKED) {
+        fch_park[ch].abort_stat = abort_stat;
+
+    } else if (result == FCH_WAIT_TIMEOUT) {
+        FileIO_FCh_WriteStat(ch, abort_stat); // err
+    }
+
+    return result;
+}
+
+uint8_t FileIO_FCh_Parked(uint8_t ch)
+{
+    return fch_park[ch].flag != 0;
+}
+
+// Drops the parked transfer, if any. The core is still waiting for it, so it
+// is completed with the driver's abort status first.
+void FileIO_FCh_Cancel(uint8_t ch)
+{
+    if (!fch_park[ch].flag) {
+        return;
+    }
+
+    if (fch_driver[ch] == 0x8) {
+        FileIO_Drv08_Abort(ch);
+
+    } else {
+        FileIO_FCh_WriteStat(ch, fch_park[ch].abort_stat);
+    }
+
+    fch_park[ch].flag = 0;
 }
 
 void FileIo_FCh_FileReadSendDirect(uint8_t ch, fch_t* pDrive, uint32_t size)
@@ -545,30 +638,41 @@ void FileIO_FCh_Process(uint8_t ch)
     Assert(ch < 2);
     uint8_t status = FileIO_FCh_GetStat(ch);
 
-    if (status & FILEIO_REQ_ACT) {
-        // do stuff
-        // note, the array is just a pointer passed ...
-        switch (fch_driver[ch]) {
-            case 0x0:
-                FileIO_Drv00_Process(ch, fch_handle, status);
-                break;
+    // nothing new starts on the channel while a transfer is parked
+    if (fch_park[ch].flag) {
+        if (!(status & fch_park[ch].flag) && !Timer_Check(fch_park[ch].timeout)) {
+            return;
+        }
 
-            case 0x1:
-                FileIO_Drv01_Process(ch, fch_handle, status);
-                break;
+    } else if (!(status & FILEIO_REQ_ACT)) {
+        return;
+    }
 
-            case 0x2:
-                FileIO_Drv02_Process(ch, fch_handle, status);
-                break;
+    // do stuff
+    // note, the array is just a pointer passed ...
+    switch (fch_driver[ch]) {
+        case 0x0:
+            FileIO_Drv00_Process(ch, fch_handle, status);
+            break;
 
-            case 0x8:
-                FileIO_Drv08_Process(ch, fch_handle, status);
-                break;
+        case 0x1:
+            FileIO_Drv01_Process(ch, fch_handle, status);
+            break;
 
-            default :
-                WARNING("FCh:Unknown driver");
-        }
+        case 0x2:
+            FileIO_Drv02_Process(ch, fch_handle, status);
+            break;
+
+        case 0x8:
+            FileIO_Drv08_Process(ch, fch_handle, status);
+            break;
+
+        default :
+            WARNING("FCh:Unknown driver");
     }
+
+    // don't let a busy drive starve the keyboard
+    OSD_PollKeyboard();
 }
 
 void FileIO_FCh_UpdateDriveStatus(uint8_t ch)
@@ -682,6 +786,11 @@ void FileIO_FCh_Eject(uint8_t ch, uint8_t drive_number)
     // REJECT eject of fixed drive ?
     DEBUG(1, "FCh:Ejecting Ch:%d;Drive:%d", ch, drive_number);
 
+    if (fch_park[ch].flag && fch_park[ch].drive_number == drive_number) {
+        WARNING("FCh:Transfer dropped by eject");
+        FileIO_FCh_Cancel(ch);
+    }
+
     fch_t* pDrive = &fch_handle[ch][drive_number];
     FF_Close(pDrive->fSource);
 
@@ -763,9 +872,16 @@ void FileIO_FCh_SetDriver(uint8_t ch, uint8_t type)
 {
     Assert(ch < 2);
     DEBUG(1, "FCh:SetDriver Ch:%d Type:%02X", ch, type);
+    FileIO_FCh_Cancel(ch);
     fch_driver[ch] = type;
 }
 
+uint8_t FileIO_FCh_GetDriver(uint8_t ch)
+{
+    Assert(ch < 2);
+    return fch_driver[ch];
+}
+
 void FileIO_FCh_Init(void)
 {
     DEBUG(1, "FCh:Init");
@@ -69,11 +69,27 @@ uint8_t FileIO_MCh_BufToMem(uint8_t* pBuf, uint32_t base, uint32_t size);
 uint8_t FileIO_MCh_MemToBuf(uint8_t* pBuf, uint32_t base, uint32_t size);
 uint8_t FileIO_MCh_Randomize(uint32_t base, uint32_t size);
 
+// streaming access, the address auto-increments with every chunk
+#define FILEIO_MCH_WRITE 0x00
+#define FILEIO_MCH_READ  0x80
+void    FileIO_MCh_SetAddress(uint32_t base, uint8_t direction);
+uint8_t FileIO_MCh_ReadChunk(uint8_t* pBuf, uint16_t size);
+
 // ch is 0 for 'A' and 1 for 'B'
 uint8_t FCH_CMD(uint8_t ch, uint8_t cmd);
 uint8_t FileIO_FCh_GetStat(uint8_t ch);
 void    FileIO_FCh_WriteStat(uint8_t ch, uint8_t stat);
-uint8_t FileIO_FCh_WaitStat(uint8_t ch, uint8_t mask, uint8_t wanted);
+
+// FileIO_FCh_Wait results
+#define FCH_WAIT_READY   0
+#define FCH_WAIT_PARKED  1  /* driver returns, it is called again to resume */
+#define FCH_WAIT_TIMEOUT 2
+
+uint8_t FileIO_FCh_Wait(uint8_t ch, uint8_t drive_number, uint8_t flag);
+uint8_t FileIO_FCh_WaitChunk(uint8_t ch, uint8_t drive_number, uint8_t dir, uint8_t abort_stat);
+uint8_t FileIO_FCh_Parked(uint8_t ch);
+void    FileIO_FCh_Cancel(uint8_t ch);
+
 void    FileIo_FCh_FileReadSendDirect(uint8_t ch, fch_t* pDrive, uint32_t size);
 
 void    FileIO_FCh_Process(uint8_t ch);
@@ -90,6 +106,7 @@ void    FileIO_FCh_TogProtect(uint8_t ch, uint8_t drive_number);
 char*   FileIO_FCh_GetName(uint8_t ch, uint8_t drive_number);
 
 void    FileIO_FCh_SetDriver(uint8_t ch, uint8_t type);
+uint8_t FileIO_FCh_GetDriver(uint8_t ch);
 
 void    FileIO_FCh_Init(void); // all chans
 
@@ -31,5 +31,13 @@ uint8_t FileIO_Drv02_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* drive,
 uint8_t FileIO_Drv01_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* drive, char* ext);
 uint8_t FileIO_Drv00_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* drive, char* ext);
 
+// block access to an inserted ATA image (USB mass storage), in the LBA space the core sees
+uint32_t FileIO_Drv08_GetBlocks(uint8_t ch, uint8_t drive_number);
+FF_ERROR FileIO_Drv08_ReadBlocks(uint8_t ch, uint8_t drive_number, uint8_t* pBuffer, uint32_t lba, uint32_t numblocks);
+FF_ERROR FileIO_Drv08_WriteBlocks(uint8_t ch, uint8_t drive_number, const uint8_t* pBuffer, uint32_t lba, uint32_t numblocks);
+
+// ends the parked data phase on 'ch' with an aborted command
+void FileIO_Drv08_Abort(uint8_t ch);
+
 
 #endif
@@ -35,11 +35,122 @@ typedef struct {
     uint32_t file_size;
 } drv00_desc_t;
 
+// Read-ahead for the buffered path (small or unaligned reads): two blocks of the
+// file read last. A request is sent from one of them, and once it is acknowledged
+// the following block is fetched into the other while the core drains its FIFO.
+// Aligned spans of whole blocks go card->FPGA directly and bypass it.
+static struct {
+    FF_FILE* file;
+    uint32_t addr[2];                   // file offset of the block
+    uint16_t length[2];                 // valid bytes, 0 = empty
+    uint32_t next;                      // where a sequential request starts
+    uint8_t  sequential;
+    uint8_t  last;                      // slot sent from last
+    uint8_t  buf[2][DRV00_BLK_SIZE] __attribute__((aligned(4)));
+} drv00_ra;
+
+static void Drv00_Invalidate(void)
+{
+    drv00_ra.length[0] = drv00_ra.length[1] = 0;
+}
+
+// the slot holding 'addr', or -1
+static int Drv00_Cached(FF_FILE* file, uint32_t addr)
+{
+    if (drv00_ra.file != file) {
+        return -1;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (addr - drv00_ra.addr[i] < drv00_ra.length[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// A transfer parked between chunks (see FileIO_FCh_Wait), per channel
+static struct {
+    uint8_t  dir;
+    uint8_t  drive_number;
+    uint8_t  buffered;
+    uint8_t  sequential;
+    uint16_t size;
+    uint32_t addr;
+} drv00_xfer[2];
+
+// Waits for the FIFO before the next chunk. Returns non-zero if the transfer
+// stops here, either parked (to be carried on by a later call) or aborted.
+static uint8_t Drv00_Wait(uint8_t ch, uint8_t dir, uint8_t drive_number, uint32_t addr, uint16_t size, uint8_t buffered)
+{
+    uint8_t result = FileIO_FCh_WaitChunk(ch, drive_number, dir, DRV00_STAT_TRANS_ACK_ABORT_ERR);
+
+    if (result == FCH_WAIT_PARKED) {
+        drv00_xfer[ch].dir = dir;
+        drv00_xfer[ch].drive_number = drive_number;
+        drv00_xfer[ch].buffered = buffered;
+        drv00_xfer[ch].sequential = drv00_ra.sequential;
+        drv00_xfer[ch].size = size;
+        drv00_xfer[ch].addr = addr;
+    }
+
+    return result != FCH_WAIT_READY;
+}
+
+// the file position is only moved when the card is actually read or written
+static uint8_t Drv00_SeekTo(FF_FILE* file, uint32_t addr)
+{
+    return FF_Tell(file) == addr || FF_Seek(file, addr, FF_SEEK_SET) == FF_ERR_NONE;
+}
+
+static uint8_t Drv00_Fill(FF_FILE* file, int slot, uint32_t addr, uint64_t file_size)
+{
+    uint32_t length = DRV00_BLK_SIZE;
+
+    addr &= ~(DRV00_BLK_SIZE - 1);
+
+    if (file_size - addr < length) {
+        length = file_size - addr;
+    }
+
+    if (drv00_ra.file != file) {
+        drv00_ra.file = file;
+        Drv00_Invalidate();
+    }
+
+    drv00_ra.length[slot] = 0;
+
+    if (!Drv00_SeekTo(file, addr) || FF_Read(file, length, 1, drv00_ra.buf[slot]) != length) {
+        return FALSE;
+    }
+
+    drv00_ra.addr[slot] = addr;
+    drv00_ra.length[slot] = length;
+    return TRUE;
+}
+
+// after a sequential request: have the block the next one starts in (or the one
+// after that, if it is cached already) ready
+static void Drv00_ReadAhead(FF_FILE* file, uint64_t file_size)
+{
+    const int current = Drv00_Cached(file, drv00_ra.next);
+    uint32_t addr = drv00_ra.next;
+
+    if (current >= 0) {
+        addr = drv00_ra.addr[current] + DRV00_BLK_SIZE;
+    }
+
+    if (addr < file_size && Drv00_Cached(file, addr) < 0) {
+        Drv00_Fill(file, current >= 0 ? current ^ 1 : 0, addr, file_size);
+    }
+}
+
 void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t status) // amiga
 {
     static int error_shown = 0;
 
-    // file buffer
+    // file buffer (writes)
     uint8_t  fbuf[DRV00_BUF_SIZE];
 
     uint8_t  dir          = 0;
@@ -48,73 +159,81 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
     uint16_t cur_size = 0;
     uint32_t addr = 0;
     uint32_t act_size = 0;
+    uint8_t  buffered = FALSE;
 
     uint8_t  goes = FILEIO_PROCESS_LIMIT; // limit number of requests.
 
     // stats
 #if DRV00_DEBUG_STATS
     uint32_t stats_bytes_processed = 0;
-    uint32_t stats_seek_ticks = 0;
     uint32_t stats_read_ticks = 0;
     uint32_t stats_send_ticks = 0;
+    uint32_t stats_cache_hits = 0;
 
     HARDWARE_TICK stats_begin = Timer_Get(0);
 #endif
 
     do {
-        dir          = (status >> 2) & 0x01; // high is write
-        drive_number = (status >> 4) & 0x03;
-
-        // validate request
-        if (!FileIO_FCh_GetInserted(ch, drive_number)) {
-            if (!error_shown) {
-                DEBUG(1, "Drv00:Process Ch:%d Drive:%d not mounted", ch, drive_number);
-                error_shown = 1;
+        if (FileIO_FCh_Parked(ch)) {
+            // carry on with the transfer left between chunks
+            dir          = drv00_xfer[ch].dir;
+            drive_number = drv00_xfer[ch].drive_number;
+            buffered     = drv00_xfer[ch].buffered;
+            size         = drv00_xfer[ch].size;
+            addr         = drv00_xfer[ch].addr;
+            drv00_ra.sequential = drv00_xfer[ch].sequential;
+
+            if (Drv00_Wait(ch, dir, drive_number, addr, size, buffered)) {
+                return;
             }
 
-            FileIO_FCh_WriteStat(ch, DRV00_STAT_REQ_ACK); // ack
-            FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_ABORT_ERR); // err
-            return;
-
         } else {
-            error_shown = 0;
-        }
+            dir          = (status >> 2) & 0x01; // high is write
+            drive_number = (status >> 4) & 0x03;
+
+            // validate request
+            if (!FileIO_FCh_GetInserted(ch, drive_number)) {
+                if (!error_shown) {
+                    DEBUG(1, "Drv00:Process Ch:%d Drive:%d not mounted", ch, drive_number);
+                    error_shown = 1;
+                }
 
-        fch_t* pDrive = (fch_t*) &handle[ch][drive_number]; // get base
+                FileIO_FCh_WriteStat(ch, DRV00_STAT_REQ_ACK); // ack
+                FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_ABORT_ERR); // err
+                return;
 
-        SPI_EnableFileIO();
-        rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_CMD_R | 0x0));
-        rSPI(0x00); // dummy
-        size  =  rSPI(0);
-        size |= (rSPI(0) << 8);
-        addr  =  rSPI(0);
-        addr |= (rSPI(0) << 8);
-        addr |= (rSPI(0) << 16);
-        addr |= (rSPI(0) << 24);
-        SPI_DisableFileIO();
-
-        FileIO_FCh_WriteStat(ch, DRV00_STAT_REQ_ACK); // ack
-
-        if (size > 0x2000) {
-            DEBUG(1, "Drv00:warning large size request:%04X", size);
-        }
+            } else {
+                error_shown = 0;
+            }
 
-#if DRV00_DEBUG_STATS
-        HARDWARE_TICK stats_begin_seek = Timer_Get(0);
-#endif
+            SPI_EnableFileIO();
+            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_CMD_R | 0x0));
+            rSPI(0x00); // dummy
+            size  =  rSPI(0);
+            size |= (rSPI(0) << 8);
+            addr  =  rSPI(0);
+            addr |= (rSPI(0) << 8);
+            addr |= (rSPI(0) << 16);
+            addr |= (rSPI(0) << 24);
+            SPI_DisableFileIO();
 
-        if (FF_Seek(pDrive->fSource, addr, FF_SEEK_SET)) {
-            WARNING("Drv00:Seek error");
-            FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_SEEK_ERR);
-            return;
-        }
+            FileIO_FCh_WriteStat(ch, DRV00_STAT_REQ_ACK); // ack
+
+            if (size > 0x2000) {
+                DEBUG(1, "Drv00:warning large size request:%04X", size);
+            }
 
 #if DRV00_DEBUG_STATS
-        stats_seek_ticks += (Timer_Get(0) - stats_begin_seek);
-        stats_bytes_processed += size;
+            stats_bytes_processed += size;
 #endif
 
-        const uint64_t file_size = FF_Size(pDrive->fSource);
+            drv00_ra.sequential = (drv00_ra.file == handle[ch][drive_number].fSource) && (drv00_ra.next == addr);
+            buffered = FALSE;
+        }
+
+        fch_t* pDrive = (fch_t*) &handle[ch][drive_number]; // get base
+        FF_FILE* const file = pDrive->fSource;
+        const uint64_t file_size = FF_Size(file);
 
         while (size) {
             cur_size = size;
@@ -146,7 +265,14 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
                 }
             }
 
-            const uint8_t burstable = (dir == 0) /* read */ & ((addr & 0x1FF) == 0) /* sector aligned */ && (cur_size >= DRV00_BLK_SIZE) /* at least one block*/ && ((file_size - addr) >= DRV00_BLK_SIZE) /* not a truncated read */;
+            const uint8_t burstable = (dir == 0) /* read */ & ((addr & 0x1FF) == 0) /* sector aligned */ && (cur_size >= DRV00_BLK_SIZE) /* at least one block*/ && (addr < file_size) && ((file_size - addr) >= DRV00_BLK_SIZE) /* not a truncated read */;
+
+            // reads served from the read-ahead leave the file position behind
+            if ((dir || burstable) && !Drv00_SeekTo(file, addr)) {
+                WARNING("Drv00:Seek error");
+                FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_SEEK_ERR);
+                return;
+            }
 
             if (dir) { // write
                 // request should not be asserted if data is not ready
@@ -163,7 +289,8 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
                 SPI_DisableFileIO();
                 /*DumpBuffer(FDD_fBuf,cur_size);*/
 
-                act_size = FF_Write(pDrive->fSource, cur_size, 1, fbuf);
+                Drv00_Invalidate();
+                act_size = FF_Write(file, cur_size, 1, fbuf);
 
                 if (act_size != cur_size) {
                     WARNING("Drv00:!! Write Fail!!");
@@ -172,8 +299,15 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
                 }
 
             } else if (burstable) {
+                // whole blocks only; a partial last block goes through the buffer
                 uint32_t block_count = size / DRV00_BLK_SIZE;
+
+                if (block_count > (file_size - addr) / DRV00_BLK_SIZE) {
+                    block_count = (file_size - addr) / DRV00_BLK_SIZE;
+                }
+
                 cur_size = block_count * DRV00_BLK_SIZE;
+                buffered = FALSE;
 
                 // on entry assumes file is in correct position
                 // no flow control check, FPGA must be able to sink entire transfer.
@@ -185,7 +319,7 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
 #if DRV00_DEBUG_STATS
                 HARDWARE_TICK stats_begin_read = Timer_Get(0);
 #endif
-                act_size = FF_ReadDirect(pDrive->fSource, cur_size, 1);
+                act_size = FF_ReadDirect(file, cur_size, 1);
 #if DRV00_DEBUG_STATS
                 stats_read_ticks += (Timer_Get(0) - stats_begin_read);
 #endif
@@ -201,14 +335,34 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
                 }
 
             } else {
-                // enough faffing, do the read
+                // enough faffing, do the read; the chunk never crosses a block
+                int slot = Drv00_Cached(file, addr);
+
+                if (slot < 0) {
 #if DRV00_DEBUG_STATS
-                HARDWARE_TICK stats_begin_read = Timer_Get(0);
+                    HARDWARE_TICK stats_begin_read = Timer_Get(0);
 #endif
-                act_size = FF_Read(pDrive->fSource, cur_size, 1, fbuf);
+                    slot = drv00_ra.last ^ 1;
+
+                    if (addr >= file_size || !Drv00_Fill(file, slot, addr, file_size)) {
+                        FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_TRUNC_ERR); // truncated
+                        return;
+                    }
+
 #if DRV00_DEBUG_STATS
-                stats_read_ticks += (Timer_Get(0) - stats_begin_read);
+                    stats_read_ticks += (Timer_Get(0) - stats_begin_read);
+
+                } else {
+                    stats_cache_hits++;
 #endif
+                }
+
+                const uint32_t offset = addr - drv00_ra.addr[slot];
+                act_size = drv00_ra.length[slot] - offset;
+
+                if (act_size > cur_size) {
+                    act_size = cur_size;
+                }
 
                 if (DRV00_DEBUG) {
                     DEBUG(1, "Drv00:bytes read:%04X", act_size);
@@ -221,8 +375,10 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
 #endif
                 SPI_EnableFileIO();
                 rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_W));
-                SPI_WriteBufferSingle(fbuf, act_size);
+                SPI_WriteBufferSingle(&drv00_ra.buf[slot][offset], act_size);
                 SPI_DisableFileIO();
+                drv00_ra.last = slot;
+                buffered = TRUE;
 #if DRV00_DEBUG_STATS
                 stats_send_ticks += (Timer_Get(0) - stats_begin_send);
 #endif
@@ -236,27 +392,25 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
             addr += cur_size;
             size -= cur_size;
 
-            // check to see if we can send/rx more
-            // NOTE, this stalls the GUI so not recommeded to use the flow control here
-            if (size) { // going again
-                if (dir) { // write to arm
-                    if (FileIO_FCh_WaitStat(ch, FILEIO_REQ_OK_TO_ARM, FILEIO_REQ_OK_TO_ARM)) {
-                        FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_ABORT_ERR); // err
-                        return;
-                    }
-
-                } else {
-                    if (FileIO_FCh_WaitStat(ch, FILEIO_REQ_OK_FM_ARM, FILEIO_REQ_OK_FM_ARM)) {
-                        FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_ABORT_ERR); // err
-                        return;
-                    }
-                }
-            } // end of wait
+            // check to see if we can send/rx more, or leave it for the next poll
+            if (size && Drv00_Wait(ch, dir, drive_number, addr, size, buffered)) {
+                return;
+            }
 
         }  // end of transfer loop
 
         // signal transfer done
         FileIO_FCh_WriteStat(ch, DRV00_STAT_TRANS_ACK_OK); // ok
+
+        if (!dir) {
+            drv00_ra.next = addr;
+
+            // the core is busy with the data, get the next block meanwhile
+            if (buffered && drv00_ra.sequential) {
+                Drv00_ReadAhead(file, file_size);
+            }
+        }
+
         // any more to do?
         status = FileIO_FCh_GetStat(ch);
         goes --;
@@ -271,9 +425,9 @@ void FileIO_Drv00_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
         DEBUG(0, "Drv00: requests processed: %d", reqs_processed);
         DEBUG(0, "Drv00: bytes processed: %d", stats_bytes_processed);
         DEBUG(0, "Drv00: time spent: %d ms", Timer_Convert(total_ticks));
-        DEBUG(0, "Drv00: time spent in seek: %d ms", Timer_Convert(stats_seek_ticks));
         DEBUG(0, "Drv00: time spent in read: %d ms", Timer_Convert(stats_read_ticks));
         DEBUG(0, "Drv00: time spent in send: %d ms", Timer_Convert(stats_send_ticks));
+        DEBUG(0, "Drv00: read-ahead hits: %d", stats_cache_hits);
         DEBUG(0, "Drv00: average speed: %d bytes / ms", stats_bytes_processed / Timer_Convert(total_ticks));
     }
 
@@ -296,6 +450,10 @@ uint8_t FileIO_Drv00_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
 
     pDesc->file_size =  FF_Size(pDrive->fSource); //->Filesize;
 
+    // the handle may be a recycled one
+    drv00_ra.file = NULL;
+    Drv00_Invalidate();
+
     // NOTE, core may still be in reset
     // select drive
     SPI_EnableFileIO();
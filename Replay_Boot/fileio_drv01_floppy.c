@@ -41,6 +41,9 @@ const uint8_t DRV01_DEBUG = 0;
 
 #define DRV01_ADF_WRITE_LEN 540 // 512 + 28 WORDS from after 2nd sync to end of sector
 
+#define DRV01_SCP_BURST       2048        // max flux bytes per request
+#define DRV01_SCP_CACHE_BUDGET (8 * 1024) // max size of the track tables kept in memory, all drives together
+
 typedef enum {
     XXX, // unsupported
     ADF,
@@ -73,6 +76,11 @@ typedef struct {
     drv01_scp_track_tlo_t tlo[5]; // one for each
 } drv01_scp_track_header_t;
 
+typedef struct {
+    uint32_t track_length;                  // words
+    uint32_t data_offset;                   // flux data offset in file. 0 = track does not exist
+} drv01_scp_rev_t;
+
 typedef struct {
     drv01_format_t  format;
     //
@@ -84,14 +92,18 @@ typedef struct {
     uint8_t  scp_revolutions;
     //
     uint8_t  scp_cur_track;
-    uint32_t scp_cur_track_header_addr;    // current track header address in file. 0 = track does not exist
+    uint8_t  scp_cur_track_valid;
     //
-    drv01_scp_track_header_t scp_cur_track_header;
+    drv01_scp_rev_t scp_cur_revs[5];
     uint8_t  scp_cur_track_rev;
     uint32_t scp_cur_track_offset;  // current offset from start of track flux data
     //
+    drv01_scp_rev_t* scp_track_cache;   // revolutions of all tracks, read at insert. NULL if not cached
 } drv01_desc_t;
 
+extern fch_t   fch_handle[2][FCH_MAX_NUM];
+extern uint8_t fch_driver[2];
+
 
 static inline uint8_t MFMDecode(uint8_t* odd, uint8_t* even)
 {
@@ -573,6 +585,55 @@ void FileIO_Drv01_ADF_Read(uint8_t ch, fch_t* pDrive, uint8_t* pBuffer)
     FileIO_FCh_WriteStat(ch, DRV01_STAT_TRANS_ACK_OK); // ok
 }
 
+// Read the TRK header of 'track' from the file.
+static uint8_t FileIO_Drv01_SCP_ReadTrack(fch_t* pDrive, uint8_t track, drv01_scp_rev_t* revs)
+{
+    drv01_desc_t* pDesc = pDrive->pDesc;
+    drv01_scp_track_header_t header;
+    uint32_t offset = 0;
+
+    memset(revs, 0, sizeof(drv01_scp_rev_t) * pDesc->scp_revolutions);
+
+    // get track header offset
+    FF_Seek(pDrive->fSource, 0x0010 + (track - pDesc->scp_start_track) * 4, FF_SEEK_SET);
+    FF_Read(pDrive->fSource, 4, 1, (uint8_t*)&offset);
+
+    if (offset == 0) { // track skipped
+        return FALSE;
+    }
+
+    // read track header
+    FF_Seek(pDrive->fSource, offset, FF_SEEK_SET);
+    FF_Read(pDrive->fSource, sizeof(drv01_scp_track_header_t), 1, (uint8_t*)&header);
+    /*DumpBuffer((uint8_t*)&header, sizeof(drv01_scp_track_header_t));*/
+
+    if (strncmp((char*)&header.id, "TRK", 3)) {
+        WARNING("Bad TRK header");
+        return FALSE;
+    }
+
+    if (header.track_number != track) {
+        WARNING("TRK header does not match current track");
+        return FALSE;
+    }
+
+    for (uint8_t rev = 0; rev < pDesc->scp_revolutions; ++rev) {
+        revs[rev].track_length = header.tlo[rev].track_length;
+        revs[rev].data_offset  = offset + header.tlo[rev].track_offset;
+    }
+
+    return TRUE;
+}
+
+static void FileIO_Drv01_SCP_SendBuffered(uint8_t ch, fch_t* pDrive, uint8_t* pBuffer, uint32_t len)
+{
+    FF_Read(pDrive->fSource, len, 1, pBuffer);
+    SPI_EnableFileIO();
+    rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_W));
+    SPI_WriteBufferSingle(pBuffer, len);
+    SPI_DisableFileIO();
+}
+
 void FileIO_Drv01_SCP_Read(uint8_t ch, fch_t* pDrive, uint8_t* pBuffer)
 {
     uint8_t  track  = 0;
@@ -598,58 +659,42 @@ void FileIO_Drv01_SCP_Read(uint8_t ch, fch_t* pDrive, uint8_t* pBuffer)
     if (track != pDesc->scp_cur_track) { // step
 
         pDesc->scp_cur_track = track; // store received track value
+        pDesc->scp_cur_track_valid = FALSE;
 
         // legalize
-        if        (track > pDesc->scp_end_track) {
-            pDesc->scp_cur_track_header_addr = 0;
-
-        } else if (track < pDesc->scp_start_track) {
-            pDesc->scp_cur_track_header_addr = 0;
-
-        } else {
-            // get track header offset
-            FF_Seek(pDrive->fSource, 0x0010 + (track - pDesc->scp_start_track) * 4, FF_SEEK_SET);
-            FF_Read(pDrive->fSource, 4, 1, (uint8_t*)&offset);
-
-            pDesc->scp_cur_track_header_addr = offset; // 0 if track skipped
-
-            if (offset != 0) {
-                // read track header
-                FF_Seek(pDrive->fSource, offset, FF_SEEK_SET);
-                FF_Read(pDrive->fSource, sizeof(drv01_scp_track_header_t), 1, (uint8_t*)&pDesc->scp_cur_track_header);
-                /*DumpBuffer((uint8_t*)&pDesc->scp_cur_track_header, sizeof(drv01_scp_track_header_t));*/
-
-                if (strncmp((char*)&pDesc->scp_cur_track_header.id, "TRK", 3)) {
-                    WARNING("Bad TRK header");
-                    pDesc->scp_cur_track_header_addr = 0;
-                }
-
-                if (pDesc->scp_cur_track_header.track_number != track) {
-                    WARNING("TRK header does not match current track");
-                    pDesc->scp_cur_track_header_addr = 0;
-                }
+        if (track >= pDesc->scp_start_track && track <= pDesc->scp_end_track) {
+            if (pDesc->scp_track_cache) {
+                const uint32_t revs = pDesc->scp_revolutions;
+                memcpy(pDesc->scp_cur_revs, &pDesc->scp_track_cache[(track - pDesc->scp_start_track) * revs], revs * sizeof(drv01_scp_rev_t));
+                pDesc->scp_cur_track_valid = pDesc->scp_cur_revs[0].data_offset != 0;
+
+            } else {
+                pDesc->scp_cur_track_valid = FileIO_Drv01_SCP_ReadTrack(pDrive, track, pDesc->scp_cur_revs);
+            }
+        }
 
-                // ok, all good
-                pDesc->scp_cur_track_rev    = 0;
+        if (pDesc->scp_cur_track_valid) {
+            // ok, all good
+            pDesc->scp_cur_track_rev    = 0;
 
-                // stay at approx offset. Check if we are off the end of new track length
-                if (pDesc->scp_cur_track_offset > pDesc->scp_cur_track_header.tlo[0].track_length) {
-                    pDesc->scp_cur_track_offset = 0;    // start at begining of track
-                }
+            // stay at approx offset. Check if we are off the end of new track length
+            if (pDesc->scp_cur_track_offset > pDesc->scp_cur_revs[0].track_length) {
+                pDesc->scp_cur_track_offset = 0;    // start at begining of track
             }
         }
     }
 
     // assume offset is valid
-    if (pDesc->scp_cur_track_header_addr == 0) {
+    if (!pDesc->scp_cur_track_valid) {
         /*DEBUG(1,"on duff track");*/
         // do nothing
     } else {
+        const drv01_scp_rev_t* rev = &pDesc->scp_cur_revs[pDesc->scp_cur_track_rev];
+
         /*DEBUG(1,"cur revolution %d", pDesc->scp_cur_track_rev + 1);*/
         /*DEBUG(1,"cur offset       %08X", pDesc->scp_cur_track_offset);*/
-        /*DEBUG(1,"cur index time   %08X", pDesc->scp_cur_track_header.tlo[pDesc->scp_cur_track_rev].index_time);*/
-        /*DEBUG(1,"cur track length %08X", pDesc->scp_cur_track_header.tlo[pDesc->scp_cur_track_rev].track_length);*/
-        /*DEBUG(1,"cur track offset %08X", pDesc->scp_cur_track_header.tlo[pDesc->scp_cur_track_rev].track_offset);*/
+        /*DEBUG(1,"cur track length %08X", rev->track_length);*/
+        /*DEBUG(1,"cur data offset  %08X", rev->data_offset);*/
 
         if (pDesc->scp_cur_track_offset == 0) {
             // send sync marker
@@ -660,44 +705,51 @@ void FileIO_Drv01_SCP_Read(uint8_t ch, fch_t* pDrive, uint8_t* pBuffer)
             SPI_DisableFileIO();
         }
 
-        cur_track_len = pDesc->scp_cur_track_header.tlo[pDesc->scp_cur_track_rev].track_length; // in words
-        trans_len     = cur_track_len - pDesc->scp_cur_track_offset; // words
-
-        if (trans_len > 1024) {
-            trans_len = 1024;
-        }
-
-        trans_len = trans_len << 1; // words to bytes
-        // max burst is 2048 bytes. Note, bufer size is only 512 used for alignment
+        cur_track_len = rev->track_length; // in words
+        uint32_t remaining = (cur_track_len - pDesc->scp_cur_track_offset) << 1; // bytes left in this revolution
 
         // offset in file
-        offset  = pDesc->scp_cur_track_header_addr + pDesc->scp_cur_track_header.tlo[pDesc->scp_cur_track_rev].track_offset;
-        offset += (pDesc->scp_cur_track_offset << 1); // words to bytes
+        offset = rev->data_offset + (pDesc->scp_cur_track_offset << 1); // words to bytes
 
         // this seek will (in most cases) not move the file pointer
         FF_Seek(pDrive->fSource, offset, FF_SEEK_SET);
 
-        // align to 512 byte boundaries if possible
-        uint32_t offset_sub    = offset & 0x1FF; // aligned?
-        uint32_t trans_len_sub = trans_len & 0x1FF; // aligned?
+        // A request carries up to DRV01_SCP_BURST bytes. Whole sectors go straight from
+        // the card to the FPGA; only an unaligned head, and the tail of the revolution,
+        // go through the 512 byte buffer. Once aligned, a revolution is streamed in full bursts.
+        uint32_t offset_sub = offset & 0x1FF;
 
-        if ((offset_sub != 0) || (trans_len_sub != 0)) {
-            offset_sub = 0x200 - offset_sub;
+        if (offset_sub || remaining < 0x200) {
+            // odd offsets never align; those are just sent in buffer sized pieces
+            trans_len = (offset & 1) ? 0x200 : 0x200 - offset_sub;
 
-            if (trans_len > offset_sub) {  // < 512
-                trans_len = offset_sub;
+            if (trans_len > remaining) {
+                trans_len = remaining;
             }
 
             trans_len &= 0xFFFE;
+            FileIO_Drv01_SCP_SendBuffered(ch, pDrive, pBuffer, trans_len);
+        }
 
-            FF_Read(pDrive->fSource, trans_len, 1, pBuffer);
-            SPI_EnableFileIO();
-            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_W));
-            SPI_WriteBufferSingle(pBuffer, trans_len);
-            SPI_DisableFileIO();
+        if (((offset + trans_len) & 0x1FF) == 0) {
+            uint32_t direct_len = (remaining - trans_len) & ~0x1FF;
 
-        } else { // aligned
-            FileIo_FCh_FileReadSendDirect(ch, pDrive, trans_len);
+            if (direct_len > DRV01_SCP_BURST - trans_len) {
+                direct_len = (DRV01_SCP_BURST - trans_len) & ~0x1FF;
+            }
+
+            if (direct_len) {
+                FileIo_FCh_FileReadSendDirect(ch, pDrive, direct_len);
+                trans_len += direct_len;
+            }
+
+            // finish the revolution if the tail fits in this burst
+            uint32_t tail_len = remaining - trans_len;
+
+            if (tail_len && tail_len < 0x200 && trans_len + tail_len <= DRV01_SCP_BURST) {
+                FileIO_Drv01_SCP_SendBuffered(ch, pDrive, pBuffer, tail_len);
+                trans_len += tail_len;
+            }
         }
 
         // check end of track
@@ -781,6 +833,28 @@ void FileIO_Drv01_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
 
 }
 
+// Bytes left for SCP track tables; the budget is shared by all inserted floppies.
+static uint32_t Drv01_ScpCacheBudgetLeft(void)
+{
+    uint32_t used = 0;
+
+    for (int ch = 0; ch < 2; ++ch) {
+        if (fch_driver[ch] != 0x1) {
+            continue;
+        }
+
+        for (int i = 0; i < FCH_MAX_NUM; ++i) {
+            drv01_desc_t* pDesc = fch_handle[ch][i].pDesc;
+
+            if ((fch_handle[ch][i].status & FILEIO_STAT_INSERTED) && pDesc && pDesc->scp_track_cache) {
+                used += pDesc->total_tracks * pDesc->scp_revolutions * sizeof(drv01_scp_rev_t);
+            }
+        }
+    }
+
+    return used < DRV01_SCP_CACHE_BUDGET ? DRV01_SCP_CACHE_BUDGET - used : 0;
+}
+
 uint8_t FileIO_Drv01_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive, char* ext)
 {
     drv01_scp_header_t scp_header;
@@ -848,10 +922,29 @@ uint8_t FileIO_Drv01_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
         pDesc->scp_revolutions = scp_header.number_of_revolutions;
 
         pDesc->scp_cur_track = 255; // illegal
-        pDesc->scp_cur_track_header_addr = 0;
+        pDesc->scp_cur_track_valid  = FALSE;
         pDesc->scp_cur_track_rev    = 0;
         pDesc->scp_cur_track_offset = 0;
 
+        // Cache the revolutions of all tracks, so a head step doesn't have to go to the card.
+        // The table lives in the same allocation as the descriptor (and is freed with it).
+        const uint32_t cache_size = pDesc->total_tracks * pDesc->scp_revolutions * sizeof(drv01_scp_rev_t);
+        drv01_desc_t* pCached = cache_size <= Drv01_ScpCacheBudgetLeft() ? malloc(sizeof(drv01_desc_t) + cache_size) : NULL;
+
+        if (pCached) {
+            memcpy(pCached, pDesc, sizeof(drv01_desc_t));
+            free(pDesc);
+            pDrive->pDesc = pDesc = pCached;
+            pDesc->scp_track_cache = (drv01_scp_rev_t*)(void*)(pDesc + 1);
+
+            for (uint16_t i = 0; i < pDesc->total_tracks; ++i) {
+                FileIO_Drv01_SCP_ReadTrack(pDrive, pDesc->scp_start_track + i, &pDesc->scp_track_cache[i * pDesc->scp_revolutions]);
+            }
+
+        } else {
+            WARNING("Drv01:SCP track table not cached (%lu bytes)", cache_size);
+        }
+
         pDrive->status |= FILEIO_STAT_READONLY; // set readonly
 
     } else {
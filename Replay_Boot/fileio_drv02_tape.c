@@ -40,7 +40,18 @@ const uint8_t DRV02_DEBUG = 1;
 #define UEF_floatGapID  0x0116
 #define UEF_startBit    0
 #define UEF_stopBit     1
-#define UEF_Baud        (1000000.0/(16.0*52.0))
+// 1000000 / (16 * 52) = 1201.92 baud, as bits per ms in 16.16 fixed point
+#define UEF_BitsPerMs   ((uint32_t)((65536ULL * 1000000) / (16 * 52 * 1000)))
+#define UEF_MsToBits(ms) ((uint32_t)(((uint64_t)(ms) * UEF_BitsPerMs) >> 16))
+
+// Playback (RAW bytes or the rendered UEF bit stream) is served from a ring that
+// runs ahead of the core. After each request it is topped up to the watermark in
+// large sequential pieces, so the card is not touched per request and a core may
+// pull data faster than real time (turbo loading).
+#define DRV02_RING_SIZE         4096    // power of two
+#define DRV02_RING_MASK         (DRV02_RING_SIZE - 1)
+#define DRV02_RING_WATERMARK    1024    // bytes ahead of the core before a refill
+#define DRV02_RING_REFILL       2048    // bytes per refill
 
 typedef enum {
     XXX, // unsupported
@@ -49,8 +60,27 @@ typedef enum {
 } drv02_format_t;
 
 typedef struct {
-    drv02_format_t  format;
-    uint32_t        file_size;
+    FF_FILE*    file;                   // NULL if the ring has to start over
+    uint32_t    start;                  // stream offset of the oldest byte held
+    uint32_t    end;                    // stream offset after the newest byte
+    uint32_t    underruns;              // requests that found the ring empty
+    uint8_t     data[DRV02_RING_SIZE] __attribute__((aligned(4)));
+} drv02_ring_t;
+
+// UEF tape data, read a block at a time rather than a byte per bit
+typedef struct {
+    uint32_t    file_offset;
+    uint32_t    length;
+    uint8_t     data[DRV02_BUF_SIZE];
+} drv02_uef_cache_t;
+
+// the ring and the cache belong to the inserted image, so they only take
+// memory while a tape is inserted and never serve another file's data
+typedef struct {
+    drv02_format_t      format;
+    uint32_t            file_size;
+    drv02_uef_cache_t   uef_cache;
+    drv02_ring_t        ring;
 } drv02_desc_t;
 
 typedef struct {
@@ -67,11 +97,38 @@ typedef struct {
 // TODO - allocate this as part of the desc structure
 static ChunkInfo s_ChunkData = { 0 };
 
-void FileIO_Drv02_RAW_Process(uint8_t ch, fch_t* pDrive, uint8_t drive_number, uint8_t dir, uint8_t* fbuf, uint32_t addr, uint16_t size)
+// A transfer parked between chunks (see FileIO_FCh_Wait), per channel
+static struct {
+    uint8_t  dir;
+    uint8_t  drive_number;
+    uint16_t size;
+    uint32_t addr;
+} drv02_xfer[2];
+
+// Waits for the FIFO before the next chunk. Returns non-zero if the transfer
+// stops here, either parked (to be carried on by a later call) or aborted.
+static uint8_t Drv02_Wait(uint8_t ch, uint8_t dir, uint8_t drive_number, uint32_t addr, uint16_t size)
+{
+    uint8_t result = FileIO_FCh_WaitChunk(ch, drive_number, dir, DRV02_STAT_TRANS_ACK_ABORT_ERR);
+
+    if (result == FCH_WAIT_PARKED) {
+        drv02_xfer[ch].dir = dir;
+        drv02_xfer[ch].drive_number = drive_number;
+        drv02_xfer[ch].size = size;
+        drv02_xfer[ch].addr = addr;
+    }
+
+    return result != FCH_WAIT_READY;
+}
+
+static void FileIO_Drv02_RAW_Write(uint8_t ch, fch_t* pDrive, uint8_t drive_number, uint8_t* fbuf, uint32_t addr, uint16_t size)
 {
     uint16_t cur_size = 0;
     uint32_t act_size = 0;
 
+    // the tape changes under the ring
+    ((drv02_desc_t*)pDrive->pDesc)->ring.file = NULL;
+
     if (FF_Seek(pDrive->fSource, addr, FF_SEEK_SET)) {
         WARNING("Drv02:Seek error");
         FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_SEEK_ERR);
@@ -108,69 +165,35 @@ void FileIO_Drv02_RAW_Process(uint8_t ch, fch_t* pDrive, uint8_t drive_number, u
             }
         }
 
-        if (dir) { // write
-            // request should not be asserted if data is not ready
-            // write will fail if read only
-            if (pDrive->status & FILEIO_STAT_READONLY_OR_PROTECTED) {
-                WARNING("Drv02:W Read only disk!");
-                FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
-                return;
-            }
-
-            SPI_EnableFileIO();
-            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
-            SPI_ReadBufferSingle(fbuf, cur_size);
-            SPI_DisableFileIO();
-            /*DumpBuffer(fbuf,cur_size);*/
-
-            act_size = FF_Write(pDrive->fSource, cur_size, 1, fbuf);
-
-            if (act_size != cur_size) {
-                WARNING("Drv02:!! Write Fail!!");
-                FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
-                return;
-            }
-
-        } else {
-            // enough faffing, do the read
-            act_size = FF_Read(pDrive->fSource, cur_size, 1, fbuf);
+        // request should not be asserted if data is not ready
+        // write will fail if read only
+        if (pDrive->status & FILEIO_STAT_READONLY_OR_PROTECTED) {
+            WARNING("Drv02:W Read only disk!");
+            FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
+            return;
+        }
 
-            if (DRV02_DEBUG) {
-                DEBUG(1, "Drv02:bytes read:%04X", act_size);
-            }
+        SPI_EnableFileIO();
+        rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
+        SPI_ReadBufferSingle(fbuf, cur_size);
+        SPI_DisableFileIO();
+        /*DumpBuffer(fbuf,cur_size);*/
 
-            /*DumpBuffer(fbuf, cur_size);*/
+        act_size = FF_Write(pDrive->fSource, cur_size, 1, fbuf);
 
-            SPI_EnableFileIO();
-            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_W));
-            SPI_WriteBufferSingle(fbuf, act_size);
-            SPI_DisableFileIO();
-
-            if (act_size != cur_size) {
-                FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
-                return;
-            }
+        if (act_size != cur_size) {
+            WARNING("Drv02:!! Write Fail!!");
+            FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
+            return;
         }
 
         addr += cur_size;
         size -= cur_size;
 
-        // check to see if we can send/rx more
-        // NOTE, this stalls the GUI so not recommeded to use the flow control here
-        if (size) { // going again
-            if (dir) { // write to arm
-                if (FileIO_FCh_WaitStat(ch, FILEIO_REQ_OK_TO_ARM, FILEIO_REQ_OK_TO_ARM)) {
-                    FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_ABORT_ERR); // err
-                    return;
-                }
-
-            } else {
-                if (FileIO_FCh_WaitStat(ch, FILEIO_REQ_OK_FM_ARM, FILEIO_REQ_OK_FM_ARM)) {
-                    FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_ABORT_ERR); // err
-                    return;
-                }
-            }
-        } // end of wait
+        // check to see if we can rx more, or leave it for the next poll
+        if (size && Drv02_Wait(ch, 1, drive_number, addr, size)) {
+            return;
+        }
 
     }  // end of transfer loop
 
@@ -252,7 +275,7 @@ static ChunkInfo* GetChunkAtPosFile(FF_FILE* f, uint32_t* p_bit_pos)
                     break;
                 }
 
-                chunk_bitlen = ms * (UEF_Baud / 1000.0);
+                chunk_bitlen = UEF_MsToBits(ms);
                 fseek(f, -sizeof(ms), FF_SEEK_CUR);
 
             } else if (id == UEF_highDummyID) {
@@ -262,13 +285,13 @@ static ChunkInfo* GetChunkAtPosFile(FF_FILE* f, uint32_t* p_bit_pos)
                     break;
                 }
 
-                chunk->pre_carrier = ms * (UEF_Baud / 1000.0);
+                chunk->pre_carrier = UEF_MsToBits(ms);
 
                 if (fread(&ms, 1, sizeof(ms), f) != sizeof(ms)) {
                     break;
                 }
 
-                uint32_t post_carrier = ms * (UEF_Baud / 1000.0);
+                uint32_t post_carrier = UEF_MsToBits(ms);
                 chunk_bitlen = chunk->pre_carrier + 20 + post_carrier;
                 fseek(f, -sizeof(ms) * 2, FF_SEEK_CUR);
             }
@@ -343,7 +366,7 @@ static ChunkInfo* GetChunkAtPosFile(FF_FILE* f, uint32_t* p_bit_pos)
     return chunk->bit_offset_end ? chunk : 0;
 }
 
-static uint8_t GetBitAtPos(FF_FILE* f, uint32_t bit_pos)
+static uint8_t GetBitAtPos(FF_FILE* f, drv02_uef_cache_t* cache, uint32_t bit_pos)
 {
     ChunkInfo* info = GetChunkAtPosFile(f, &bit_pos);
 
@@ -373,9 +396,19 @@ static uint8_t GetBitAtPos(FF_FILE* f, uint32_t bit_pos)
             return UEF_stopBit;
         }
 
-        uint8_t byte;
-        fseek(f, info->file_offset + byte_offset, FF_SEEK_SET);
-        fread(&byte, 1, sizeof(byte), f);
+        const uint32_t offset = info->file_offset + byte_offset;
+
+        if (offset - cache->file_offset >= cache->length) {
+            cache->file_offset = offset & ~(DRV02_BUF_SIZE - 1);
+            fseek(f, cache->file_offset, FF_SEEK_SET);
+            cache->length = fread(cache->data, 1, sizeof(cache->data), f);
+
+            if (offset - cache->file_offset >= cache->length) {
+                return 0;
+            }
+        }
+
+        const uint8_t byte = cache->data[offset - cache->file_offset];
 
         bit_offset -= 1;        // E (0,7)
         Assert(bit_offset < 8);
@@ -409,82 +442,142 @@ static uint8_t GetBitAtPos(FF_FILE* f, uint32_t bit_pos)
 
 // *** UEF ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
 
-void FileIO_Drv02_UEF_Process(uint8_t ch, fch_t* pDrive, uint8_t drive_number, uint8_t dir, uint8_t* fbuf, uint32_t addr, uint16_t size)
+// Appends up to DRV02_RING_REFILL bytes of the stream to the ring without
+// dropping anything from 'keep' on. Returns the number of bytes added.
+static uint32_t Drv02_Refill(fch_t* pDrive, uint32_t keep)
 {
-    uint16_t cur_size = 0;
-    uint32_t act_size = 0;
     drv02_desc_t* pDesc = pDrive->pDesc;
+    drv02_ring_t* ring = &pDesc->ring;
+    FF_FILE* f = pDrive->fSource;
+    uint32_t size = DRV02_RING_REFILL;
 
-    if (dir) {    // write not supported
-        WARNING("UEF Write not supported!");
-        return;
+    if (ring->end >= pDesc->file_size) {
+        return 0;
     }
 
-    // out-of-bounds read offsets trap here
-    if (addr > pDesc->file_size) {
-        addr = pDesc->file_size;
+    if (size > pDesc->file_size - ring->end) {
+        size = pDesc->file_size - ring->end;
     }
 
-    while (size) {
-        cur_size = size;
+    if (size > DRV02_RING_SIZE - (ring->end - keep)) {
+        size = DRV02_RING_SIZE - (ring->end - keep);
+    }
 
-        if (cur_size > DRV02_BUF_SIZE) {
-            cur_size = DRV02_BUF_SIZE;
-        }
+    HARDWARE_TICK tick = Timer_Get(0);
+    uint32_t done = 0;
+
+    if (pDesc->format == RAW && FF_Tell(f) != ring->end && FF_Seek(f, ring->end, FF_SEEK_SET)) {
+        WARNING("Drv02:Seek error");
+        return 0;
+    }
 
-        act_size = cur_size;
+    while (done < size) {
+        const uint32_t pos = (ring->end + done) & DRV02_RING_MASK;
+        uint32_t len = size - done;
 
-        // artifically clamp size to the end of the bit stream
-        if ((addr + act_size) > pDesc->file_size) {
-            act_size = pDesc->file_size - addr;
+        if (len > DRV02_RING_SIZE - pos) {
+            len = DRV02_RING_SIZE - pos;
         }
 
-        if (DRV02_DEBUG) {
-            DEBUG(1, "Drv02:Process Ch%d Drive:%02X Addr:%08X Size:%04X", ch, drive_number, addr, cur_size);
+        if (pDesc->format == RAW) {
+            const uint32_t act_size = FF_Read(f, len, 1, &ring->data[pos]);
+            done += act_size;
+
+            if (act_size != len) {
+                break;
+            }
+
+        } else {
+            for (uint32_t i = 0; i < len; ++i) {
+                const uint32_t bit_pos = (ring->end + done + i) << 3;
+                uint8_t val = 0;
+
+                for (uint32_t bit = 0; bit < 8; ++bit) {
+                    val = (val << 1) | GetBitAtPos(f, &pDesc->uef_cache, bit_pos + bit);
+                }
+
+                ring->data[pos + i] = val;
+            }
+
+            done += len;
         }
+    }
+
+    ring->end += done;
+
+    if (ring->end - ring->start > DRV02_RING_SIZE) {
+        ring->start = ring->end - DRV02_RING_SIZE;
+    }
 
-        HARDWARE_TICK tick = Timer_Get(0);
+    DEBUG(2, "Drv02:Ring refill %04X bytes in %d ms", done, Timer_Convert(Timer_Get(0) - tick));
+    return done;
+}
 
-        // this is a very naive conversion, but it'll have to do for now..
-        for (uint32_t pos = 0; pos < act_size; ++pos) {
-            uint8_t val = 0;
+static void FileIO_Drv02_Stream(uint8_t ch, fch_t* pDrive, uint8_t drive_number, uint32_t addr, uint16_t size)
+{
+    drv02_ring_t* ring = &((drv02_desc_t*)pDrive->pDesc)->ring;
+    uint16_t cur_size = 0;
+
+    // anything but (near) sequential playback starts over
+    if (ring->file != pDrive->fSource || addr < ring->start || addr > ring->end) {
+        ring->file = pDrive->fSource;
+        ring->start = ring->end = addr;
+    }
 
-            for (uint32_t bit = 0; bit < 8; ++bit) {
-                val = val << 1;
-                val = val | GetBitAtPos(pDrive->fSource, ((addr + pos) << 3) + bit);
+    while (size) {
+        if (addr == ring->end) {
+            if (ring->start != ring->end) {
+                ring->underruns++;
+                DEBUG(1, "Drv02:Ring underrun at %08lx (%lu)", addr, ring->underruns);
             }
 
-            fbuf[pos] = val;
+            if (!Drv02_Refill(pDrive, addr)) {
+                FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
+                return;
+            }
         }
 
-        uint32_t ms = Timer_Convert(Timer_Get(0) - tick);
-        (void)ms;
-        DEBUG(0, "Drv02:Process %04X bytes read/converted in %d ms. (%d bps)", cur_size, ms, 1000 * cur_size / ms);
+        cur_size = size;
 
-        if (DRV02_DEBUG) {
-            DEBUG(1, "Drv02:bytes read:%04X", act_size);
+        if (cur_size > DRV02_BUF_SIZE) {
+            cur_size = DRV02_BUF_SIZE;
         }
 
-        /*DumpBuffer(fbuf, cur_size);*/
+        if (cur_size > ring->end - addr) {
+            cur_size = ring->end - addr;
+        }
+
+        if (cur_size > DRV02_RING_SIZE - (addr & DRV02_RING_MASK)) {
+            cur_size = DRV02_RING_SIZE - (addr & DRV02_RING_MASK);
+        }
+
+        if (DRV02_DEBUG) {
+            DEBUG(1, "Drv02:Process Ch%d Drive:%02X Addr:%08X Size:%04X", ch, drive_number, addr, cur_size);
+        }
 
         SPI_EnableFileIO();
         rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_W));
-        SPI_WriteBufferSingle(fbuf, act_size);
+        SPI_WriteBufferSingle(&ring->data[addr & DRV02_RING_MASK], cur_size);
         SPI_DisableFileIO();
 
-        if (act_size != cur_size) {
-            FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_TRUNC_ERR); // truncated
-            return;
-        }
-
         addr += cur_size;
         size -= cur_size;
 
+        // check to see if we can send more, or leave it for the next poll
+        if (size && Drv02_Wait(ch, 0, drive_number, addr, size)) {
+            return;
+        }
+
     }  // end of transfer loop
 
     // signal transfer done
     FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_OK); // ok
 
+    // the core plays what it has; get ahead again meanwhile
+    while (ring->end - addr < DRV02_RING_WATERMARK && Drv02_Refill(pDrive, addr))
+        ;
+
+    DEBUG(2, "Drv02:Ring %lu bytes ahead, %lu underruns", ring->end - addr, ring->underruns);
 }
 
 void FileIO_Drv02_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t status) // amiga
@@ -502,50 +595,69 @@ void FileIO_Drv02_Process(uint8_t ch, fch_t handle[2][FCH_MAX_NUM], uint8_t stat
     uint8_t  goes = FILEIO_PROCESS_LIMIT; // limit number of requests.
 
     do {
-        dir          = (status >> 2) & 0x01; // high is write
-        drive_number = (status >> 4) & 0x03;
-
-        // validate request
-        if (!FileIO_FCh_GetInserted(ch, drive_number)) {
-            if (!error_shown) {
-                DEBUG(1, "Drv02:Process Ch:%d Drive:%d not mounted", ch, drive_number);
-                error_shown = 1;
+        if (FileIO_FCh_Parked(ch)) {
+            // carry on with the transfer left between chunks
+            dir          = drv02_xfer[ch].dir;
+            drive_number = drv02_xfer[ch].drive_number;
+            size         = drv02_xfer[ch].size;
+            addr         = drv02_xfer[ch].addr;
+
+            if (Drv02_Wait(ch, dir, drive_number, addr, size)) {
+                return;
             }
 
+        } else {
+            dir          = (status >> 2) & 0x01; // high is write
+            drive_number = (status >> 4) & 0x03;
+
+            // validate request
+            if (!FileIO_FCh_GetInserted(ch, drive_number)) {
+                if (!error_shown) {
+                    DEBUG(1, "Drv02:Process Ch:%d Drive:%d not mounted", ch, drive_number);
+                    error_shown = 1;
+                }
+
+                FileIO_FCh_WriteStat(ch, DRV02_STAT_REQ_ACK); // ack
+                FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_ABORT_ERR); // err
+                return;
+
+            } else {
+                error_shown = 0;
+            }
+
+            SPI_EnableFileIO();
+            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_CMD_R | 0x0));
+            rSPI(0x00); // dummy
+            size  =  rSPI(0);
+            size |= (rSPI(0) << 8);
+            addr  =  rSPI(0);
+            addr |= (rSPI(0) << 8);
+            addr |= (rSPI(0) << 16);
+            addr |= (rSPI(0) << 24);
+            SPI_DisableFileIO();
+
             FileIO_FCh_WriteStat(ch, DRV02_STAT_REQ_ACK); // ack
-            FileIO_FCh_WriteStat(ch, DRV02_STAT_TRANS_ACK_ABORT_ERR); // err
-            return;
 
-        } else {
-            error_shown = 0;
+            if (size > 0x2000) {
+                DEBUG(1, "Drv02:warning large size request:%04X", size);
+            }
         }
 
         fch_t* pDrive = (fch_t*) &handle[ch][drive_number]; // get base
         drv02_desc_t* pDesc = pDrive->pDesc;
 
-        SPI_EnableFileIO();
-        rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_CMD_R | 0x0));
-        rSPI(0x00); // dummy
-        size  =  rSPI(0);
-        size |= (rSPI(0) << 8);
-        addr  =  rSPI(0);
-        addr |= (rSPI(0) << 8);
-        addr |= (rSPI(0) << 16);
-        addr |= (rSPI(0) << 24);
-        SPI_DisableFileIO();
-
-        FileIO_FCh_WriteStat(ch, DRV02_STAT_REQ_ACK); // ack
+        if (pDesc->format == UEF && dir) {    // write not supported
+            WARNING("UEF Write not supported!");
 
-        if (size > 0x2000) {
-            DEBUG(1, "Drv02:warning large size request:%04X", size);
-        }
+        } else if (pDesc->format == RAW && dir) {
+            FileIO_Drv02_RAW_Write(ch, pDrive, drive_number, fbuf, addr, size);
 
-        if (pDesc->format == RAW) {
-            FileIO_Drv02_RAW_Process(ch, pDrive, drive_number, dir, fbuf, addr, size);
+        } else if (pDesc->format != XXX) {
+            FileIO_Drv02_Stream(ch, pDrive, drive_number, addr, size);
         }
 
-        if (pDesc->format == UEF) {
-            FileIO_Drv02_UEF_Process(ch, pDrive, drive_number, dir, fbuf, addr, size);
+        if (FileIO_FCh_Parked(ch)) {
+            return;
         }
 
         // any more to do?
@@ -33,6 +33,10 @@ const uint8_t DRV08_DEBUG = 0;
 #define DRV08_MAX_READ_BURST 7 // number of sectors FIFO can hold from AF de-asserted (could have <1 sector in FIFO still)
 /*#define DRV08_MAX_READ_BURST 1 // number of sectors FIFO can hold from AF de-asserted (could have <1 sector in FIFO still)*/
 
+// seek index memory, shared by all mounted drives (both channels)
+#define DRV08_INDEX_BUDGET (16 * 1024) // bytes, what four drives used to take with fixed tables
+#define DRV08_INDEX_SHARE  (1024 * 4)  // a drive may always claim this much (the old fixed table)
+
 // status bits
 #define DRV08_STATUS_END 0x80
 #define DRV08_STATUS_IRQ 0x10
@@ -102,18 +106,27 @@ typedef struct {
     uint16_t heads;
     uint16_t sectors;
     uint16_t sectors_per_block;
-    uint32_t index[1024];
-    uint32_t index_size;
+
+    // seek index, allocated behind the descriptor (see Drv08_BuildHardfileIndex)
+    // either a FatFS cluster link map (one extent per file fragment),
+    // or a sampled cluster table with a granularity of 2^index_size bytes
+    uint32_t* index;
+    uint16_t index_len;     // number of uint32_t entries
+    uint8_t  index_size;
+    uint8_t  index_extents; // index is a link map
 
     // most recently used seek point
     uint32_t mru_lba;
     uint32_t mru_cluster;
 
-    drv08_rdb_t hdf_rdb;
+    drv08_rdb_t* hdf_rdb;   // only allocated for HDF_NAKED
     uint32_t hdf_dostype;
     uint32_t lba_offset;
 } drv08_desc_t;
 
+extern fch_t   fch_handle[2][FCH_MAX_NUM];
+extern uint8_t fch_driver[2];
+
 void Drv08_SwapBytes(uint8_t* ptr, uint32_t len)
 {
     uint8_t x;
@@ -196,9 +209,6 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
 
     HARDWARE_TICK time = Timer_Get(0);
 
-    FF_IOMAN*  pIoman;// = pDrive->fSource->pIoman;
-    (void)pIoman;
-
     uint64_t lba_byte = (uint64_t)lba << 9;
 
     if (pDesc->format == HDF_NAKED) {
@@ -215,62 +225,13 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
         lba_byte = (uint64_t)lba << 9;
     }
 
-#if !defined(FF_DEFINED)    // Using FullFAT backend?
-    pIoman = pDrive->fSource->pIoman;
-
-    // first check if we are moving to the same cluster
-    FF_T_UINT32 nNewCluster = FF_getClusterChainNumber(pIoman, lba_byte, 1);
-
-    if ((nNewCluster < pDrive->fSource->CurrentCluster) || (nNewCluster > (pDrive->fSource->CurrentCluster + 1)) ) {
-        // reposition using table
-        uint16_t idx = lba >> (pDesc->index_size - 9); // 9 as lba is in 512 byte sectors
-        uint32_t pos = (uint32_t)lba_byte & (-1 << pDesc->index_size);
-
-        nNewCluster = FF_getClusterChainNumber(pIoman, pos, 1);
-
-        Assert(idx < 1024);
-
-        // The current cluster index is not yet known;
-        //  *) find the first valid cluster,
-        //  *) step through all indices up to the current one,
-        //  *) and fill out the index cluster table
-        if (pDesc->index[idx] == 0xffffffff) {
-            // find the first and the last indices
-            uint16_t start = idx;
-
-            // step backwards until we find a valid cluster
-            for (; start ; --start)
-                if (pDesc->index[start] != 0xffffffff) {
-                    break;
-                }
-
-            uint64_t step = 1 << pDesc->index_size;
-            uint64_t filepos = start * step;
-
-            for (uint16_t i = start; i <= idx; ++i, filepos += step) {
-                if (pDesc->index[i] != 0xffffffff) {
-                    continue;
-                }
-
-                FF_Seek(pDrive->fSource, filepos, FF_SEEK_SET);
-                //DEBUG(1,"index %08x %08x %08x @ %08x", (int)filepos,  pDrive->fSource->AddrCurrentCluster, pDrive->fSource->CurrentCluster, (int)i);
-                Assert(i < 1024);
-                pDesc->index[i] = pDrive->fSource->AddrCurrentCluster;
-            }
-        }
-
-        uint32_t index_cluster = pDesc->index[idx];
-        Assert(index_cluster != 0xffffffff);
-
-        pDrive->fSource->FilePointer        = pos;
-        pDrive->fSource->CurrentCluster     = nNewCluster;
-        pDrive->fSource->AddrCurrentCluster = index_cluster;
+    FIL* fp = (FIL*)pDrive->fSource;
 
-        //DEBUG(1,"seek JUMP lba*512 %08X, pos %08x, idx %d, newcluster %08X index_cluster %08X", lba_byte, pos, idx, nNewCluster, index_cluster);
+    // with a link map FatFS resolves the cluster directly (fast seek mode)
+    if (pDesc->index_extents) {
+        return FF_Seek(pDrive->fSource, lba_byte, FF_SEEK_SET);
     }
 
-#else   // defined(FF_DEFINED) == using FATFS backend
-    FIL* fp = (FIL*)pDrive->fSource;
     FATFS* fs = fp->obj.fs;
 
     // if we just visited this block, we know the file offset and cluster
@@ -283,13 +244,11 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
     uint32_t clusterSize = fs->csize * /*((fs)->ssize)*/ ((UINT)FF_MAX_SS);
     uint32_t newCluster = lba_byte / clusterSize;
     uint32_t currentCluster = fp->fptr / clusterSize;
-    uint16_t idx = lba >> (pDesc->index_size - 9); // 9 as lba is in 512 byte sectors
-
-    Assert(idx < 1024);
+    uint32_t idx = lba_byte >> pDesc->index_size;
 
-    if ((newCluster < currentCluster) || (newCluster > (currentCluster + 1)) || pDesc->index[idx] == 0xffffffff ) {
+    if (idx < pDesc->index_len && ((newCluster < currentCluster) || (newCluster > (currentCluster + 1)) || pDesc->index[idx] == 0xffffffff)) {
         // reposition using table
-        uint64_t pos = lba_byte & (-1 << pDesc->index_size);
+        uint64_t pos = lba_byte & ~(((uint64_t)1 << pDesc->index_size) - 1);
 
         newCluster = pos / clusterSize;
 
@@ -299,7 +258,7 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
         //  *) and fill out the index cluster table
         if (pDesc->index[idx] == 0xffffffff) {
             // find the first and the last indices
-            uint16_t start = idx;
+            uint32_t start = idx;
 
             // step backwards until we find a valid cluster
             for (; start ; --start)
@@ -307,17 +266,17 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
                     break;
                 }
 
-            uint64_t step = 1 << pDesc->index_size;
+            uint64_t step = (uint64_t)1 << pDesc->index_size;
             uint64_t filepos = start * step;
 
-            for (uint16_t i = start; i <= idx; ++i, filepos += step) {
+            for (uint32_t i = start; i <= idx; ++i, filepos += step) {
                 if (pDesc->index[i] != 0xffffffff) {
                     continue;
                 }
 
                 FF_Seek(pDrive->fSource, filepos, FF_SEEK_SET);
                 // DEBUG(1, "index LBA %08x CL %08x CURCL %08x @ %08x", (int)(filepos >> 9),  fp->clust, currentCluster, (int)i);
-                Assert(i < 1024);
+                Assert(i < pDesc->index_len);
                 pDesc->index[i] = fp->clust;
             }
         }
@@ -331,8 +290,6 @@ FF_ERROR Drv08_HardFileSeek(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t lba)
         //DEBUG(1,"seek JUMP lba*512 %08X, pos %08x, idx %d, newcluster %08X index_cluster %08X", lba_byte, pos, idx, newCluster, index_cluster);
     }
 
-#endif
-
     FF_ERROR err = FF_Seek(pDrive->fSource, lba_byte, FF_SEEK_SET);
 
     // replace the most-recently-used position
@@ -537,6 +494,317 @@ static inline void Drv08_IncParams(drv08_desc_t* pDesc,  // inputs
     // and the LBA
     (*lba)++;
 }
+//
+// Data phases of the PIO commands. Rather than spinning on the FIFO between
+// sectors they park the channel (see FileIO_FCh_Wait) and are carried on by the
+// next Drv08_ATA_Handle, with their position kept here.
+//
+typedef struct {
+    uint8_t  cmd;
+    uint8_t  tfr[8];
+    uint8_t  unit;
+    uint8_t  first;
+    uint8_t  parked;            // READ SECTORS: DRQ already raised for this sector
+    uint8_t  head;
+    uint8_t  lba_mode;
+    uint16_t sector;
+    uint16_t cylinder;
+    uint16_t sector_count;
+    uint16_t block_count;       // left in the current multiple block
+    uint32_t lba;
+    uint32_t lba_naked;         // next block on the card / image (multiple and writes)
+    uint64_t file_pos;          // where the image file was left when parked
+} drv08_xfer_t;
+
+static drv08_xfer_t drv08_xfer[2];
+
+static void Drv08_ReadSectors(uint8_t ch, fch_t* pDrive, drv08_desc_t* pDesc, drv08_xfer_t* x)
+{
+    while (x->sector_count) {
+        if (!x->parked) {
+            FileIO_FCh_WriteStat(ch, DRV08_STATUS_RDY); // pio in (class 1) command type
+        }
+
+        // wait for nearly empty buffer
+        x->parked = FileIO_FCh_Wait(ch, x->unit, FILEIO_REQ_OK_FM_ARM) == FCH_WAIT_PARKED;
+
+        if (x->parked) {
+            return;
+        }
+
+        FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
+
+        if (!x->first) {
+            Drv08_IncParams(pDesc, &x->sector, &x->cylinder, &x->head, &x->lba);
+            Drv08_UpdateParams(ch, x->tfr, x->sector, x->cylinder, x->head, x->lba, x->lba_mode);
+        }
+
+        x->first = 0;
+
+        if (pDesc->format == MMC) {
+            Drv08_CardReadSendDirect(ch, x->lba + pDesc->lba_offset, 1);
+
+        } else if (x->lba < pDesc->lba_offset) {
+            Drv08_BufferSend(ch, pDrive, pDesc->hdf_rdb->blocks[x->lba % 3].b);
+
+        } else {
+            /*Drv08_FileReadSend(ch, pDrive, fbuf);*/
+            Drv08_FileReadSendDirect(ch, pDrive, 1); // read and send block
+        }
+
+        x->sector_count--; // decrease sector count
+    }
+
+    x->cmd = 0;
+}
+
+static void Drv08_ReadMultiple(uint8_t ch, fch_t* pDrive, drv08_desc_t* pDesc, drv08_xfer_t* x)
+{
+    uint16_t i;
+
+    while (x->sector_count) {
+        if (!x->block_count) {
+            x->block_count = x->sector_count;
+
+            if (x->block_count > pDesc->sectors_per_block) {
+                x->block_count = pDesc->sectors_per_block;
+            }
+
+            FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
+
+            // calc final sector number in block
+            i = x->block_count;
+
+            while (i--) {
+                if (!x->first) {
+                    Drv08_IncParams(pDesc, &x->sector, &x->cylinder, &x->head, &x->lba);
+                }
+
+                x->first = 0;
+            }
+
+            // update, this should be done at the end really, but we need to make sure the transfer has not completed
+            Drv08_UpdateParams(ch, x->tfr, x->sector, x->cylinder, x->head, x->lba, x->lba_mode);
+        }
+
+        // do transfer
+        i = x->block_count;
+
+        if (i > DRV08_MAX_READ_BURST) {
+            i = DRV08_MAX_READ_BURST;
+        }
+
+        if (FileIO_FCh_Wait(ch, x->unit, FILEIO_REQ_OK_FM_ARM) == FCH_WAIT_PARKED) {
+            return;
+        }
+
+        if (pDesc->format == MMC) {
+            Drv08_CardReadSendDirect(ch, x->lba_naked + pDesc->lba_offset, i);
+
+        } else if (x->lba_naked < pDesc->lba_offset) {
+
+            if (i > pDesc->lba_offset - x->lba_naked) {
+                i = pDesc->lba_offset - x->lba_naked;
+            }
+
+            for (int n = 0; n < i; ++n) {
+                uint8_t* pBuffer = pDesc->hdf_rdb->blocks[(x->lba_naked + n) % 3].b;
+                DEBUG(3, "Drv08_BufferSend(%08x, %lu, %lu)", pBuffer, x->lba_naked + n, 1);
+                Drv08_BufferSend(ch, pDrive, pBuffer);
+            }
+
+        } else {
+            Drv08_FileReadSendDirect(ch, pDrive, i); // read and send block(s)
+        }
+
+        x->sector_count -= i;
+        x->block_count -= i;
+        x->lba_naked += i;
+    }
+
+    x->cmd = 0;
+}
+
+static void Drv08_WriteSectors(uint8_t ch, fch_t* pDrive, drv08_desc_t* pDesc, drv08_xfer_t* x, uint8_t* fbuf)
+{
+    while (x->sector_count) {
+        // wait for data
+        if (FileIO_FCh_Wait(ch, x->unit, FILEIO_REQ_OK_TO_ARM) == FCH_WAIT_PARKED) {
+            return;
+        }
+
+        // fetch
+        SPI_EnableFileIO();
+        rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
+        SPI_ReadBufferSingle(fbuf, DRV08_BLK_SIZE);
+        SPI_DisableFileIO();
+
+        // safe to do after fetch, STATUS_END clears busy
+        if (!x->first) {
+            Drv08_IncParams(pDesc, &x->sector, &x->cylinder, &x->head, &x->lba);
+            Drv08_UpdateParams(ch, x->tfr, x->sector, x->cylinder, x->head, x->lba, x->lba_mode);
+        }
+
+        x->first = 0;
+
+        x->sector_count--; // decrease sector count
+
+        // release core
+        if (x->sector_count) {
+            FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
+
+        } else {
+            FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ);    // last one
+        }
+
+        // optimal to put this after the status update, but then we cannot indicate write failure
+        // write to file
+        if (pDesc->format == MMC) {
+            Drv08_CardWrite(ch, x->lba_naked + pDesc->lba_offset, fbuf, 1);
+
+        } else {
+            Drv08_FileWrite(ch, pDrive, fbuf, 1);
+        }
+
+        x->lba_naked++;
+    }
+
+    x->cmd = 0;
+}
+
+static void Drv08_WriteMultiple(uint8_t ch, fch_t* pDrive, drv08_desc_t* pDesc, drv08_xfer_t* x, uint8_t* fbuf)
+{
+    drv08_block_t* p = (drv08_block_t*)&fbuf[0];
+
+    while (x->sector_count) {
+        if (!x->block_count) {
+            x->block_count = x->sector_count;
+
+            if (x->block_count > pDesc->sectors_per_block) {
+                x->block_count = pDesc->sectors_per_block;
+            }
+        }
+
+        uint16_t i = x->block_count;
+        uint16_t fetched = 0;
+        uint8_t  parked = FALSE;
+
+        if (i > DRV08_MAX_NUM_BLOCKS) {
+            i = DRV08_MAX_NUM_BLOCKS;
+        }
+
+        // fetch N blocks; if the core is slow to deliver, write what we have before parking
+        while (fetched < i) {
+            // wait for data
+            if (FileIO_FCh_Wait(ch, x->unit, FILEIO_REQ_OK_TO_ARM) == FCH_WAIT_PARKED) {
+                parked = TRUE;
+                break;
+            }
+
+            // fetch
+            SPI_EnableFileIO();
+            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
+            SPI_ReadBufferSingle(&p[fetched], DRV08_BLK_SIZE);
+            SPI_DisableFileIO();
+            fetched++;
+        }
+
+        if (fetched) {
+            // write N blocks to file/disk
+            if (pDesc->format == MMC) {
+                Drv08_CardWrite(ch, x->lba_naked + pDesc->lba_offset, p->b, fetched);
+
+            } else {
+                Drv08_FileWrite(ch, pDrive, p->b, fetched);
+            }
+
+            // update N blocks
+            for (int n = 0; n < fetched; ++n) {
+                if (!x->first) {
+                    Drv08_IncParams(pDesc, &x->sector, &x->cylinder, &x->head, &x->lba);
+                }
+
+                x->first = 0;
+            }
+
+            x->lba_naked += fetched;
+            x->block_count -= fetched;
+            x->sector_count -= fetched;
+        }
+
+        if (!x->block_count) {
+            Drv08_UpdateParams(ch, x->tfr, x->sector, x->cylinder, x->head, x->lba, x->lba_mode);
+
+            // release core
+            if (x->sector_count) {
+                FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
+
+            } else {
+                FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ);    // last one
+            }
+        }
+
+        if (parked) {
+            return;
+        }
+    }
+
+    x->cmd = 0;
+}
+
+// Runs the data phase of x->cmd until it is done or parked
+static void Drv08_DataPhase(uint8_t ch, fch_t* pDrive, drv08_xfer_t* x, uint8_t* fbuf)
+{
+    drv08_desc_t* pDesc = pDrive->pDesc;
+
+    // the image may have been accessed meanwhile (USB mass storage)
+    if (FileIO_FCh_Parked(ch) && pDesc->format != MMC && FF_Tell(pDrive->fSource) != x->file_pos) {
+        Drv08_HardFileSeek(pDrive, pDesc, (x->file_pos >> 9) + (pDesc->format == HDF_NAKED ? pDesc->lba_offset : 0));
+    }
+
+    switch (x->cmd) {
+        case DRV08_CMD_READ_SECTORS:
+            Drv08_ReadSectors(ch, pDrive, pDesc, x);
+            break;
+
+        case DRV08_CMD_READ_MULTIPLE:
+            Drv08_ReadMultiple(ch, pDrive, pDesc, x);
+            break;
+
+        case DRV08_CMD_WRITE_SECTORS:
+            Drv08_WriteSectors(ch, pDrive, pDesc, x, fbuf);
+            break;
+
+        case DRV08_CMD_WRITE_MULTIPLE:
+            Drv08_WriteMultiple(ch, pDrive, pDesc, x, fbuf);
+            break;
+    }
+
+    if (FileIO_FCh_Parked(ch) && pDesc->format != MMC) {
+        x->file_pos = FF_Tell(pDrive->fSource);
+    }
+}
+
+static void Drv08_StartDataPhase(uint8_t ch, fch_t* pDrive, drv08_xfer_t* x, uint8_t tfr[8], uint8_t unit, uint8_t* fbuf)
+{
+    memcpy(x->tfr, tfr, sizeof(x->tfr));
+    x->cmd = tfr[7];
+    x->unit = unit;
+    x->first = 1;
+    x->parked = FALSE;
+    x->block_count = 0;
+    Drv08_DataPhase(ch, pDrive, x, fbuf);
+}
+
+void FileIO_Drv08_Abort(uint8_t ch)
+{
+    drv08_xfer_t* x = &drv08_xfer[ch];
+
+    Drv08_WriteTaskFile(ch, DRV08_ERROR_ABRT, x->tfr[2], x->tfr[3], x->tfr[4], x->tfr[5], x->tfr[6]);
+    FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ | DRV08_STATUS_ERR);
+    x->cmd = 0;
+}
+
 //
 //
 //
@@ -553,15 +821,13 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
     uint8_t  tfr[8];
     uint16_t i;
     uint8_t  unit         = 0;
-    uint16_t sector_count = 0;
-    uint16_t block_count  = 0;
 
-    uint16_t sector   = 0;
-    uint16_t cylinder = 0;
-    uint8_t  head     = 0;
-    uint32_t lba      = 0;
-    uint8_t  lba_mode = 0;
-    uint8_t  first    = 1;
+    drv08_xfer_t* x = &drv08_xfer[ch];
+
+    if (FileIO_FCh_Parked(ch)) {
+        Drv08_DataPhase(ch, &handle[ch][x->unit], x, fbuf);
+        return;
+    }
 
     // read task file
     SPI_EnableFileIO();
@@ -674,9 +940,9 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
         }
 
         //
-        Drv08_GetParams(tfr, pDesc, &sector, &cylinder, &head, &sector_count, &lba, &lba_mode);
+        Drv08_GetParams(tfr, pDesc, &x->sector, &x->cylinder, &x->head, &x->sector_count, &x->lba, &x->lba_mode);
 
-        uint32_t lba_naked = lba < pDesc->lba_offset ? pDesc->lba_offset : lba;
+        uint32_t lba_naked = x->lba < pDesc->lba_offset ? pDesc->lba_offset : x->lba;
 
         if (Drv08_HardFileSeek(pDrive, pDesc, lba_naked) != FF_ERR_NONE) {
             WARNING("Drv08:Read from invalid LBA (%lu)", lba_naked);
@@ -686,35 +952,10 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
         }
 
 #if DRV08_DEBUG_STATS
-        accu_blocks += sector_count;
+        accu_blocks += x->sector_count;
 #endif
 
-        while (sector_count) {
-            FileIO_FCh_WriteStat(ch, DRV08_STATUS_RDY); // pio in (class 1) command type
-            FileIO_FCh_WaitStat (ch, FILEIO_REQ_OK_FM_ARM, FILEIO_REQ_OK_FM_ARM); // wait for nearly empty buffer
-            FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
-
-            if (!first) {
-                Drv08_IncParams(pDesc, &sector, &cylinder, &head, &lba);
-                Drv08_UpdateParams(ch, tfr, sector, cylinder,  head, lba, lba_mode);
-            }
-
-            first = 0;
-
-            if (pDesc->format == MMC) {
-                Drv08_CardReadSendDirect(ch, lba + pDesc->lba_offset, 1);
-
-            } else if (lba < pDesc->lba_offset) {
-                Drv08_BufferSend(ch, pDrive, pDesc->hdf_rdb.blocks[lba % 3].b);
-
-            } else {
-                /*Drv08_FileReadSend(ch, pDrive, fbuf);*/
-                Drv08_FileReadSendDirect(ch, pDrive, 1); // read and send block
-            }
-
-
-            sector_count--; // decrease sector count
-        }
+        Drv08_StartDataPhase(ch, pDrive, x, tfr, unit, fbuf);
 
         //
 #if DRV08_DEBUG_STATS
@@ -750,9 +991,9 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
 
         FileIO_FCh_WriteStat(ch, DRV08_STATUS_RDY); // pio in (class 1) command type
 
-        Drv08_GetParams(tfr, pDesc, &sector, &cylinder, &head, &sector_count, &lba, &lba_mode);
+        Drv08_GetParams(tfr, pDesc, &x->sector, &x->cylinder, &x->head, &x->sector_count, &x->lba, &x->lba_mode);
 
-        uint32_t lba_naked = lba < pDesc->lba_offset ? pDesc->lba_offset : lba;
+        uint32_t lba_naked = x->lba < pDesc->lba_offset ? pDesc->lba_offset : x->lba;
 
         if (Drv08_HardFileSeek(pDrive, pDesc, lba_naked) != FF_ERR_NONE) {
             WARNING("Drv08:Read Multiple bad LBA (%lu)", lba_naked);
@@ -761,69 +1002,12 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
             return;
         }
 
-        lba_naked = lba;
+        x->lba_naked = x->lba;
 #if DRV08_DEBUG_STATS
-        accu_blocks += sector_count;
+        accu_blocks += x->sector_count;
 #endif
 
-        while (sector_count) {
-            block_count = sector_count;
-
-            if (block_count > pDesc->sectors_per_block) {
-                block_count = pDesc->sectors_per_block;
-            }
-
-            FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
-
-            // calc final sector number in block
-            i = block_count;
-
-            while (i--) {
-                if (!first) {
-                    Drv08_IncParams(pDesc, &sector, &cylinder, &head, &lba);
-                }
-
-                first = 0;
-            }
-
-            // update, this should be done at the end really, but we need to make sure the transfer has not completed
-            Drv08_UpdateParams(ch, tfr, sector, cylinder,  head, lba, lba_mode);
-
-            // do transfer
-            while (block_count) {
-                i = block_count;
-
-                if (i > DRV08_MAX_READ_BURST) {
-                    i = DRV08_MAX_READ_BURST;
-                }
-
-                FileIO_FCh_WaitStat (ch, FILEIO_REQ_OK_FM_ARM, FILEIO_REQ_OK_FM_ARM);
-
-                if (pDesc->format == MMC) {
-                    Drv08_CardReadSendDirect(ch, lba_naked + pDesc->lba_offset, i);
-
-                } else if (lba_naked < pDesc->lba_offset) {
-
-                    if (i > pDesc->lba_offset - lba_naked) {
-                        i = pDesc->lba_offset - lba_naked;
-                    }
-
-                    for (int x = 0; x < i; ++x) {
-                        uint8_t* pBuffer = pDesc->hdf_rdb.blocks[(lba_naked + x) % 3].b;
-                        DEBUG(3, "Drv08_BufferSend(%08x, %lu, %lu)", pBuffer, lba_naked + x, 1);
-                        Drv08_BufferSend(ch, pDrive, pBuffer);
-                    }
-
-                } else {
-                    Drv08_FileReadSendDirect(ch, pDrive, i); // read and send block(s)
-                }
-
-                sector_count -= i;
-                block_count -= i;
-                lba_naked += i;
-            } // end block
-
-        }  // end sector
+        Drv08_StartDataPhase(ch, pDrive, x, tfr, unit, fbuf);
 
 #if DRV08_DEBUG_STATS
         accu_ticks += (Timer_Get(0) - time);
@@ -871,64 +1055,28 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
 
         //
         FileIO_FCh_WriteStat(ch, DRV08_STATUS_REQ); // pio out (class 2) command type
-        Drv08_GetParams(tfr, pDesc, &sector, &cylinder, &head, &sector_count, &lba, &lba_mode);
+        Drv08_GetParams(tfr, pDesc, &x->sector, &x->cylinder, &x->head, &x->sector_count, &x->lba, &x->lba_mode);
 
-        if (Drv08_HardFileSeek(pDrive, pDesc, lba) != FF_ERR_NONE) {
-            WARNING("Drv08:Write to invalid LBA (%lu)", lba);
+        if (Drv08_HardFileSeek(pDrive, pDesc, x->lba) != FF_ERR_NONE) {
+            WARNING("Drv08:Write to invalid LBA (%lu)", x->lba);
             Drv08_WriteTaskFile (ch, DRV08_ERROR_ABRT, tfr[2], tfr[3], tfr[4], tfr[5], tfr[6]);
             FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ | DRV08_STATUS_ERR);
             return;
         }
 
-        if (lba == 0 && pDesc->format == MMC && pDesc->lba_offset == 0) {
+        if (x->lba == 0 && pDesc->format == MMC && pDesc->lba_offset == 0) {
             WARNING("Drv08:Write to MBR disabled");
             Drv08_WriteTaskFile (ch, DRV08_ERROR_ABRT, tfr[2], tfr[3], tfr[4], tfr[5], tfr[6]);
             FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ | DRV08_STATUS_ERR);
             return;
         }
 
-        uint32_t lba_mmc = lba;
+        x->lba_naked = x->lba;
 #if DRV08_DEBUG_STATS
-        accu_blocks += sector_count;
+        accu_blocks += x->sector_count;
 #endif
 
-        while (sector_count) {
-            FileIO_FCh_WaitStat (ch, FILEIO_REQ_OK_TO_ARM, FILEIO_REQ_OK_TO_ARM); // wait for data
-
-            // fetch
-            SPI_EnableFileIO();
-            rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
-            SPI_ReadBufferSingle(fbuf, DRV08_BLK_SIZE);
-            SPI_DisableFileIO();
-
-            // safe to do after fetch, STATUS_END clears busy
-            if (!first) {
-                Drv08_IncParams(pDesc, &sector, &cylinder, &head, &lba);
-                Drv08_UpdateParams(ch, tfr, sector, cylinder,  head, lba, lba_mode);
-            }
-
-            first = 0;
-
-            sector_count--; // decrease sector count
-
-            // release core
-            if (sector_count) {
-                FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
-
-            } else {
-                FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ);    // last one
-            }
-
-            // optimal to put this after the status update, but then we cannot indicate write failure
-            // write to file
-            if (pDesc->format == MMC) {
-                Drv08_CardWrite(ch, lba_mmc + pDesc->lba_offset, fbuf, 1);
-                lba_mmc++;
-
-            } else {
-                Drv08_FileWrite(ch, pDrive, fbuf, 1);
-            }
-        }
+        Drv08_StartDataPhase(ch, pDrive, x, tfr, unit, fbuf);
 
 #if DRV08_DEBUG_STATS
         accu_ticks += (Timer_Get(0) - time);
@@ -971,87 +1119,28 @@ void Drv08_ATA_Handle(uint8_t ch, fch_t handle[2][FCH_MAX_NUM])
 
         FileIO_FCh_WriteStat(ch, DRV08_STATUS_REQ); // pio out (class 2) command type
 
-        Drv08_GetParams(tfr, pDesc, &sector, &cylinder, &head, &sector_count, &lba, &lba_mode);
+        Drv08_GetParams(tfr, pDesc, &x->sector, &x->cylinder, &x->head, &x->sector_count, &x->lba, &x->lba_mode);
 
-        if (Drv08_HardFileSeek(pDrive, pDesc, lba) != FF_ERR_NONE) {
-            WARNING("Drv08:Write Multiple bad LBA (%lu)", lba);
+        if (Drv08_HardFileSeek(pDrive, pDesc, x->lba) != FF_ERR_NONE) {
+            WARNING("Drv08:Write Multiple bad LBA (%lu)", x->lba);
             Drv08_WriteTaskFile (ch, DRV08_ERROR_ABRT, tfr[2], tfr[3], tfr[4], tfr[5], tfr[6]);
             FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ | DRV08_STATUS_ERR);
             return;
         }
 
-        if (lba == 0 && pDesc->format == MMC && pDesc->lba_offset == 0) {
+        if (x->lba == 0 && pDesc->format == MMC && pDesc->lba_offset == 0) {
             WARNING("Drv08:Write to MBR disabled");
             Drv08_WriteTaskFile (ch, DRV08_ERROR_ABRT, tfr[2], tfr[3], tfr[4], tfr[5], tfr[6]);
             FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ | DRV08_STATUS_ERR);
             return;
         }
 
-        uint32_t lba_mmc = lba;
+        x->lba_naked = x->lba;
 #if DRV08_DEBUG_STATS
-        accu_blocks += sector_count;
+        accu_blocks += x->sector_count;
 #endif
 
-        while (sector_count) {
-            block_count = sector_count;
-
-            if (block_count > pDesc->sectors_per_block) {
-                block_count = pDesc->sectors_per_block;
-            }
-
-            while (block_count) {
-                i = block_count;
-
-                if (i > DRV08_MAX_NUM_BLOCKS) {
-                    i = DRV08_MAX_NUM_BLOCKS;
-                }
-
-                drv08_block_t* p = (drv08_block_t*)&fbuf[0];
-
-                // fetch N blocks
-                for (int x = 0; x < i; ++x) {
-                    FileIO_FCh_WaitStat (ch, FILEIO_REQ_OK_TO_ARM, FILEIO_REQ_OK_TO_ARM); // wait for data
-
-                    // fetch
-                    SPI_EnableFileIO();
-                    rSPI(FCH_CMD(ch, FILEIO_FCH_CMD_FIFO_R));
-                    SPI_ReadBufferSingle(&p[x], DRV08_BLK_SIZE);
-                    SPI_DisableFileIO();
-                }
-
-                // write N blocks to file/disk
-                if (pDesc->format == MMC) {
-                    Drv08_CardWrite(ch, lba_mmc + pDesc->lba_offset, p->b, i);
-                    lba_mmc += i;
-
-                } else {
-                    Drv08_FileWrite(ch, pDrive, p->b, i);
-                }
-
-                // update N blocks
-                for (int x = 0; x < i; ++x) {
-                    if (!first) {
-                        Drv08_IncParams(pDesc, &sector, &cylinder, &head, &lba);
-                    }
-
-                    first = 0;
-                }
-
-                block_count -= i;
-                sector_count -= i;
-            }
-
-            Drv08_UpdateParams(ch, tfr, sector, cylinder,  head, lba, lba_mode);
-
-            // release core
-            if (sector_count) {
-                FileIO_FCh_WriteStat(ch, DRV08_STATUS_IRQ);
-
-            } else {
-                FileIO_FCh_WriteStat(ch, DRV08_STATUS_END | DRV08_STATUS_IRQ);    // last one
-            }
-
-        } // end sector
+        Drv08_StartDataPhase(ch, pDrive, x, tfr, unit, fbuf);
 
 #if DRV08_DEBUG_STATS
         accu_ticks += (Timer_Get(0) - time);
@@ -1334,42 +1423,127 @@ void Drv08_GetHardfileGeometry(fch_t* pDrive, drv08_desc_t* pDesc)
     pDesc->sectors_per_block = 0; // catch if not set to !=0
 }
 
-void Drv08_BuildHardfileIndex(fch_t* pDrive, drv08_desc_t* pDesc)
+static uint32_t Drv08_IndexBudgetLeft(void)
 {
-    pDesc->index_size = 16; // indexing size
+    uint32_t used = 0;
 
-    uint64_t i; // 64 as the last index (> filesize) can cause a 32 bit int to wrap
-    uint64_t j;
+    for (int ch = 0; ch < 2; ++ch) {
+        if (fch_driver[ch] != 0x8) {
+            continue;
+        }
 
-    i = pDesc->file_size >> 10; // file size divided by 1024 (index table size)
-    j = 1 << pDesc->index_size;
+        for (int i = 0; i < FCH_MAX_NUM; ++i) {
+            drv08_desc_t* pDesc = fch_handle[ch][i].pDesc;
 
-    while (j < i) { // find greater or equal power of two
-        j <<= 1;
-        pDesc->index_size++;
+            if ((fch_handle[ch][i].status & FILEIO_STAT_INSERTED) && pDesc) {
+                used += pDesc->index_len * sizeof(uint32_t);
+            }
+        }
     }
 
-    // index 22 for 4G file 0 - FFFFFFFF
-    // 2^22 = 0040,0000 step size
-    //
-    DEBUG(1, "index size %08X j %08X", pDesc->index_size, j); // j step size
-    //  Build table on-the-fly instead ; see Drv08_HardFileSeek()
-#if 0
-    uint32_t idx = 0;
-
-    for (i = 0; i < pDesc->file_size; i += j) {
-        FF_Seek(pDrive->fSource, i, FF_SEEK_SET);
-        //DEBUG(1,"index %08x %08x %08x",i,  pDrive->fSource->AddrCurrentCluster, pDrive->fSource->CurrentCluster);
-        Assert(idx < 1024);
-        pDesc->index[idx++] = pDrive->fSource->AddrCurrentCluster;
-        // call me paranoid
-    };
+    return used < DRV08_INDEX_BUDGET ? DRV08_INDEX_BUDGET - used : 0;
+}
 
-#endif
-    memset(pDesc->index, 0xff, sizeof(pDesc->index));
+// Decides the kind and size of the seek index before the descriptor is allocated.
+// A link map is built straight into a scratch table of the drive's claim, which
+// Drv08_BuildHardfileIndex() copies behind the descriptor, so the FAT chain is
+// only walked once. Returns the bytes the index needs.
+static uint32_t Drv08_SizeHardfileIndex(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t** pScratch)
+{
+    FIL* fp = (FIL*)pDrive->fSource;
+
+    // claim half of the remaining budget, but never less than the old fixed table
+    uint32_t budget = Drv08_IndexBudgetLeft();
+    uint32_t claim = budget < DRV08_INDEX_SHARE ? budget : DRV08_INDEX_SHARE;
+
+    if (claim < budget / 2) {
+        claim = budget / 2;
+    }
+
+    claim &= ~(sizeof(uint32_t) - 1);
 
+    pDesc->index_len = 0;
+    pDesc->index_extents = 0;
     pDesc->mru_lba = 0xffffffff;
+    *pScratch = NULL;
+
+    // First try to describe the file as a list of extents (cluster runs).
+    // A contiguous file only needs 4 entries, plus 2 more for each additional fragment.
+    uint32_t* scratch = claim >= 4 * sizeof(uint32_t) ? malloc(claim) : NULL;
+
+    if (scratch) {
+        scratch[0] = claim / sizeof(uint32_t);
+        fp->cltbl = scratch;
+        FRESULT res = f_lseek(fp, CREATE_LINKMAP);
+        fp->cltbl = NULL;
+
+        if (res == FR_OK) {
+            pDesc->index_extents = 1;
+            pDesc->index_len = scratch[0];
+            *pScratch = scratch;
+            return pDesc->index_len * sizeof(uint32_t);
+        }
+
+        if (res == FR_NOT_ENOUGH_CORE) {
+            DEBUG(1, "Drv08:Index %d extents do not fit in %d bytes", (scratch[0] - 2) / 2, claim);
+        }
+
+        free(scratch);
+    }
+
+    // Too fragmented; fall back to a sampled cluster table, filled on demand in Drv08_HardFileSeek().
+    // It takes the whole claim: the granularity is the smallest power of two (but at least a cluster)
+    // that fits.
+    if (claim) {
+        uint32_t entries = claim / sizeof(uint32_t);
+
+        pDesc->index_size = 9;
+
+        while ((1u << pDesc->index_size) < fp->obj.fs->csize * 512u) {
+            pDesc->index_size++;
+        }
+
+        while ((pDesc->file_size >> pDesc->index_size) >= entries) {
+            pDesc->index_size++;
+        }
+
+        pDesc->index_len = (pDesc->file_size >> pDesc->index_size) + 1;
+    }
+
+    return pDesc->index_len * sizeof(uint32_t);
+}
+
+// the RDB blocks and the index live in the same allocation as the descriptor,
+// so that FileIO_FCh_Eject() releases everything with a single free()
+static drv08_desc_t* Drv08_AllocDesc(fch_t* pDrive, const drv08_desc_t* pProbe, uint32_t index_bytes)
+{
+    const uint32_t rdb_bytes = pProbe->format == HDF_NAKED ? sizeof(drv08_rdb_t) : 0;
+    drv08_desc_t* pDesc = calloc(1, sizeof(drv08_desc_t) + rdb_bytes + index_bytes);
+
+    if (pDesc == NULL) {
+        return NULL;
+    }
+
+    *pDesc = *pProbe;
+    pDesc->hdf_rdb = rdb_bytes ? (drv08_rdb_t*)(void*)(pDesc + 1) : NULL;
+    pDesc->index   = index_bytes ? (uint32_t*)(void*)((uint8_t*)(pDesc + 1) + rdb_bytes) : NULL;
+    pDrive->pDesc  = pDesc;
+    return pDesc;
+}
+
+static void Drv08_BuildHardfileIndex(fch_t* pDrive, drv08_desc_t* pDesc, uint32_t* scratch)
+{
+    FIL* fp = (FIL*)pDrive->fSource;
 
+    if (pDesc->index_extents) {
+        memcpy(pDesc->index, scratch, pDesc->index_len * sizeof(uint32_t));
+        fp->cltbl = pDesc->index;
+        DEBUG(1, "Drv08:Index %d extents (%d bytes)", (pDesc->index_len - 2) / 2, pDesc->index_len * sizeof(uint32_t));
+
+    } else if (pDesc->index_len) {
+        memset(pDesc->index, 0xff, pDesc->index_len * sizeof(uint32_t));
+        DEBUG(1, "Drv08:Index %d entries of %lu bytes", pDesc->index_len, 1ul << pDesc->index_size);
+    }
 }
 
 void Drv08_CreateRDB(drv08_desc_t* pDesc, uint8_t drive_number)
@@ -1402,11 +1576,11 @@ void Drv08_CreateRDB(drv08_desc_t* pDesc, uint8_t drive_number)
     pDesc->lba_offset = pDesc->sectors * pDesc->heads * partition_offset;
     pDesc->cylinders += partition_offset;
 
-    memset(&pDesc->hdf_rdb, 0x00, sizeof(pDesc->hdf_rdb));
+    memset(pDesc->hdf_rdb, 0x00, sizeof(drv08_rdb_t));
 
-    tRigidDiskBlock* rdsk = &pDesc->hdf_rdb.rdsk;
-    tPartitionBlock* part = &pDesc->hdf_rdb.part;
-    tFileSysHeaderBlock* fshd = &pDesc->hdf_rdb.fshd;
+    tRigidDiskBlock* rdsk = &pDesc->hdf_rdb->rdsk;
+    tPartitionBlock* part = &pDesc->hdf_rdb->part;
+    tFileSysHeaderBlock* fshd = &pDesc->hdf_rdb->fshd;
 
     // RigidDiskBlock
     {
@@ -1512,14 +1686,10 @@ uint8_t FileIO_Drv08_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
 
     //pDrive points to the base fch_t struct for this unit. It contains a pointer (pDesc) to our drv08_desc_t
 
-    pDrive->pDesc = calloc(1, sizeof(drv08_desc_t)); // 0 everything
-
-    if (pDrive->pDesc == NULL) {
-        WARNING("Drv08:Failed to allocate memory.");
-        return (1);
-    }
-
-    drv08_desc_t* pDesc = pDrive->pDesc;
+    // probed here; allocated once its RDB and index needs are known
+    drv08_desc_t desc;
+    memset(&desc, 0, sizeof(desc)); // 0 everything
+    drv08_desc_t* pDesc = &desc;
 
     pDesc->format    = (drv08_format_t)XXX;
 
@@ -1614,6 +1784,11 @@ uint8_t FileIO_Drv08_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
         INFO("CHS : %u.%u.%u --> %lu MB", pDesc->cylinders, pDesc->heads, pDesc->sectors,
              ((((unsigned long) pDesc->cylinders) * pDesc->heads * pDesc->sectors) >> 11));
 
+        if (Drv08_AllocDesc(pDrive, pDesc, 0) == NULL) {
+            WARNING("Drv08:Failed to allocate memory.");
+            return (1);
+        }
+
         // skip the rest of the setup - we're all done
         return (0);
 
@@ -1635,7 +1810,31 @@ uint8_t FileIO_Drv08_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
     }
 
     Drv08_GetHardfileGeometry(pDrive, pDesc);
-    Drv08_BuildHardfileIndex(pDrive, pDesc);
+
+    uint32_t* scratch;
+    uint32_t index_bytes = Drv08_SizeHardfileIndex(pDrive, pDesc, &scratch);
+
+    if (Drv08_AllocDesc(pDrive, pDesc, index_bytes) == NULL) {
+        // out of memory; continue without an index
+        desc.index_len = 0;
+        desc.index_extents = 0;
+
+        if (Drv08_AllocDesc(pDrive, pDesc, 0) == NULL) {
+            if (scratch) {
+                free(scratch);
+            }
+
+            WARNING("Drv08:Failed to allocate memory.");
+            return (1);
+        }
+    }
+
+    pDesc = pDrive->pDesc;
+    Drv08_BuildHardfileIndex(pDrive, pDesc, scratch);
+
+    if (scratch) {
+        free(scratch);
+    }
     time = Timer_Get(0) - time;
 
     if (pDesc->format == HDF_NAKED) {
@@ -1654,3 +1853,92 @@ uint8_t FileIO_Drv08_InsertInit(uint8_t ch, uint8_t drive_number, fch_t* pDrive,
     return (0);
 }
 
+
+//
+// Block access for USB mass storage: the host gets the same view of the image
+// as the core, including the synthesized RDB of a naked HDF. Direct card
+// partitions (?MMC) are left out, the card itself is already visible.
+//
+static drv08_desc_t* Drv08_GetBlockDesc(uint8_t ch, uint8_t drive_number)
+{
+    if (FileIO_FCh_GetDriver(ch) != 0x8 || !FileIO_FCh_GetInserted(ch, drive_number)) {
+        return NULL;
+    }
+
+    drv08_desc_t* pDesc = fch_handle[ch][drive_number].pDesc;
+
+    if (!pDesc || pDesc->format == MMC) {
+        return NULL;
+    }
+
+    return pDesc;
+}
+
+uint32_t FileIO_Drv08_GetBlocks(uint8_t ch, uint8_t drive_number)
+{
+    drv08_desc_t* pDesc = Drv08_GetBlockDesc(ch, drive_number);
+
+    if (!pDesc) {
+        return 0;
+    }
+
+    return (uint32_t)pDesc->cylinders * pDesc->heads * pDesc->sectors;
+}
+
+FF_ERROR FileIO_Drv08_ReadBlocks(uint8_t ch, uint8_t drive_number, uint8_t* pBuffer, uint32_t lba, uint32_t numblocks)
+{
+    fch_t* pDrive = &fch_handle[ch][drive_number];
+    drv08_desc_t* pDesc = Drv08_GetBlockDesc(ch, drive_number);
+
+    if (!pDesc || lba + numblocks > FileIO_Drv08_GetBlocks(ch, drive_number) || lba + numblocks < lba) {
+        return FF_ERR_IOMAN_OUT_OF_BOUNDS_READ | FF_SEEK;
+    }
+
+    // rigid disk block area of a naked HDF
+    for (; numblocks && lba < pDesc->lba_offset; numblocks--, lba++, pBuffer += DRV08_BLK_SIZE) {
+        memcpy(pBuffer, pDesc->hdf_rdb->blocks[lba % 3].b, DRV08_BLK_SIZE);
+    }
+
+    if (!numblocks) {
+        return FF_ERR_NONE;
+    }
+
+    FF_ERROR err = Drv08_HardFileSeek(pDrive, pDesc, lba);
+
+    if (err != FF_ERR_NONE) {
+        return err;
+    }
+
+    if (FF_Read(pDrive->fSource, DRV08_BLK_SIZE, numblocks, pBuffer) != DRV08_BLK_SIZE * numblocks) {
+        return FF_ERR_DEVICE_DRIVER_FAILED;
+    }
+
+    return FF_ERR_NONE;
+}
+
+FF_ERROR FileIO_Drv08_WriteBlocks(uint8_t ch, uint8_t drive_number, const uint8_t* pBuffer, uint32_t lba, uint32_t numblocks)
+{
+    fch_t* pDrive = &fch_handle[ch][drive_number];
+    drv08_desc_t* pDesc = Drv08_GetBlockDesc(ch, drive_number);
+
+    if (!pDesc || lba + numblocks > FileIO_Drv08_GetBlocks(ch, drive_number) || lba + numblocks < lba) {
+        return FF_ERR_IOMAN_OUT_OF_BOUNDS_WRITE | FF_SEEK;
+    }
+
+    // the synthesized RDB is not backed by the file (the core can't write it either)
+    if (pDrive->status & FILEIO_STAT_READONLY || lba < pDesc->lba_offset) {
+        return FF_ERR_FILE_IS_READ_ONLY | FF_OPEN;
+    }
+
+    FF_ERROR err = Drv08_HardFileSeek(pDrive, pDesc, lba);
+
+    if (err != FF_ERR_NONE) {
+        return err;
+    }
+
+    if (FF_Write(pDrive->fSource, DRV08_BLK_SIZE, numblocks, (uint8_t*)pBuffer) != DRV08_BLK_SIZE * numblocks) {
+        return FF_ERR_DEVICE_DRIVER_FAILED;
+    }
+
+    return FF_ERR_NONE;
+}
@@ -153,120 +153,130 @@ void PrintSummary(tDirScan* dir_entries)
     }
 }
 
-void Filesel_ScanUpdate(tDirScan* dir_entries)
+// sorts an entry into the window around ref (dPrev/dNext)
+static void Filesel_InsertEntry(tDirScan* dir_entries, FILEENTRY* mydir)
 {
-    FF_DIRENT direntry;
-    FILEENTRY mydir;
     int comp_result, comp_result2 = 0;
-    FF_ERROR tester = 0;
     uint32_t i, j = 0;
 
-    //ref must be valid
-    //finds entries above and below ref
-    dir_entries->prevc = 0;
-    dir_entries->refc  = 1;
-    dir_entries->nextc = 0;
+    //DEBUG(1,"File %s", mydir->FileName);
+    //
+    // first check file against our reference
+    comp_result = CompareDirEntries(mydir, &dir_entries->dRef);
 
-    tester = FF_FindFirst(pIoman, &direntry, dir_entries->pPath); // Find first Object.
+    //
+    if (comp_result > 0) { // greater than ref
 
-    while (tester == 0) {
-        if (FilterFile(dir_entries, &direntry)) {
+        if (dir_entries->nextc == 0 ) { // first, take it
+            dir_entries->dNext[0] = *mydir;
+            dir_entries->nextc++;
 
-            // Copy info from general representation (FF_DIRENT) to size-minimized (FILENTRY)
-            mydir.Attrib = direntry.Attrib;
-            strncpy(mydir.FileName, direntry.FileName, sizeof(mydir.FileName));
-            mydir.FileName[sizeof(mydir.FileName) - 1] = 0;
+        } else {
+            for (i = 0; i < dir_entries->nextc; i++) {
+                comp_result2 = CompareDirEntries(mydir, &dir_entries->dNext[i]);
 
-            //DEBUG(1,"File %s", mydir.FileName);
-            //
-            // first check file against our reference
-            comp_result = CompareDirEntries(&mydir, &dir_entries->dRef);
+                if (comp_result2 == 0) { // can happen when we scroll and hold onto the first entry
+                    break;
+                }
 
-            //
-            if (comp_result > 0) { // greater than ref
+                //
+                if (comp_result2 < 0) {
+                    for (j = dir_entries->nextc; j > i; --j) { // we know entries is 1 or more
+                        if (j < MAXDIRENTRIES) { // don't move the last one, it can fall off
+                            dir_entries->dNext[j] = dir_entries->dNext[j - 1];
+                        }
+                    }
 
-                if (dir_entries->nextc == 0 ) { // first, take it
-                    dir_entries->dNext[0] = mydir;
-                    dir_entries->nextc++;
+                    dir_entries->dNext[i] = *mydir;
 
-                } else {
-                    for (i = 0; i < dir_entries->nextc; i++) {
-                        comp_result2 = CompareDirEntries(&mydir, &dir_entries->dNext[i]);
+                    // add one to count if not full
+                    if (dir_entries->nextc < MAXDIRENTRIES) {
+                        dir_entries->nextc++;
+                    }
 
-                        if (comp_result2 == 0) { // can happen when we scroll and hold onto the first entry
-                            break;
-                        }
+                    break; // file is now inserted, move on to next file
+                }
 
-                        //
-                        if (comp_result2 < 0) {
-                            for (j = dir_entries->nextc; j > i; --j) { // we know entries is 1 or more
-                                if (j < MAXDIRENTRIES) { // don't move the last one, it can fall off
-                                    dir_entries->dNext[j] = dir_entries->dNext[j - 1];
-                                }
-                            }
+                // file is bigger than current entry, so we move on to compare with next entry - unless we are at the end
+                if (dir_entries->nextc < MAXDIRENTRIES) {// not full
+                    if (i == dir_entries->nextc - 1) { //last
+                        dir_entries->dNext[i + 1] = *mydir;
+                        dir_entries->nextc++;
+                        break;
+                    }
+                }
+            } // i loop
+        }
 
-                            dir_entries->dNext[i] = mydir;
+    } else if (comp_result < 0) { // less than ref, exclude ==0 case
+        if (dir_entries->prevc == 0 ) { // first, take it
+            dir_entries->dPrev[0] = *mydir;
+            dir_entries->prevc++;
 
-                            // add one to count if not full
-                            if (dir_entries->nextc < MAXDIRENTRIES) {
-                                dir_entries->nextc++;
-                            }
+        } else {
+            for (i = 0; i < dir_entries->prevc; i++) {
+                comp_result2 = CompareDirEntries(mydir, &dir_entries->dPrev[i]);
 
-                            break; // file is now inserted, move on to next file
-                        }
+                if (comp_result2 == 0) { // can happen when we scroll and hold onto the first entry
+                    break;
+                }
 
-                        // file is bigger than current entry, so we move on to compare with next entry - unless we are at the end
-                        if (dir_entries->nextc < MAXDIRENTRIES) {// not full
-                            if (i == dir_entries->nextc - 1) { //last
-                                dir_entries->dNext[i + 1] = mydir;
-                                dir_entries->nextc++;
-                                break;
-                            }
+                if (comp_result2 > 0) {
+                    for (j = dir_entries->prevc; j > i; --j) { // we know entries is 1 or more
+                        if (j < MAXDIRENTRIES) { // don't move the last one, it can fall off
+                            dir_entries->dPrev[j] = dir_entries->dPrev[j - 1];
                         }
-                    } // i loop
-                }
+                    }
 
-            } else if (comp_result < 0) { // less than ref, exclude ==0 case
-                if (dir_entries->prevc == 0 ) { // first, take it
-                    dir_entries->dPrev[0] = mydir;
-                    dir_entries->prevc++;
+                    dir_entries->dPrev[i] = *mydir;
 
-                } else {
-                    for (i = 0; i < dir_entries->prevc; i++) {
-                        comp_result2 = CompareDirEntries(&mydir, &dir_entries->dPrev[i]);
+                    // add one to count if not full
+                    if (dir_entries->prevc < MAXDIRENTRIES) {
+                        dir_entries->prevc++;
+                    }
 
-                        if (comp_result2 == 0) { // can happen when we scroll and hold onto the first entry
-                            break;
-                        }
+                    break; // file is now inserted, move on to next file
+                }
 
-                        if (comp_result2 > 0) {
-                            for (j = dir_entries->prevc; j > i; --j) { // we know entries is 1 or more
-                                if (j < MAXDIRENTRIES) { // don't move the last one, it can fall off
-                                    dir_entries->dPrev[j] = dir_entries->dPrev[j - 1];
-                                }
-                            }
+                // file is bigger than current entry, so we move on to compare with next entry - unless we are at the end
+                if (dir_entries->prevc < MAXDIRENTRIES) {// not full
+                    if (i == dir_entries->prevc - 1) { //last
+                        dir_entries->dPrev[i + 1] = *mydir;
+                        dir_entries->prevc++;
+                        break;
+                    }
+                }
+            } // i loop
+        }
+    }
+}
 
-                            dir_entries->dPrev[i] = mydir;
+static inline void Filesel_CopyEntry(FILEENTRY* mydir, FF_DIRENT* direntry)
+{
+    // Copy info from general representation (FF_DIRENT) to size-minimized (FILENTRY)
+    mydir->Attrib = direntry->Attrib;
+    strncpy(mydir->FileName, direntry->FileName, sizeof(mydir->FileName));
+    mydir->FileName[sizeof(mydir->FileName) - 1] = 0;
+}
 
-                            // add one to count if not full
-                            if (dir_entries->prevc < MAXDIRENTRIES) {
-                                dir_entries->prevc++;
-                            }
+void Filesel_ScanUpdate(tDirScan* dir_entries)
+{
+    FF_DIRENT direntry;
+    FILEENTRY mydir;
+    FF_ERROR tester = 0;
 
-                            break; // file is now inserted, move on to next file
-                        }
+    //ref must be valid
+    //finds entries above and below ref
+    dir_entries->prevc = 0;
+    dir_entries->refc  = 1;
+    dir_entries->nextc = 0;
 
-                        // file is bigger than current entry, so we move on to compare with next entry - unless we are at the end
-                        if (dir_entries->prevc < MAXDIRENTRIES) {// not full
-                            if (i == dir_entries->prevc - 1) { //last
-                                dir_entries->dPrev[i + 1] = mydir;
-                                dir_entries->prevc++;
-                                break;
-                            }
-                        }
-                    } // i loop
-                }
-            }
+    tester = FF_FindFirst(pIoman, &direntry, dir_entries->pPath); // Find first Object.
+
+    while (tester == 0) {
+        if (FilterFile(dir_entries, &direntry)) {
+            Filesel_CopyEntry(&mydir, &direntry);
+            Filesel_InsertEntry(dir_entries, &mydir);
         } // next file
 
         tester = FF_FindNext(pIoman, &direntry);
@@ -295,6 +305,7 @@ void Filesel_ScanFirst(tDirScan* dir_entries)
 
     dir_entries->offset = 128;
     dir_entries->sel = 129;
+    dir_entries->seek_state = SEEK_IDLE;
 
     tester = FF_FindFirst(pIoman, &direntry, dir_entries->pPath); // Find first Object.
 
@@ -379,6 +390,7 @@ void Filesel_Init(tDirScan* dir_entries, char* pPath, const file_ext_t* pExt)
 void Filesel_ChangeDir(tDirScan* dir_entries, char* pPath)
 {
     //DEBUG(1,"ChangeDir entry, path %s", pPath);
+    dir_entries->seek_state = SEEK_IDLE;
     dir_entries->pPath = pPath;
     dir_entries->total_entries = 0;
     dir_entries->prevc = 0;
@@ -395,6 +407,7 @@ void Filesel_AddFilterChar(tDirScan* dir_entries, char letter)
 {
     //DEBUG(1,"AddFilterChar entry with '%c'", letter);
     size_t len = strlen(dir_entries->file_filter);
+    dir_entries->seek_state = SEEK_IDLE;
 
     dir_entries->total_entries = 0;
     dir_entries->prevc = 0;
@@ -411,6 +424,7 @@ void Filesel_AddFilterChar(tDirScan* dir_entries, char letter)
 void Filesel_DelFilterChar(tDirScan* dir_entries)
 {
     //DEBUG(1,"DelFilterChar entry");
+    dir_entries->seek_state = SEEK_IDLE;
     dir_entries->total_entries = 0;
     dir_entries->prevc = 0;
     dir_entries->nextc = 0;
@@ -498,6 +512,114 @@ void Filesel_ScanFind(tDirScan* dir_entries, uint8_t search)
     }
 }
 
+// jump to the last entry, shown on the bottom line
+void Filesel_ScanLast(tDirScan* dir_entries)
+{
+    FF_DIRENT direntry;
+    FILEENTRY mydir;
+    FF_ERROR tester = 0;
+    uint8_t found = 0;
+
+    dir_entries->seek_state = SEEK_IDLE;
+
+    tester = FF_FindFirst(pIoman, &direntry, dir_entries->pPath); // Find first Object.
+
+    while (tester == 0) {
+        if (FilterFile(dir_entries, &direntry)) {
+            Filesel_CopyEntry(&mydir, &direntry);
+
+            if (!found || CompareDirEntries(&mydir, &dir_entries->dRef) > 0) {
+                dir_entries->dRef = mydir;
+                found = 1;
+            }
+        }
+
+        tester = FF_FindNext(pIoman, &direntry);
+    }
+
+    if (found) {
+        Filesel_ScanUpdate(dir_entries);
+        dir_entries->offset = 128 - (MAXDIRENTRIES - 1);
+        dir_entries->sel = 128;
+    }
+}
+
+void Filesel_SeekPrefix(tDirScan* dir_entries, const char* prefix)
+{
+    _strlcpy(dir_entries->seek_prefix, prefix, sizeof(dir_entries->seek_prefix));
+
+    dir_entries->seek_found = 0;
+    dir_entries->seek_state = SEEK_MATCH;
+    dir_entries->seek_error = FF_FindFirst(pIoman, &dir_entries->seek_dirent, dir_entries->pPath);
+}
+
+// The seek takes two passes over the directory; the first one finds the lowest
+// entry starting with the prefix (the list on screen is untouched), the second
+// one rebuilds the list around it. Neither pass walks the list entry by entry.
+uint8_t Filesel_SeekUpdate(tDirScan* dir_entries, uint32_t budget)
+{
+    FF_DIRENT* direntry = &dir_entries->seek_dirent;
+    const size_t len = strlen(dir_entries->seek_prefix);
+    FILEENTRY mydir;
+
+    while (dir_entries->seek_state != SEEK_IDLE && budget--) {
+        if (dir_entries->seek_error == 0) {
+            if (FilterFile(dir_entries, direntry)) {
+                Filesel_CopyEntry(&mydir, direntry);
+
+                if (dir_entries->seek_state == SEEK_WINDOW) {
+                    Filesel_InsertEntry(dir_entries, &mydir);
+
+                } else if (!_strnicmp(mydir.FileName, dir_entries->seek_prefix, len) &&
+                           (!dir_entries->seek_found || CompareDirEntries(&mydir, &dir_entries->seek_match) < 0)) {
+                    dir_entries->seek_match = mydir;
+                    dir_entries->seek_found = 1;
+                }
+            }
+
+            dir_entries->seek_error = FF_FindNext(pIoman, direntry);
+            continue;
+        }
+
+        // end of directory
+        if (dir_entries->seek_state == SEEK_WINDOW) {
+            dir_entries->seek_state = SEEK_IDLE;
+            dir_entries->offset = 127;
+            dir_entries->sel = 128;
+            return TRUE;
+        }
+
+        if (!dir_entries->seek_found) {
+            DEBUG(2, "Seek: no match for '%s'", dir_entries->seek_prefix);
+            dir_entries->seek_state = SEEK_IDLE;
+            return FALSE;
+        }
+
+        dir_entries->dRef = dir_entries->seek_match;
+        dir_entries->prevc = 0;
+        dir_entries->refc  = 1;
+        dir_entries->nextc = 0;
+
+        dir_entries->seek_state = SEEK_WINDOW;
+        dir_entries->seek_error = FF_FindFirst(pIoman, direntry, dir_entries->pPath);
+    }
+
+    return FALSE;
+}
+
+void Filesel_SeekWait(tDirScan* dir_entries)
+{
+    while (dir_entries->seek_state == SEEK_WINDOW) {
+        Filesel_SeekUpdate(dir_entries, FILESEL_SEEK_BUDGET);
+    }
+}
+
+void Filesel_SeekCancel(tDirScan* dir_entries)
+{
+    Filesel_SeekWait(dir_entries);
+    dir_entries->seek_state = SEEK_IDLE;
+}
+
 FILEENTRY Filesel_GetEntry(tDirScan* dir_entries, uint8_t entry)
 {
     uint8_t offset = 0;
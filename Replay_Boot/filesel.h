@@ -29,6 +29,12 @@
 #define SCAN_OK 0
 #define SCAN_END 0
 
+#define SEEK_IDLE   0       // no type-ahead seek pending
+#define SEEK_MATCH  1       // looking for the first entry matching the prefix
+#define SEEK_WINDOW 2       // collecting the entries around the match
+
+#define FILESEL_SEEK_BUDGET 32  // directory entries looked at per Filesel_SeekUpdate()
+
 typedef struct file_ext {
     char ext[4];  // "EXT\0"
 } file_ext_t;
@@ -56,12 +62,30 @@ typedef struct {
     FILEENTRY  dPrev[MAXDIRENTRIES];
     FILEENTRY  dRef;
     FILEENTRY  dNext[MAXDIRENTRIES];
+
+    // type-ahead seek, runs a few entries at a time (see Filesel_SeekUpdate)
+    char       seek_prefix[12];
+    uint8_t    seek_state;
+    uint8_t    seek_found;
+    FILEENTRY  seek_match;
+    FF_DIRENT  seek_dirent;
+    FF_ERROR   seek_error;
 } tDirScan;
 
 void Filesel_ScanUpdate(tDirScan* dir_entries);
 
 void Filesel_ScanFirst(tDirScan* dir_entries);
 void Filesel_ScanFind(tDirScan* dir_entries, uint8_t search);
+void Filesel_ScanLast(tDirScan* dir_entries);
+
+// starts a seek to the first entry with the given name prefix
+void Filesel_SeekPrefix(tDirScan* dir_entries, const char* prefix);
+// continues a pending seek for at most 'budget' entries, TRUE when the selection moved
+uint8_t Filesel_SeekUpdate(tDirScan* dir_entries, uint32_t budget);
+// finishes a seek that is already rebuilding the list, so the list can be shown
+void Filesel_SeekWait(tDirScan* dir_entries);
+// drops a pending seek, the list stays valid
+void Filesel_SeekCancel(tDirScan* dir_entries);
 void Filesel_Init(tDirScan* dir_entries, char* pPath, const file_ext_t* pExt);
 void Filesel_ChangeDir(tDirScan* dir_entries, char* pPath);
 void Filesel_AddFilterChar(tDirScan* dir_entries, char letter);
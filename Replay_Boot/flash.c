@@ -27,7 +27,9 @@ when done we reboot the ARM
 */
 
 #include <stdint.h>
+#include <stddef.h>
 #include "osd.h"
+#include "crc32.h"
 
 #if defined(AT91SAM7S256)
 #include "common/AT91SAM7S256.h"
@@ -397,29 +399,6 @@ static uint8_t ParseSRecords(const char* filename, SRECHandler handler)
 }
 
 
-static unsigned int feed_crc32(uint8_t* data, uint32_t length)
-{
-    static uint32_t crc;
-
-    if (data == 0 && length == 0xffffffff) {
-        crc = length;
-        length = 0;
-    }
-
-    for (uint32_t i = 0; i < length; ++i) {
-        uint32_t byte = *data++;
-        crc = crc ^ byte;
-
-        for (int j = 7; j >= 0; j--) {    // Do eight times.
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
-    }
-
-    return ~crc;
-}
-
-
 static uint32_t srecCurrentAddr;
 static uint8_t srecLineBuffer[FLASH_PAGE_SIZE];
 
@@ -428,13 +407,14 @@ static uint32_t dramBaseAddr;
 static uint32_t s_FlashAddress;
 static uint32_t s_FlashSize;
 static uint32_t s_FlashCRC32;
+static uint32_t s_SRecCRC32;
 
 static void DumpToConsole(void)
 {
     uint32_t valid_bytes = ((srecCurrentAddr - 1) & (FLASH_PAGE_SIZE - 1)) + 1;
     //    DumpBufferOffset(srecLineBuffer, valid_bytes, srecCurrentAddr-valid_bytes);
     s_FlashSize += valid_bytes;
-    feed_crc32(srecLineBuffer, valid_bytes);
+    s_SRecCRC32 = CRC32_Update(s_SRecCRC32, srecLineBuffer, valid_bytes);
 }
 
 static uint8_t VerifyHandler(uint8_t type, uint32_t base, uint32_t offset, uint8_t length, uint8_t value)
@@ -451,7 +431,7 @@ static uint8_t VerifyHandler(uint8_t type, uint32_t base, uint32_t offset, uint8
             srecLineBuffer[offset + 1] = '\0';
             INFO("S0 : <%04x> %s", base, srecLineBuffer);
             s_FlashSize = 0;
-            feed_crc32(0, 0xffffffff);
+            s_SRecCRC32 = CRC32_INIT;
         }
 
         return 0;
@@ -464,7 +444,7 @@ static uint8_t VerifyHandler(uint8_t type, uint32_t base, uint32_t offset, uint8
         }
 
         s_FlashAddress = base;
-        s_FlashCRC32 = feed_crc32(0, 0);
+        s_FlashCRC32 = s_SRecCRC32;
         INFO("S7 : Address = $%08x", s_FlashAddress);
         INFO("S7 : Length  = %d", s_FlashSize);
         INFO("S7 : CRC32   = $%08x", s_FlashCRC32);
@@ -494,18 +474,98 @@ static uint8_t VerifyHandler(uint8_t type, uint32_t base, uint32_t offset, uint8
 }
 
 
-uint8_t FLASH_VerifySRecords(const char* filename, uint32_t* crc_file, uint32_t* crc_flash)
+// returns the open file if it starts with a binary firmware container header
+static FF_FILE* OpenContainer(const char* filename, flash_fw_header_t* hdr)
+{
+    FF_FILE* f = FF_Open(pIoman, filename, FF_MODE_READ, NULL);
+
+    if (!f) {
+        return NULL;
+    }
+
+    if (FF_Read(f, sizeof(flash_fw_header_t), 1, (uint8_t*)hdr) == sizeof(flash_fw_header_t) &&
+            hdr->magic == FLASH_FW_MAGIC) {
+        return f;
+    }
+
+    FF_Close(f);
+    return NULL;
+}
+
+static uint8_t VerifyContainer(FF_FILE* f, const flash_fw_header_t* hdr)
 {
-    srecCurrentAddr = 0x102000L;        // we expect the flash SREC to start at $102000 - otherwise error.
-    uint8_t retval = ParseSRecords(filename, VerifyHandler);
+    uint8_t buf[FILEBUF_SIZE];
+    uint32_t remaining = hdr->size;
+    uint32_t crc = CRC32_INIT;
+
+    if (hdr->version != FLASH_FW_VERSION ||
+            CRC32_Update(CRC32_INIT, hdr, offsetof(flash_fw_header_t, header_crc32)) != hdr->header_crc32) {
+        WARNING("FW : Bad header");
+        return 0;
+    }
+
+    // we expect the flash image to start at $102000 - otherwise error.
+    if (hdr->address != 0x102000L || hdr->size == 0 ||
+            hdr->size > AT91C_IFLASH_SIZE - (hdr->address & (AT91C_IFLASH_SIZE - 1))) {
+        WARNING("FW : Bad address/size $%08x/%d", hdr->address, hdr->size);
+        return 0;
+    }
+
+    if (FF_Size(f) < sizeof(flash_fw_header_t) + hdr->size) {
+        WARNING("FW : File truncated");
+        return 0;
+    }
 
-    if (retval != 0) {
+    while (remaining) {
+        uint32_t len = remaining > sizeof(buf) ? sizeof(buf) : remaining;
+
+        if (FF_Read(f, len, 1, buf) != len) {
+            WARNING("FW : Read failed");
+            return 0;
+        }
+
+        crc = CRC32_Update(crc, buf, len);
+        remaining -= len;
+    }
+
+    if (crc != hdr->crc32) {
+        WARNING("FW : CRC32 mismatch $%08x vs $%08x", crc, hdr->crc32);
         return 0;
     }
 
+    s_FlashAddress = hdr->address;
+    s_FlashSize = hdr->size;
+    s_FlashCRC32 = hdr->crc32;
+    INFO("FW : Address = $%08x", s_FlashAddress);
+    INFO("FW : Length  = %d", s_FlashSize);
+    INFO("FW : CRC32   = $%08x", s_FlashCRC32);
+    return 1;
+}
+
+uint8_t FLASH_VerifySRecords(const char* filename, uint32_t* crc_file, uint32_t* crc_flash)
+{
+    flash_fw_header_t hdr;
+    FF_FILE* f = OpenContainer(filename, &hdr);
+
+    if (f) {
+        uint8_t ok = VerifyContainer(f, &hdr);
+        FF_Close(f);
+
+        if (!ok) {
+            return 0;
+        }
+
+    } else {
+        srecCurrentAddr = 0x102000L;        // we expect the flash SREC to start at $102000 - otherwise error.
+        uint8_t retval = ParseSRecords(filename, VerifyHandler);
+
+        if (retval != 0) {
+            return 0;
+        }
+    }
+
     uint8_t* p = (uint8_t*)0x102000;
-    feed_crc32(0, 0xffffffff);
-    uint32_t current_crc = feed_crc32(p, s_FlashSize);
+    uint32_t current_crc = CRC32_Update(CRC32_INIT, p, s_FlashSize);
 
     INFO("Current CRC32 = $%08x", current_crc);
 
@@ -573,9 +633,8 @@ static uint8_t UploadHandler(uint8_t type, uint32_t base, uint32_t offset, uint8
 
 static uint8_t VerifyDRAMContents(uint32_t address, uint32_t size, uint32_t crc32)
 {
-    uint8_t line[256];
-
-    feed_crc32(0, 0xffffffff);
+    uint8_t line[512];
+    uint32_t crc = CRC32_INIT;
 
     while (size) {
         uint32_t len = size >= sizeof(line) ? sizeof(line) : size;
@@ -583,13 +642,12 @@ static uint8_t VerifyDRAMContents(uint32_t address, uint32_t size, uint32_t crc3
         FileIO_MCh_MemToBuf(line, address, len);
         address += len;
         size -= len;
-        feed_crc32(line, len);
-
+        crc = CRC32_Update(crc, line, len);
     }
 
-    DEBUG(1, "crc32 %08x vs %08x", crc32, feed_crc32(0, 0));
+    DEBUG(1, "crc32 %08x vs %08x", crc32, crc);
 
-    return 0;
+    return crc == crc32;
 }
 
 
@@ -679,16 +737,37 @@ uint8_t FLASH_RebootAndFlash(const char* filename)
 
     RenderText(30, 30 + (576 - 480), "Flashing... Please wait!");
 
-    srecCurrentAddr = 0x102000L;        // we expect the flash SREC to start at $102000 - otherwise error.
-    dramBaseAddr = DRAMupload;
-    uint8_t ret = ParseSRecords(filename, UploadHandler);
+    flash_fw_header_t hdr;
+    FF_FILE* f = OpenContainer(filename, &hdr);
 
-    if (ret != 0) {
-        WARNING("SREC error at line %d", ret);
-        return 0;
+    if (f) {
+        // binary container; stream the payload straight into DRAM
+        uint8_t ret = FileIO_MCh_FileToMem(f, DRAMupload, hdr.size, sizeof(flash_fw_header_t));
+        FF_Close(f);
+
+        if (ret != 0) {
+            WARNING("FW : Upload failed (%d)", ret);
+            return 0;
+        }
+
+        s_FlashSize = hdr.size;
+        s_FlashCRC32 = hdr.crc32;
+
+    } else {
+        srecCurrentAddr = 0x102000L;        // we expect the flash SREC to start at $102000 - otherwise error.
+        dramBaseAddr = DRAMupload;
+        uint8_t ret = ParseSRecords(filename, UploadHandler);
+
+        if (ret != 0) {
+            WARNING("SREC error at line %d", ret);
+            return 0;
+        }
     }
 
-    VerifyDRAMContents(DRAMupload, s_FlashSize, s_FlashCRC32);
+    if (!VerifyDRAMContents(DRAMupload, s_FlashSize, s_FlashCRC32)) {
+        WARNING("DRAM contents don't match the image!");
+        return 0;
+    }
 
     DEBUG(1, "LETS GO!");
 
@@ -28,6 +28,10 @@
 #include "messaging.h"
 #include "hardware/spi.h"
 
+#if defined(HOSTED)
+extern uint8_t pin_fpga_done;   // hardware_host/io.c
+#endif
+
 #ifndef FPGA_DISABLE_EMBEDDED_CORE
 // Bah! But that's how it is proposed by this lib...
 #define TINFL_HEADER_FILE_ONLY
@@ -92,6 +96,8 @@ uint8_t FPGA_Default(void) // embedded in FW, something to start with
     JTAG_StartEmbeddedCore();
     return 0;
 #elif defined(HOSTED)
+    // there is no bitstream to clock out; the hosted FPGA is just configured
+    pin_fpga_done = TRUE;
     return 0;
 #endif
 
@@ -496,6 +502,217 @@ uint8_t FPGA_DramEye(uint8_t mode)
 }
 
 
+//
+// Thorough DRAM test, streams the patterns through the MCh in FILEIO_MEMBUF_SIZE bursts
+//
+#if defined(AT91SAM7S256) // Replay
+#define DRAM_SIZE           (64 * 1024 * 1024)
+#elif defined(ARDUINO_SAMD_MKRVIDOR4000)
+#define DRAM_SIZE           (8 * 1024 * 1024)
+#else
+#define DRAM_SIZE           (1 * 1024 * 1024)   // emulated, keep it short
+#endif
+
+#define DRAM_MARGIN_SIZE    (64 * 1024)         // tested per phase step
+#define DRAM_MARGIN_RANGE   0x40                // phase sweep around kDRAM_PHASE
+#define DRAM_MARGIN_STEP    4
+#define DRAM_LFSR_SEED      0x12345678
+#define DRAM_MAX_REPORTED   8                   // error addresses shown per pattern
+
+enum {
+    DRAM_WALK_ONES,
+    DRAM_WALK_ZEROS,
+    DRAM_ADDRESS,
+    DRAM_NOT_ADDRESS,
+    DRAM_RANDOM,
+    DRAM_PATTERNS
+};
+
+static const char* const kDramPattern[DRAM_PATTERNS] = {
+    "walking 1s", "walking 0s", "address", "~address", "random"
+};
+
+typedef struct {
+    uint32_t bytes;     // per direction
+    uint32_t write_ms;
+    uint32_t read_ms;
+} dram_rate_t;
+
+static inline uint32_t _DramPatternWord(uint8_t pattern, uint32_t addr, uint32_t* lfsr)
+{
+    switch (pattern) {
+        case DRAM_WALK_ONES:
+            return 1UL << ((addr >> 2) & 31);
+
+        case DRAM_WALK_ZEROS:
+            return ~(1UL << ((addr >> 2) & 31));
+
+        case DRAM_ADDRESS:
+            return addr;
+
+        case DRAM_NOT_ADDRESS:
+            return ~addr;
+
+        default:
+            // 32 bit galois LFSR, maximum length
+            *lfsr = (*lfsr >> 1) ^ (-(*lfsr & 1) & 0x80200003);
+            return *lfsr;
+    }
+}
+
+static uint32_t _DramTestPattern(uint8_t pattern, uint32_t base, uint32_t size, uint8_t verbose, dram_rate_t* rate)
+{
+    uint32_t buf[FILEIO_MEMBUF_SIZE / sizeof(uint32_t)];
+    uint32_t lfsr = DRAM_LFSR_SEED;
+    const uint32_t words = sizeof(buf) / sizeof(buf[0]);
+    uint32_t errors = 0;
+    uint32_t addr;
+    uint32_t i;
+    HARDWARE_TICK time = Timer_Get(0);
+
+    FileIO_MCh_SetAddress(base, FILEIO_MCH_WRITE);
+
+    for (addr = base; addr < base + size; addr += sizeof(buf)) {
+        for (i = 0; i < words; i++) {
+            buf[i] = _DramPatternWord(pattern, addr + i * sizeof(uint32_t), &lfsr);
+        }
+
+        if (FileIO_MCh_SendBuffer((uint8_t*)buf, sizeof(buf))) {
+            return size / sizeof(uint32_t);
+        }
+    }
+
+    if (FileIO_MCh_WaitStat(0x01, 0)) {
+        return size / sizeof(uint32_t);
+    }
+
+    rate->write_ms += Timer_Convert(Timer_Get(0) - time);
+    time = Timer_Get(0);
+
+    lfsr = DRAM_LFSR_SEED;
+    FileIO_MCh_SetAddress(base, FILEIO_MCH_READ);
+
+    for (addr = base; addr < base + size; addr += sizeof(buf)) {
+        if (FileIO_MCh_ReadChunk((uint8_t*)buf, sizeof(buf))) {
+            return size / sizeof(uint32_t);
+        }
+
+        for (i = 0; i < words; i++) {
+            const uint32_t expected = _DramPatternWord(pattern, addr + i * sizeof(uint32_t), &lfsr);
+
+            if (buf[i] != expected) {
+                if (verbose && errors < DRAM_MAX_REPORTED) {
+                    WARNING("DRAM:%s $%08lX read $%08lX (xor $%08lX)",
+                            kDramPattern[pattern], addr + i * sizeof(uint32_t), buf[i], buf[i] ^ expected);
+                }
+
+                errors++;
+            }
+        }
+    }
+
+    rate->read_ms += Timer_Convert(Timer_Get(0) - time);
+    rate->bytes += size;
+
+    return errors;
+}
+
+static void _DramShowRate(const char* what, uint32_t bytes, uint32_t ms)
+{
+    // MB/s with two decimals
+    const uint32_t rate = ms ? (uint32_t)(((uint64_t)bytes * 100 * 1000 / ms) >> 20) : 0;
+
+    DEBUG(0, "FPGA:DRAM %s %lu.%02lu MB/s", what, rate / 100, rate % 100);
+}
+
+static uint32_t _DramTest(uint32_t base, uint32_t size, uint8_t verbose, dram_rate_t* rate)
+{
+    uint32_t errors = 0;
+
+    for (uint8_t pattern = 0; pattern < DRAM_PATTERNS; pattern++) {
+        const uint32_t e = _DramTestPattern(pattern, base, size, verbose, rate);
+
+        if (verbose) {
+            DEBUG(0, "FPGA:DRAM %s : %s (%lu errors)", kDramPattern[pattern], e ? "FAIL" : "ok", e);
+        }
+
+        errors += e;
+    }
+
+    return errors;
+}
+
+uint32_t FPGA_DramTest(void)
+{
+    dram_rate_t rate = { 0 };
+    HARDWARE_TICK time = Timer_Get(0);
+
+    DEBUG(0, "FPGA:DRAM full test of %lu KB, this takes a while.", DRAM_SIZE >> 10);
+
+    const uint32_t errors = _DramTest(0, DRAM_SIZE, TRUE, &rate);
+
+    _DramShowRate("write", rate.bytes, rate.write_ms);
+    _DramShowRate("read ", rate.bytes, rate.read_ms);
+    DEBUG(0, "FPGA:DRAM full test %s in %lu ms (%lu errors).",
+          errors ? "FAILED" : "passed", Timer_Convert(Timer_Get(0) - time), errors);
+
+    return errors;
+}
+
+uint32_t FPGA_DramMargin(uint8_t phase)
+{
+    dram_rate_t rate = { 0 };
+    int32_t first = -1, last = -1;
+    int32_t best_first = -1, best_last = -1;
+
+    DEBUG(0, "FPGA:DRAM phase margin map, %lu KB per step:", DRAM_MARGIN_SIZE >> 10);
+
+    for (int32_t p = kDRAM_PHASE - DRAM_MARGIN_RANGE; p <= kDRAM_PHASE + DRAM_MARGIN_RANGE; p += DRAM_MARGIN_STEP) {
+        if (p < 0 || p > 0xFF) {
+            continue;
+        }
+
+        OSD_ConfigSendCtrl((kDRAM_SEL << 8) | p);
+        Timer_Wait(1);
+
+        const uint32_t errors = _DramTest(0, DRAM_MARGIN_SIZE, FALSE, &rate);
+
+        DEBUG(0, "FPGA:DRAM phase $%02X %c %s%s", (int)p, p == phase ? '>' : ' ',
+              errors ? "FAIL " : "ok   ", errors ? "" : "########");
+
+        // track the widest passing window
+        if (!errors) {
+            if (first < 0) {
+                first = p;
+            }
+
+            last = p;
+
+            if (best_first < 0 || last - first > best_last - best_first) {
+                best_first = first;
+                best_last = last;
+            }
+
+        } else {
+            first = -1;
+        }
+    }
+
+    OSD_ConfigSendCtrl((kDRAM_SEL << 8) | phase);
+
+    if (best_first < 0) {
+        WARNING("FPGA:DRAM no working phase found!");
+        return 0;
+    }
+
+    const int centre = (best_first + best_last) / 2;
+    DEBUG(0, "FPGA:DRAM passing window $%02X..$%02X, centre $%02X (INI: PHASE = %d)",
+          (int)best_first, (int)best_last, centre, centre);
+
+    return best_last - best_first + DRAM_MARGIN_STEP;
+}
+
+
 uint8_t FPGA_ProdTest(void)
 {
     uint32_t ram_phase;
@@ -31,6 +31,8 @@ uint8_t FPGA_Config(FF_FILE* pFile);
 
 uint8_t FPGA_DramTrain(void);
 uint8_t FPGA_DramEye(uint8_t mode);
+uint32_t FPGA_DramTest(void);
+uint32_t FPGA_DramMargin(uint8_t phase);
 uint8_t FPGA_ProdTest(void);
 void    FPGA_ClockMon(status_t* current_status);
 
@@ -0,0 +1,44 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+/** @file fwcontainer.h */
+
+#ifndef FWCONTAINER_H_INCLUDED
+#define FWCONTAINER_H_INCLUDED
+
+#include <stdint.h>
+
+/*
+ Binary firmware container, an alternative to the S-record image.
+ All fields are little endian; the payload follows the header directly.
+
+ Only depends on stdint.h; tools/genupd writes these with the same header.
+*/
+
+#define FLASH_FW_MAGIC      0x57465052  // "RPFW"
+#define FLASH_FW_VERSION    1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t address;       // flash address of the first payload byte
+    uint32_t size;          // payload size in bytes
+    uint32_t crc32;         // payload crc32
+    uint32_t header_crc32;  // crc32 of the fields above
+    uint32_t reserved[2];
+} flash_fw_header_t;
+
+#endif
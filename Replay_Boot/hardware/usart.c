@@ -18,9 +18,11 @@
 #include "hardware/usart.h"
 #include "hardware/irq.h"
 
-// for RX, we use a software ring buffer as we are interested in any character
-// as soon as it is received.
-#define RXBUFLEN 16
+#include <stddef.h>
+
+// for RX, we use a ring buffer that the PDC writes into directly (in two halves),
+// deep enough to hold a full window of the serial file transfer.
+#define RXBUFLEN 1024
 #define RXBUFMASK (RXBUFLEN-1)
 volatile uint8_t USART_rxbuf[RXBUFLEN];
 volatile int16_t USART_rxptr, USART_rdptr;
@@ -31,17 +33,39 @@ volatile int16_t USART_rxptr, USART_rdptr;
 volatile uint8_t USART_txbuf[TXBUFLEN];
 volatile int16_t USART_txptr, USART_wrptr, USART_barrier;
 
+static inline int16_t USART_RxPtr(void)
+{
+#if USB_USART==1
+    return USART_rxptr;
+#else
+    return ((uint32_t)AT91C_BASE_US0->US_RPR - (uint32_t)USART_rxbuf) & RXBUFMASK;
+#endif
+}
+
 void ISR_USART(void)
 {
     uint32_t isr_status = AT91C_BASE_US0->US_CSR;
 
-    // returns if no character
-    if (!(isr_status & AT91C_US_RXRDY)) {
+    // returns if no half of the ring buffer was completed
+    if (!(isr_status & AT91C_US_ENDRX)) {
         return;
     }
 
-    USART_rxbuf[USART_rxptr] = AT91C_BASE_US0->US_RHR;
-    USART_rxptr = (USART_rxptr + 1) & RXBUFMASK;
+    // the PDC moved on to the other half; queue the completed one behind it
+    if (AT91C_BASE_US0->US_RCR == 0) {
+        // we were too late - restart at the beginning
+        AT91C_BASE_US0->US_RPR = (uint32_t)USART_rxbuf;
+        AT91C_BASE_US0->US_RCR = RXBUFLEN / 2;
+    }
+
+    if (USART_RxPtr() < RXBUFLEN / 2) {
+        AT91C_BASE_US0->US_RNPR = (uint32_t)&USART_rxbuf[RXBUFLEN / 2];
+
+    } else {
+        AT91C_BASE_US0->US_RNPR = (uint32_t)USART_rxbuf;
+    }
+
+    AT91C_BASE_US0->US_RNCR = RXBUFLEN / 2;
 }
 
 void USART_Init(unsigned long baudrate)
@@ -84,11 +108,19 @@ void USART_Init(unsigned long baudrate)
     // Enable AIC interrupt
     AT91C_BASE_AIC->AIC_IECR = 1 << AT91C_ID_US0;
 
+    // Set up the RX PDC ring buffer
+    USART_rdptr = 0;
+    AT91C_BASE_US0->US_RPR  = (uint32_t)USART_rxbuf;
+    AT91C_BASE_US0->US_RCR  = RXBUFLEN / 2;
+    AT91C_BASE_US0->US_RNPR = (uint32_t)&USART_rxbuf[RXBUFLEN / 2];
+    AT91C_BASE_US0->US_RNCR = RXBUFLEN / 2;
+    AT91C_BASE_US0->US_PTCR = AT91C_PDC_RXTEN;
+
     // Enable receiver & transmitter
     AT91C_BASE_US0->US_CR = AT91C_US_RXEN | AT91C_US_TXEN;
 
-    // Enable USART RX interrupt
-    AT91C_BASE_US0->US_IER = AT91C_US_RXRDY;
+    // Enable USART RX interrupt (end of each half of the ring buffer)
+    AT91C_BASE_US0->US_IER = AT91C_US_ENDRX;
 
     // enable IRQ on ARM
     enableIRQ();
@@ -102,9 +134,12 @@ void USART_update(void)
 #if USB_USART==1
 
     if (pCDC.IsConfigured(&pCDC)) {
-        char data[RXBUFLEN];
+        char data[64];
         uint16_t length;
-        length = pCDC.Read(&pCDC, data, RXBUFLEN);
+        uint16_t space = RXBUFLEN - 1 - USART_CharAvail();
+
+        // leave anything that doesn't fit with the host
+        length = pCDC.Read(&pCDC, data, space < sizeof(data) ? space : sizeof(data));
 
         if (length) {
             if ((length + USART_rxptr) > (RXBUFLEN - 1)) {
@@ -134,33 +169,57 @@ void USART_Putc(void* p, char c)
     USART_wrptr = (USART_wrptr + 1) & TXBUFMASK;
 
     if ((c == '\n') || (!USART_wrptr) || (USART_wrptr == USART_barrier)) {
+        USART_Flush();
+    }
+}
+
+void USART_Flush(void)
+{
+    if (USART_txptr == USART_wrptr) {
+        return;
+    }
+
 #if USB_USART==1
 
-        if (pCDC.IsConfigured(&pCDC)) {
-            //pCDC.Write(&pCDC, data, length);
-            pCDC.Write(&pCDC, (const char*) & (USART_txbuf[USART_txptr]), (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK);
-            USART_barrier = USART_txptr;
-            USART_txptr = USART_wrptr;
-        }
+    if (pCDC.IsConfigured(&pCDC)) {
+        //pCDC.Write(&pCDC, data, length);
+        pCDC.Write(&pCDC, (const char*) & (USART_txbuf[USART_txptr]), (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK);
+        USART_barrier = USART_txptr;
+        USART_txptr = USART_wrptr;
+    }
 
 #else
 
-        // flush the buffer now (end of line, end of buffer reached or buffer full)
-        if ((AT91C_BASE_US0->US_TCR == 0) && (AT91C_BASE_US0->US_TNCR == 0)) {
-            USART_barrier = USART_txptr;
-            AT91C_BASE_US0->US_TPR = (uint32_t) & (USART_txbuf[USART_txptr]);
-            AT91C_BASE_US0->US_TCR = (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK;
-            AT91C_BASE_US0->US_PTCR = AT91C_PDC_TXTEN;
-            USART_txptr = USART_wrptr;
-
-        } else if (AT91C_BASE_US0->US_TNCR == 0) {
-            AT91C_BASE_US0->US_TNPR = (uint32_t) & (USART_txbuf[USART_txptr]);
-            AT91C_BASE_US0->US_TNCR = (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK;
-            USART_txptr = USART_wrptr;
-        }
+    // flush the buffer now (end of line, end of buffer reached or buffer full)
+    if ((AT91C_BASE_US0->US_TCR == 0) && (AT91C_BASE_US0->US_TNCR == 0)) {
+        USART_barrier = USART_txptr;
+        AT91C_BASE_US0->US_TPR = (uint32_t) & (USART_txbuf[USART_txptr]);
+        AT91C_BASE_US0->US_TCR = (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK;
+        AT91C_BASE_US0->US_PTCR = AT91C_PDC_TXTEN;
+        USART_txptr = USART_wrptr;
+
+    } else if (AT91C_BASE_US0->US_TNCR == 0) {
+        AT91C_BASE_US0->US_TNPR = (uint32_t) & (USART_txbuf[USART_txptr]);
+        AT91C_BASE_US0->US_TNCR = (TXBUFLEN + USART_wrptr - USART_txptr) & TXBUFMASK;
+        USART_txptr = USART_wrptr;
+    }
 
 #endif
+}
+
+void USART_Write(const uint8_t* data, uint16_t length)
+{
+    while (length--) {
+        USART_Putc(NULL, *data++);
     }
+
+#if USB_USART==0
+    // wait for a free PDC slot so the data goes out now
+    while (AT91C_BASE_US0->US_TNCR) ;
+
+#endif
+
+    USART_Flush();
 }
 
 
@@ -168,7 +227,7 @@ uint8_t USART_GetValid(void)
 {
     uint8_t val = 0;
 
-    if (USART_rxptr != USART_rdptr) {
+    if (USART_RxPtr() != USART_rdptr) {
         val = 1;
     }
 
@@ -179,7 +238,7 @@ uint8_t USART_Getc(void)
 {
     uint8_t val;
 
-    if (USART_rxptr != USART_rdptr) {
+    if (USART_RxPtr() != USART_rdptr) {
         val = USART_rxbuf[USART_rdptr];
         USART_rdptr = (USART_rdptr + 1) & RXBUFMASK;
 
@@ -194,7 +253,7 @@ uint8_t USART_Peekc(void)
 {
     uint8_t val;
 
-    if (USART_rxptr != USART_rdptr) {
+    if (USART_RxPtr() != USART_rdptr) {
         val = USART_rxbuf[USART_rdptr];
 
     } else {
@@ -206,7 +265,7 @@ uint8_t USART_Peekc(void)
 
 inline int16_t USART_CharAvail(void)
 {
-    return (RXBUFLEN + USART_rxptr - USART_rdptr) & RXBUFMASK;
+    return (RXBUFLEN + USART_RxPtr() - USART_rdptr) & RXBUFMASK;
 }
 
 /*
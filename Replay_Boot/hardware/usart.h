@@ -28,6 +28,10 @@ extern struct _AT91S_CDC pCDC;
 void USART_Init(unsigned long baudrate);
 // Putc printf callback
 void USART_Putc(void*, char c);
+// Send the buffered output now
+void USART_Flush(void);
+// Binary output, flushed when done
+void USART_Write(const uint8_t* data, uint16_t length);
 
 uint8_t USART_GetValid(void);
 uint8_t USART_Getc(void);
@@ -39,3 +39,4 @@ void Hardware_Init(void)
 #include "hardware_host/twi.c"
 #include "hardware_host/usart.c"
 #include "hardware_host/telnet_listen.c"
+#include "hardware_host/usb.c"
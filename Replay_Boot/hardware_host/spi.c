@@ -23,6 +23,7 @@
 #include "../fileio.h"
 
 #include <ncurses.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
@@ -194,10 +195,14 @@ uint8_t sdc_result[5] = {0};
 uint32_t sdc_read_sector = 0;
 uint32_t sdc_write_sector = 0;
 uint32_t sdc_data_length = 0;
-uint8_t sdc_data[1 + 512 + 2] = {0};
+uint8_t sdc_data[1 + 1 + 512 + 2] = {0};
 uint8_t* sdc_data_ptr = 0;
 
 uint8_t last_command = 0;
+uint8_t sdc_ready = 0;      // ACMD41 done; CMD55 no longer answers 'idle'
+uint32_t sdc_erase_start = 0;
+uint32_t sdc_erase_end = 0;
+uint8_t sdc_crc_on = 0;     // CMD59
 
 enum {
     SPI_IDLE        = 1 << 0,
@@ -212,6 +217,124 @@ enum {
 uint8_t osd_command = 0xff;
 uint8_t osd_param = 0xff;
 
+// bit by bit on purpose; a second opinion on the firmware's tables
+static uint8_t sdc_crc7(const uint8_t* p, uint32_t length)
+{
+    uint8_t crc = 0;
+
+    while (length--) {
+        uint8_t c = *p++;
+
+        for (int i = 0; i < 8; i++) {
+            const uint8_t feedback = ((c >> 7) ^ (crc >> 6)) & 1;
+            crc = (crc << 1) & 0x7f;
+            crc ^= feedback ? 0x09 : 0;
+            c <<= 1;
+        }
+    }
+
+    return (crc << 1) | 1;
+}
+
+static uint16_t sdc_crc16(const uint8_t* p, uint32_t length)
+{
+    uint16_t crc = 0;
+
+    while (length--) {
+        crc ^= *p++ << 8;
+
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+// REPLAY_SDCARD_CRC_FAULTS=n damages the CRC of every n-th data block (both ways)
+static uint8_t sdc_crc_fault(void)
+{
+    static int every = -1;
+    static int count = 0;
+
+    if (every < 0) {
+        const char* env = getenv("REPLAY_SDCARD_CRC_FAULTS");
+        every = env ? atoi(env) : 0;
+    }
+
+    return sdc_crc_on && every > 0 && (++count % every) == 0;
+}
+
+static void sdc_read_block(void)
+{
+    sdc_data_length = 512 + 1 + 2;
+    sdc_data_ptr = sdc_data;
+    sdc_data[0] = 0xfe;
+
+    int f = open(SDCARD_FILE, O_RDWR);
+
+    if (f >= 0) {
+        lseek(f, (off_t)sdc_read_sector * 512, SEEK_SET);
+        read(f, &sdc_data[1], 512);
+        close(f);
+    }
+
+    const uint16_t crc = sdc_crc16(&sdc_data[1], 512) ^ (sdc_crc_fault() ? 0x0100 : 0);
+    sdc_data[513] = crc >> 8;
+    sdc_data[514] = crc & 0xff;
+}
+
+// CSD version 2.0 (SDHC) describing the image size, in 512 kB units
+static void sdc_read_csd(void)
+{
+    uint8_t* csd = &sdc_data[1];
+    uint32_t c_size = 0;
+    int f = open(SDCARD_FILE, O_RDONLY);
+
+    if (f >= 0) {
+        c_size = lseek(f, 0, SEEK_END) / (512 * 1024);
+        close(f);
+    }
+
+    c_size = c_size ? c_size - 1 : 0;
+
+    sdc_data_length = 1 + 16 + 2;
+    sdc_data_ptr = sdc_data;
+    sdc_data[0] = 0xfe;
+    memset(csd, 0x00, 16);
+    csd[0] = 0x40;                      // CSD_STRUCTURE = 1
+    csd[5] = 0x09;                      // READ_BL_LEN = 512
+    csd[7] = (c_size >> 16) & 0x3f;
+    csd[8] = c_size >> 8;
+    csd[9] = c_size;
+    csd[15] = sdc_crc7(csd, 15);
+
+    const uint16_t crc = sdc_crc16(csd, 16);
+    sdc_data[17] = crc >> 8;
+    sdc_data[18] = crc & 0xff;
+}
+
+// a data block from the host; FALSE if the card rejects it for its CRC
+static uint8_t sdc_write_block(const uint8_t* data)
+{
+    const uint16_t crc = (data[512] << 8) | data[513];
+
+    if (sdc_crc_on && (crc != sdc_crc16(data, 512) || sdc_crc_fault())) {
+        printf("write_sector = $%x CRC ERROR\n", sdc_write_sector);
+        return 0;
+    }
+
+    int f = open(SDCARD_FILE, O_RDWR);
+
+    if (f >= 0) {
+        lseek(f, (off_t)sdc_write_sector * 512, SEEK_SET);
+        write(f, data, 512);
+        close(f);
+    }
+
+    return 1;
+}
+
 unsigned char rSPI(unsigned char outByte)
 {
     uint8_t v = 0;
@@ -224,21 +347,43 @@ unsigned char rSPI(unsigned char outByte)
                 --sdc_data_length;
 
                 if (sdc_data_length == 0) {
+                    sdc_result_length = 1;
+                    sdc_result[0] = sdc_write_block(&sdc_data[2]) ? 0x05 : 0x0b;
+                }
 
-                    int f = open(SDCARD_FILE, O_RDWR);
+                return 0;
+            }
+        }
 
-                    if (f >= 0) {
-                        lseek(f, sdc_write_sector * 512, SEEK_SET);
-                        write(f, &sdc_data[2], 512);
-                        close(f);
-                    }
+        if (last_command == CMD25 && !sdc_result_length) {
+            if (!sdc_data_length) {
+                // between blocks; the card is never busy here
+                if (outByte == 0xFC) {
+                    sdc_data_length = 512 + 2 /*crc = $????*/;
+                    sdc_data_ptr = sdc_data;
 
-                    sdc_result_length = 1;
-                    sdc_result[0] = 0x05;
+                } else if (outByte == 0xFD) {
+                    last_command = 0;
                 }
 
-                return 0;
+                return 0xff;
+            }
+
+            *sdc_data_ptr++ = outByte;
+            --sdc_data_length;
+
+            if (sdc_data_length == 0) {
+                sdc_result_length = 1;
+                sdc_result[0] = 0x0b;
+
+                // a rejected block ends the write; the host sends the stop token
+                if (sdc_write_block(sdc_data)) {
+                    sdc_write_sector++;
+                    sdc_result[0] = 0x05;
+                }
             }
+
+            return 0;
         }
 
         sdc_cmd.buffer[0] = sdc_cmd.buffer[1];
@@ -248,12 +393,23 @@ unsigned char rSPI(unsigned char outByte)
         sdc_cmd.buffer[4] = sdc_cmd.buffer[5];
         sdc_cmd.buffer[5] = outByte;
 
+        if (sdc_crc_on && (sdc_cmd.command & 0xc0) == 0x40 && sdc_crc7(sdc_cmd.buffer, 5) != sdc_cmd.crc) {
+            printf("CMD%d CRC ERROR (%02x)\n", sdc_cmd.command - CMD0, sdc_cmd.crc);
+            last_command = 0;
+            sdc_result_length = 1;
+            sdc_result[0] = SPI_CRC;
+            memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+            return 0;
+        }
+
         switch (sdc_cmd.command) {
             case CMD0:
                 printf("CMD0 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
                 last_command = sdc_cmd.command;
                 sdc_result_length = 1;
                 sdc_result[0] = 0;//SPI_IDLE;
+                sdc_ready = 0;
+                sdc_crc_on = 0;
                 int test = open(SDCARD_FILE, O_RDWR);
 
                 if (test >= 0) {
@@ -264,6 +420,16 @@ unsigned char rSPI(unsigned char outByte)
                 memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
                 break;
 
+            case CMD9:
+                printf("CMD9 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                sdc_result_length = 1;
+                sdc_result[0] = 0x00;
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+
+                sdc_read_csd();
+                break;
+
             case CMD12:
                 printf("CMD12 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
                 last_command = sdc_cmd.command;
@@ -309,18 +475,7 @@ unsigned char rSPI(unsigned char outByte)
                 sdc_result[0] = 0x00;
                 memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
 
-                sdc_data_length = 512 + 1 + 2;
-                sdc_data_ptr = sdc_data;
-                sdc_data[0] = 0xfe;
-
-                int f = open(SDCARD_FILE, O_RDWR);
-
-                if (f >= 0) {
-                    lseek(f, (off_t)sdc_read_sector * 512, SEEK_SET);
-                    read(f, &sdc_data[1], 512);
-                    close(f);
-                }
-
+                sdc_read_block();
                 break;
             }
 
@@ -340,18 +495,7 @@ unsigned char rSPI(unsigned char outByte)
                 sdc_result[0] = 0x00;
                 memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
 
-                sdc_data_length = 512 + 1 + 2;
-                sdc_data_ptr = sdc_data;
-                sdc_data[0] = 0xfe;
-
-                int f = open(SDCARD_FILE, O_RDWR);
-
-                if (f >= 0) {
-                    lseek(f, (off_t)sdc_read_sector * 512, SEEK_SET);
-                    read(f, &sdc_data[1], 512);
-                    close(f);
-                }
-
+                sdc_read_block();
                 break;
             }
 
@@ -376,11 +520,88 @@ unsigned char rSPI(unsigned char outByte)
                 break;
             }
 
+            case CMD23:
+                printf("CMD23 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                sdc_result_length = 1;
+                sdc_result[0] = 0x00;
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+                break;
+
+            case CMD25: {
+                printf("CMD25 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                sdc_write_sector = 0;
+                sdc_write_sector |= sdc_cmd.arg0;
+                sdc_write_sector <<= 8;
+                sdc_write_sector |= sdc_cmd.arg1;
+                sdc_write_sector <<= 8;
+                sdc_write_sector |= sdc_cmd.arg2;
+                sdc_write_sector <<= 8;
+                sdc_write_sector |= sdc_cmd.arg3;
+                printf("write_sector = $%x\n", sdc_write_sector);
+                sdc_result_length = 1;
+                sdc_result[0] = 0x00;
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+
+                sdc_data_length = 0;    // blocks start with a token, see above
+                break;
+            }
+
+            case CMD32:
+            case CMD33: {
+                printf("CMD%d [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.command - CMD0, sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                const uint32_t sector = (sdc_cmd.arg0 << 24) | (sdc_cmd.arg1 << 16) | (sdc_cmd.arg2 << 8) | sdc_cmd.arg3;
+
+                if (sdc_cmd.command == CMD32) {
+                    sdc_erase_start = sector;
+
+                } else {
+                    sdc_erase_end = sector;
+                }
+
+                sdc_result_length = 1;
+                sdc_result[0] = 0x00;
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+                break;
+            }
+
+            case CMD38: {
+                printf("CMD38 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                printf("erase_sectors = $%x - $%x\n", sdc_erase_start, sdc_erase_end);
+                sdc_result_length = 1;
+                sdc_result[0] = SPI_ERASE_SEQ;
+
+                if (sdc_erase_start <= sdc_erase_end) {
+                    // erased blocks read back as zero (DATA_STAT_AFTER_ERASE = 0)
+                    static const uint8_t zero[512];
+                    int f = open(SDCARD_FILE, O_RDWR);
+
+                    if (f >= 0) {
+                        lseek(f, (off_t)sdc_erase_start * 512, SEEK_SET);
+
+                        for (uint32_t i = sdc_erase_start; i <= sdc_erase_end; ++i) {
+                            write(f, zero, sizeof(zero));
+                        }
+
+                        close(f);
+                    }
+
+                    sdc_result[0] = 0x00;
+                }
+
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+                break;
+            }
+
             case CMD41:
                 printf("CMD41 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
                 last_command = sdc_cmd.command;
                 sdc_result_length = 1;
                 sdc_result[0] = 0;
+                sdc_ready = 1;
                 memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
                 break;
 
@@ -388,7 +609,16 @@ unsigned char rSPI(unsigned char outByte)
                 printf("CMD55 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
                 last_command = sdc_cmd.command;
                 sdc_result_length = 1;
-                sdc_result[0] = SPI_IDLE;
+                sdc_result[0] = sdc_ready ? 0x00 : SPI_IDLE;
+                memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
+                break;
+
+            case CMD59:
+                printf("CMD59 [%02x,%02x,%02x,%02x] CRC = %02x\n", sdc_cmd.arg0, sdc_cmd.arg1, sdc_cmd.arg2, sdc_cmd.arg3, sdc_cmd.crc);
+                last_command = sdc_cmd.command;
+                sdc_crc_on = sdc_cmd.arg3 & 1;
+                sdc_result_length = 1;
+                sdc_result[0] = 0x00;
                 memset(sdc_cmd.buffer, 0x00, sizeof(sdc_cmd.buffer));
                 break;
 
@@ -421,18 +651,7 @@ unsigned char rSPI(unsigned char outByte)
                     if (sdc_data_length == 0 && last_command == CMD18) {
                         printf("ANOTHER SECTOR\n");
                         sdc_read_sector++;
-                        sdc_data_length = 512 + 1 + 2;
-                        sdc_data_ptr = sdc_data;
-                        sdc_data[0] = 0xfe;
-
-                        int f = open(SDCARD_FILE, O_RDWR);
-
-                        if (f >= 0) {
-                            lseek(f, (off_t)sdc_read_sector * 512, SEEK_SET);
-                            read(f, &sdc_data[1], 512);
-                            close(f);
-                        }
-
+                        sdc_read_block();
                     }
 
                     break;
@@ -714,6 +933,16 @@ unsigned char rSPI(unsigned char outByte)
 
 void SPI_WriteBufferSingle(void* pBuffer, uint32_t length)
 {
+    if (spi_enable & SPI_OSD) {
+        uint8_t* p = (uint8_t*)pBuffer;
+
+        while (length--) {
+            rSPI(*p++);
+        }
+
+        return;
+    }
+
     printf("%s %p %08x -> %08x\n", __FUNCTION__, pBuffer, length, fio_address);
 
     if (fio_address & fio_blockram_mask) {
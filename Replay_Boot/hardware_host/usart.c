@@ -38,7 +38,7 @@ void TELNET_send(void* buffer, size_t size);
 
 // for RX, we use a software ring buffer as we are interested in any character
 // as soon as it is received.
-#define RXBUFLEN 16
+#define RXBUFLEN 1024
 #define RXBUFMASK (RXBUFLEN-1)
 volatile uint8_t USART_rxbuf[RXBUFLEN];
 volatile int16_t USART_rxptr, USART_rdptr;
@@ -79,6 +79,12 @@ void USART_update(void)
 {
     char data[RXBUFLEN];
     ssize_t length = -1;
+    // leave anything that doesn't fit in the ring with the sender
+    size_t space = RXBUFLEN - 1 - USART_CharAvail();
+
+    if (!space) {
+        return;
+    }
 
 #ifndef USART_TELNET_PORT
 
@@ -86,11 +92,11 @@ void USART_update(void)
         return;
     }
 
-    length = read(fd, data, RXBUFLEN);
+    length = read(fd, data, space);
 
 #else
 
-    length = TELNET_recv(data, RXBUFLEN);
+    length = TELNET_recv(data, space);
 
 #endif
 
@@ -140,6 +146,18 @@ void USART_Putc(void* p, char c)
 }
 
 
+void USART_Flush(void)
+{
+    // USART_Putc writes through
+}
+
+void USART_Write(const uint8_t* data, uint16_t length)
+{
+    while (length--) {
+        USART_Putc(NULL, *data++);
+    }
+}
+
 uint8_t USART_GetValid(void)
 {
     uint8_t val = 0;
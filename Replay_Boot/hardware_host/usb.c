@@ -0,0 +1,278 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+// usb_hardware backend for the hosted build. The device side of the USB link is
+// a loopback TCP socket (port 1235, or $REPLAY_USB_PORT); a connected client is
+// the cable being plugged in. Every transaction is one frame
+//
+//    ep | flags | len (16 bit, little endian) | data[len]
+//
+// host -> replay
+//    ep 0    an 8 byte setup packet
+//    ep 2    bulk OUT data; a CBW must be a frame of its own
+//
+// replay -> host
+//    ep 0    control IN data (len 0 is the status stage ZLP)
+//    ep 1    bulk IN data, split at the firmware's discretion
+//    ep x    with USB_HOSTED_STALL set and len 0 when the endpoint stalls
+//
+// tools/msctest implements the host side.
+
+#include "../messaging.h"
+#include "usb/usb_hardware.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define USB_HOSTED_PORT     1235
+#define USB_HOSTED_STALL    0x01
+#define USB_HOSTED_HEADER   4
+
+#define min(a, b) (((a) > (b)) ? (b) : (a))
+
+static int usb_socket = -1;
+static int usb_fd = -1;
+static usb_func usb_recv_func;
+
+// bulk OUT data that arrived ahead of usb_recv()
+static uint8_t usb_out_buffer[2048];
+static uint32_t usb_out_length;
+static uint32_t usb_out_offset;
+
+static void usb_listen(void)
+{
+    static uint8_t tried = FALSE;
+
+    if (tried) {
+        return;
+    }
+
+    tried = TRUE;
+
+    const char* env = getenv("REPLAY_USB_PORT");
+    struct sockaddr_in addr_in;
+    memset(&addr_in, 0, sizeof(addr_in));
+    addr_in.sin_family = AF_INET;
+    addr_in.sin_port = htons(env ? atoi(env) : USB_HOSTED_PORT);
+    addr_in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((usb_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        WARNING("USB:No listen socket");
+        return;
+    }
+
+    setsockopt(usb_socket, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int));
+
+    if (bind(usb_socket, (struct sockaddr*)&addr_in, sizeof(addr_in)) < 0 || listen(usb_socket, 1) < 0) {
+        WARNING("USB:Port %d busy", ntohs(addr_in.sin_port));
+        close(usb_socket);
+        usb_socket = -1;
+        return;
+    }
+
+    fcntl(usb_socket, F_SETFL, fcntl(usb_socket, F_GETFL) | O_NONBLOCK);
+    DEBUG(1, "USB:Listening on port %d", ntohs(addr_in.sin_port));
+}
+
+static void usb_drop(void)
+{
+    if (usb_fd >= 0) {
+        DEBUG(1, "USB:Host detached");
+        close(usb_fd);
+        usb_fd = -1;
+    }
+
+    usb_out_length = usb_out_offset = 0;
+}
+
+static uint8_t usb_read_all(uint8_t* buffer, uint32_t length)
+{
+    while (length && usb_fd >= 0) {
+        ssize_t n = read(usb_fd, buffer, length);
+
+        if (n <= 0) {
+            usb_drop();
+            return FALSE;
+        }
+
+        buffer += n;
+        length -= n;
+    }
+
+    return usb_fd >= 0;
+}
+
+static void usb_write_frame(uint8_t ep, uint8_t flags, const uint8_t* data, uint32_t length)
+{
+    uint8_t header[USB_HOSTED_HEADER] = { ep, flags, length, length >> 8 };
+
+    if (usb_fd < 0) {
+        return;
+    }
+
+    if (write(usb_fd, header, sizeof(header)) != sizeof(header) ||
+            (length && write(usb_fd, data, length) != length)) {
+        usb_drop();
+    }
+}
+
+// Reads one frame into 'buffer'; returns the endpoint or 0xff if there is none
+static uint8_t usb_read_frame(uint8_t* buffer, uint32_t* length, uint8_t wait)
+{
+    uint8_t header[USB_HOSTED_HEADER];
+    struct pollfd pfd = { usb_fd, POLLIN, 0 };
+
+    if (usb_fd < 0 || (!wait && poll(&pfd, 1, 0) <= 0)) {
+        return 0xff;
+    }
+
+    if (!usb_read_all(header, sizeof(header))) {
+        return 0xff;
+    }
+
+    *length = header[2] | (header[3] << 8);
+
+    if (*length > sizeof(usb_out_buffer)) {
+        WARNING("USB:Frame too big (%lu)", *length);
+        usb_drop();
+        return 0xff;
+    }
+
+    return usb_read_all(buffer, *length) ? header[0] : 0xff;
+}
+
+uint8_t usb_attached(void)
+{
+    usb_listen();
+
+    if (usb_fd < 0 && usb_socket >= 0 && (usb_fd = accept(usb_socket, NULL, NULL)) >= 0) {
+        setsockopt(usb_fd, IPPROTO_TCP, TCP_NODELAY, &(int) {1}, sizeof(int));
+        DEBUG(1, "USB:Host attached");
+    }
+
+    return usb_fd >= 0;
+}
+
+void usb_connect(usb_func _recv)
+{
+    usb_recv_func = _recv;
+}
+
+uint8_t usb_poll()
+{
+    uint32_t length;
+    uint8_t ep;
+
+    if (usb_out_length) {
+        // left over from a short usb_recv(); hand it on as it arrived
+        ep = 2;
+        length = usb_out_length - usb_out_offset;
+        memmove(usb_out_buffer, &usb_out_buffer[usb_out_offset], length);
+        usb_out_length = usb_out_offset = 0;
+
+    } else if ((ep = usb_read_frame(usb_out_buffer, &length, FALSE)) == 0xff) {
+        return FALSE;
+    }
+
+    if (usb_recv_func) {
+        usb_recv_func(ep, usb_out_buffer, length);
+    }
+
+    return TRUE;
+}
+
+void usb_disconnect()
+{
+    usb_recv_func = NULL;
+    usb_drop();
+}
+
+void usb_send(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength)
+{
+    uint32_t len = wLength ? min(packet_length, wLength) : packet_length;
+
+    usb_write_frame(ep, 0, packet, packet ? len : 0);
+}
+
+void usb_send_async(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength, uint8_t wait_done)
+{
+    usb_send(ep, wMaxPacketSize, packet, packet_length, wLength);
+}
+
+// The socket takes whole packets right away, like a free FIFO bank would
+uint32_t usb_send_async_nb(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length)
+{
+    uint32_t len = packet_length & ~(wMaxPacketSize - 1);
+
+    if (len) {
+        usb_write_frame(ep, 0, packet, len);
+    }
+
+    return len;
+}
+
+void usb_send_ep0_stall(void)
+{
+    usb_send_stall(0);
+}
+
+void usb_send_stall(uint8_t ep)
+{
+    usb_write_frame(ep, USB_HOSTED_STALL, NULL, 0);
+}
+
+uint32_t usb_recv(uint8_t ep, uint8_t* packet, uint32_t length)
+{
+    uint32_t remaining = length;
+
+    while (remaining) {
+        if (usb_out_offset == usb_out_length) {
+            usb_out_offset = usb_out_length = 0;
+
+            uint8_t rx_ep = usb_read_frame(usb_out_buffer, &usb_out_length, TRUE);
+
+            if (rx_ep == 0xff) {
+                break;
+            }
+
+            if (rx_ep != ep) {
+                WARNING("USB:Expected data on ep %d, got ep %d", ep, rx_ep);
+                usb_out_length = 0;
+                break;
+            }
+        }
+
+        uint32_t n = min(remaining, usb_out_length - usb_out_offset);
+        memcpy(packet, &usb_out_buffer[usb_out_offset], n);
+        usb_out_offset += n;
+        packet += n;
+        remaining -= n;
+    }
+
+    if (usb_out_offset == usb_out_length) {
+        usb_out_offset = usb_out_length = 0;
+    }
+
+    return length - remaining;
+}
+
+void usb_setup_faddr(uint16_t wValue) {}
+void usb_setup_endpoints(uint32_t* ep_types, uint32_t num_eps) {}
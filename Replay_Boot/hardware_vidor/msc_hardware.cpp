@@ -293,6 +293,12 @@ extern "C" void usb_send_async(uint8_t ep, uint32_t wMaxPacketSize, const uint8_
     usbhw.send(ep, packet, packet_length, wLength, wait_done ? false : true);
 }
 
+// no queueing into free FIFO banks here; everything goes through usb_send_async()
+extern "C" uint32_t usb_send_async_nb(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length)
+{
+    return 0;
+}
+
 extern "C" uint32_t usb_recv(uint8_t ep, uint8_t* packet, uint32_t length)
 {
     return usbhw.recv(ep, packet, length);
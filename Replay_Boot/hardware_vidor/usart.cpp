@@ -18,7 +18,7 @@
 
 // for RX, we use a software ring buffer as we are interested in any character
 // as soon as it is received.
-#define RXBUFLEN 16
+#define RXBUFLEN 1024
 #define RXBUFMASK (RXBUFLEN-1)
 volatile uint8_t USART_rxbuf[RXBUFLEN];
 volatile int16_t USART_rxptr, USART_rdptr;
@@ -63,10 +63,12 @@ void USART_Init(unsigned long baudrate)
 
 void USART_update(void)
 {
-    char data[RXBUFLEN];
+    char data[64];
     ssize_t length = -1;
+    // leave anything that doesn't fit in the ring in the Serial1 buffer
+    size_t space = RXBUFLEN - 1 - USART_CharAvail();
 
-    length = read(data, RXBUFLEN);
+    length = read(data, space < sizeof(data) ? space : sizeof(data));
 
     if (length == -1) {
         return;
@@ -93,6 +95,15 @@ void USART_Putc(void*, char c)
 #endif
 }
 
+void USART_Flush(void)
+{
+    Serial1.flush();
+}
+
+void USART_Write(const uint8_t* data, uint16_t length)
+{
+    Serial1.write(data, length);
+}
 
 uint8_t USART_GetValid(void)
 {
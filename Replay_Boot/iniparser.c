@@ -65,6 +65,7 @@ const ini_symtab_t symtab[] = {
     {.keyword = "HOTKEY",       .token = INI_HOTKEY,       .section = FALSE },
     {.keyword = "KEYBOARD",     .token = INI_KEYB_MODE,    .section = FALSE },
     {.keyword = "CLOCKMON",     .token = INI_CLOCKMON,     .section = FALSE },
+    {.keyword = "DRAMTEST",     .token = INI_DRAMTEST,     .section = FALSE },
     {.keyword = "VIDEO",        .token = INI_VIDEO,        .section = FALSE },
     {.keyword = "CONFIG",       .token = INI_CONFIG,       .section = FALSE },
     {.keyword = "CSTORE",       .token = INI_CSTORE,       .section = FALSE },
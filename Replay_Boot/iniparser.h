@@ -31,6 +31,7 @@ typedef enum {
     INI_HOTKEY,          ///< token for HOTKEY keyword (keyboard menu/reset/etc key combo)
     INI_KEYB_MODE,       ///< token for Keyboard Mode keyword (OBSOLETE!)
     INI_CLOCKMON,        ///< toekn for CLOCKMON enable (dynamic switch of vid clock)
+    INI_DRAMTEST,        ///< token for DRAMTEST keyword (DRAM test mode at core start)
     INI_VIDEO,           ///< token for VIDEO keyword (video DAC configuration)
     INI_CONFIG,          ///< token for CONFIG keyword (config bits for FPGA/OSD)
     INI_CSTORE,          ///< token for CSTORE keyword (filename to store dynamic config part)
@@ -34,6 +34,7 @@
 #include "menu.h"
 #include "osd.h"
 #include "messaging.h"
+#include "xfer.h"
 #include <stdio.h>
 #undef printf
 #undef sprintf
@@ -197,6 +198,7 @@ int main(void)
 
     // register file system handlers
     FF_RegisterBlkDevice(pIoman, 512, (FF_WRITE_BLOCKS) Card_WriteM, (FF_READ_BLOCKS) Card_ReadM, NULL);
+    FF_RegisterBlkErase(pIoman, (FF_ERASE_BLOCKS) Card_Erase);
 
     DEBUG(1, "");
 
@@ -484,6 +486,15 @@ static __attribute__ ((noinline)) void main_update()
 
     USB_Update(&current_status);
 
+    Card_Update();
+
+    if (current_status.fs_mounted_ok) {
+        FF_ScanFreeClusters(pIoman, 4);
+    }
+
+    // serial transfers take what they need from the USART before the keys do
+    XFER_Update();
+
     // get keys (from Replay button, RS232 or PS/2 via OSD/FPGA)
     key = OSD_GetKeyCode(&current_status);
 
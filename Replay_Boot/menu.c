@@ -328,8 +328,16 @@ static uint8_t _MENU_action_menu_execute(menuitem_t* item, status_t* current_sta
     // mount sdcard over usb -------------------
     else if MATCH(item->action_name, "mountmsc") {
         MENU_set_state(current_status, POPUP_MENU);
-        strcpy(current_status->popup_msg, "This will unmount all images!");
-        current_status->popup_msg2 = "Continue?";
+        if (current_status->fs_mounted_ok) {
+            // shared with the running core (see USB_MountMassStorage)
+            strcpy(current_status->popup_msg, "Share card with USB host?");
+            current_status->popup_msg2 = "(read-only if images open)";
+
+        } else {
+            strcpy(current_status->popup_msg, "Mount card over USB?");
+            current_status->popup_msg2 = "Continue?";
+        }
+
         current_status->selections = MENU_POPUP_YESNO;
         current_status->selected = 0;
         current_status->update = 1;
@@ -358,7 +366,7 @@ static uint8_t _MENU_action_menu_execute(menuitem_t* item, status_t* current_sta
         // open file browser
         strcpy(current_status->act_dir, "/");
         // search for INI files
-        static const file_ext_t ini_ext[2] = { {"S19"}, {"\0"} };
+        static const file_ext_t ini_ext[3] = { {"S19"}, {"FW"}, {"\0"} };
         Filesel_Init(current_status->dir_scan, current_status->act_dir, ini_ext);
         // initialize browser
         Filesel_ScanFirst(current_status->dir_scan);
@@ -620,8 +628,10 @@ void MENU_init_ui(status_t* current_status)
     OSD_SetPage(1);
     OSD_Clear();
 
+    // menu frames are composed in RAM and only the changed rows are sent,
+    // so page 0 is used all the time
     OSD_SetDisplay(0);
-    OSD_SetPage(1);
+    OSD_SetPage(0);
 
     // clean up display flags
     MENU_set_state(current_status, NO_MENU);
@@ -818,6 +828,9 @@ void _MENU_show_file_browser(status_t* current_status)
     char* filename;
     FILEENTRY entry;
 
+    // a seek that is rebuilding the list has to complete before it is shown
+    Filesel_SeekWait(current_status->dir_scan);
+
     // show filter in header
     uint8_t sel = Filesel_GetSel(current_status->dir_scan);
 
@@ -831,6 +844,14 @@ void _MENU_show_file_browser(status_t* current_status)
         OSD_WriteRC(1, 0, s, 0, WHITE, DARK_BLUE);
     }
 
+    if (current_status->typeahead) {
+        char s[OSDMAXLEN + 1];
+        size_t len = strlen(current_status->dir_scan->seek_prefix);
+        s[0] = '>';
+        memcpy(s + 1, current_status->dir_scan->seek_prefix, len + 1);
+        OSD_WriteRC(1, OSDLINELEN - 1 - len, s, 0, WHITE, DARK_BLUE);
+    }
+
     // show file/directory list
     if (current_status->dir_scan->total_entries == 0) {
         // nothing there
@@ -1172,32 +1193,72 @@ static uint8_t key_action_menu_protect(status_t* current_status, const uint16_t
 
 
 
+// holding up/down first steps one entry, then a few, then a page at a time
+#define REPEAT_FAST     8   // repeated key events before stepping REPEAT_STEP entries
+#define REPEAT_PAGE     24  // repeated key events before stepping whole pages
+#define REPEAT_STEP     3
+
+#define TYPEAHEAD_TIMEOUT 1000  // ms after the last key before the type-ahead prefix starts over
+
+static uint8_t _MENU_filebrowser_move(status_t* current_status, const uint16_t key,
+                                      uint8_t opt, uint8_t page_opt)
+{
+    static uint8_t repeats = 0;
+    uint8_t steps = 1;
+
+    Filesel_SeekCancel(current_status->dir_scan);
+
+    if (!(key & KF_REPEATED)) {
+        repeats = 0;
+
+    } else if (repeats < REPEAT_PAGE) {
+        repeats++;
+    }
+
+    if (repeats >= REPEAT_PAGE) {
+        Filesel_Update(current_status->dir_scan, page_opt);
+        return 1;
+    }
+
+    if (repeats >= REPEAT_FAST) {
+        steps = REPEAT_STEP;
+    }
+
+    while (steps--) {
+        Filesel_Update(current_status->dir_scan, opt);
+    }
+
+    return 1;
+}
+
 static uint8_t key_action_filebrowser_left(status_t* current_status, const uint16_t key)
 {
+    Filesel_SeekCancel(current_status->dir_scan);
     Filesel_Update(current_status->dir_scan, SCAN_PREV_PAGE);
     return 1; // update
 }
 
 static uint8_t key_action_filebrowser_right(status_t* current_status, const uint16_t key)
 {
+    Filesel_SeekCancel(current_status->dir_scan);
     Filesel_Update(current_status->dir_scan, SCAN_NEXT_PAGE);
     return 1; // update
 }
 
 static uint8_t key_action_filebrowser_up(status_t* current_status, const uint16_t key)
 {
-    Filesel_Update(current_status->dir_scan, SCAN_PREV);
-    return 1;
+    return _MENU_filebrowser_move(current_status, key, SCAN_PREV, SCAN_PREV_PAGE);
 }
 
 static uint8_t key_action_filebrowser_down(status_t* current_status, const uint16_t key)
 {
-    Filesel_Update(current_status->dir_scan, SCAN_NEXT);
-    return 1;
+    return _MENU_filebrowser_move(current_status, key, SCAN_NEXT, SCAN_NEXT_PAGE);
 }
 
 static uint8_t key_action_filebrowser_enter(status_t* current_status, const uint16_t key)
 {
+    Filesel_SeekCancel(current_status->dir_scan);
+
     FILEENTRY mydir = Filesel_GetEntry(current_status->dir_scan, current_status->dir_scan->sel);
 
     if (mydir.Attrib & FF_FAT_ATTR_DIR) {
@@ -1236,7 +1297,24 @@ static uint8_t key_action_filebrowser_esc(status_t* current_status, const uint16
 
 static uint8_t key_action_filebrowser_back(status_t* current_status, const uint16_t key)
 {
-    Filesel_DelFilterChar(current_status->dir_scan);
+    tDirScan* dir_scan = current_status->dir_scan;
+
+    // while typing ahead backspace edits the prefix
+    if (current_status->typeahead) {
+        size_t len = strlen(dir_scan->seek_prefix);
+
+        if (len) {
+            char prefix[sizeof(dir_scan->seek_prefix)];
+            _strlcpy(prefix, dir_scan->seek_prefix, len);
+            Filesel_SeekCancel(dir_scan);
+            Filesel_SeekPrefix(dir_scan, prefix);
+            current_status->typeahead_timer = Timer_Get(TYPEAHEAD_TIMEOUT);
+        }
+
+        return 1;
+    }
+
+    Filesel_DelFilterChar(dir_scan);
     // keep grace period here before re-scanning - user might be typing..
     current_status->filescan_timer = Timer_Get(250);
     current_status->delayed_filescan = 1;
@@ -1250,17 +1328,49 @@ static uint8_t key_action_filebrowser_home(status_t* current_status, const uint1
     return 1;
 }
 
+static uint8_t key_action_filebrowser_end(status_t* current_status, const uint16_t key)
+{
+    Filesel_ScanLast(current_status->dir_scan);
+    return 1;
+}
 
 static uint8_t key_action_filebrowser_default(status_t* current_status, const uint16_t key)
 {
-    if ( ((key >= '0') && (key <= '9')) || ((key >= 'A') && (key <= 'Z')) ) {
-        Filesel_AddFilterChar(current_status->dir_scan, key & 0x7F);
+    const uint16_t c = key & ~KF_SHIFT;
+
+    if ( !((c >= '0') && (c <= '9')) && !((c >= 'A') && (c <= 'Z')) ) {
+        return 0;
+    }
+
+    if (key & KF_SHIFT) {
+        Filesel_AddFilterChar(current_status->dir_scan, c & 0x7F);
         // keep grace period here before re-scanning - user might be typing..
         current_status->filescan_timer = Timer_Get(250);
         current_status->delayed_filescan = 1;
+        return 0;
     }
 
-    return 0;
+    // type-ahead; keys typed in quick succession extend the prefix
+    tDirScan* dir_scan = current_status->dir_scan;
+    char prefix[sizeof(dir_scan->seek_prefix)];
+    size_t len = 0;
+
+    if (current_status->typeahead) {
+        _strlcpy(prefix, dir_scan->seek_prefix, sizeof(prefix));
+        len = strlen(prefix);
+    }
+
+    if (len < sizeof(prefix) - 1) {
+        prefix[len] = c & 0x7F;
+        prefix[len + 1] = 0;
+    }
+
+    Filesel_SeekCancel(dir_scan);
+    Filesel_SeekPrefix(dir_scan, prefix);
+
+    current_status->typeahead = 1;
+    current_status->typeahead_timer = Timer_Get(TYPEAHEAD_TIMEOUT);
+    return 1; // show the prefix
 }
 
 
@@ -1364,6 +1474,7 @@ const tKeyMapping keymappings_filebrowser[] = {
     {.mask = KEY_MASK, .key = KEY_ESC,   .action = key_action_filebrowser_esc},
     {.mask = KEY_MASK, .key = KEY_BACK,  .action = key_action_filebrowser_back},
     {.mask = KEY_MASK, .key = KEY_HOME,  .action = key_action_filebrowser_home},
+    {.mask = KEY_MASK, .key = KEY_END,   .action = key_action_filebrowser_end},
     {.mask = KEY_MASK_ASCII, .key = 0,   .action = key_action_filebrowser_default}
 };
 
@@ -1529,6 +1640,16 @@ uint8_t MENU_handle_ui(const uint16_t key, status_t* current_status)
         update = 1;
     }
 
+    // type-ahead seeks look at a few directory entries per call
+    if (current_status->menu_state == FILE_BROWSER) {
+        update |= Filesel_SeekUpdate(current_status->dir_scan, FILESEL_SEEK_BUDGET);
+
+        if (current_status->typeahead && Timer_Check(current_status->typeahead_timer)) {
+            current_status->typeahead = 0;
+            update = 1; // remove the prefix from the header
+        }
+    }
+
     if (current_status->menu_state == SHOW_STATUS) {
         static uint32_t last_rate = 0;
         uint32_t refresh_rate = OSD_GetVerticalRefreshRate();
@@ -1538,10 +1659,9 @@ uint8_t MENU_handle_ui(const uint16_t key, status_t* current_status)
 
     // update menu if needed
     if (update) {
+        OSD_BeginFrame();
         _MENU_update_ui(current_status);
-
-        OSD_SetDisplay(OSD_GetPage()); //  OSD_GetPage());
-        OSD_SetPage(OSD_NextPage());   //  OSD_NextPage());
+        OSD_EndFrame();
 
         scroll_timer = Timer_Get(1000); // restart scroll timer
         scroll_started = 0;
@@ -23,6 +23,7 @@
 #include "hardware/timer.h"
 #include "messaging.h"
 #include "config.h"
+#include "xfer.h"
 
 #if defined(ARDUINO_SAMD_MKRVIDOR4000)
 #include "hardware_vidor/usbhid.h"
@@ -135,6 +136,14 @@ static void _OSD_SendKey(uint8_t key);
 uint8_t osd_vscroll = 0;
 uint8_t osd_page = 0;
 
+// menu frame composed in RAM (character/attribute pairs as sent over SPI),
+// and what was last sent to the displayed page
+#define OSD_ROWBYTES (OSDLINELEN * 2)
+static uint8_t  osd_frame[OSDNLINE][OSD_ROWBYTES];
+static uint8_t  osd_shown[OSDNLINE][OSD_ROWBYTES];
+static uint16_t osd_shown_valid = 0;    // bit per row, cleared by direct writes
+static uint8_t  osd_compose = FALSE;
+
 /*static*/ volatile uint32_t vbl_counter = 0;
 static volatile uint32_t time_elapsed = 0;
 static volatile uint32_t refresh_rate = 0;
@@ -175,6 +184,46 @@ void OSD_WriteRCt(uint8_t row, uint8_t col, const char* s, uint8_t maxlen, uint8
 }
 
 
+static inline void _OSD_ComposeChar(uint8_t row, uint8_t col, uint8_t c, uint8_t attrib)
+{
+    // anything beyond the visible page is dropped
+    if (col < OSDLINELEN) {
+        osd_frame[row][col * 2]     = c;
+        osd_frame[row][col * 2 + 1] = attrib;
+    }
+}
+
+// OSD_WriteBase() into the RAM frame, same semantics as the SPI version
+static void _OSD_ComposeBase(uint8_t row, uint8_t col, const char* s, uint8_t maxlen, uint8_t attrib, uint8_t clear)
+{
+    uint16_t i = 0;
+    uint8_t pos = col;
+    uint8_t b;
+
+    while ((b = *s++)) {
+        if (b == 0x0D || b == 0x0A) {
+            if (++row >= OSDNLINE) {
+                row = 0;
+            }
+
+            pos = col;
+
+        } else {
+            _OSD_ComposeChar(row, pos++, b, attrib);
+
+            if (++i == maxlen) {
+                break;
+            }
+        }
+    }
+
+    if (clear) {
+        for (; i < OSDLINELEN; i++) {
+            _OSD_ComposeChar(row, pos++, 0x20, attrib);
+        }
+    }
+}
+
 // write a null-terminated string <s> to the OSD buffer starting at line row, col. If maxlen non zero, truncate string to maxlen chars
 void OSD_WriteBase(uint8_t row, uint8_t col, const char* s, uint8_t maxlen, uint8_t invert, tOSDColor fg_col, tOSDColor bg_col, uint8_t clear )
 {
@@ -199,6 +248,13 @@ void OSD_WriteBase(uint8_t row, uint8_t col, const char* s, uint8_t maxlen, uint
 
 #endif
 
+    if (osd_compose) {
+        _OSD_ComposeBase(row, col, s, maxlen, attrib, clear);
+        return;
+    }
+
+    osd_shown_valid = 0;
+
     // select OSD SPI device
     SPI_EnableOsd();
     rSPI(OSDCMD_WRITE | (row & 0x3F));
@@ -330,6 +386,9 @@ void OSD_WriteScroll(uint8_t row, const char* text, uint16_t pos, uint16_t len,
         strncpy(s + remaining + OSD_SCROLL_BLANKSPACE, text, OSDMAXLEN + 1 - remaining - OSD_SCROLL_BLANKSPACE);
     }
 
+    // the next frame restores this row (and its offset)
+    osd_shown_valid &= ~(1 << row);
+
     SPI_EnableOsd();
     rSPI(OSDCMD_WRITE | (row & 0x3F));
     rSPI(0); // col
@@ -353,6 +412,19 @@ void OSD_Clear(void)
     DEBUG(1, "OsdClear");
 #endif
 
+    if (osd_compose) {
+        for (row = 0; row < OSDNLINE; row++) {
+            for (n = 0; n < OSDLINELEN; n++) {
+                osd_frame[row][n * 2]     = 0x20;
+                osd_frame[row][n * 2 + 1] = 0x0F;
+            }
+        }
+
+        return;
+    }
+
+    osd_shown_valid = 0;
+
     for (row = 0; row < OSDNLINE; row++) {
         SPI_EnableOsd();
         rSPI(OSDCMD_WRITE | (row & 0x3F));
@@ -371,6 +443,54 @@ void OSD_Clear(void)
     osd_vscroll = 0;
 }
 
+// Redirect all OSD writes into the RAM frame until OSD_EndFrame()
+void OSD_BeginFrame(void)
+{
+    osd_compose = TRUE;
+}
+
+// Send the rows that differ from what is on screen, in one go right after the vertical blank
+void OSD_EndFrame(void)
+{
+    uint16_t dirty = 0;
+    uint8_t row;
+
+    osd_compose = FALSE;
+
+    for (row = 0; row < OSDNLINE; row++) {
+        if (!(osd_shown_valid & (1 << row)) || memcmp(osd_frame[row], osd_shown[row], OSD_ROWBYTES)) {
+            dirty |= 1 << row;
+        }
+    }
+
+    if (!dirty) {
+        return;
+    }
+
+    OSD_WaitVBL();
+
+    for (row = 0; row < OSDNLINE; row++) {
+        if (!(dirty & (1 << row))) {
+            continue;
+        }
+
+        SPI_EnableOsd();
+        rSPI(OSDCMD_WRITE | (row & 0x3F));
+        rSPI(osd_page * OSDLINELEN);
+        SPI_WriteBufferSingle(osd_frame[row], OSD_ROWBYTES);
+        SPI_DisableOsd();
+
+        // unknown rows may have been scrolled
+        if (!(osd_shown_valid & (1 << row))) {
+            OSD_SetHOffset(row, osd_page * OSDLINELEN, 0);
+        }
+
+        memcpy(osd_shown[row], osd_frame[row], OSD_ROWBYTES);
+    }
+
+    osd_shown_valid = (1 << OSDNLINE) - 1;
+}
+
 void OSD_WaitVBL(void)
 {
     IO_WaitVBL();
@@ -616,6 +736,86 @@ uint16_t OSD_ConvFlags(uint8_t keycode1, uint8_t keycode2, uint8_t keycode3)
     return 0;
 }
 
+//
+// PS/2 scancode ring
+//
+// Scancodes are drained from the FPGA as soon as possible (OSD_PollKeyboard is
+// cheap and also called from long running loops) and only assembled into key
+// codes by OSD_GetKeyCode. Each entry remembers whether it arrived after a
+// PS2DELAY gap, so the sequence timeout is based on arrival time rather than
+// on how late the main loop gets around to decoding.
+//
+#define PS2_RING_SIZE   64          // power of two
+#define PS2_POLL_MAX    16          // max scancodes drained per poll
+#define PS2_GAP         0x100       // entry flag: arrived after a PS2DELAY gap
+
+static struct {
+    uint16_t data[PS2_RING_SIZE];
+    uint8_t head;                   // write position
+    uint8_t tail;                   // read position
+    uint8_t enabled;                // OSD available; set by OSD_GetKeyCode
+    HARDWARE_TICK timeout;          // PS2DELAY after the last scancode
+    uint32_t dropped;
+} ps2_ring;
+
+uint8_t OSD_PS2Push(uint8_t code)
+{
+    const uint16_t entry = code | (Timer_Check(ps2_ring.timeout) ? PS2_GAP : 0);
+
+    ps2_ring.timeout = Timer_Get(PS2DELAY);
+
+    if ((uint8_t)(ps2_ring.head - ps2_ring.tail) == PS2_RING_SIZE) {
+        if (!ps2_ring.dropped++) {
+            WARNING("PS2:Scancode buffer overflow");
+        }
+
+        return FALSE;
+    }
+
+    ps2_ring.data[ps2_ring.head++ & (PS2_RING_SIZE - 1)] = entry;
+    return TRUE;
+}
+
+static uint8_t OSD_PS2Pop(uint16_t* entry)
+{
+    if (ps2_ring.head == ps2_ring.tail) {
+        return FALSE;
+    }
+
+    *entry = ps2_ring.data[ps2_ring.tail++ & (PS2_RING_SIZE - 1)];
+    return TRUE;
+}
+
+uint32_t OSD_PS2Dropped(void)
+{
+    return ps2_ring.dropped;
+}
+
+void OSD_PollKeyboard(void)
+{
+    if (!ps2_ring.enabled) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < PS2_POLL_MAX; ++i) {
+        SPI_EnableOsd();
+        rSPI(OSDCMD_READSTAT);
+        uint8_t stat = rSPI(0);
+        SPI_DisableOsd();
+
+        if (!(stat & STF_NEWKEY)) {
+            break;
+        }
+
+        SPI_EnableOsd();
+        rSPI(OSDCMD_READKBD);
+        uint8_t code = rSPI(0);
+        SPI_DisableOsd();
+
+        OSD_PS2Push(code);
+    }
+}
+
 uint16_t OSD_GetKeyCode(status_t* current_status)
 {
     const uint8_t osd_enabled   = current_status ? current_status->spi_osd_enabled : 1;
@@ -633,8 +833,8 @@ uint16_t OSD_GetKeyCode(status_t* current_status)
     uint16_t key_break = 0;
     uint16_t key_code = 0;
 
-    static HARDWARE_TICK ps2_delay = 0;
     static HARDWARE_TICK ps2_flags_delay = 0;
+    uint8_t decode = FALSE;
 
     static uint8_t keybuf[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // max. amount of codes with one keypress (PAUSE key)
     static uint16_t keypos = 0;
@@ -666,47 +866,16 @@ uint16_t OSD_GetKeyCode(status_t* current_status)
         button_pressed = 0;
     }
 
-    // check and buffer keycodes from FPGA (if available)
+    // drain keycodes from FPGA into the ring buffer (if available)
     // ---------------------------------------------------
-    if (osd_enabled) {
-        SPI_EnableOsd();
-        rSPI(OSDCMD_READSTAT);
-        x = rSPI(0);
-        SPI_DisableOsd();
-
-        if (x & STF_NEWKEY) {
-            SPI_EnableOsd();
-            rSPI(OSDCMD_READKBD);
-            x = rSPI(0);
-            SPI_DisableOsd();
-
-            keybuf[keypos++] = x;
-            ps2_delay = Timer_Get(PS2DELAY);
-
-            if (keypos == 1) {
-                DEBUG(3, "ps2: %d: %02x", keypos, keybuf[0]);
-            }
+    ps2_ring.enabled = osd_enabled;
 
-            if (keypos == 2) {
-                DEBUG(3, "ps2: %d: %02x %02x", keypos, keybuf[0], keybuf[1]);
-            }
-
-            if (keypos == 3) {
-                DEBUG(3, "ps2: %d: %02x %02x %02x", keypos, keybuf[0], keybuf[1], keybuf[2]);
-            }
-
-            if (keypos == 4) {
-                DEBUG(3, "ps2: %d: %02x %02x %02x %02x", keypos, keybuf[0], keybuf[1], keybuf[2], keybuf[3]);
-            }
-
-        } else if (keypos && Timer_Check(ps2_delay)) {
-            // we clean up the buffer on a timeout
-            DEBUG(3, "ps2: timeout %d: %02x, %02x, %02x, %02x, %02x, %02x, %02x, %02x", keypos, keybuf[0], keybuf[1], keybuf[2], keybuf[3], keybuf[4], keybuf[5], keybuf[6], keybuf[7]);
-            keypos = 0;
-        }
+    if (osd_enabled) {
+        OSD_PollKeyboard();
 
     } else {
         // clean up if no OSD available
+        ps2_ring.tail = ps2_ring.head;
         keypos = 0;
     }
 
@@ -734,15 +903,37 @@ uint16_t OSD_GetKeyCode(status_t* current_status)
                 }
 
             }
+
+            decode = TRUE;
         }
     }
 
 #endif
 
-    // process key buffer
+    // process key buffer, one scancode at a time
     // ---------------------------------------------------
-    if (keypos && (!key_code)) { // menu push button takes priority
+    while (!key_code) { // menu push button takes priority
         uint16_t ignored_keys = 0;
+        uint16_t entry;
+
+        key_break = 0;
+
+        if (!decode) {
+            if (!OSD_PS2Pop(&entry)) {
+                break;
+            }
+
+            if (keypos && ((entry & PS2_GAP) || keypos == sizeof(keybuf))) {
+                // we clean up the buffer on a timeout
+                DEBUG(3, "ps2: timeout %d: %02x, %02x, %02x, %02x, %02x, %02x, %02x, %02x", keypos, keybuf[0], keybuf[1], keybuf[2], keybuf[3], keybuf[4], keybuf[5], keybuf[6], keybuf[7]);
+                keypos = 0;
+            }
+
+            keybuf[keypos++] = (uint8_t)entry;
+            DEBUG(3, "ps2: %d: %02x", keypos, keybuf[keypos - 1]);
+        }
+
+        decode = FALSE;
 
         // break sequence (key release)
         if ((keybuf[1] == 0xF0) && (keypos == 3)) {
@@ -870,6 +1061,12 @@ uint16_t OSD_GetKeyCode(status_t* current_status)
         }
     }
 
+    if (keypos && !key_code && ps2_ring.head == ps2_ring.tail && Timer_Check(ps2_ring.timeout)) {
+        // nothing more arrived in time; drop the incomplete sequence
+        DEBUG(3, "ps2: timeout %d: %02x, %02x, %02x, %02x, %02x, %02x, %02x, %02x", keypos, keybuf[0], keybuf[1], keybuf[2], keybuf[3], keybuf[4], keybuf[5], keybuf[6], keybuf[7]);
+        keypos = 0;
+    }
+
     if (key_flags && Timer_Check(ps2_flags_delay)) {
         key_flags = 0;
         old_key_code = 0;
@@ -886,6 +1083,10 @@ uint16_t OSD_GetKeyCode(status_t* current_status)
         return 0;
     }
 
+    if (XFER_Active()) {
+        return 0;
+    }
+
     if (USART_Peekc() != 0x1b) {
         // Not in, or starting new, ESC sequence
         key_code = USART_Getc();
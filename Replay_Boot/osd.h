@@ -176,6 +176,8 @@ void OSD_SetDisplayScroll(uint8_t page);
 void OSD_WriteScroll(uint8_t row, const char* text, uint16_t pos, uint16_t len, uint8_t invert, tOSDColor fg_col, tOSDColor bg_col);
 
 void OSD_Clear(void);
+void OSD_BeginFrame(void);
+void OSD_EndFrame(void);
 void OSD_Enable(unsigned char mode);
 void OSD_Disable(void);
 void OSD_Reset(unsigned char option);
@@ -200,6 +202,9 @@ uint8_t OSD_ConvPosx(uint8_t keycode);
 uint16_t OSD_ConvFlags(uint8_t keycode1, uint8_t keycode2, uint8_t keycode3);
 
 uint16_t OSD_GetKeyCode(status_t* current_status);
+void OSD_PollKeyboard(void);
+uint8_t OSD_PS2Push(uint8_t code);
+uint32_t OSD_PS2Dropped(void);
 
 uint16_t OSD_GetKeyCodeFromString(const char* string);
 const char* OSD_GetStringFromKeyCode(uint16_t keycode);
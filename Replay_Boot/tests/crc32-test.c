@@ -0,0 +1,159 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+// Checks CRC32_Update against values produced by zlib's crc32() and against
+// the bit-at-a-time loop it replaced, then measures its throughput.
+
+#include "board.h"
+#include "crc32.h"
+#include "messaging.h"
+#include "hardware/timer.h"
+
+#define SETUP_TEST \
+    DEBUG(0, "%s start", __FUNCTION__);
+#define TEAR_DOWN \
+    DEBUG(0, "%s done.", __FUNCTION__);
+#define EXPECT(a,b) \
+    { \
+        if ((a) == (b)) \
+            DEBUG(0, "\t%s == %s OK", #a, #b); \
+        else \
+            DEBUG(0, "FAIL:\t%s == %s FAILED! (%08lx != %08lx)", #a, #b, (uint32_t)(a), (uint32_t)(b)); \
+    }
+
+#define BUFFER_SIZE     4096
+#define SPEED_BYTES     (1024 * 1024)
+
+static uint8_t buffer[BUFFER_SIZE];
+
+// the previous implementation (flash.c feed_crc32), used as reference
+static uint32_t BitwiseCrc32(uint32_t crc, const uint8_t* data, uint32_t length)
+{
+    crc = ~crc;
+
+    while (length--) {
+        crc ^= *data++;
+
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static void FillBuffer(void)
+{
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < BUFFER_SIZE; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        buffer[i] = seed >> 24;
+    }
+}
+
+static uint32_t Crc32String(const char* s)
+{
+    return CRC32_Update(CRC32_INIT, s, strlen(s));
+}
+
+static void TEST_KnownValues()
+{
+    SETUP_TEST;
+
+    // expected values are zlib.crc32() of the same input
+    EXPECT(Crc32String(""), 0x00000000);
+    EXPECT(Crc32String("a"), 0xe8b7be43);
+    EXPECT(Crc32String("abc"), 0x352441c2);
+    EXPECT(Crc32String("123456789"), 0xcbf43926);
+    EXPECT(Crc32String("The quick brown fox jumps over the lazy dog"), 0x414fa339);
+    EXPECT(CRC32_Update(CRC32_INIT, buffer, BUFFER_SIZE), 0x5b24a61a);
+
+    TEAR_DOWN;
+}
+
+static void TEST_Incremental()
+{
+    SETUP_TEST;
+
+    const uint32_t whole = CRC32_Update(CRC32_INIT, buffer, BUFFER_SIZE);
+    uint32_t errors = 0;
+
+    // every split point and every (unaligned) length up to 64 bytes
+    for (uint32_t split = 0; split <= 64; ++split) {
+        uint32_t crc = CRC32_Update(CRC32_INIT, buffer, split);
+        crc = CRC32_Update(crc, buffer + split, BUFFER_SIZE - split);
+        errors += (crc != whole);
+
+        errors += (CRC32_Update(CRC32_INIT, buffer + 3, split) != BitwiseCrc32(0, buffer + 3, split));
+    }
+
+    // odd sized pieces, as the flash / DRAM verification feeds them
+    uint32_t crc = CRC32_INIT;
+
+    for (uint32_t pos = 0, len = 1; pos < BUFFER_SIZE; pos += len, len = len * 3 + 1) {
+        if (len > BUFFER_SIZE - pos) {
+            len = BUFFER_SIZE - pos;
+        }
+
+        crc = CRC32_Update(crc, buffer + pos, len);
+    }
+
+    EXPECT(crc, whole);
+    EXPECT(errors, 0);
+    EXPECT(BitwiseCrc32(0, buffer, BUFFER_SIZE), whole);
+
+    TEAR_DOWN;
+}
+
+static void TEST_Speed()
+{
+    SETUP_TEST;
+
+    uint32_t crc = CRC32_INIT;
+    HARDWARE_TICK t0 = Timer_Get(0);
+
+    for (uint32_t i = 0; i < SPEED_BYTES / BUFFER_SIZE; ++i) {
+        crc = CRC32_Update(crc, buffer, BUFFER_SIZE);
+    }
+
+    uint32_t t_table = Timer_Convert(Timer_Get(0) - t0);
+
+    t0 = Timer_Get(0);
+
+    for (uint32_t i = 0; i < SPEED_BYTES / BUFFER_SIZE; ++i) {
+        crc = BitwiseCrc32(crc, buffer, BUFFER_SIZE);
+    }
+
+    uint32_t t_bitwise = Timer_Convert(Timer_Get(0) - t0);
+
+    DEBUG(0, "\ttable   : %d KB in %d ms (%d KB/s)", SPEED_BYTES / 1024, t_table,
+          t_table ? SPEED_BYTES / t_table * 1000 / 1024 : 0);
+    DEBUG(0, "\tbitwise : %d KB in %d ms (%d KB/s)", SPEED_BYTES / 1024, t_bitwise,
+          t_bitwise ? SPEED_BYTES / t_bitwise * 1000 / 1024 : 0);
+    DEBUG(3, "\t(crc %08lx)", crc);
+
+    TEAR_DOWN;
+}
+
+void RunCRC32Tests()
+{
+    FillBuffer();
+
+    TEST_KnownValues();
+    TEST_Incremental();
+    TEST_Speed();
+}
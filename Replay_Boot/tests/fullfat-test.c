@@ -74,6 +74,7 @@ static void TEST_Setup()
 
     TIME(pIoman = FF_CreateIOMAN(fatBuf, FS_FATBUF_SIZE, 512, &error));
     CHECK(FF_RegisterBlkDevice(pIoman, 512, (FF_WRITE_BLOCKS) Card_WriteM, (FF_READ_BLOCKS) Card_ReadM, NULL));
+    CHECK(FF_RegisterBlkErase(pIoman, (FF_ERASE_BLOCKS) Card_Erase));
     CHECK(FF_MountPartition(pIoman, 0));
 
     TEAR_DOWN;
@@ -340,6 +341,50 @@ static void TEST_RmFiles()
     TEAR_DOWN;
 }
 
+// a removed file's clusters are discarded (FF_USE_TRIM -> Card_Erase)
+static void TEST_TrimOnRemove()
+{
+    SETUP_TEST;
+
+    const char* filename = "/fullfat-test/trim.bin";
+    FF_FILE* pFile = NULL;
+    TIME(pFile = FF_Open(pIoman, filename, FF_MODE_WRITE | FF_MODE_CREATE | FF_MODE_TRUNCATE, &error));
+
+    memset(buffer, 0xa5, sizeof(buffer));
+
+    for (int kb = 0; kb < 64; kb++) {
+        FF_Write(pFile, 1, sizeof(buffer), buffer);
+    }
+
+    const FIL* fp = (const FIL*)pFile;
+    const FF_T_UINT32 sector = fp->obj.fs->database + (fp->obj.sclust - 2) * fp->obj.fs->csize;
+    const FF_T_UINT32 numSectors = 64 * sizeof(buffer) / 512;
+    CHECK(FF_Close(pFile));
+
+    CHECK(Card_ReadM(buffer, sector + numSectors - 1, 1, NULL));
+    EXPECT(buffer[511], 0xa5);
+
+    CHECK(FF_RmFile(pIoman, filename));
+
+    uint32_t erased = 0;
+
+    for (FF_T_UINT32 i = 0; i < numSectors; ++i) {
+        Card_ReadM(buffer, sector + i, 1, NULL);
+
+        // erased blocks read back as all zeroes or all ones, depending on the card
+        uint32_t n = 0;
+
+        while (n < 512 && buffer[n] == buffer[0] && (buffer[0] == 0x00 || buffer[0] == 0xff)) {
+            n++;
+        }
+
+        erased += (n == 512);
+    }
+
+    EXPECT(erased, numSectors);
+
+    TEAR_DOWN;
+}
 
 void RunFullFatTests()
 {
@@ -366,6 +411,7 @@ void RunFullFatTests()
         TIME(TEST_MkDir());
         TIME(TEST_OpenWriteClose());
         TIME(TEST_CheckOpenReadClose());
+        TIME(TEST_TrimOnRemove());
         TIME(TEST_RmFiles());
         TIME(TEST_RmDir());
         TIME(TEST_RmDirTree());
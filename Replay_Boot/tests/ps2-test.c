@@ -0,0 +1,181 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+// Feeds scancode streams straight into the PS/2 ring buffer (as if the main
+// loop had been busy while they arrived) and checks every key comes out.
+
+#include "board.h"
+#include "osd.h"
+#include "messaging.h"
+#include "hardware/timer.h"
+
+#define SETUP_TEST \
+    DEBUG(0, "%s start", __FUNCTION__);
+#define TEAR_DOWN \
+    DEBUG(0, "%s done.", __FUNCTION__);
+#define EXPECT(a,b) \
+    { \
+        if ((a) == (b)) \
+            DEBUG(0, "\t%s == %s OK", #a, #b); \
+        else \
+            DEBUG(0, "FAIL:\t%s == %s FAILED! (%04x != %04x)", #a, #b, (a), (b)); \
+    }
+
+#define SC_A        0x1c
+#define SC_UP       0x75
+#define SC_LSHIFT   0x12
+
+static uint16_t keys[64];
+
+static void PushStream(const uint8_t* stream, uint32_t length, uint32_t repeat)
+{
+    while (repeat--) {
+        for (uint32_t i = 0; i < length; ++i) {
+            OSD_PS2Push(stream[i]);
+        }
+    }
+}
+
+static uint32_t CollectKeys(void)
+{
+    uint32_t count = 0;
+    uint16_t key;
+
+    while ((key = OSD_GetKeyCode(NULL)) != 0) {
+        if (count < sizeof(keys) / sizeof(keys[0])) {
+            keys[count] = key;
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+static void TEST_MakeBreakBurst()
+{
+    SETUP_TEST;
+
+    static const uint8_t stream[] = { SC_A, 0xf0, SC_A };
+    const uint16_t key = OSD_ConvASCII(SC_A);
+    uint32_t errors = 0;
+
+    PushStream(stream, sizeof(stream), 20);
+    const uint32_t count = CollectKeys();
+    EXPECT(count, 40);
+
+    for (uint32_t i = 0; i < 40; i += 2) {
+        errors += keys[i] != key;
+        errors += keys[i + 1] != (KF_RELEASED | key);
+    }
+
+    EXPECT(errors, 0);
+
+    TEAR_DOWN;
+}
+
+static void TEST_ExtendedBurst()
+{
+    SETUP_TEST;
+
+    static const uint8_t stream[] = { 0xe0, SC_UP, 0xe0, 0xf0, SC_UP };
+    uint32_t errors = 0;
+
+    PushStream(stream, sizeof(stream), 12);
+    const uint32_t count = CollectKeys();
+    EXPECT(count, 24);
+
+    for (uint32_t i = 0; i < 24; i += 2) {
+        errors += keys[i] != KEY_UP;
+        errors += keys[i + 1] != (KF_RELEASED | KEY_UP);
+    }
+
+    EXPECT(errors, 0);
+
+    TEAR_DOWN;
+}
+
+static void TEST_ModifierBurst()
+{
+    SETUP_TEST;
+
+    static const uint8_t stream[] = { SC_LSHIFT, SC_A, 0xf0, SC_A, 0xf0, SC_LSHIFT, SC_A, 0xf0, SC_A };
+    const uint16_t key = OSD_ConvASCII(SC_A);
+
+    PushStream(stream, sizeof(stream), 1);
+    const uint32_t count = CollectKeys();
+    EXPECT(count, 4);
+    EXPECT(keys[0], KF_SHIFT | key);
+    EXPECT(keys[1], KF_RELEASED | KF_SHIFT | key);
+    EXPECT(keys[2], key);
+    EXPECT(keys[3], KF_RELEASED | key);
+
+    TEAR_DOWN;
+}
+
+static void TEST_SequenceTimeout()
+{
+    SETUP_TEST;
+
+    static const uint8_t stream[] = { SC_A, 0xf0, SC_A };
+    const uint16_t key = OSD_ConvASCII(SC_A);
+
+    // a stray prefix, then nothing for a while
+    OSD_PS2Push(0xe0);
+    Timer_Wait(2 * PS2DELAY);
+    PushStream(stream, sizeof(stream), 1);
+
+    const uint32_t count = CollectKeys();
+    EXPECT(count, 2);
+    EXPECT(keys[0], key);
+    EXPECT(keys[1], KF_RELEASED | key);
+
+    TEAR_DOWN;
+}
+
+static void TEST_Overflow()
+{
+    SETUP_TEST;
+
+    const uint32_t dropped = OSD_PS2Dropped();
+    uint32_t pushed = 0;
+
+    for (uint32_t i = 0; i < 40; ++i) {
+        pushed += OSD_PS2Push(SC_A);
+        pushed += OSD_PS2Push(0xf0);
+        pushed += OSD_PS2Push(SC_A);
+    }
+
+    const uint32_t lost = OSD_PS2Dropped() - dropped;
+    EXPECT(lost, 120 - pushed);
+
+    // a trailing partial make/break still yields its make code
+    const uint32_t count = CollectKeys();
+    EXPECT(count, pushed / 3 * 2 + (pushed % 3 ? 1 : 0));
+
+    TEAR_DOWN;
+}
+
+void RunPS2Tests()
+{
+    CollectKeys();  // start from an empty buffer
+
+    TEST_MakeBreakBurst();
+    TEST_ExtendedBurst();
+    TEST_ModifierBurst();
+    TEST_SequenceTimeout();
+    TEST_Overflow();
+}
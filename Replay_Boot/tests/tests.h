@@ -16,11 +16,15 @@
 
 #pragma once
 
+#include "crc32-test.h"
 #include "fullfat-test.h"
+#include "ps2-test.h"
 
 void RunFullTestSuite()
 {
     DEBUG(1, "\033[2J");
     RunFullFatTests();
+    RunPS2Tests();
+    RunCRC32Tests();
     DEBUG(1, "DONE!");
 }
@@ -17,60 +17,133 @@
 #include "usb.h"
 #include "messaging.h"
 #include "fileio.h"
+#include "fileio_drv.h"
 #include "usb/msc.h"
+#include "usb/usb_hardware.h"
 
 extern FF_IOMAN* pIoman;
 
+// While the file system stays mounted the host shares the card with the
+// firmware: drive emulation keeps running in between host transfers and the
+// host only gets write access while the firmware has no file open. An open
+// file (drive image, ROM, ...) carries cluster chains, read-ahead and seek
+// indexes that a host write could invalidate behind its back.
+static status_t* s_Status;
+
+static void USB_ServiceDrives(void)
+{
+    if (s_Status->fileio_cha_ena != 0) {
+        FileIO_FCh_Process(0);
+    }
+
+    if (s_Status->fileio_chb_ena != 0) {
+        FileIO_FCh_Process(1);
+    }
+}
+
+static uint8_t USB_HostReadOnly(void)
+{
+    return s_Status->card_write_protect || FF_FilesOpen(pIoman) != 0;
+}
+
+static void USB_HostWrote(void)
+{
+    FF_InvalidateCache(pIoman);
+}
+
+// The ATA drives (master/slave) of the enabled channels are presented as
+// additional logical units. The image is writable for the host only while it
+// is write protected for the core, or both would modify the same file system.
+static struct {
+    uint8_t ch;
+    uint8_t drive;
+} s_Images[MSC_MAX_IMAGES];
+
+static uint32_t USB_ImageBlocks(uint8_t image)
+{
+    return FileIO_Drv08_GetBlocks(s_Images[image].ch, s_Images[image].drive);
+}
+
+static uint8_t USB_ImageReadOnly(uint8_t image)
+{
+    const uint8_t ch = s_Images[image].ch;
+    const uint8_t drive = s_Images[image].drive;
+
+    return FileIO_FCh_GetReadOnly(ch, drive) || !FileIO_FCh_GetProtect(ch, drive);
+}
+
+static FF_ERROR USB_ImageRead(uint8_t image, uint8_t* buffer, uint32_t lba, uint32_t blocks)
+{
+    return FileIO_Drv08_ReadBlocks(s_Images[image].ch, s_Images[image].drive, buffer, lba, blocks);
+}
+
+static FF_ERROR USB_ImageWrite(uint8_t image, const uint8_t* buffer, uint32_t lba, uint32_t blocks)
+{
+    return FileIO_Drv08_WriteBlocks(s_Images[image].ch, s_Images[image].drive, buffer, lba, blocks);
+}
+
+static msc_share_t s_Share = {
+    USB_ServiceDrives,
+    USB_HostReadOnly,
+    USB_HostWrote,
+    0,
+    USB_ImageBlocks,
+    USB_ImageReadOnly,
+    USB_ImageRead,
+    USB_ImageWrite
+};
+
 void USB_MountMassStorage(status_t* current_status)
 {
-    DEBUG(1, "MOUNTING USB! HOLD ON TO YOUR HATS!");
+    s_Status = current_status;
 
     if (FF_Mounted(pIoman)) {
+        DEBUG(1, "Sharing the card over USB (%d files open)", FF_FilesOpen(pIoman));
 
-        DEBUG(1, "Unmount partition..");
+        s_Share.images = 0;
 
-        for (int ch = 0; ch < 2; ++ch) {
-            for (int drive = 0; drive < FCH_MAX_NUM; ++drive) {
-                DEBUG(1, "eject %d / %d..", ch, drive);
+        for (uint8_t ch = 0; ch < 2; ++ch) {
+            const uint8_t enabled = ch ? current_status->fileio_chb_ena : current_status->fileio_cha_ena;
 
-                if (!FileIO_FCh_GetInserted(ch, drive)) {
-                    continue;
-                }
+            if (!enabled || FileIO_FCh_GetDriver(ch) != 0x8) {
+                continue;
+            }
 
-                DEBUG(1, "Ejecting '%s'...", FileIO_FCh_GetName(ch, drive));
-                FileIO_FCh_Eject(ch, drive);
+            for (uint8_t drive = 0; drive < 2; ++drive) {
+                s_Images[s_Share.images].ch = ch;
+                s_Images[s_Share.images].drive = drive;
+                s_Share.images++;
             }
         }
 
-        // Make sure it's 'clean'...
-        FileIO_FCh_Init();
-
-        // Let's hope nobody is holding any file handles open at this time..
-
         FF_FlushCache(pIoman);
-        FF_ERROR ret = FF_UnmountPartition(pIoman);
-
-        if (ret != FF_ERR_NONE) {
-            WARNING("Failed to unmount partition!");
-            DEBUG(1, "FF_UnmountPartition return %08x", ret);
-            return;
-        }
+        MSC_Start(&s_Share);
 
-        current_status->fs_mounted_ok = FALSE;
-        DEBUG(1, "Partition unmounted!");
+        current_status->usb_mounted = USB_MOUNT_SHARED;
+        return;
     }
 
-    MSC_Start();
+    DEBUG(1, "MOUNTING USB! HOLD ON TO YOUR HATS!");
+
+    MSC_Start(NULL);
 
-    current_status->usb_mounted = 1;
+    current_status->usb_mounted = USB_MOUNT_EXCLUSIVE;
 }
 
 void USB_UnmountMassStorage(status_t* current_status)
 {
-    DEBUG(1, "UNMOUNTING USB! RE-INIT FILESYSTEM!");
-
     MSC_Stop();
 
+    if (current_status->usb_mounted == USB_MOUNT_SHARED) {
+        DEBUG(1, "UNSHARING USB!");
+        // the host may have left anything behind
+        FF_InvalidateCache(pIoman);
+        current_status->usb_mounted = 0;
+        return;
+    }
+
+    DEBUG(1, "UNMOUNTING USB! RE-INIT FILESYSTEM!");
+
     FileIO_FCh_Init();
 
     // CFG_card_start() will take care of remouting the sdcard..
@@ -79,6 +152,20 @@ void USB_UnmountMassStorage(status_t* current_status)
 
 void USB_Update(status_t* current_status)
 {
+#if defined(HOSTED)
+
+    // a client on the hosted USB socket stands in for plugging in the cable
+    if (usb_attached() != !!current_status->usb_mounted) {
+        if (current_status->usb_mounted) {
+            USB_UnmountMassStorage(current_status);
+
+        } else {
+            USB_MountMassStorage(current_status);
+        }
+    }
+
+#endif
+
     if (current_status->usb_mounted) {
         MSC_Poll();
     }
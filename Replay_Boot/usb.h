@@ -21,8 +21,12 @@
 #include "config.h"
 #include "usb/msc.h"
 
+// status_t::usb_mounted
+#define USB_MOUNT_EXCLUSIVE 1   // the host owns the card, the file system is unmounted
+#define USB_MOUNT_SHARED    2   // host and firmware (running core) share the card
+
 void USB_MountMassStorage(status_t* current_status);
 void USB_UnmountMassStorage(status_t* current_status);
 void USB_Update(status_t* current_status);
 
-#endif // USB_H_INCLUDED
\ No newline at end of file
+#endif // USB_H_INCLUDED
\ No newline at end of file
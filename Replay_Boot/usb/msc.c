@@ -20,6 +20,7 @@
 #include "usb_hardware.h"
 #include "messaging.h"
 #include "hardware/io.h"
+#include "hardware/timer.h"
 
 #include "card.h"
 
@@ -42,6 +43,24 @@ static void msc_packet_recv(uint8_t* packet, uint32_t length);
 
 static uint8_t s_PreventMediaRemoval = 0;
 
+// Sharing the card with the running firmware (see MSC_Start)
+#define MSC_YIELD_MS    2       // longest stretch of host card access before the firmware gets a turn
+
+static const msc_share_t* s_Share = NULL;
+static HARDWARE_TICK s_YieldTimer;
+
+// per logical unit: 0 is the card, 1.. the disk images
+#define MSC_MAX_LUNS    (1 + MSC_MAX_IMAGES)
+
+static uint8_t s_NumLuns = 1;
+static uint8_t s_WriteProtected[MSC_MAX_LUNS];
+static uint8_t s_MediumPresent[MSC_MAX_LUNS];
+static uint8_t s_MediumChanged[MSC_MAX_LUNS];
+static uint8_t s_MediumRemount[MSC_MAX_LUNS];   // the host has to drop its view of the medium first
+static uint32_t s_CardBlocks;       // the card does not change size while mounted
+
+static void msc_update_luns();
+
 void msc_recv(uint8_t ep, uint8_t* packet, uint32_t length)
 {
 ;;//    DEBUG(1,"msc_recv (ep = %d; packet = %08x, length = %d", ep, packet, length);
@@ -74,9 +93,17 @@ void msc_read(uint8_t* packet, uint32_t length)
     }
 }
 
-void MSC_Start(void)
+void MSC_Start(const msc_share_t* share)
 {
     s_PreventMediaRemoval = 0;
+    s_Share = share;
+    s_NumLuns = 1 + (share ? share->images : 0);
+    Assert(s_NumLuns <= MSC_MAX_LUNS);
+    s_CardBlocks = (uint32_t)(Card_GetCapacity() / 512);
+    msc_update_luns();
+    memset(s_MediumChanged, 0x00, sizeof(s_MediumChanged));
+    memset(s_MediumRemount, 0x00, sizeof(s_MediumRemount));
+    s_YieldTimer = Timer_Get(MSC_YIELD_MS);
     msc_reset();
 	usb_connect(msc_recv);
 }
@@ -84,6 +111,7 @@ void MSC_Stop(void)
 {
 	usb_disconnect();
     s_PreventMediaRemoval = 0;
+    s_Share = NULL;
 }
 uint8_t MSC_Poll(void)
 {
@@ -153,16 +181,16 @@ static void HandleRxdSetupData(UsbSetupPacket* data)
         }
         case USB_REQUEST_SET_CONFIGURATION:
             DEBUG(1,"\tUSB_REQUEST_SET_CONFIGURATION");
-#if defined(AT91SAM7S256)
             CurrentConfiguration = usd.wValue;
+#if defined(AT91SAM7S256)
             uint32_t eps[2] = { EPTYPE_BULK_IN, EPTYPE_BULK_OUT };
             if(CurrentConfiguration) {
                 usb_setup_endpoints(eps, 2);
             } else {
                 usb_setup_endpoints(NULL, 0);
             }
-            usb_send_ep0_zlp();
 #endif
+            usb_send_ep0_zlp();
             break;
 
         case USB_REQUEST_GET_INTERFACE: {
@@ -213,7 +241,7 @@ static void HandleRxdSetupData(UsbSetupPacket* data)
         case USB_REQUEST_GET_MAX_LUN:
         {
             DEBUG(1,"\tUSB_REQUEST_GET_MAX_LUN");
-            uint16_t w = 0x00;
+            uint16_t w = s_NumLuns - 1;
             usb_send_ep0((uint8_t *)&w, sizeof(w), usd.wLength);
             break;
         }
@@ -325,6 +353,88 @@ static void msc_reset()
     memset(&s_ProcessState, 0x00, sizeof(s_ProcessState));
 }
 
+// Host and firmware take turns on the card: a long transfer is interrupted
+// every MSC_YIELD_MS between two card accesses (never inside one), so the
+// drive emulation of a running core keeps its latency.
+static void msc_yield()
+{
+    if (s_Share && s_Share->yield && Timer_Check(s_YieldTimer)) {
+        s_Share->yield();
+        s_YieldTimer = Timer_Get(MSC_YIELD_MS);
+    }
+}
+
+// The sector buffer of process_command(), in two halves. READ(10) streams
+// through them as a ring: while one half is filled by a single (multi-block)
+// card read, the other one is drained to the host from the card driver's wait
+// loops. Chunks are aligned to their size, so on an aligned FAT volume a chunk
+// never straddles a cluster. WRITE(10) and UNMAP use the first half.
+#define MSC_READ_CHUNK  2       // sectors per half
+
+static uint8_t s_Sectors[2][MSC_READ_CHUNK * 512] __attribute__((aligned(16)));
+
+static struct {
+    const uint8_t* data;
+    uint32_t length;
+} s_ReadPending;
+
+static void msc_read_drain()
+{
+    uint32_t n = usb_send_async_nb(1, 64, s_ReadPending.data, s_ReadPending.length);
+    s_ReadPending.data += n;
+    s_ReadPending.length -= n;
+}
+
+static void msc_written()
+{
+    if (s_Share && s_Share->written) {
+        s_Share->written();
+    }
+}
+
+static uint32_t msc_capacity(uint8_t lun)    // in sectors
+{
+    if (lun) {
+        return s_Share->image_blocks(lun - 1);
+    }
+
+    return s_CardBlocks;
+}
+
+// The card is write protected for the host while the firmware uses it, images
+// are inserted and ejected by the firmware. A change is reported as a medium
+// change so the host re-reads capacity and WP flag. When the card changes hands
+// the host also has to forget what it cached (or it writes back a stale FAT),
+// so it is shown as removed first, and not written to until that was reported.
+static void msc_update_luns()
+{
+    for (uint8_t lun = 0; lun < s_NumLuns; ++lun) {
+        uint8_t wp = 0;
+        uint8_t present = 1;
+
+        if (lun) {
+            present = s_Share->image_blocks(lun - 1) != 0;
+            wp = s_Share->image_write_protected(lun - 1) ? 1 : 0;
+
+        } else if (s_Share && s_Share->write_protected) {
+            wp = s_Share->write_protected() ? 1 : 0;
+        }
+
+        if (wp != s_WriteProtected[lun] || present != s_MediumPresent[lun]) {
+            INFO("USB: LUN %d is %s", lun, !present ? "empty" : wp ? "read-only" : "writable");
+            s_MediumRemount[lun] |= !lun && wp != s_WriteProtected[lun];
+            s_WriteProtected[lun] = wp;
+            s_MediumPresent[lun] = present;
+            s_MediumChanged[lun] = 1;
+        }
+    }
+}
+
+static uint8_t msc_write_allowed(uint8_t lun)
+{
+    return !s_WriteProtected[lun] && !s_MediumRemount[lun];
+}
+
 static void msc_packet_recv(uint8_t* packet, uint32_t length)
 {
     DEBUG(3, "------------------------ NEW PACKET -------------------------");
@@ -345,6 +455,8 @@ static void msc_packet_recv(uint8_t* packet, uint32_t length)
         return;
     }
 
+    msc_update_luns();
+
     uint8_t valid = process_transfer_mode();
 
     if (!valid) {
@@ -531,6 +643,91 @@ static const struct {
     {'0','1','2','3','4','5','6','7'}
 };
 
+static const struct {
+    uint8_t PERIPHERALDEVICETYPE:5;
+    uint8_t PERIPHERALQUALIFIER:3;
+    uint8_t PAGECODE;
+    uint8_t Reserved;
+    uint8_t PAGELENGTH;
+    uint8_t SupportedPages[4];
+} __attribute__ ((packed)) s_SUPPORTED_VPD_PAGESdata = {
+    0,0,
+    0x00,
+    0,
+    0x04,
+    {0x00, 0x80, 0xb0, 0xb2}
+};
+
+// UNMAP limits; the parameter list has to fit process_command()'s sector buffers
+#define UNMAP_MAX_DESCRIPTORS   63
+#define UNMAP_MAX_SECTORS       (4 * 8192)  // 16MB, four CMD38s of up to 1s each (see Card_Erase); well inside the host's command timeout
+
+static const struct {
+    uint8_t PERIPHERALDEVICETYPE:5;
+    uint8_t PERIPHERALQUALIFIER:3;
+    uint8_t PAGECODE;
+    uint8_t PAGELENGTH[2];
+    uint8_t Reserved[16];
+    uint8_t MAXUNMAPLBACOUNT[4];
+    uint8_t MAXUNMAPBLOCKDESCRIPTORCOUNT[4];
+    uint8_t Reserved1[36];
+} __attribute__ ((packed)) s_BLOCK_LIMITSdata = {
+    0,0,
+    0xb0,
+    {0x00, 0x3c},
+    {0},
+    {(uint8_t)(UNMAP_MAX_SECTORS >> 24), (uint8_t)(UNMAP_MAX_SECTORS >> 16), (uint8_t)(UNMAP_MAX_SECTORS >> 8), (uint8_t)UNMAP_MAX_SECTORS},
+    {0x00, 0x00, 0x00, UNMAP_MAX_DESCRIPTORS},
+    {0}
+};
+
+static const struct {
+    uint8_t PERIPHERALDEVICETYPE:5;
+    uint8_t PERIPHERALQUALIFIER:3;
+    uint8_t PAGECODE;
+    uint8_t PAGELENGTH[2];
+    uint8_t THRESHOLDEXPONENT;
+    uint8_t DP:1;
+    uint8_t ANC_SUP:1;
+    uint8_t LBPRZ:1;
+    uint8_t Reserved:2;
+    uint8_t LBPWS10:1;
+    uint8_t LBPWS:1;
+    uint8_t LBPU:1;
+    uint8_t PROVISIONINGTYPE;
+    uint8_t Reserved1;
+} __attribute__ ((packed)) s_LOGICAL_BLOCK_PROVISIONINGdata = {
+    0,0,
+    0xb2,
+    {0x00, 0x04},
+    0,
+    0, 0, 0, 0, 0, 0,
+    1,          // UNMAP
+    0,
+    0
+};
+
+static const void* get_vpd_page(uint8_t pageCode, uint32_t* length)
+{
+    switch (pageCode) {
+        case 0x00:
+            *length = sizeof(s_SUPPORTED_VPD_PAGESdata);
+            return &s_SUPPORTED_VPD_PAGESdata;
+        case 0x80:
+            *length = sizeof(s_UNIT_SERIAL_NUMBERdata);
+            return &s_UNIT_SERIAL_NUMBERdata;
+        case 0xb0:
+            *length = sizeof(s_BLOCK_LIMITSdata);
+            return &s_BLOCK_LIMITSdata;
+        case 0xb2:
+            *length = sizeof(s_LOGICAL_BLOCK_PROVISIONINGdata);
+            return &s_LOGICAL_BLOCK_PROVISIONINGdata;
+        default:
+            *length = 0;
+            return NULL;
+    }
+}
+
 typedef struct {
     uint8_t     OPERATIONCODE;
     uint8_t     Reserved:5;
@@ -573,6 +770,40 @@ typedef struct {
     uint8_t     NUMBYTESPERBLOCK[4];
 } __attribute__ ((packed)) READ_CAPACITYdata;
 
+typedef struct {
+    uint8_t     OPERATIONCODE;
+    uint8_t     SERVICEACTION:5;
+    uint8_t     Reserved:3;
+    uint8_t     LBA[8];
+    uint8_t     ALLOCATIONLENGTH[4];
+    uint8_t     PMI:1;
+    uint8_t     Reserved1:7;
+    uint8_t     CONTROL;
+} __attribute__ ((packed)) READ_CAPACITY_16;
+#define OPERATIONCODE_SERVICE_ACTION_IN_16 0x9e
+#define SERVICEACTION_READ_CAPACITY_16 0x10
+
+typedef struct {
+    // byte 0-7
+    uint8_t     LBA[8];
+    // byte 8-11
+    uint8_t     NUMBYTESPERBLOCK[4];
+    // byte 12
+    uint8_t     PROT_EN:1;
+    uint8_t     P_TYPE:3;
+    uint8_t     Reserved:4;
+    // byte 13
+    uint8_t     LBPPBE:4;
+    uint8_t     P_I_EXPONENT:4;
+    // byte 14-15
+    uint8_t     LOWESTALIGNEDLBA_HI:6;
+    uint8_t     LBPRZ:1;
+    uint8_t     LBPME:1;
+    uint8_t     LOWESTALIGNEDLBA_LO;
+    // byte 16-31
+    uint8_t     Reserved1[16];
+} __attribute__ ((packed)) READ_CAPACITY_16data;
+
 typedef struct {
     uint8_t     OPERATIONCODE;
     uint8_t     Reserved0:3;
@@ -602,7 +833,7 @@ typedef struct {
 #define OPERATIONCODE_MODE_SENSE_10 0x5a
 
 
-static const struct {
+static struct {
     uint8_t     MODEDATALENGTH;
     uint8_t     MEDIUMTYPE;
     uint8_t     DEVICESPECIFIC;
@@ -610,7 +841,7 @@ static const struct {
 } __attribute__ ((packed)) s_MODE_PARAMETER_HEADERdata = {
     sizeof(s_MODE_PARAMETER_HEADERdata) - 1,
     0x00,               // Direct Access Device (0x00)
-    0x00,               // Device Specific.. ?
+    0x00,               // Device Specific (0x80 = write protected)
     0x00                // No block descriptors
 };
 
@@ -667,6 +898,30 @@ typedef struct {
 } __attribute__ ((packed)) START_STOP_UNIT;
 #define OPERATIONCODE_START_STOP_UNIT 0x1b
 
+typedef struct {
+    uint8_t     OPERATIONCODE;
+    uint8_t     ANCHOR:1;
+    uint8_t     Reserved:7;
+    uint8_t     Reserved1[4];
+    uint8_t     GROUPNUMBER:5;
+    uint8_t     Reserved2:3;
+    uint8_t     PARAMETERLISTLENGTH[2];
+    uint8_t     CONTROL;
+} __attribute__ ((packed)) UNMAP;
+#define OPERATIONCODE_UNMAP 0x42
+
+typedef struct {
+    uint8_t     UNMAPDATALENGTH[2];
+    uint8_t     BLOCKDESCRIPTORDATALENGTH[2];
+    uint8_t     Reserved[4];
+    struct UnmapBlockDescriptor
+    {
+        uint8_t LBA[8];
+        uint8_t NUMBLOCKS[4];
+        uint8_t Reserved[4];
+    }           DESC[];
+} __attribute__ ((packed)) UNMAPdata;
+
 typedef enum {
     NOSENSE = 0x00,             // Indicates that there is no specific sense key information to be reported.
     RECOVEREDERROR = 0x01,      // Indicates that the command completed successfully, with some recovery action performed by the device server. 
@@ -720,6 +975,7 @@ typedef enum {
     LOGICAL_UNIT_NOT_SUPPORTED = 0x25,
     INVALID_FIELD_IN_PARAMETER_LIST = 0x26,
     WRITE_PROTECTED = 0x27,
+    NOT_READY_TO_READY_CHANGE_MEDIUM_MAY_HAVE_CHANGED = 0x28,
     FLASHING_LED_OCCURRED = 0x29,
     POWER_ON_RESET_OR_BUS_DEVICE_RESET_OCCURRED = 0x29,
     COMMAND_SEQUENCE_ERROR = 0x2C,
@@ -729,6 +985,7 @@ typedef enum {
     FLASH_NOT_READY_FOR_ACCESS = 0x33,
     UNSPECIFIED_ENCLOSURE_SERVICES_FAILURE = 0x35,
     PARAMETER_ROUNDED = 0x37,
+    MEDIUM_NOT_PRESENT = 0x3A,
     INVALID_BITS_IN_IDENTIFY_MESSAGE = 0x3D,
     LOGICAL_UNIT_HAS_NOT_SELF_CONFIGURED_YET = 0x3E,
     TARGET_OPERATING_CONDITIONS_HAVE_CHANGED = 0x3F,
@@ -807,6 +1064,8 @@ typedef union {
     PREVENT_ALLOW_REMOVAL   preventAllowRemoval;
     REQUEST_SENSE   requestSense;
     START_STOP_UNIT startStopUnit;
+    READ_CAPACITY_16    readCapacity16;
+    UNMAP           unmap;
 } CommandDescriptorBlock;
 
 
@@ -821,6 +1080,12 @@ typedef union {
     x[2] = (uint8_t) (((val)  >> 8) & 0xff); \
     x[3] = (uint8_t)  ((val)        & 0xff);
 
+#define READ_BE_64B(x)  (((uint64_t) READ_BE_32B(x) << 32) | READ_BE_32B((x + 4)))
+
+#define WRITE_BE_64B(x,val) \
+    WRITE_BE_32B(x, (uint64_t)(val) >> 32) \
+    WRITE_BE_32B((x + 4), (val))
+
 
 static uint8_t process_transfer_mode()
 {
@@ -837,8 +1102,9 @@ static uint8_t process_transfer_mode()
     switch (cdb->OPERATIONCODE) {
         case OPERATIONCODE_INQUIRY:
             if (cdb->inquiry.EVPD) {
-                if (cdb->inquiry.PAGECODE == 0x80) {
-                    deviceLength = sizeof(s_UNIT_SERIAL_NUMBERdata);
+                if (get_vpd_page(cdb->inquiry.PAGECODE, &deviceLength)) {
+                    if (deviceLength > READ_BE_16B(cdb->inquiry.ALLOCATIONLENGTH))
+                        deviceLength = READ_BE_16B(cdb->inquiry.ALLOCATIONLENGTH);
                 }
                 else {
                     WARNING("USB: Unknown EVPD %02x!", cdb->inquiry.PAGECODE);
@@ -859,6 +1125,20 @@ static uint8_t process_transfer_mode()
             deviceLength = sizeof(READ_CAPACITYdata);
             deviceTransferType = DeviceToHost;
             break;
+        case OPERATIONCODE_SERVICE_ACTION_IN_16:
+            if (cdb->readCapacity16.SERVICEACTION == SERVICEACTION_READ_CAPACITY_16) {
+                deviceLength = READ_BE_32B(cdb->readCapacity16.ALLOCATIONLENGTH);
+                if (deviceLength > sizeof(READ_CAPACITY_16data))
+                    deviceLength = sizeof(READ_CAPACITY_16data);
+            } else {
+                WARNING("USB: Unknown service action = %02x", cdb->readCapacity16.SERVICEACTION);
+            }
+            deviceTransferType = DeviceToHost;
+            break;
+        case OPERATIONCODE_UNMAP:
+            deviceLength = READ_BE_16B(cdb->unmap.PARAMETERLISTLENGTH);
+            deviceTransferType = HostToDevice;
+            break;
         case OPERATIONCODE_MODE_SENSE_6:
             if (cdb->modeSense6.ALLOCATIONLENGTH >= sizeof(s_MODE_PARAMETER_HEADERdata))
                 deviceLength = sizeof(s_MODE_PARAMETER_HEADERdata);
@@ -952,34 +1232,75 @@ static uint8_t process_transfer_mode()
 
 static CSWStatus process_command()
 {
-    uint8_t TwoSectors[2][512] __attribute__((aligned(16)));
-    Assert(( ((uint32_t)&TwoSectors[0][0]) & 0xf ) == 0);
-
     CommandBlockWrapper* cbw = &s_ProcessState.cbw;
 //    CommandStatusWrapper* csw = &s_ProcessState.csw;
 
     CommandDescriptorBlock* cdb = (CommandDescriptorBlock*)cbw->CBWCB;
+    const uint8_t lun = cbw->bCBWLUN;
+
+    if (lun >= s_NumLuns) {
+        // finish the data phase like READ(10) out of range does, no stalls
+        uint32_t length = s_ProcessState.deviceLength;
+        if (s_ProcessState.transferMode == Hi_eq_Di || s_ProcessState.transferMode == Hi_gt_Di) {
+            memset(s_Sectors[0], 0x00, sizeof(s_Sectors[0]));
+            while (length) {
+                uint32_t n = length < sizeof(s_Sectors[0]) ? length : sizeof(s_Sectors[0]);
+                length -= n;
+                msc_send_async(s_Sectors[0], n, length == 0);
+            }
+        } else if (s_ProcessState.transferMode == Ho_eq_Do || s_ProcessState.transferMode == Ho_gt_Do) {
+            while (length) {
+                uint32_t n = length < sizeof(s_Sectors[0]) ? length : sizeof(s_Sectors[0]);
+                msc_read(s_Sectors[0], n);
+                length -= n;
+            }
+        }
+        set_sense_data(ILLEGALREQUEST, LOGICAL_UNIT_NOT_SUPPORTED);
+        return CommandFailed;
+    }
+
+    // report a pending medium change on a command without data (the host polls
+    // with TEST UNIT READY), there is no way to abort a data phase without stalls
+    if (s_MediumRemount[lun] && s_ProcessState.transferMode == Hn_eq_Dn) {
+        s_MediumRemount[lun] = 0;
+        set_sense_data(NOTREADY, MEDIUM_NOT_PRESENT);
+        return CommandFailed;
+    }
+
+    if (s_MediumChanged[lun] && s_ProcessState.transferMode == Hn_eq_Dn) {
+        s_MediumChanged[lun] = 0;
+        set_sense_data(UNITATTENTION, NOT_READY_TO_READY_CHANGE_MEDIUM_MAY_HAVE_CHANGED);
+        return CommandFailed;
+    }
+
     switch (cdb->OPERATIONCODE) {
         case OPERATIONCODE_INQUIRY:
             INFO("USB: Inquiry (%1x, %02x)", cdb->inquiry.EVPD, cdb->inquiry.PAGECODE);
             if (cdb->inquiry.EVPD) {
-                if (cdb->inquiry.PAGECODE == 0x80)
-                    msc_send((uint8_t*)&s_UNIT_SERIAL_NUMBERdata, s_ProcessState.deviceLength);
+                uint32_t length;
+                const void* page = get_vpd_page(cdb->inquiry.PAGECODE, &length);
+                if (!page) {
+                    set_sense_data(ILLEGALREQUEST, INVALID_FIELD_IN_CDB);
+                    return CommandFailed;
+                }
+                msc_send((uint8_t*)page, s_ProcessState.deviceLength);
             } else {
                 msc_send((uint8_t*)&s_INQUIRYdata, s_ProcessState.deviceLength);
             }
             return CommandPassed;
         case OPERATIONCODE_TEST_UNIT_READY:
             INFO("USB: Test Unit Ready");
-            // assume all is good
+            if (!s_MediumPresent[lun]) {
+                set_sense_data(NOTREADY, MEDIUM_NOT_PRESENT);
+                return CommandFailed;
+            }
             return CommandPassed;
         case OPERATIONCODE_READ_FORMAT_CAPACITY: {
             INFO("USB: Read Format Capacity");
             READ_FORMAT_CAPACITYdata data;
             memset(&data,0x00,sizeof(data));
             data.ADDITIONALLENGTH = sizeof(data)-4;
-            uint64_t capacity = Card_GetCapacity();
-            uint32_t sectorCount = (uint32_t)(capacity / 512);
+            uint32_t sectorCount = msc_capacity(lun);
             WRITE_BE_32B(data.CAP_DESC.NUM_BLOCKS, sectorCount);
             data.CAP_DESC.BLOCK_LENGTH[1] = 0x02;   // 512
             msc_send((uint8_t*)&data, s_ProcessState.deviceLength);
@@ -989,46 +1310,198 @@ static CSWStatus process_command()
             INFO("USB: Read Capacity(10)");
             READ_CAPACITYdata data;
             memset(&data,0x00,sizeof(data));
-            uint64_t capacity = Card_GetCapacity();
-            uint32_t sectorCount = (uint32_t)(capacity / 512);
-            WRITE_BE_32B(data.LBA, sectorCount-1);
+            uint32_t sectorCount = msc_capacity(lun);
+            WRITE_BE_32B(data.LBA, sectorCount ? sectorCount-1 : 0);
+            WRITE_BE_32B(data.NUMBYTESPERBLOCK, 512);
+            msc_send((uint8_t*)&data, s_ProcessState.deviceLength);
+            return CommandPassed;
+        }
+        case OPERATIONCODE_SERVICE_ACTION_IN_16: {
+            if (cdb->readCapacity16.SERVICEACTION != SERVICEACTION_READ_CAPACITY_16) {
+                set_sense_data(ILLEGALREQUEST, INVALID_FIELD_IN_CDB);
+                return CommandFailed;
+            }
+            INFO("USB: Read Capacity(16)");
+            READ_CAPACITY_16data data;
+            memset(&data,0x00,sizeof(data));
+            uint64_t sectorCount = msc_capacity(lun);
+            WRITE_BE_64B(data.LBA, sectorCount ? sectorCount-1 : 0);
             WRITE_BE_32B(data.NUMBYTESPERBLOCK, 512);
+            data.LBPME = lun == 0;  // UNMAP is supported on the card
             msc_send((uint8_t*)&data, s_ProcessState.deviceLength);
             return CommandPassed;
         }
         case OPERATIONCODE_MODE_SENSE_6:
             INFO("USB: Mode Sense(6)");
+            s_MODE_PARAMETER_HEADERdata.DEVICESPECIFIC = s_WriteProtected[lun] ? 0x80 : 0x00;
             msc_send((uint8_t*)&s_MODE_PARAMETER_HEADERdata, s_ProcessState.deviceLength);
             return CommandPassed;
         case OPERATIONCODE_MODE_SENSE_10:
             INFO("USB: Mode Sense(10)");
+            s_MODE_PARAMETER_HEADERdata.DEVICESPECIFIC = s_WriteProtected[lun] ? 0x80 : 0x00;
             msc_send((uint8_t*)&s_MODE_PARAMETER_HEADERdata, s_ProcessState.deviceLength);
             return CommandPassed;
         case OPERATIONCODE_READ_10: {
             uint32_t sectorOffset = READ_BE_32B(cdb->readWrite10.LBA);
             uint32_t numSectors = s_ProcessState.deviceLength / 512;
-            INFO("USB: Read(10) (%08x, %d)", sectorOffset, numSectors);
-            for (int i = 0; i < numSectors; ++i) {
-                uint8_t buf = i&1;
-                uint8_t last = ((i+1) == numSectors);
-                Card_ReadM(TwoSectors[buf], sectorOffset+i, 1, NULL);
-                msc_send_async(TwoSectors[buf], sizeof(TwoSectors[buf]), last);
+            uint8_t failed = FALSE;
+            uint8_t half = 0;
+            INFO("USB: Read(10) (%d, %08x, %d)", lun, sectorOffset, numSectors);
+            const uint32_t capacity = msc_capacity(lun);
+            if (sectorOffset > capacity || numSectors > capacity - sectorOffset) {
+                // no stalls here either; the host gets zeros and the status
+                memset(s_Sectors[0], 0x00, sizeof(s_Sectors[0]));
+                for (uint32_t i = 0; i < numSectors; ) {
+                    uint32_t n = numSectors - i < MSC_READ_CHUNK ? numSectors - i : MSC_READ_CHUNK;
+                    i += n;
+                    msc_send_async(s_Sectors[0], n * 512, i == numSectors);
+                }
+                set_sense_data(ILLEGALREQUEST, LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+                return CommandFailed;
+            }
+            s_ReadPending.length = 0;
+            Card_SetReadHook(msc_read_drain);
+            for (uint32_t i = 0; i < numSectors; ) {
+                uint32_t n = MSC_READ_CHUNK - ((sectorOffset + i) % MSC_READ_CHUNK);
+                if (n > numSectors - i)
+                    n = numSectors - i;
+                uint8_t* buf = s_Sectors[half];
+                msc_yield();
+                // the data phase goes on regardless, the status tells
+                FF_ERROR err = lun ? s_Share->image_read(lun - 1, buf, sectorOffset + i, n)
+                                   : Card_ReadM(buf, sectorOffset + i, n, NULL);
+                if (FF_isERR(err))
+                    failed = TRUE;
+                // queue what is left of the other half before it is refilled
+                if (s_ReadPending.length)
+                    msc_send_async((uint8_t*)s_ReadPending.data, s_ReadPending.length, FALSE);
+                s_ReadPending.data = buf;
+                s_ReadPending.length = n * 512;
+                half ^= 1;
+                i += n;
+            }
+            Card_SetReadHook(NULL);
+            if (s_ReadPending.length)
+                msc_send_async((uint8_t*)s_ReadPending.data, s_ReadPending.length, TRUE);
+            if (failed) {
+                set_sense_data(MEDIUMERROR, UNRECOVERED_READ_ERROR);
+                return CommandFailed;
             }
             return CommandPassed;
         }
         case OPERATIONCODE_WRITE_10: {
             uint32_t sectorOffset = READ_BE_32B(cdb->readWrite10.LBA);
             uint32_t numSectors = s_ProcessState.deviceLength / 512;
-            INFO("USB: Write(10) (%08x, %d)", sectorOffset, numSectors);
+            uint8_t failed = FALSE;
+            uint8_t protected = FALSE;
+            INFO("USB: Write(10) (%d, %08x, %d)", lun, sectorOffset, numSectors);
+            const uint32_t capacity = msc_capacity(lun);
+            const uint8_t in_range = sectorOffset <= capacity && numSectors <= capacity - sectorOffset;
             for (int i = 0; i < numSectors; ) {
                 // usb_recv_async(2, sizeof(OneSector), usb_func WriteCallback);
                 uint32_t n = 2; /* blocks */
                 if (n > (numSectors-i))
                     n = (numSectors-i);
-                msc_read(TwoSectors[0], n * sizeof(TwoSectors[0]));
-                Card_WriteM(TwoSectors[0], sectorOffset+i, n, NULL);
+                msc_read(s_Sectors[0], n * 512);
+                if (msc_write_allowed(lun) && in_range) {
+                    msc_yield();
+                    if (lun) {
+                        FF_ERROR err = s_Share->image_write(lun - 1, s_Sectors[0], sectorOffset+i, n);
+                        // e.g. the rigid disk block of a naked hardfile
+                        if (FF_GETERROR(err) == FF_ERR_FILE_IS_READ_ONLY)
+                            protected = TRUE;
+                        else if (FF_isERR(err))
+                            failed = TRUE;
+                    } else {
+                        Card_WriteM(s_Sectors[0], sectorOffset+i, n, NULL);
+                    }
+                }
                 i += n;
             }
+            if (!msc_write_allowed(lun) || protected) {
+                set_sense_data(DATAPROTECT, WRITE_PROTECTED);
+                return CommandFailed;
+            }
+            if (!in_range) {
+                set_sense_data(ILLEGALREQUEST, LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+                return CommandFailed;
+            }
+            if (failed) {
+                set_sense_data(MEDIUMERROR, WRITE_ERROR);
+                return CommandFailed;
+            }
+            if (lun == 0) {
+                msc_written();
+            }
+            return CommandPassed;
+        }
+        case OPERATIONCODE_UNMAP: {
+            uint32_t length = s_ProcessState.deviceLength;
+            INFO("USB: Unmap (%d)", length);
+            if (length > sizeof(s_Sectors[0])) {
+                // drain the parameter list; the host ignored our block limits
+                while (length) {
+                    uint32_t n = length < sizeof(s_Sectors[0]) ? length : sizeof(s_Sectors[0]);
+                    msc_read(s_Sectors[0], n);
+                    length -= n;
+                }
+                set_sense_data(ILLEGALREQUEST, PARAMETER_LIST_LENGTH_ERROR);
+                return CommandFailed;
+            }
+            if (length == 0) {
+                return CommandPassed;
+            }
+            msc_read(s_Sectors[0], length);
+
+            if (lun) {
+                set_sense_data(ILLEGALREQUEST, INVALID_COMMAND_OPERATION_CODE);
+                return CommandFailed;
+            }
+
+            if (!msc_write_allowed(lun)) {
+                set_sense_data(DATAPROTECT, WRITE_PROTECTED);
+                return CommandFailed;
+            }
+
+            const UNMAPdata* data = (const UNMAPdata*)s_Sectors[0];
+            uint32_t numDescriptors = 0;
+            if (length >= sizeof(UNMAPdata)) {
+                uint32_t descLength = READ_BE_16B(data->BLOCKDESCRIPTORDATALENGTH);
+                if (descLength > length - sizeof(UNMAPdata))
+                    descLength = length - sizeof(UNMAPdata);
+                numDescriptors = descLength / sizeof(data->DESC[0]);
+            }
+
+            // check the whole list first; the total is bounded by what VPD B0 advertises
+            const uint64_t sectorCount = msc_capacity(lun);
+            uint32_t totalSectors = 0;
+            for (int i = 0; i < numDescriptors; ++i) {
+                uint64_t lba = READ_BE_64B(data->DESC[i].LBA);
+                uint32_t numSectors = READ_BE_32B(data->DESC[i].NUMBLOCKS);
+                if (lba > sectorCount || numSectors > sectorCount - lba) {
+                    set_sense_data(ILLEGALREQUEST, LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+                    return CommandFailed;
+                }
+                if (numSectors > UNMAP_MAX_SECTORS - totalSectors) {
+                    set_sense_data(ILLEGALREQUEST, INVALID_FIELD_IN_PARAMETER_LIST);
+                    return CommandFailed;
+                }
+                totalSectors += numSectors;
+            }
+
+            for (int i = 0; i < numDescriptors; ++i) {
+                uint32_t lba = (uint32_t)READ_BE_64B(data->DESC[i].LBA);
+                uint32_t numSectors = READ_BE_32B(data->DESC[i].NUMBLOCKS);
+                msc_yield();
+                if (Card_Erase(lba, numSectors, NULL) != FF_ERR_NONE) {
+                    msc_written();
+                    set_sense_data(MEDIUMERROR, WRITE_ERROR);
+                    return CommandFailed;
+                }
+            }
+            if (numDescriptors) {
+                msc_written();
+            }
             return CommandPassed;
         }
         case OPERATIONCODE_PREVENT_ALLOW_REMOVAL:
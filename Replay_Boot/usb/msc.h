@@ -16,8 +16,27 @@
 
 #pragma once
 #include <stdint.h>
+#include "fullfat.h"
 
-void MSC_Start(void);
+#define MSC_MAX_IMAGES  4               // logical units in addition to the card (LUN 0)
+
+// Sharing the card with the running firmware. All callbacks are optional,
+// except the image ones when there are images.
+typedef struct {
+    void    (*yield)(void);             // serve the firmware between card accesses
+    uint8_t (*write_protected)(void);   // TRUE while the host must not write
+    void    (*written)(void);           // the host changed the card
+
+    // disk images, presented as LUN 1..images
+    uint8_t   images;
+    uint32_t  (*image_blocks)(uint8_t image);           // 0 = nothing inserted
+    uint8_t   (*image_write_protected)(uint8_t image);
+    FF_ERROR  (*image_read)(uint8_t image, uint8_t* buffer, uint32_t lba, uint32_t blocks);
+    FF_ERROR  (*image_write)(uint8_t image, const uint8_t* buffer, uint32_t lba, uint32_t blocks);
+} msc_share_t;
+
+// share is NULL when the host owns the card exclusively
+void MSC_Start(const msc_share_t* share);
 void MSC_Stop(void);
 uint8_t MSC_Poll(void);
 
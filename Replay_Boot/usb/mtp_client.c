@@ -485,25 +485,15 @@ typedef struct _GetObjectHandles_Context {
     uint32_t num_handles;
 } GetObjectHandles_Context;
 
-static FF_ERROR GetObjectHandles_Callback(FF_DIRENT* pDirent, void* context)
+static FRESULT GetObjectHandles_Callback(uint32_t handle, const FILINFO* info, void* context)
 {
     GetObjectHandles_Context* ctx = (GetObjectHandles_Context*)context;
 
-    if (!strcmp(pDirent->FileName, ".") || !strcmp(pDirent->FileName, ".."))
-        return FF_ERR_NONE;
-
-    // cluster index is +1 since it would otherwise cause the handle to result in 0x00000000 which is illegal (== root parent)
-//    if (pDirent->Attrib & FF_FAT_ATTR_DIR)
-//      return FF_ERR_NONE;
-    uint32_t handle = ((GetClusterIndex(pDirent->DirCluster) + 1) << 16) | pDirent->CurrentItem;
-    DEBUG(1,"[%08x] %08x / %04x : %s", handle, pDirent->DirCluster, pDirent->CurrentItem, pDirent->FileName);
+    DEBUG(1,"[%08x] %s", handle, info->fname);
     ctx->payload_offset = Write32bits(ptp_out, ctx->payload_offset, handle);
     ++ctx->num_handles;
 
-    if (pDirent->Attrib & FF_FAT_ATTR_DIR)
-        AddCluster(pDirent->ObjectCluster, handle);
-
-    return FF_ERR_NONE;
+    return FR_OK;
 }
 static uint16_t GetObjectHandles(PTPUSBBulkContainer* ptp_in)
 {
@@ -531,43 +521,27 @@ static uint16_t GetObjectHandles(PTPUSBBulkContainer* ptp_in)
     uint32_t format = ptp_in->payload.params.param2;
     uint32_t parent = ptp_in->payload.params.param3;
 
-    MtpObjectHandle* handles = (MtpObjectHandle*)(void*)ptp_out->payload.data;
-    uint32_t max_handles = sizeof(ptp_out->payload.data) / sizeof(MtpObjectHandle);
-    int32_t num_handles = mtp_get_object_handles(storage, format, parent, handles, max_handles);
-    (void)num_handles;
+    (void)format;
 
     DEBUG(1,"\t\t\t\tcheck storage");
 
     if (storage != 0xffffffff && storage != 0x00010001)
         return PTP_RC_InvalidStorageId;
 
-    DEBUG(1,"\t\t\t\tcheck num_clusters");
-
-    FF_DIRENT dirent;
-    memset(&dirent, 0, sizeof(FF_DIRENT));
+    DEBUG(1,"\t\t\t\tcheck parent");
 
-    dirent.DirCluster = FindClusterByHandle(parent);
-    if (!dirent.DirCluster)
+    if (FindClusterByHandle(parent) == 0xffff)
         return PTP_RC_InvalidParentObject;
 
     ctx.payload_offset = 0;
     ctx.num_handles = 0;
     ctx.payload_offset = Write32bits(ptp_out, ctx.payload_offset, ctx.num_handles);        // number of object handles
 
-    DEBUG(1,"\t\t\t\tinit entry fetch");
-    if (FF_isERR(FF_InitEntryFetch(pIoman, dirent.DirCluster, &dirent.FetchContext)))
-        return PTP_RC_GeneralError;
-
     DEBUG(1,"\t\t\t\tfetch dirents");
-    FF_DIRENT* pDirent = &dirent;
-    FetchDirents(pDirent, GetObjectHandles_Callback, &ctx);
+    if (FetchDirents(parent, GetObjectHandles_Callback, &ctx) != FR_OK)
+        return PTP_RC_GeneralError;
 
     DumpClusters();
-//    DEBUG(1,"\t\t\t\tnum_clusters : %d", num_clusters);
-//    for (int i = 0; i < num_clusters; ++i)
-//    {
-//        DEBUG(1,"\t\t\t\t%04x ; dir = %08x ; parent = %08x", i, dirclusters[i], assoclink[i]);
-//    }
 
     Write32bits(ptp_out, 0, ctx.num_handles);        // number of object handles
 
@@ -581,13 +555,6 @@ static uint16_t GetObjectHandles(PTPUSBBulkContainer* ptp_in)
     return PTP_RC_OK;
 }
 
-static FF_ERROR GetObjectInfo_Callback(FF_DIRENT* pDirent, void* context)
-{
-    FF_DIRENT* dirent_out = (FF_DIRENT*) context;
-    DEBUG(1,"           %08x / %04x : %s", pDirent->DirCluster, pDirent->CurrentItem, pDirent->FileName);
-    memcpy(dirent_out, pDirent, sizeof(FF_DIRENT));
-    return FF_ERR_DIR_END_OF_DIR | FF_GETENTRY;
-}
 static uint16_t GetObjectInfo(PTPUSBBulkContainer* ptp_in)
 {
     /*
@@ -633,70 +600,27 @@ static uint16_t GetObjectInfo(PTPUSBBulkContainer* ptp_in)
 
     uint32_t handle = ptp_in->payload.params.param1;
 
-    MtpObjectInfo info;
-    mtp_get_object_info(handle, &info);
-
     handle = TrackRenames(handle);
 
-    uint16_t cluster_index = (handle >> 16) - 1;
-    uint16_t item_index = handle & 0xffff;
-
-    DEBUG(1,"\t\t\t\tcheck cluster index");
-    if (cluster_index >= num_clusters)
-        return PTP_RC_InvalidObjectHandle;
-    DEBUG(1,"\t\t\t\tcheck dir_cluster");
-    uint32_t dir_cluster = dirclusters[cluster_index];
-    if (dir_cluster == 0x00000000)
-        return PTP_RC_InvalidParameter;
-
-    FF_DIRENT dirent;
-    memset(&dirent, 0, sizeof(dirent));
-
-
-    DEBUG(1,"\t\t\t\tcluster %08x index %04x", dir_cluster, item_index);
-
-    dirent.DirCluster = dir_cluster;
-    dirent.CurrentItem = item_index;
-
-  FF_ERROR  err;
-//  FF_T_UINT8  numLFNs;
-
-
-    FF_DIRENT* pDirent = &dirent;
-
-    DEBUG(1,"\t\t\t\tinit entry fetch");
-    if(FF_isERR(FF_InitEntryFetch(pIoman, pDirent->DirCluster, &pDirent->FetchContext)))
-        return PTP_RC_GeneralError;
-
-    DEBUG(1,"\t\t\t\tfetch dirent");
-
-    FF_DIRENT dirent_out;
-    err = FetchDirents(pDirent, GetObjectInfo_Callback, &dirent_out);
-
-    DEBUG(1,"\t\t\t\tcheck return value");
-
-    if (FF_isERR(err) && FF_GETERROR (err) != FF_ERR_DIR_END_OF_DIR)
-        return PTP_RC_GeneralError;
-
-    DEBUG(1,"\t\t\t\tvalidate cluster/index");
+    DEBUG(1,"\t\t\t\tfetch dirent %08x", handle);
 
-    if (dirent_out.DirCluster != dir_cluster || dirent_out.CurrentItem != item_index)
+    FILINFO info;
+    if (GetDirentInfo(handle, &info) != FR_OK)
         return PTP_RC_InvalidObjectHandle;
 
-
     DEBUG(1,"\t\t\t\ta-ok - writing info");
 
-    uint8_t isdir = dirent_out.Attrib & FF_FAT_ATTR_DIR;
+    uint8_t isdir = info.fattrib & AM_DIR;
 
     uint32_t storage = 0x00010001;
     uint16_t object_format = isdir ? PTP_OFC_Association : PTP_OFC_Undefined;
     uint16_t protection = PTP_PS_NoProtection;
-    uint32_t filesize = dirent_out.Filesize;
-    uint32_t parent = assoclink[cluster_index];
+    uint32_t filesize = info.fsize;
+    uint32_t parent = GetParentHandle(handle);
     uint16_t assoc_code = isdir ? 0x0001 : 0x0000;
     uint32_t assoc_desc = 0x00000001;   // if 0x00000001 supports "object references"
 
-    const char* filename = dirent_out.FileName;
+    const char* filename = info.fname;
     const char* created = "19700101T010101.5";
     const char* modified = "19700101T010101.5";
 
@@ -748,7 +672,63 @@ static uint16_t GetObjectInfo(PTPUSBBulkContainer* ptp_in)
     return PTP_RC_OK;
 }
 
-static uint16_t GetObject(PTPUSBBulkContainer* ptp_in) 
+// Object data is moved through a multi-sector buffer. Reads from (and writes to) the file are
+// kept sector aligned, so FatFS transfers them straight from/to the card with one multi-block
+// command, instead of going through its sector window.
+#define MTP_STREAM_CHUNK (4 * 512)
+
+static uint8_t stream_buffer[MTP_STREAM_CHUNK + 64] __attribute__((aligned(4)));
+
+// Send 'length' bytes of 'file', starting at 'offset', as the data phase of 'ptp_in'.
+// Whole USB packets are handed to both endpoint banks; the remainder (< 64 bytes) is moved
+// to the front of the buffer and goes out with the next chunk. While the card is busy with
+// that next chunk, the last packets of the previous one are still in flight.
+static uint32_t StreamFromFile(PTPUSBBulkContainer* ptp_in, FF_FILE* file, uint32_t offset, uint32_t length)
+{
+    PTPUSBBulkContainer* header = (PTPUSBBulkContainer*)(void*)stream_buffer;
+    header->length = PTP_USB_BULK_HDR_LEN + length;
+    header->type = PTP_USB_CONTAINER_DATA;
+    header->code = ptp_in->code;
+    header->trans_id = ptp_in->trans_id;
+
+    uint32_t pending = PTP_USB_BULK_HDR_LEN;
+    uint32_t sent = 0;
+
+    if (FF_Seek(file, offset, FF_SEEK_SET) != FF_ERR_NONE) {
+        length = 0;
+    }
+
+    while (length) {
+        // first chunk stops at a sector boundary; all following ones are aligned
+        uint32_t chunk = min(MTP_STREAM_CHUNK - (offset & 511), length);
+        int32_t bytes_read = FF_Read(file, 1, chunk, &stream_buffer[pending]);
+
+        if (bytes_read <= 0) {
+            WARNING("MTP: read failed at %08x", offset);
+            break;
+        }
+
+        offset += bytes_read;
+        length -= bytes_read;
+        sent += bytes_read;
+        pending += bytes_read;
+
+        if (length) {
+            // a short packet would end the transfer - only send whole packets until the last chunk
+            uint32_t packets = pending & ~63;
+            ptp_send_stream(stream_buffer, packets, FALSE);
+            pending -= packets;
+            memmove(stream_buffer, &stream_buffer[packets], pending);
+        }
+    }
+
+    // last (short) packet, or a zlp if the container is a multiple of the packet size
+    ptp_send_stream(pending ? stream_buffer : 0, pending, TRUE);
+
+    return sent;
+}
+
+static uint16_t GetObject(PTPUSBBulkContainer* ptp_in)
 {
     /*
         Operation Code          0x1009
@@ -771,33 +751,10 @@ static uint16_t GetObject(PTPUSBBulkContainer* ptp_in)
 
     uint32_t handle = ptp_in->payload.params.param1;
 
-    // create full path
-
-    char buffer[FF_MAX_PATH];
-    size_t pos = sizeof(buffer) - 1;
-    buffer[pos] = 0;
-    uint32_t filesize = 0;
-
-    do {
-        uint16_t cluster_index = (handle >> 16) - 1;
-        uint16_t item_index = handle & 0xffff;
-
-        FF_DIRENT dirent;
-        if (FF_isERR(GetDirentInfo(cluster_index, item_index, &dirent)))
-            return PTP_RC_InvalidObjectHandle;
-
-        // insert current filename infront of existing name
-        size_t len = strlen(dirent.FileName);
-        pos -= len;
-        memcpy(&buffer[pos], dirent.FileName, len);
-        buffer[--pos] = '/';
-
-        filesize += dirent.Filesize;
-
-        handle = assoclink[cluster_index];
-    } while(handle);
-
-    const char* path = &buffer[pos];
+    FILINFO info;
+    const char* path = GetFullPathFromHandle(handle, NULL, &info);
+    if (!path || (info.fattrib & AM_DIR))
+        return PTP_RC_InvalidObjectHandle;
 
     DEBUG(1,"\t\t\t\tFULL PATH = %s", path);
 
@@ -805,97 +762,13 @@ static uint16_t GetObject(PTPUSBBulkContainer* ptp_in)
     if (!file)
         return PTP_RC_GeneralError;
 
-// ---------------------
-
-    int32_t bytes_read = 0;
-    size_t first_packet_len = 64 - PTP_USB_BULK_HDR_LEN;
-    bytes_read = FF_Read(file, first_packet_len, 1, ptp_out->payload.data);
-
-    ptp_out->length = PTP_USB_BULK_HDR_LEN + filesize;
-    ptp_out->type = PTP_USB_CONTAINER_DATA;
-    ptp_out->code = ptp_in->code;
-    ptp_out->trans_id = ptp_in->trans_id;
-
-    int len = PTP_USB_BULK_HDR_LEN + bytes_read;
-    uint8_t *packet = (uint8_t*)ptp_out;
-    DEBUG(1,"\t\t\t\tsending first packet; size = %04x", len);
-    do {
-        int wLength = len == 64 ? 64 : 0;   // set wLength to the wMaxPacketSize to prevent zlp except on the last one
-        usb_send(2, 64, packet, len, wLength);
-        bytes_read = FF_Read(file, 64, 1, (FF_T_UINT8*)buffer);
-        packet = (uint8_t*)buffer;
-        len = bytes_read;
-        DEBUG(1,"\t\t\t\tsending next packet; size = %04x", len);
-    } while(bytes_read);
-
-#if 0
-    int32_t bytes_read = 0;
-    size_t first_packet_len = 64 - PTP_USB_BULK_HDR_LEN;
-    bytes_read = FF_Read(file, first_packet_len, 1, ptp_out->payload.data);
-
-/*
-"NB! change to actual file length here!!!"
-"    if that doesn't work - change to split header/data packets"!!
-
-" also - sending mtp data packets that align with 512 seems to need another zlp, perhaps outside of the regular USB zlp"
-" no probably not - this is just a buggy workaround in mtp.. without split headers and a absolute length of 1024 we will hit that path - not good"
-*/
-    ptp_out->length = PTP_USB_BULK_HDR_LEN + filesize;
-    ptp_out->type = PTP_USB_CONTAINER_DATA;
-    ptp_out->code = ptp_in->code;
-    ptp_out->trans_id = ptp_in->trans_id;
-
-    // in-line send routine!
-        uint8_t *packet = (uint8_t*)ptp_out;
-        int len = PTP_USB_BULK_HDR_LEN + bytes_read;
-        DEBUG(1,"\t\t\t\tsending first packet; size = %04x", len);
-
-        for(int i = 0; i < len; i++) {
-            UDP_ENDPOINT_FIFO(2) = packet[i];
-        }
-
-        DEBUG(1,"\t\t\t\tfirst packet; size = %04x", len);
-        UDP_ENDPOINT_CSR(2) |= UDP_CSR_TX_PACKET;
-
-
-        if (len < 64)
-            goto done;
-
-        do {
-            bytes_read = FF_Read(file, 64, 1, (FF_T_UINT8*)buffer);
-
-//            DEBUG(1,"\t\t\t\tsending next packet; size = %04x", bytes_read);
-
-            packet = (uint8_t*)buffer;
-            len = bytes_read;
-
-            for(int i = 0; i < len; i++) {
-                UDP_ENDPOINT_FIFO(2) = packet[i];
-            }
-
-            while(!(UDP_ENDPOINT_CSR(2) & UDP_CSR_TX_PACKET_ACKED))
-                ;
-            UDP_ENDPOINT_CSR(2) &= ~UDP_CSR_TX_PACKET_ACKED;
-            while(UDP_ENDPOINT_CSR(2) & UDP_CSR_TX_PACKET_ACKED)
-                ;
-
-            UDP_ENDPOINT_CSR(2) |= UDP_CSR_TX_PACKET;
-
-        } while(bytes_read);
-done:
-
-        while(!(UDP_ENDPOINT_CSR(2) & UDP_CSR_TX_PACKET_ACKED))
-            ;
-        UDP_ENDPOINT_CSR(2) &= ~UDP_CSR_TX_PACKET_ACKED;
-        while(UDP_ENDPOINT_CSR(2) & UDP_CSR_TX_PACKET_ACKED)
-            ;
-#endif
-//---------------------------------------------------------
-
+    const uint32_t filesize = info.fsize;
+    const uint32_t sent = StreamFromFile(ptp_in, file, 0, filesize);
 
     DEBUG(1,"\t\t\t\twe're done");
     FF_Close(file);
-    return PTP_RC_OK;
+
+    return sent == filesize ? PTP_RC_OK : PTP_RC_IncompleteTransfer;
 }
 
 static uint16_t GetThumb(PTPUSBBulkContainer* ptp)
@@ -950,15 +823,13 @@ static uint16_t DeleteObject(PTPUSBBulkContainer* ptp_in)
     uint32_t handle = ptp_in->payload.params.param1;
 
     DumpClusters();
-//    DEBUG(1,"\t\t\t\tnum_clusters : %d", num_clusters);
-//    for (int i = 0; i < num_clusters; ++i)
-//    {
-//        DEBUG(1,"\t\t\t\t%04x ; dir = %08x ; parent = %08x", i, dirclusters[i], assoclink[i]);
-//    }
 
-    FF_ERROR err = DeleteDirent(handle);
+    FRESULT res = DeleteDirent(handle);
+
+    if (res == FR_NO_FILE)
+        return PTP_RC_InvalidObjectHandle;
 
-    return FF_isERR(err) ? PTP_RC_StoreReadOnly : PTP_RC_OK;
+    return res != FR_OK ? PTP_RC_StoreReadOnly : PTP_RC_OK;
 }
 
 static uint32_t send_object_handle = 0;
@@ -1025,7 +896,7 @@ static uint16_t SendObjectInfo(PTPUSBBulkContainer* ptp_in)
     uint16_t assoc_code;
     uint32_t assoc_desc;
 
-    char filename[FF_MAX_FILENAME];
+    char filename[FF_LFN_BUF + 1];
     char created[20];
     char modified[20];
 
@@ -1068,47 +939,18 @@ static uint16_t SendObjectInfo(PTPUSBBulkContainer* ptp_in)
 
     DEBUG(1,"\t\t\t\tCreate full path");
 
-    char buffer[FF_MAX_PATH];
-    size_t pos = sizeof(buffer) - 1;
-    buffer[pos] = 0;
-
-    size_t len = strlen(filename);
-    pos -= len;
-    memcpy(&buffer[pos], filename, len);
-    buffer[--pos] = '/';
-
     if (parent == 0xffffffff)
         parent = 0x00000000;
 
-    {
-        uint32_t handle = parent;
-
-        while(handle) {
-            uint16_t cluster_index = (handle >> 16) - 1;
-            uint16_t item_index = handle & 0xffff;
-
-            FF_DIRENT dirent;
-            if (FF_isERR(GetDirentInfo(cluster_index, item_index, &dirent)))
-                return PTP_RC_InvalidObjectHandle;
-
-            // insert current filename infront of existing name
-            len = strlen(dirent.FileName);
-            pos -= len;
-            memcpy(&buffer[pos], dirent.FileName, len);
-            buffer[--pos] = '/';
-
-            handle = assoclink[cluster_index];
-        };
-    }
-
-    const char* path = &buffer[pos];
+    const char* path = GetFullPathFromHandle(parent, filename, NULL);
+    if (!path)
+        return PTP_RC_InvalidParentObject;
 
     DEBUG(1,"\t\t\t\tFULL PATH = %s", path);
-    uint8_t attrib = 0;
+    uint8_t isdir = object_format == PTP_OFC_Association;
 
-    if (object_format == PTP_OFC_Association) {
-        attrib = FF_FAT_ATTR_DIR;
-        FF_ERROR err = FF_MkDir(pIoman, path);
+    if (isdir) {
+        FF_ERROR err = FF_MkDirTree(pIoman, path);
         DEBUG(1,"\t\t\t\tFF_MkDir returned %08x", err);
     } else {
         FF_ERROR err;
@@ -1119,22 +961,19 @@ static uint16_t SendObjectInfo(PTPUSBBulkContainer* ptp_in)
         DEBUG(1,"\t\t\t\tFF_Open returned %08x", err);
     }
 
-    DEBUG(1,"\t\t\t\tcreated %s with attrib = %02x", path, attrib);
+    DEBUG(1,"\t\t\t\tcreated %s (%s)", path, isdir ? "dir" : "file");
 
-    FF_DIRENT dirent;
-    FF_ERROR error = GetDirentInfoFromName(parent, filename, &dirent);
-    uint32_t object = dirent.ObjectCluster;
+    uint32_t handle;
+    FILINFO info;
+    FRESULT res = GetDirentInfoFromName(parent, filename, &handle, &info);
 
-    DEBUG(1,"\t\t\t\tfind entry returned = %08x with error = %08x", object, error);
-    if (FF_isERR(error))
+    DEBUG(1,"\t\t\t\tfind entry returned = %08x with error = %d", handle, res);
+    if (res != FR_OK)
         return PTP_RC_InvalidParameter;
 
-    DEBUG(1,"\t\t\t\tobj cluster = %08x", object);
-
-    uint32_t handle = ((GetClusterIndex(dirent.DirCluster) + 1) << 16) | dirent.CurrentItem;
-    DEBUG(1,"[%08x] %08x / %04x : %s", handle, dirent.DirCluster, dirent.CurrentItem, dirent.FileName);
-    if (attrib == FF_FAT_ATTR_DIR)
-        AddCluster(dirent.ObjectCluster, handle);
+    DEBUG(1,"[%08x] %s", handle, info.fname);
+    if (isdir)
+        AddCluster(MTP_CLUSTER_UNKNOWN, handle);
     else {
         send_object_handle = handle;
         send_object_filesize = filesize;
@@ -1157,28 +996,52 @@ typedef struct _SendObject_Context {
     PTPUSBBulkContainer header;
     FF_FILE* file;
     int32_t remaining_bytes;
+    uint32_t fill;                      // bytes collected in 'stream_buffer'
+    uint8_t error;
 } SendObject_Context;
 
 static SendObject_Context send_ctx;
+
+static void flush_to_file(SendObject_Context* ctx)
+{
+    if (ctx->fill && FF_Write(ctx->file, 1, ctx->fill, stream_buffer) != ctx->fill) {
+        WARNING("MTP: write failed");
+        ctx->error = 1;
+    }
+
+    ctx->fill = 0;
+}
+
+// Incoming packets are collected until a whole chunk can be written; the file position
+// then stays chunk (and so sector) aligned for the complete object.
 static uint32_t stream_to_file(uint8_t* buffer, uint32_t length, void* context) {
     SendObject_Context* ctx = (SendObject_Context*)context;
 
-//    DEBUG(1,"\t\t\t\t Streaming %08x bytes to %08X", length, ctx->file);
-    ctx->remaining_bytes -= length;
+    for (uint32_t copied = 0; copied < length; ) {
+        uint32_t n = min(length - copied, MTP_STREAM_CHUNK - ctx->fill);
+        memcpy(&stream_buffer[ctx->fill], &buffer[copied], n);
+        ctx->fill += n;
+        copied += n;
 
-    int written = 0;
-    if (length)
-        written = length;//FF_Write(ctx->file, 1, length, buffer);
+        if (ctx->fill == MTP_STREAM_CHUNK) {
+            flush_to_file(ctx);
+        }
+    }
+
+    ctx->remaining_bytes -= length;
 
     if (ctx->remaining_bytes > 0)
-        return written;
+        return length;
+
+    flush_to_file(ctx);
 
     DEBUG(1,"\t\t\t\t Closing %08X", ctx->file);
     FF_Close(ctx->file);
+    InvalidateDirCursor();
 
     ptp_out->length = PTP_USB_BULK_HDR_LEN;
     ptp_out->type = PTP_USB_CONTAINER_RESPONSE;
-    ptp_out->code = PTP_RC_OK;
+    ptp_out->code = ctx->error ? PTP_RC_IncompleteTransfer : PTP_RC_OK;
     ptp_out->trans_id = ctx->header.trans_id;
 
     UsbSendPacket((uint8_t*)ptp_out, ptp_out->length);
@@ -1186,7 +1049,7 @@ static uint32_t stream_to_file(uint8_t* buffer, uint32_t length, void* context)
     stream_func = 0;
     stream_context = 0;
 
-    return written;
+    return length;
 }
 
 static uint16_t SendObject(PTPUSBBulkContainer* ptp_in)
@@ -1217,32 +1080,9 @@ static uint16_t SendObject(PTPUSBBulkContainer* ptp_in)
         return PTP_RC_Undefined;
     }
 
-    uint32_t handle = send_object_handle;
-
-    // create full path
-
-    char buffer[FF_MAX_PATH];
-    size_t pos = sizeof(buffer) - 1;
-    buffer[pos] = 0;
-
-    do {
-        uint16_t cluster_index = (handle >> 16) - 1;
-        uint16_t item_index = handle & 0xffff;
-
-        FF_DIRENT dirent;
-        if (FF_isERR(GetDirentInfo(cluster_index, item_index, &dirent)))
-            return PTP_RC_InvalidObjectHandle;
-
-        // insert current filename infront of existing name
-        size_t len = strlen(dirent.FileName);
-        pos -= len;
-        memcpy(&buffer[pos], dirent.FileName, len);
-        buffer[--pos] = '/';
-
-        handle = assoclink[cluster_index];
-    } while(handle);
-
-    const char* path = &buffer[pos];
+    const char* path = GetFullPathFromHandle(send_object_handle, NULL, NULL);
+    if (!path)
+        return PTP_RC_InvalidObjectHandle;
 
     DEBUG(1,"\t\t\t\tFULL PATH = %s", path);
 
@@ -1251,6 +1091,8 @@ static uint16_t SendObject(PTPUSBBulkContainer* ptp_in)
     if (!send_ctx.file)
         return PTP_RC_GeneralError;
     send_ctx.remaining_bytes = send_object_filesize;
+    send_ctx.fill = 0;
+    send_ctx.error = 0;
 
     DEBUG(1,"\t\t\t\tFILE* = %08X", send_ctx.file);
 
@@ -1434,7 +1276,7 @@ static uint16_t ResetDevicePropValue(PTPUSBBulkContainer* ptp)
     return PTP_RC_GeneralError;
 }
 
-static uint16_t GetPartialObject(PTPUSBBulkContainer* ptp)
+static uint16_t GetPartialObject(PTPUSBBulkContainer* ptp_in)
 {
     /*
         Operation Code          0x101B
@@ -1452,7 +1294,39 @@ static uint16_t GetPartialObject(PTPUSBBulkContainer* ptp)
         Response Parameter 4    None
         Response Parameter 5    None
     */
-    return PTP_RC_GeneralError;
+
+    DumpParams(ptp_in);
+
+    uint32_t handle = ptp_in->payload.params.param1;
+    uint32_t offset = ptp_in->payload.params.param2;
+    uint32_t length = ptp_in->payload.params.param3;
+
+    FILINFO info;
+    const char* path = GetFullPathFromHandle(handle, NULL, &info);
+    if (!path || (info.fattrib & AM_DIR))
+        return PTP_RC_InvalidObjectHandle;
+
+    if (offset > info.fsize)
+        return PTP_RC_InvalidParameter;
+
+    length = min(length, info.fsize - offset);
+
+    FF_FILE* file = FF_Open(pIoman, path, FF_MODE_READ, NULL);
+    if (!file)
+        return PTP_RC_GeneralError;
+
+    const uint32_t sent = StreamFromFile(ptp_in, file, offset, length);
+    FF_Close(file);
+
+    ptp_out->length = PTP_USB_BULK_HDR_LEN + sizeof(uint32_t);
+    ptp_out->type = PTP_USB_CONTAINER_RESPONSE;
+    ptp_out->code = sent == length ? PTP_RC_OK : PTP_RC_IncompleteTransfer;
+    ptp_out->trans_id = ptp_in->trans_id;
+    ptp_out->payload.params.param1 = sent;
+
+    UsbSendPacket((uint8_t*)ptp_out, ptp_out->length);
+
+    return PTP_RC_Undefined;
 }
 
 
@@ -1641,77 +1515,52 @@ static uint16_t GetObjectPropDesc(PTPUSBBulkContainer* ptp_in)
                     // hack
                     static uint32_t PUOID[2];
 
-                    static uint16_t GetSingleObjectPropValue(uint32_t handle, uint16_t prop_code, FF_DIRENT* cached_dirent, size_t* value_out)
+                    typedef struct _CachedDirent {
+                        uint32_t handle;
+                        FILINFO info;
+                    } CachedDirent;
+
+                    static uint16_t GetSingleObjectPropValue(uint32_t handle, uint16_t prop_code, CachedDirent* cached, size_t* value_out)
                     {
                         if (prop_code == PTP_OPC_StorageID)
                             *value_out = 0x00010001;
                         else if (prop_code == PTP_OPC_ProtectionStatus)
                             *value_out = PTP_PS_NoProtection;
                         else if (prop_code == PTP_OPC_ObjectFormat) {
-                            uint16_t object_format = PTP_OFC_Undefined;
-
-                            // scan all know assoclinks for the handle. if found -> handle is an association
-                            for (uint16_t i = 0; i < num_clusters; ++i) {
-                                if (assoclink[i] == handle) {
-                                    object_format = PTP_OFC_Association;
-                                    break;
-                                }
-                            }
-                            *value_out = object_format;
+                            *value_out = IsDirHandle(handle) ? PTP_OFC_Association : PTP_OFC_Undefined;
                         } else {
 
                             // all other object properties requires a directory fetch..
+                            // the dirent is cached between calls, so a property list only reads it once
 
                             uint16_t cluster_index = (handle >> 16) - 1;
-                            uint16_t item_index = handle & 0xffff;
 
                             if (cluster_index >= num_clusters)
                                 return PTP_RC_InvalidObjectHandle;
-                            uint32_t dir_cluster = dirclusters[cluster_index];
-                            if (dir_cluster == 0x00000000)
-                                return PTP_RC_InvalidParameter;
 
-                            // if the cached dirent doesn't match what we're looking for -> re-read
-                            if (cached_dirent->DirCluster != dir_cluster || cached_dirent->CurrentItem != item_index)
+                            if (cached->handle != handle)
                             {
-                                FF_DIRENT dirent;
-                                memset(&dirent, 0x00, sizeof(dirent));
-
-                                dirent.DirCluster = dir_cluster;
-                                dirent.CurrentItem = item_index;
-
-                                DEBUG(1,"\t\t\t\tinit entry fetch");
-                                if(FF_isERR(FF_InitEntryFetch(pIoman, dirent.DirCluster, &dirent.FetchContext)))
-                                    return PTP_RC_GeneralError;
-
                                 DEBUG(1,"\t\t\t\tfetch dirent");
 
-                                FF_ERROR err = FetchDirents(&dirent, GetObjectInfo_Callback, cached_dirent);
-
-                                DEBUG(1,"\t\t\t\tcheck return value");
-
-                                if (FF_isERR(err) && FF_GETERROR(err) != FF_ERR_DIR_END_OF_DIR)
-                                    return PTP_RC_GeneralError;
-
-                                DEBUG(1,"\t\t\t\tvalidate cluster/index");
-
-                                if (cached_dirent->DirCluster != dir_cluster || cached_dirent->CurrentItem != item_index)
+                                if (GetDirentInfo(handle, &cached->info) != FR_OK)
                                     return PTP_RC_InvalidObjectHandle;
+
+                                cached->handle = handle;
                             }
 
                             if (prop_code == PTP_OPC_ObjectSize)
-                                *value_out = cached_dirent->Filesize;
+                                *value_out = cached->info.fsize;
                             else if (prop_code == PTP_OPC_ObjectFileName || prop_code == PTP_OPC_Name)
-                               *value_out = (size_t)cached_dirent->FileName;
+                               *value_out = (size_t)cached->info.fname;
                             else if (prop_code == PTP_OPC_ParentObject)
-                                *value_out = assoclink[cluster_index];
+                                *value_out = GetParentHandle(handle);
                             else if (prop_code == PTP_OPC_DateModified)
                                 *value_out = (size_t)"19700101T010101.5";
                             else if (prop_code == PTP_OPC_DateAdded)
                                 *value_out = (size_t)"19700101T010101.5";
                             else if (prop_code == PTP_OPC_PersistantUniqueObjectIdentifier) {
-                                PUOID[0] = cached_dirent->DirCluster;
-                                PUOID[1] = cached_dirent->ObjectCluster;
+                                PUOID[0] = dirclusters[cluster_index];
+                                PUOID[1] = handle;
                                 *value_out = (size_t)PUOID;
                             }
                             else {
@@ -1760,9 +1609,9 @@ static uint16_t GetObjectPropValue(PTPUSBBulkContainer* ptp_in)
     uint16_t datatype = ObjectPropsSupported[prop_index].dtc;
     size_t value = 0;
 
-    FF_DIRENT dirent;
-    memset(&dirent, 0x00, sizeof(dirent));
-    uint16_t rc = GetSingleObjectPropValue(handle, prop_code, &dirent, &value);
+    CachedDirent cached;
+    cached.handle = MTP_INVALID_ID;
+    uint16_t rc = GetSingleObjectPropValue(handle, prop_code, &cached, &value);
     if (rc != PTP_RC_OK) {
         DEBUG(1,"Unknown prop_code / error getting property : %04x", prop_code);    
         return rc;
@@ -1818,47 +1667,41 @@ static uint16_t SetObjectPropValue(PTPUSBBulkContainer* ptp_in)
     }
 
     if (prop_code == PTP_OPC_ObjectFileName) {
+        char old_name[FF_MAX_PATH];
         char new_name[FF_MAX_PATH];
-        const char* old_name = GetFullPathFromHandle(handle, NULL, NULL);
+        const char* path = GetFullPathFromHandle(handle, NULL, NULL);
+        if (!path)
+            return PTP_RC_InvalidObjectHandle;
+        strcpy(old_name, path);
         DEBUG(1,"\t\t\t\told_name = %s", old_name);
 
-        uint8_t len = ptp_in->length - PTP_USB_BULK_HDR_LEN;
-        uint8_t offset = strrchr(old_name, '/') - old_name + 1;
+        uint32_t len = ptp_in->length - PTP_USB_BULK_HDR_LEN;
+        uint32_t offset = strrchr(old_name, '/') - old_name + 1;
         DEBUG(1,"\t\t\t\tlen = %d", len);
         DEBUG(1,"\t\t\t\toffset = %d", offset);
         memcpy(new_name, old_name, offset);
         ReadString(ptp_in, 0, &new_name[offset]);
         DEBUG(1,"\t\t\t\tnew_name = %s", new_name);
 
+        if (FF_Move(pIoman, old_name, new_name) != FF_ERR_NONE)
+            return PTP_RC_AccessDenied;
 
-        FF_Move(pIoman, old_name, new_name);
-
-
-//        uint32_t new_handle = GetHandleFromFullPath(handle);
+        InvalidateDirCursor();
 
+        // the renamed entry may end up in a different slot of the same directory
         DEBUG(1,"\t\t\t\t -- get new handle");
 
-        uint32_t parent = 0;
-        FF_ERROR error = FF_ERR_NONE;
-        FF_T_UINT32 dirCluster = FF_FindDir(pIoman, new_name, offset, &error);
-        DEBUG(1,"\t\t\t\t error = %08x", error);
-        DEBUG(1,"\t\t\t\t dirCluster = %08x", dirCluster);
-        for (size_t cluster_index = 0; cluster_index < num_clusters; ++cluster_index)
-            if (dirclusters[cluster_index] == dirCluster)
-                parent = assoclink[cluster_index];
-        DEBUG(1,"\t\t\t\t parent = %08x", parent);
-        FF_DIRENT dirent;
-        error = GetDirentInfoFromName(parent, &new_name[offset], &dirent);
-        DEBUG(1,"\t\t\t\t error = %08x", error);
-        DEBUG(1,"\t\t\t\t dirent.DirCluster = %08x", dirent.DirCluster);
-        DEBUG(1,"\t\t\t\t dirent.CurrentItem = %08x", dirent.CurrentItem);
-        uint32_t new_handle = ((GetClusterIndex(dirent.DirCluster) + 1) << 16) | dirent.CurrentItem;
+        uint32_t parent = GetParentHandle(handle);
+        uint32_t new_handle = 0;
+        FILINFO info;
+        if (GetDirentInfoFromName(parent, &new_name[offset], &new_handle, &info) != FR_OK)
+            return PTP_RC_GeneralError;
+
         DEBUG(1,"\t\t\t\t old_handle = %08x", handle);
         DEBUG(1,"\t\t\t\t new_handle = %08x", new_handle);
 
-        moved[num_moved*2+0] = handle;
-        moved[num_moved*2+1] = new_handle;
-        num_moved++;
+        if (new_handle != handle)
+            AddRename(handle, new_handle);
     }
 
     return PTP_RC_OK;
@@ -1931,15 +1774,15 @@ static uint16_t GetObjPropList(PTPUSBBulkContainer* ptp_in)
 
     offset = Write32bits(ptp_out, offset, num_props);
 
-    FF_DIRENT dirent;
-    memset(&dirent, 0x00, sizeof(dirent));
+    CachedDirent cached;
+    cached.handle = MTP_INVALID_ID;
     for (uint32_t i = prop_index; i < (prop_index + num_props); ++i) {
 
         uint16_t prop_code = ObjectPropsSupported[i].opc;
         uint16_t datatype = ObjectPropsSupported[i].dtc;
         size_t value = 0;
 
-        if (GetSingleObjectPropValue(handle, prop_code, &dirent, &value) != PTP_RC_OK) {
+        if (GetSingleObjectPropValue(handle, prop_code, &cached, &value) != PTP_RC_OK) {
             DEBUG(1,"Unknown prop_code / error getting property : %04x", prop_code);
             return PTP_RC_GeneralError;    
         }
@@ -16,30 +16,48 @@
 
 #include "mtp_database.h"
 #include "messaging.h"
+#include "stringlight.h"
 #include <string.h>
 #include "hardware/io.h"
 
-/*static*/ uint16_t num_clusters = 0;
-/*static*/ int32_t dirclusters[256] = { 0 };
-/*static*/ uint32_t assoclink[256] = { 0 };
-/*static*/ uint16_t num_moved = 0;
-/*static*/ uint32_t moved[256] = { 0 };
+uint16_t num_clusters = 0;
+uint32_t dirclusters[MTP_MAX_DIRS] = { 0 };
+uint32_t assoclink[MTP_MAX_DIRS] = { 0 };
+
+static uint16_t num_moved = 0;
+static uint32_t moved[MTP_MAX_MOVED * 2] = { 0 };
 
 static MtpStorage storage;
 
+// A single open directory object is kept between calls. MTP hosts walk a folder
+// in order (GetObjectHandles followed by GetObjectInfo/GetObjectPropValue for each
+// handle), so resolving a handle is usually just a continuation of the last f_readdir().
+typedef struct {
+    DIR         dir;
+    uint8_t     valid;
+    uint16_t    index;                  // directory index (see below) the cursor is open on
+    uint32_t    next;                   // item index the next f_readdir() will start at
+    uint16_t    path_len;
+    char        path[FF_MAX_PATH];
+} dir_cursor_t;
+
+static dir_cursor_t cursor;
+
 void mtp_open_session()
 {
     // invalidate clusters
     num_clusters = 0;
-    memset(dirclusters, 0x00, sizeof(dirclusters)); // dircluster == 0 is invalid
-    memset(assoclink, 0x00, sizeof(assoclink)); // dircluster == 0 is invalid
+    memset(dirclusters, 0xff, sizeof(dirclusters)); // MTP_CLUSTER_DELETED
+    memset(assoclink, 0x00, sizeof(assoclink));
     num_moved = 0;
-    memset(moved, 0x00, sizeof(moved)); //
+    memset(moved, 0x00, sizeof(moved));
+
+    InvalidateDirCursor();
 }
 
 void mtp_close_session()
 {
-
+    InvalidateDirCursor();
 }
 
 uint32_t mtp_get_num_storages()
@@ -61,14 +79,8 @@ const MtpStorage* mtp_get_storage_info(MtpStorageId id)
 
 	storage.storage_id = id;
 
-    strncpy(storage.description, pIoman->pPartition->VolLabel, sizeof(storage.description));
-    storage.description[sizeof(storage.description)-1] = '\0';
-    for (int i = sizeof(storage.description)-1; i; --i) {
-    	if (isspace(storage.description[i]) || storage.description[i] == '\0')
-    		storage.description[i] = 0;
-    	else
-    		break;
-	}
+    // FF_USE_LABEL is disabled; the volume label is not available
+    strncpy(storage.description, "SDCARD", sizeof(storage.description));
 
 	storage.storage_type = PTP_ST_RemovableRAM;
 	storage.filesystem_type = PTP_FST_GenericHierarchical;
@@ -87,8 +99,11 @@ const MtpStorage* mtp_get_storage_info(MtpStorageId id)
 
 
 /*
-    'dirclusters' is an index-mapping from 16bit to the full 32bit FF_DIRENT.DirCluster.
-    The 16bit index is the top 16bit of the MTP ObjectHandle minus 1. The lower 16bit is the FAT ItemIndex.
+    'dirclusters' is an index-mapping from 16bit to the first cluster of a directory (DIR.obj.sclust).
+    The 16bit index is the top 16bit of the MTP ObjectHandle minus 1. The lower 16bit is the index of
+    the (short name) directory entry inside that directory, i.e. DIR.dptr / 32.
+    A directory found while listing its parent is entered as MTP_CLUSTER_UNKNOWN; the cluster is filled
+    in the first time the directory is opened, and checked every time after that.
     The cluster index is +1 since it could otherwise cause the handle to result in 0x00000000 which is illegal (== root parent)
 
     'assoclink' is an index-mapping to the full 32bit ObjectHandle of the directory entry in the parent dir.
@@ -130,6 +145,7 @@ const MtpStorage* mtp_get_storage_info(MtpStorageId id)
     FAT is structured the other way (a directory lists its children)
 */
 
+
 uint32_t TrackRenames(uint32_t handle)
 {
     for (size_t i = 0; i < num_moved; i++)
@@ -139,39 +155,24 @@ uint32_t TrackRenames(uint32_t handle)
         }
     return handle;
 }
-/*
-void SendMovedFiles()
+
+void AddRename(uint32_t old_handle, uint32_t new_handle)
 {
-    for (size_t i = 0; i < num_moved; i++) {
-        uint32_t handle = moved[i*2+0];
-
-        size_t offset = 0;
-        offset = Write32bits(ptp_out, offset, handle);
-
-        ptp_out->length = PTP_USB_BULK_HDR_LEN + offset;
-        ptp_out->type = PTP_USB_CONTAINER_EVENT;
-        ptp_out->code = PTP_EC_ObjectRemoved;
-        
-        DEBUG(1,"\t\t\t\t removing %08x", handle);
-        UsbSendPacket((uint8_t*)ptp_out, ptp_out->length);
+    if (num_moved == MTP_MAX_MOVED) {
+        WARNING("MTP: rename table full");
+        return;
     }
 
-    for (size_t i = 0; i < num_moved; i++) {
-        uint32_t handle = moved[i*2+1];
-
-        size_t offset = 0;
-        offset = Write32bits(ptp_out, offset, handle);
+    moved[num_moved*2+0] = old_handle;
+    moved[num_moved*2+1] = new_handle;
+    num_moved++;
 
-        ptp_out->length = PTP_USB_BULK_HDR_LEN + offset;
-        ptp_out->type = PTP_USB_CONTAINER_EVENT;
-        ptp_out->code = PTP_EC_ObjectAdded;
-        
-        DEBUG(1,"\t\t\t\t adding %08x", handle);
-        UsbSendPacket((uint8_t*)ptp_out, ptp_out->length);
-    }
-    num_moved = 0;
+    // a renamed directory keeps its cluster; relink it so its children keep their handles
+    for (uint16_t i = 0; i < num_clusters; ++i)
+        if (assoclink[i] == old_handle) {
+            assoclink[i] = new_handle;
+        }
 }
-*/
 
 void DumpClusters() {
     DEBUG(1,"\t\t\t\tnum_clusters : %d", num_clusters);
@@ -183,63 +184,61 @@ void DumpClusters() {
 
 void AddCluster(uint32_t cluster, uint32_t handle) {
     for (uint16_t i = 0; i < num_clusters; ++i) {
-        if (assoclink[i] == handle) {
-            if (dirclusters[i] != cluster)
+        if (assoclink[i] == handle && dirclusters[i] != MTP_CLUSTER_DELETED) {
+            if (cluster != MTP_CLUSTER_UNKNOWN && dirclusters[i] != MTP_CLUSTER_UNKNOWN && dirclusters[i] != cluster)
                 DEBUG(1,"ERROR! mismatching cluster / assoclink!");
             return;
         }
     }
 
+    if (num_clusters == MTP_MAX_DIRS) {
+        WARNING("MTP: too many directories");
+        return;
+    }
+
     dirclusters[num_clusters] = cluster;
     assoclink[num_clusters] = handle;
     num_clusters++;
 }
 
-static void DeleteCluster(uint32_t handle) {
-    uint16_t cluster_index = 0xffff;
+static uint16_t GetParentCluster(uint32_t handle) {
+    // given an object handle, we scan through the assoclink list trying to find the index of the link
     for (uint16_t i = 0; i < num_clusters; ++i)
-        if (assoclink[i] == handle) {
-            if (!dirclusters[i])
-                DEBUG(1,"ERROR! bad cluster value!");
-            cluster_index = i;
-            break;
+        if (assoclink[i] == handle && dirclusters[i] != MTP_CLUSTER_DELETED) {
+            return i;
         }
-
-    // we can't remove the cluster here, but we mark it as 'bad'
-    dirclusters[cluster_index] = 0;
+    return 0xffff;
 }
 
-uint16_t GetClusterIndex(uint32_t cluster) {
+void DeleteCluster(uint32_t handle) {
+    // we can't remove the cluster index (handles are built from it), but we mark it and
+    // every directory below it as 'deleted'
     for (uint16_t i = 0; i < num_clusters; ++i) {
-        if (dirclusters[i] == cluster) {
-            return i;
+        uint32_t link = assoclink[i];
+
+        for (uint8_t depth = 0; link && depth < MTP_MAX_DEPTH; ++depth) {
+            if (link == handle) {
+                dirclusters[i] = MTP_CLUSTER_DELETED;
+                break;
+            }
+            link = assoclink[(link >> 16) - 1];
         }
     }
 
-    DEBUG(1,"ERROR! could not find cluster index = %08x!", cluster);
-    DumpClusters();
-    return 0;
+    InvalidateDirCursor();
 }
 
-static uint16_t GetParentCluster(uint32_t handle) {
-    // given an object handle, we scan through the assoclink list trying to find the index of the link
-    for (uint16_t i = 0; i < num_clusters; ++i)
-        if (assoclink[i] == handle) {
-            return i;
-        }
-    return 0xffff;
+uint8_t IsDirHandle(uint32_t handle)
+{
+    return GetParentCluster(handle) != 0xffff;
 }
 
-/*
-static uint32_t CreateObjectHandle(uint32_t dircluster, uint16_t itemindex) {
-    uint32_t handle = ((cGetClusterIndex(dircluster) + 1) << 16) | pDirent->CurrentItem;
-    return handle;
-}
-static uint32_t CreateDirent(uint32_t dircluster, uint16_t itemindex) {
-    uint32_t handle = ((cGetClusterIndex(dircluster) + 1) << 16) | pDirent->CurrentItem;
-    return handle;
+uint32_t GetParentHandle(uint32_t handle)
+{
+    uint16_t cluster_index = (handle >> 16) - 1;
+    return cluster_index < num_clusters ? assoclink[cluster_index] : 0;
 }
-*/
+
 uint32_t FindClusterByHandle(uint32_t parent) {
     if (parent == 0xffffffff)
         parent = 0x00000000;
@@ -250,331 +249,349 @@ uint32_t FindClusterByHandle(uint32_t parent) {
         DEBUG(1,"\t\t\t\tcheck parent");
         // if the HOST is asking for something else than the root handles at this point it must be an error
         if (parent != 0x00000000)
-            return 0;
+            return 0xffff;
 
-        AddCluster(pIoman->pPartition->RootDirCluster, 0x00000000);
+        // the root cluster is filled in when the cursor first opens "/"
+        AddCluster(MTP_CLUSTER_UNKNOWN, 0x00000000);
     }
 
     uint16_t cluster_index = GetParentCluster(parent);
     DEBUG(1,"\t\t\t\tcheck cluster index : %04x", cluster_index);
-    if (cluster_index == 0xffff || cluster_index >= num_clusters || dirclusters[cluster_index] == 0 ) {
+    if (cluster_index == 0xffff) {
         DEBUG(1,"\t\t\t\tDIR CLUSTER NOT FOUND!");
-        return 0;
     }
 
-    DEBUG(1,"\t\t\t\tdircluster : %08x", dirclusters[cluster_index]);
-
-    return dirclusters[cluster_index];
+    return cluster_index;
 }
 
+// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-const char* GetFullPathFromHandle(uint32_t handle, const char* optional_filename, FF_DIRENT* optional_dirent)
+void InvalidateDirCursor(void)
 {
-    // create full path
+    if (cursor.valid) {
+        f_closedir(&cursor.dir);
+    }
 
-    FF_DIRENT dirent, *pDirent;
+    cursor.valid = 0;
+}
 
-    static char buffer[FF_MAX_PATH];
-    size_t pos = sizeof(buffer) - 1;
-    buffer[pos] = 0;
+// Read the next entry from the cursor, returning its item index.
+// f_readdir() leaves 'dptr' on the entry following the one returned, except when
+// the end of the table was hit - then 'sect' is cleared and 'dptr' is not advanced.
+static FRESULT ReadCursor(FILINFO* info, uint32_t* item)
+{
+    FRESULT res = f_readdir(&cursor.dir, info);
 
-    if (optional_filename) {
-        size_t len = strlen(optional_filename);
-        pos -= len;
-        memcpy(&buffer[pos], optional_filename, len);
-        buffer[--pos] = '/';
+    if (res != FR_OK) {
+        InvalidateDirCursor();
+        return res;
     }
 
-    pDirent = optional_dirent ? optional_dirent : &dirent;
-
-    while(handle) {
-        uint16_t cluster_index = (handle >> 16) - 1;
-        uint16_t item_index = handle & 0xffff;
-
-        if (FF_isERR(GetDirentInfo(cluster_index, item_index, pDirent)))
-            return 0;
+    if (!info->fname[0]) {
+        return FR_NO_FILE;
+    }
 
-        // insert current filename infront of existing name
-        size_t len = strlen(pDirent->FileName);
-        pos -= len;
-        memcpy(&buffer[pos], pDirent->FileName, len);
-        buffer[--pos] = '/';
+    uint32_t ofs = cursor.dir.dptr;
 
-        handle = assoclink[cluster_index];
+    if (cursor.dir.sect) {
+        ofs -= 32;
     }
 
-    const char* path = &buffer[pos];
-    return path;
+    *item = ofs / 32;
+    cursor.next = *item + 1;
+    return FR_OK;
 }
 
+static FRESULT OpenCursor(uint16_t index, const char* path, size_t path_len)
+{
+    InvalidateDirCursor();
 
-// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+    if (path_len >= sizeof(cursor.path)) {
+        return FR_INVALID_NAME;
+    }
 
-// FetchDirent will progress through the TOC, starting att 'CurrentItem', until it finds the end-of-dir.
-// For each valid directory entry it will callback, check its return value, and (if 'true') continue to find the next directory entry
-// pDirent must have 'DirCluster' and 'CurrentItem' filled out - i.e. through a previous call to FF_InitEntryFetch() with DirCluster filled out.
-// callback will only be called for a valid directory entry, with _matching_ 'CurrentItem' set (i.e. not pointing to 'next')
-// pDirent will be updated to point to the next (possibly invalid) directory entry before returning from FetchDirent()
-FF_ERROR FetchDirents(FF_DIRENT* pDirent, DirentCallback callback, void* context)
-{
-    FF_ERROR err = FF_ERR_DIR_END_OF_DIR | FF_FINDNEXTINDIR;
-    FF_T_UINT8  numLFNs;
-    FF_T_UINT8 EntryBuffer[32];
+    memcpy(cursor.path, path, path_len);
+    cursor.path[path_len] = 0;
+    cursor.path_len = path_len;
 
-  for(; pDirent->CurrentItem < 0xFFFF; pDirent->CurrentItem += 1) {
+    FRESULT res = f_opendir(&cursor.dir, path_len ? cursor.path : "/");
 
-//    DEBUG(1,"0x%04x :", pDirent->CurrentItem);
-    const FF_T_UINT16 currentEntry = pDirent->CurrentItem;
+    if (res != FR_OK) {
+        return res;
+    }
+
+    const uint32_t sclust = cursor.dir.obj.sclust;
 
-    err = FF_FetchEntryWithContext(pIoman, pDirent->CurrentItem, &pDirent->FetchContext, EntryBuffer);
-    if (FF_isERR(err))
-        break;
+    if (dirclusters[index] == MTP_CLUSTER_UNKNOWN) {
+        dirclusters[index] = sclust;
 
-    if(EntryBuffer[0] == FF_FAT_DELETED) {
-//      DEBUG(1,"       : <DELETED>");
-      continue;
+    } else if (dirclusters[index] != sclust) {
+        // the entry behind this handle is no longer the directory we listed
+        DEBUG(1,"\t\t\t\tstale directory %04x : %08x != %08x", index, dirclusters[index], sclust);
+        f_closedir(&cursor.dir);
+        return FR_NO_PATH;
     }
 
-    if(FF_isEndOfDir(EntryBuffer)){
-//      DEBUG(1,"      : <ENDOFDIR>");
-      err = FF_ERR_DIR_END_OF_DIR | FF_FINDNEXTINDIR;
-      break;
+    cursor.valid = 1;
+    cursor.index = index;
+    cursor.next = 0;
+    return FR_OK;
+}
+
+// Position the cursor on directory 'index' and return the first entry with an item index >= 'first'.
+static FRESULT SeekCursor(uint16_t index, uint32_t first, uint32_t* item, FILINFO* info)
+{
+    FRESULT res;
+
+    if (index >= num_clusters || dirclusters[index] == MTP_CLUSTER_DELETED) {
+        return FR_NO_PATH;
     }
 
-    pDirent->Attrib = FF_getChar(EntryBuffer, (FF_T_UINT16)(FF_FAT_DIRENT_ATTRIB));
-    if((pDirent->Attrib & FF_FAT_ATTR_LFN) == FF_FAT_ATTR_LFN) {
+    if (!cursor.valid || cursor.index != index) {
+        // walk down from the root, resolving one directory name per level
+        uint32_t chain[MTP_MAX_DEPTH];
+        uint8_t depth = 0;
 
-      numLFNs = (FF_T_UINT8)(EntryBuffer[0] & ~0x40);
-//      DEBUG(1,"       : numLFNs = %d", numLFNs);
+        for (uint32_t link = assoclink[index]; link; link = assoclink[(link >> 16) - 1]) {
+            if (depth == MTP_MAX_DEPTH) {
+                return FR_NO_PATH;
+            }
 
-      err = FF_FetchEntryWithContext(pIoman, (pDirent->CurrentItem + numLFNs), &pDirent->FetchContext, EntryBuffer);
-      if(FF_isERR(err))
-        break;
+            chain[depth++] = link;
+        }
 
-      if(EntryBuffer[0] == FF_FAT_DELETED) {
-//        DEBUG(1,"       : <DELETED> (SHORT, 0x%04x)", pDirent->CurrentItem + numLFNs);
-        pDirent->CurrentItem += numLFNs;    // jump to short name, for() will update to next entry
-        continue;
-      }
+        char path[FF_MAX_PATH];
+        size_t path_len = 0;
 
-      err = FF_PopulateLongDirent(pIoman, pDirent, pDirent->CurrentItem, &pDirent->FetchContext);
-      if(FF_isERR(err))
-        break;
+        if ((res = OpenCursor(0, path, path_len)) != FR_OK) {
+            return res;
+        }
 
-    if (callback)
-    {
-        const FF_T_UINT16 nextEntry = pDirent->CurrentItem;
-        pDirent->CurrentItem = currentEntry;
-        err = callback(pDirent, context);
-        pDirent->CurrentItem = nextEntry;
-        if (FF_isERR(err))
-            break;
-    }
+        while (depth--) {
+            const uint32_t link = chain[depth];
+            uint32_t found;
 
-      // pDirent->CurrentItem is already updated (by FF_PopulateLongDirent)
-      // Adjust the value to account for our top 'for()' loop
-      pDirent->CurrentItem -= 1;
-//      DEBUG(1,"       :    LFN : name = %s", pDirent->FileName);
+            if ((res = SeekCursor((link >> 16) - 1, link & 0xffff, &found, info)) != FR_OK) {
+                return res;
+            }
 
-      FF_PopulateShortDirent(pIoman, pDirent, EntryBuffer);
-//      DEBUG(1,"       : nonLFN : name = %s (SHORT, 0x%04x)", pDirent->FileName, pDirent->CurrentItem);
+            const size_t len = strlen(info->fname);
 
-    } else if((pDirent->Attrib & FF_FAT_ATTR_VOLID) == FF_FAT_ATTR_VOLID) {
-      // Do Nothing
-//      DEBUG(1,"       : <VOLID>");
+            if (found != (link & 0xffff) || path_len + 1 + len >= sizeof(path)) {
+                InvalidateDirCursor();
+                return FR_NO_PATH;
+            }
 
-    } else {
-      FF_PopulateShortDirent(pIoman, pDirent, EntryBuffer);
+            path[path_len++] = '/';
+            memcpy(&path[path_len], info->fname, len);
+            path_len += len;
 
-    if (callback)
-    {
-        const FF_T_UINT16 nextEntry = pDirent->CurrentItem;
-        pDirent->CurrentItem = currentEntry;
-        err = callback(pDirent, context);
-        pDirent->CurrentItem = nextEntry;
-        if (FF_isERR(err))
-            break;
+            const uint16_t dir_index = GetParentCluster(link);
+
+            if (dir_index == 0xffff) {
+                InvalidateDirCursor();
+                return FR_NO_PATH;
+            }
+
+            if ((res = OpenCursor(dir_index, path, path_len)) != FR_OK) {
+                return res;
+            }
+        }
     }
 
-//      DEBUG(1,"       : nonLFN : name = %s", pDirent->FileName);
+    if (first < cursor.next) {
+        if ((res = f_readdir(&cursor.dir, NULL)) != FR_OK) {
+            InvalidateDirCursor();
+            return res;
+        }
+
+        cursor.next = 0;
     }
-  }
 
-// ???
-  FF_CleanupEntryFetch(pIoman, &pDirent->FetchContext);
+    do {
+        if ((res = ReadCursor(info, item)) != FR_OK) {
+            return res;
+        }
+    } while (*item < first);
 
-  return err;
+    return FR_OK;
 }
 
-static FF_ERROR GetDirentInfo_Callback(FF_DIRENT* pDirent, void* context)
+int32_t mtp_get_num_objects(MtpStorageId id, MtpObjectFormat format, MtpObjectHandle parent)
 {
-    FF_DIRENT* dirent_out = (FF_DIRENT*) context;
-    DEBUG(1,"           %08x / %04x : %s", pDirent->DirCluster, pDirent->CurrentItem, pDirent->FileName);
-    memcpy(dirent_out, pDirent, sizeof(FF_DIRENT));
-    return FF_ERR_DIR_END_OF_DIR | FF_GETENTRY;
-}
-FF_ERROR GetDirentInfo(uint32_t cluster_index, uint16_t item_index, FF_DIRENT* pDirent)
-{
-    FF_DIRENT dirent;
-    memset(&dirent, 0x00, sizeof(dirent));
+    uint16_t cluster_index = FindClusterByHandle(parent);
 
-    if (cluster_index >= num_clusters)
-        return PTP_RC_InvalidObjectHandle;
-    uint32_t dir_cluster = dirclusters[cluster_index];
-    if (dir_cluster == 0x00000000)
-        return PTP_RC_InvalidParameter;
+    if (cluster_index == 0xffff) {
+        return -1;
+    }
 
-    dirent.DirCluster = dir_cluster;
-    dirent.CurrentItem = item_index;
+    FILINFO info;
+    int32_t count = 0;
 
-    DEBUG(1,"\t\t\t\tinit entry fetch");
-    if(FF_isERR(FF_InitEntryFetch(pIoman, dirent.DirCluster, &dirent.FetchContext)))
-        return PTP_RC_GeneralError;
+    for (uint32_t item = 0; SeekCursor(cluster_index, item, &item, &info) == FR_OK; ++item) {
+        count++;
+    }
 
-    DEBUG(1,"\t\t\t\tfetch dirent");
+    return count;
+}
 
-    FF_ERROR err = FetchDirents(&dirent, GetDirentInfo_Callback, pDirent);
+// FetchDirents will progress through the directory of 'parent' and callback for each valid
+// directory entry, with the object handle of that entry. Directories found are added to the
+// database. The callback is free to use the database (and move the cursor) - the listing
+// continues from the next item after the callback returns. A callback result other than
+// FR_OK stops the listing, and is passed back to the caller.
+FRESULT FetchDirents(uint32_t parent, DirentCallback callback, void* context)
+{
+    uint16_t cluster_index = FindClusterByHandle(parent);
 
-    DEBUG(1,"\t\t\t\tcheck return value");
+    if (cluster_index == 0xffff) {
+        return FR_NO_PATH;
+    }
 
-    if (FF_isERR(err) && FF_GETERROR(err) != FF_ERR_DIR_END_OF_DIR)
-        return PTP_RC_GeneralError;
+    FILINFO info;
+    FRESULT res;
+    uint32_t item = 0;
 
-    DEBUG(1,"\t\t\t\tvalidate cluster/index");
+    while ((res = SeekCursor(cluster_index, item, &item, &info)) == FR_OK) {
+        if (item > 0xffff) {
+            WARNING("MTP: directory too large");
+            break;
+        }
 
-    if (pDirent->DirCluster != dir_cluster || pDirent->CurrentItem != item_index)
-        return PTP_RC_InvalidObjectHandle;
+        const uint32_t handle = ((cluster_index + 1) << 16) | item;
 
-    return FF_ERR_NONE;
-}
+        if (info.fattrib & AM_DIR) {
+            AddCluster(MTP_CLUSTER_UNKNOWN, handle);
+        }
 
-static FF_ERROR GetDirentInfoFromName_Callback(FF_DIRENT* pDirent, void* context)
-{
-    FF_DIRENT* dirent_out = (FF_DIRENT*) context;
-    DEBUG(1,"           %08x / %04x : %s", pDirent->DirCluster, pDirent->CurrentItem, pDirent->FileName);
-    if (FF_stricmp(dirent_out->FileName, pDirent->FileName))
-        return FF_ERR_NONE;
-    memcpy(dirent_out, pDirent, sizeof(FF_DIRENT));
-    DEBUG(1,"\t\t\t\tfound dirent");
-    return FF_ERR_DIR_END_OF_DIR | FF_GETENTRY;
+        if (callback && (res = callback(handle, &info, context)) != FR_OK) {
+            return res;
+        }
+
+        item++;
+    }
+
+    return res == FR_NO_FILE ? FR_OK : res;
 }
-FF_ERROR GetDirentInfoFromName(uint32_t parent, const char* filename, FF_DIRENT* pDirent)
-{
-    FF_DIRENT dirent;
-    memset(&dirent, 0x00, sizeof(dirent));
 
-    dirent.DirCluster = FindClusterByHandle(parent);
-    dirent.CurrentItem = 0;
+FRESULT GetDirentInfo(uint32_t handle, FILINFO* info)
+{
+    uint16_t cluster_index = (handle >> 16) - 1;
+    uint32_t item_index = handle & 0xffff;
+    uint32_t found;
 
-    DEBUG(1,"\t\t\t\tfind created entry from dir cluster %08x / %s / %02x", dirent.DirCluster, filename);
+    FRESULT res = SeekCursor(cluster_index, item_index, &found, info);
 
-    DEBUG(1,"\t\t\t\tinit entry fetch");
-    FF_ERROR err = FF_InitEntryFetch(pIoman, dirent.DirCluster, &dirent.FetchContext);
-    if(FF_isERR(err))
-        return err;
+    if (res == FR_OK && found != item_index) {
+        res = FR_NO_FILE;
+    }
 
-    DEBUG(1,"\t\t\t\tfetch dirent");
-    strncpy(pDirent->FileName, filename, sizeof(pDirent->FileName));
-    err = FetchDirents(&dirent, GetDirentInfoFromName_Callback, pDirent);
+    return res;
+}
 
-    DEBUG(1,"\t\t\t\tcheck return value");
+typedef struct {
+    const char* filename;
+    uint32_t    handle;
+    FILINFO*    info;
+} FindName_Context;
 
-    if (FF_isERR(err) && FF_GETERROR(err) != FF_ERR_DIR_END_OF_DIR)
-        return err;
+static FRESULT GetDirentInfoFromName_Callback(uint32_t handle, const FILINFO* info, void* context)
+{
+    FindName_Context* ctx = (FindName_Context*) context;
 
-    if (FF_stricmp(pDirent->FileName, filename))
-        return FF_ERR_DIR_END_OF_DIR | FF_GETENTRY;
+    if (stricmp(ctx->filename, info->fname)) {
+        return FR_OK;
+    }
 
-    return FF_ERR_NONE;
+    DEBUG(1,"\t\t\t\tfound dirent [%08x] %s", handle, info->fname);
+    ctx->handle = handle;
+    memcpy(ctx->info, info, sizeof(FILINFO));
+    return FR_EXIST;
 }
 
-static FF_ERROR DeleteDirent_Callback(FF_DIRENT* pDirent, void* context)
+FRESULT GetDirentInfoFromName(uint32_t parent, const char* filename, uint32_t* handle, FILINFO* info)
 {
-    if (!strcmp(pDirent->FileName, ".") || !strcmp(pDirent->FileName, ".."))
-        return FF_ERR_NONE;
+    FindName_Context ctx = { filename, 0, info };
 
-    uint32_t handle = ((GetClusterIndex(pDirent->DirCluster) + 1) << 16) | pDirent->CurrentItem;
-    DEBUG(1,"[%08x] %08x / %04x : %s", handle, pDirent->DirCluster, pDirent->CurrentItem, pDirent->FileName);
-    FF_ERROR err;
-    if (pDirent->Attrib & FF_FAT_ATTR_DIR) {
-        AddCluster(pDirent->ObjectCluster, handle);
-        DEBUG(1,"\t\trecursing...");
-        err = DeleteDirent(handle);
-    } else {
-        // cat file
-        char* path = (char*)context;
-        const size_t path_len = strlen(path);
-        const size_t name_len = strlen(pDirent->FileName);
-        path[path_len] = '/';
-        memcpy(&path[path_len+1], pDirent->FileName, name_len+1);
-        DEBUG(1,"                           : %s", path);
-        err = FF_RmFile(pIoman, path);
-        path[path_len] = 0;
+    DEBUG(1,"\t\t\t\tfind created entry from parent %08x / %s", parent, filename);
+
+    // entries may have been added since the directory was last read
+    InvalidateDirCursor();
+
+    FRESULT res = FetchDirents(parent, GetDirentInfoFromName_Callback, &ctx);
+
+    if (res == FR_EXIST) {
+        *handle = ctx.handle;
+        return FR_OK;
     }
-    return err;
+
+    return res == FR_OK ? FR_NO_FILE : res;
 }
-FF_ERROR DeleteDirent(uint32_t handle)
-{
-    DEBUG(1,"\t\tDeleteDirent %08x", handle);
 
-    FF_DIRENT dirent;
+const char* GetFullPathFromHandle(uint32_t handle, const char* optional_filename, FILINFO* optional_info)
+{
+    // create full path, right to left
 
-    uint8_t isfile = GetParentCluster(handle) == 0xffff;
+    FILINFO info;
 
-    char buffer[FF_MAX_PATH];
+    static char buffer[FF_MAX_PATH];
     size_t pos = sizeof(buffer) - 1;
     buffer[pos] = 0;
 
-    uint32_t parent = handle;
-    do {
-        uint16_t cluster_index = (parent >> 16) - 1;
-        uint16_t item_index = parent & 0xffff;
+    if (optional_filename) {
+        size_t len = strlen(optional_filename);
+        if (len + 1 > pos)
+            return 0;
+        pos -= len;
+        memcpy(&buffer[pos], optional_filename, len);
+        buffer[--pos] = '/';
+    }
 
-        if (FF_isERR(GetDirentInfo(cluster_index, item_index, &dirent)))
-            return PTP_RC_InvalidObjectHandle;
+    for (uint8_t depth = 0; handle; ++depth) {
+        if (depth == MTP_MAX_DEPTH || GetDirentInfo(handle, &info) != FR_OK)
+            return 0;
+
+        if (depth == 0 && optional_info)
+            memcpy(optional_info, &info, sizeof(FILINFO));
 
         // insert current filename infront of existing name
-        size_t len = strlen(dirent.FileName);
+        size_t len = strlen(info.fname);
+        if (len + 1 > pos)
+            return 0;
         pos -= len;
-        memcpy(&buffer[pos], dirent.FileName, len);
+        memcpy(&buffer[pos], info.fname, len);
         buffer[--pos] = '/';
 
-        parent = assoclink[cluster_index];
-    } while(parent);
+        handle = GetParentHandle(handle);
+    }
 
-    memmove(buffer, &buffer[pos], strlen(&buffer[pos])+1);
+    return &buffer[pos];
+}
 
-    if (isfile)
-    {
-        DEBUG(1,"deleting (file) : %s", buffer);
-        return FF_RmFile(pIoman, buffer);
-    }
+FRESULT DeleteDirent(uint32_t handle)
+{
+    DEBUG(1,"\t\tDeleteDirent %08x", handle);
 
-    DEBUG(1,"deleting (dir) : %s", buffer);
+    FILINFO info;
+    const char* path = GetFullPathFromHandle(handle, NULL, &info);
 
-    memset(&dirent, 0x00, sizeof(dirent));
-    dirent.DirCluster = FindClusterByHandle(handle);
-    dirent.CurrentItem = 0;
+    if (!path) {
+        return FR_NO_FILE;
+    }
 
-    DEBUG(1,"\t\t\t\tinit entry fetch");
-    FF_ERROR err = FF_InitEntryFetch(pIoman, dirent.DirCluster, &dirent.FetchContext);
-    if(FF_isERR(err))
-        return err;
+    InvalidateDirCursor();
 
-    DEBUG(1,"\t\t\t\tfetch dirent");
-    err = FetchDirents(&dirent, DeleteDirent_Callback, buffer);
-    DEBUG(1,"\t\t\t\terr = %08x", err);
-    if (FF_isERR(err) && FF_GETERROR(err) != FF_ERR_DIR_END_OF_DIR)
-        return err;
+    FF_ERROR err;
 
-    DEBUG(1,"\t\t\t\trmdir %s", buffer);
-    err = FF_RmDir(pIoman, buffer);
-    if(FF_isERR(err))
-        return err;
+    if (info.fattrib & AM_DIR) {
+        DEBUG(1,"deleting (dir) : %s", path);
+        err = FF_RmDirTree(pIoman, path);
+        DeleteCluster(handle);
 
-    DEBUG(1,"\t\t\t\trm cluster");
-    DeleteCluster(handle);
+    } else {
+        DEBUG(1,"deleting (file) : %s", path);
+        err = FF_RmFile(pIoman, path);
+    }
 
-    return err;
+    return err == FF_ERR_NONE ? FR_OK : FR_DENIED;
 }
-
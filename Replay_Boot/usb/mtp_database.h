@@ -17,8 +17,8 @@
 #pragma once
 
 #include "mtp_supported.h"
-//#include <string.h>
-#include "filesys/fullfat.h"
+#include <string.h>
+#include "fullfat.h"
 
 typedef struct _MtpStorage
 {
@@ -61,7 +61,7 @@ uint32_t            mtp_get_num_storages();
 MtpStorageId        mtp_get_storage_id(uint32_t index);
 const MtpStorage*   mtp_get_storage_info(MtpStorageId id);
 
-static __attribute__((unused)) int32_t mtp_get_num_objects(MtpStorageId id, MtpObjectFormat format, MtpObjectHandle parent) { return -1; }
+int32_t             mtp_get_num_objects(MtpStorageId id, MtpObjectFormat format, MtpObjectHandle parent);
 static __attribute__((unused)) int32_t mtp_get_object_handles(MtpStorageId id, MtpObjectFormat format, MtpObjectHandle parent, MtpObjectHandle* handles_out, uint32_t max_handles) { return -1; }
 
 static __attribute__((unused)) void            mtp_get_object_info(MtpObjectHandle handle, MtpObjectInfo* info) { memset(info, 0x00, sizeof(MtpObjectInfo)); }
@@ -83,21 +83,30 @@ void mtp_set_object_property(); // only PTP_OPC_ObjectFileName
 
 extern FF_IOMAN *pIoman;
 
-uint16_t GetClusterIndex(uint32_t cluster);
+#define MTP_MAX_DIRS            256
+#define MTP_MAX_MOVED           64
+#define MTP_MAX_DEPTH           16
+
+#define MTP_CLUSTER_UNKNOWN     0xfffffffe      // directory listed, but not opened yet
+#define MTP_CLUSTER_DELETED     0xffffffff
+
 void AddCluster(uint32_t cluster, uint32_t handle);
+void DeleteCluster(uint32_t handle);
 uint32_t FindClusterByHandle(uint32_t parent);
+uint8_t IsDirHandle(uint32_t handle);
+uint32_t GetParentHandle(uint32_t handle);
 void DumpClusters();
 uint32_t TrackRenames(uint32_t handle);
+void AddRename(uint32_t old_handle, uint32_t new_handle);
+void InvalidateDirCursor(void);
 
-typedef FF_ERROR (*DirentCallback)(FF_DIRENT* pDirent, void* context);
-FF_ERROR FetchDirents(FF_DIRENT* pDirent, DirentCallback callback, void* context);
-FF_ERROR GetDirentInfo(uint32_t cluster_index, uint16_t item_index, FF_DIRENT* pDirent);
-FF_ERROR DeleteDirent(uint32_t handle);
-FF_ERROR GetDirentInfoFromName(uint32_t parent, const char* filename, FF_DIRENT* pDirent);
-const char* GetFullPathFromHandle(uint32_t handle, const char* optional_filename, FF_DIRENT* optional_dirent);
+typedef FRESULT (*DirentCallback)(uint32_t handle, const FILINFO* info, void* context);
+FRESULT FetchDirents(uint32_t parent, DirentCallback callback, void* context);
+FRESULT GetDirentInfo(uint32_t handle, FILINFO* info);
+FRESULT GetDirentInfoFromName(uint32_t parent, const char* filename, uint32_t* handle, FILINFO* info);
+FRESULT DeleteDirent(uint32_t handle);
+const char* GetFullPathFromHandle(uint32_t handle, const char* optional_filename, FILINFO* optional_info);
 
 extern uint16_t num_clusters;
-extern int32_t dirclusters[256];
-extern uint32_t assoclink[256];
-extern uint16_t num_moved;
-extern uint32_t moved[256];
+extern uint32_t dirclusters[MTP_MAX_DIRS];
+extern uint32_t assoclink[MTP_MAX_DIRS];
@@ -1 +1,280 @@
-/* ptp.h from libmtp (LGPL) */
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+// PTP (PIMA 15740) / MTP 1.1 definitions used by the MTP responder.
+// Only the codes the responder needs are listed; names follow libmtp's ptp.h.
+
+#pragma once
+#include <stdint.h>
+
+// USB container
+#define PTP_USB_BULK_HS_MAX_PACKET_LEN_WRITE    512
+#define PTP_USB_BULK_HS_MAX_PACKET_LEN_READ     512
+#define PTP_USB_BULK_HDR_LEN                    (2 * sizeof(uint32_t) + 2 * sizeof(uint16_t))
+#define PTP_USB_BULK_PAYLOAD_LEN_WRITE          (PTP_USB_BULK_HS_MAX_PACKET_LEN_WRITE - PTP_USB_BULK_HDR_LEN)
+#define PTP_USB_BULK_PAYLOAD_LEN_READ           (PTP_USB_BULK_HS_MAX_PACKET_LEN_READ - PTP_USB_BULK_HDR_LEN)
+#define PTP_USB_BULK_REQ_LEN                    (PTP_USB_BULK_HDR_LEN + 5 * sizeof(uint32_t))
+
+typedef struct _PTPUSBBulkContainer {
+    uint32_t length;
+    uint16_t type;
+    uint16_t code;
+    uint32_t trans_id;
+    union {
+        struct {
+            uint32_t param1;
+            uint32_t param2;
+            uint32_t param3;
+            uint32_t param4;
+            uint32_t param5;
+        } params;
+        uint8_t data[PTP_USB_BULK_PAYLOAD_LEN_READ];
+    } payload;
+} PTPUSBBulkContainer;
+
+#define PTP_USB_CONTAINER_UNDEFINED             0x0000
+#define PTP_USB_CONTAINER_COMMAND               0x0001
+#define PTP_USB_CONTAINER_DATA                  0x0002
+#define PTP_USB_CONTAINER_RESPONSE              0x0003
+#define PTP_USB_CONTAINER_EVENT                 0x0004
+
+// vendor extension IDs
+#define PTP_VENDOR_MICROSOFT                    0x00000006
+
+// operation codes
+#define PTP_OC_Undefined                        0x1000
+#define PTP_OC_GetDeviceInfo                    0x1001
+#define PTP_OC_OpenSession                      0x1002
+#define PTP_OC_CloseSession                     0x1003
+#define PTP_OC_GetStorageIDs                    0x1004
+#define PTP_OC_GetStorageInfo                   0x1005
+#define PTP_OC_GetNumObjects                    0x1006
+#define PTP_OC_GetObjectHandles                 0x1007
+#define PTP_OC_GetObjectInfo                    0x1008
+#define PTP_OC_GetObject                        0x1009
+#define PTP_OC_GetThumb                         0x100A
+#define PTP_OC_DeleteObject                     0x100B
+#define PTP_OC_SendObjectInfo                   0x100C
+#define PTP_OC_SendObject                       0x100D
+#define PTP_OC_InitiateCapture                  0x100E
+#define PTP_OC_FormatStore                      0x100F
+#define PTP_OC_ResetDevice                      0x1010
+#define PTP_OC_SelfTest                         0x1011
+#define PTP_OC_SetObjectProtection              0x1012
+#define PTP_OC_PowerDown                        0x1013
+#define PTP_OC_GetDevicePropDesc                0x1014
+#define PTP_OC_GetDevicePropValue               0x1015
+#define PTP_OC_SetDevicePropValue               0x1016
+#define PTP_OC_ResetDevicePropValue             0x1017
+#define PTP_OC_TerminateOpenCapture             0x1018
+#define PTP_OC_MoveObject                       0x1019
+#define PTP_OC_CopyObject                       0x101A
+#define PTP_OC_GetPartialObject                 0x101B
+#define PTP_OC_InitiateOpenCapture              0x101C
+
+#define PTP_OC_ANDROID_GetPartialObject64       0x95C1
+#define PTP_OC_ANDROID_SendPartialObject        0x95C2
+#define PTP_OC_ANDROID_TruncateObject           0x95C3
+#define PTP_OC_ANDROID_BeginEditObject          0x95C4
+#define PTP_OC_ANDROID_EndEditObject            0x95C5
+
+#define PTP_OC_MTP_GetObjectPropsSupported      0x9801
+#define PTP_OC_MTP_GetObjectPropDesc            0x9802
+#define PTP_OC_MTP_GetObjectPropValue           0x9803
+#define PTP_OC_MTP_SetObjectPropValue           0x9804
+#define PTP_OC_MTP_GetObjPropList               0x9805
+#define PTP_OC_MTP_SetObjPropList               0x9806
+#define PTP_OC_MTP_GetInterdependendPropdesc    0x9807
+#define PTP_OC_MTP_SendObjectPropList           0x9808
+#define PTP_OC_MTP_GetObjectReferences          0x9810
+#define PTP_OC_MTP_SetObjectReferences          0x9811
+#define PTP_OC_MTP_Skip                         0x9820
+
+// response codes
+#define PTP_RC_Undefined                        0x2000
+#define PTP_RC_OK                               0x2001
+#define PTP_RC_GeneralError                     0x2002
+#define PTP_RC_SessionNotOpen                   0x2003
+#define PTP_RC_InvalidTransactionID             0x2004
+#define PTP_RC_OperationNotSupported            0x2005
+#define PTP_RC_ParameterNotSupported            0x2006
+#define PTP_RC_IncompleteTransfer               0x2007
+#define PTP_RC_InvalidStorageId                 0x2008
+#define PTP_RC_InvalidObjectHandle              0x2009
+#define PTP_RC_DevicePropNotSupported           0x200A
+#define PTP_RC_InvalidObjectFormatCode          0x200B
+#define PTP_RC_StoreFull                        0x200C
+#define PTP_RC_ObjectWriteProtected             0x200D
+#define PTP_RC_StoreReadOnly                    0x200E
+#define PTP_RC_AccessDenied                     0x200F
+#define PTP_RC_NoThumbnailPresent               0x2010
+#define PTP_RC_SelfTestFailed                   0x2011
+#define PTP_RC_PartialDeletion                  0x2012
+#define PTP_RC_StoreNotAvailable                0x2013
+#define PTP_RC_SpecificationByFormatUnsupported 0x2014
+#define PTP_RC_NoValidObjectInfo                0x2015
+#define PTP_RC_InvalidCodeFormat                0x2016
+#define PTP_RC_UnknownVendorCode                0x2017
+#define PTP_RC_CaptureAlreadyTerminated         0x2018
+#define PTP_RC_DeviceBusy                       0x2019
+#define PTP_RC_InvalidParentObject              0x201A
+#define PTP_RC_InvalidDevicePropFormat          0x201B
+#define PTP_RC_InvalidDevicePropValue           0x201C
+#define PTP_RC_InvalidParameter                 0x201D
+#define PTP_RC_SessionAlreadyOpened             0x201E
+#define PTP_RC_TransactionCanceled              0x201F
+#define PTP_RC_SpecificationOfDestinationUnsupported 0x2020
+
+#define PTP_RC_MTP_Invalid_ObjectPropCode       0xA801
+#define PTP_RC_MTP_Invalid_ObjectProp_Format    0xA802
+#define PTP_RC_MTP_Invalid_ObjectProp_Value     0xA803
+#define PTP_RC_MTP_Invalid_ObjectReference      0xA804
+#define PTP_RC_MTP_Invalid_Dataset              0xA806
+#define PTP_RC_MTP_Specification_By_Group_Unsupported 0xA807
+#define PTP_RC_MTP_Specification_By_Depth_Unsupported 0xA808
+#define PTP_RC_MTP_Object_Too_Large             0xA809
+#define PTP_RC_MTP_ObjectProp_Not_Supported     0xA80A
+
+// event codes
+#define PTP_EC_Undefined                        0x4000
+#define PTP_EC_CancelTransaction                0x4001
+#define PTP_EC_ObjectAdded                      0x4002
+#define PTP_EC_ObjectRemoved                    0x4003
+#define PTP_EC_StoreAdded                       0x4004
+#define PTP_EC_StoreRemoved                     0x4005
+#define PTP_EC_DevicePropChanged                0x4006
+#define PTP_EC_ObjectInfoChanged                0x4007
+#define PTP_EC_DeviceInfoChanged                0x4008
+#define PTP_EC_RequestObjectTransfer            0x4009
+#define PTP_EC_StoreFull                        0x400A
+#define PTP_EC_DeviceReset                      0x400B
+#define PTP_EC_StorageInfoChanged               0x400C
+#define PTP_EC_CaptureComplete                  0x400D
+#define PTP_EC_UnreportedStatus                 0x400E
+
+#define PTP_EC_MTP_ObjectPropChanged            0xC801
+#define PTP_EC_MTP_ObjectPropDescChanged        0xC802
+#define PTP_EC_MTP_ObjectReferencesChanged      0xC803
+
+// device property codes
+#define PTP_DPC_Undefined                       0x5000
+#define PTP_DPC_BatteryLevel                    0x5001
+#define PTP_DPC_FunctionalMode                  0x5002
+#define PTP_DPC_ImageSize                       0x5003
+
+#define PTP_DPC_MTP_SynchronizationPartner      0xD401
+#define PTP_DPC_MTP_DeviceFriendlyName          0xD402
+
+// data type codes
+#define PTP_DTC_UNDEF                           0x0000
+#define PTP_DTC_INT8                            0x0001
+#define PTP_DTC_UINT8                           0x0002
+#define PTP_DTC_INT16                           0x0003
+#define PTP_DTC_UINT16                          0x0004
+#define PTP_DTC_INT32                           0x0005
+#define PTP_DTC_UINT32                          0x0006
+#define PTP_DTC_INT64                           0x0007
+#define PTP_DTC_UINT64                          0x0008
+#define PTP_DTC_INT128                          0x0009
+#define PTP_DTC_UINT128                         0x000A
+#define PTP_DTC_ARRAY_MASK                      0x4000
+#define PTP_DTC_STR                             0xFFFF
+
+// object format codes
+#define PTP_OFC_Undefined                       0x3000
+#define PTP_OFC_Association                     0x3001
+#define PTP_OFC_Script                          0x3002
+#define PTP_OFC_Executable                      0x3003
+#define PTP_OFC_Text                            0x3004
+#define PTP_OFC_HTML                            0x3005
+#define PTP_OFC_DPOF                            0x3006
+#define PTP_OFC_AIFF                            0x3007
+#define PTP_OFC_WAV                             0x3008
+#define PTP_OFC_MP3                             0x3009
+#define PTP_OFC_AVI                             0x300A
+#define PTP_OFC_MPEG                            0x300B
+#define PTP_OFC_ASF                             0x300C
+#define PTP_OFC_QT                              0x300D
+#define PTP_OFC_EXIF_JPEG                       0x3801
+#define PTP_OFC_TIFF_EP                         0x3802
+#define PTP_OFC_FlashPix                        0x3803
+#define PTP_OFC_BMP                             0x3804
+#define PTP_OFC_CIFF                            0x3805
+#define PTP_OFC_GIF                             0x3807
+#define PTP_OFC_JFIF                            0x3808
+#define PTP_OFC_PCD                             0x3809
+#define PTP_OFC_PICT                            0x380A
+#define PTP_OFC_PNG                             0x380B
+#define PTP_OFC_TIFF                            0x380D
+#define PTP_OFC_TIFF_IT                         0x380E
+#define PTP_OFC_JP2                             0x380F
+#define PTP_OFC_JPX                             0x3810
+
+#define PTP_OFC_MTP_WMA                         0xB901
+#define PTP_OFC_MTP_OGG                         0xB902
+#define PTP_OFC_MTP_AAC                         0xB903
+#define PTP_OFC_MTP_FLAC                        0xB906
+#define PTP_OFC_MTP_MP4                         0xB982
+#define PTP_OFC_MTP_MP2                         0xB983
+#define PTP_OFC_MTP_3GP                         0xB984
+#define PTP_OFC_MTP_AbstractAudioVideoPlaylist  0xBA05
+#define PTP_OFC_MTP_WPLPlaylist                 0xBA10
+#define PTP_OFC_MTP_M3UPlaylist                 0xBA11
+#define PTP_OFC_MTP_PLSPlaylist                 0xBA14
+#define PTP_OFC_MTP_XMLDocument                 0xBA82
+
+// object property codes
+#define PTP_OPC_StorageID                       0xDC01
+#define PTP_OPC_ObjectFormat                    0xDC02
+#define PTP_OPC_ProtectionStatus                0xDC03
+#define PTP_OPC_ObjectSize                      0xDC04
+#define PTP_OPC_AssociationType                 0xDC05
+#define PTP_OPC_AssociationDesc                 0xDC06
+#define PTP_OPC_ObjectFileName                  0xDC07
+#define PTP_OPC_DateCreated                     0xDC08
+#define PTP_OPC_DateModified                    0xDC09
+#define PTP_OPC_Keywords                        0xDC0A
+#define PTP_OPC_ParentObject                    0xDC0B
+#define PTP_OPC_AllowedFolderContents           0xDC0C
+#define PTP_OPC_Hidden                          0xDC0D
+#define PTP_OPC_SystemObject                    0xDC0E
+#define PTP_OPC_PersistantUniqueObjectIdentifier 0xDC41
+#define PTP_OPC_SyncID                          0xDC42
+#define PTP_OPC_PropertyBag                     0xDC43
+#define PTP_OPC_Name                            0xDC44
+#define PTP_OPC_DateAdded                       0xDC4E
+
+// storage types
+#define PTP_ST_Undefined                        0x0000
+#define PTP_ST_FixedROM                         0x0001
+#define PTP_ST_RemovableROM                     0x0002
+#define PTP_ST_FixedRAM                         0x0003
+#define PTP_ST_RemovableRAM                     0x0004
+
+// filesystem types
+#define PTP_FST_Undefined                       0x0000
+#define PTP_FST_GenericFlat                     0x0001
+#define PTP_FST_GenericHierarchical             0x0002
+#define PTP_FST_DCF                             0x0003
+
+// access capability
+#define PTP_AC_ReadWrite                        0x0000
+#define PTP_AC_ReadOnly                         0x0001
+#define PTP_AC_ReadOnly_with_Object_Deletion    0x0002
+
+// protection status
+#define PTP_PS_NoProtection                     0x0000
+#define PTP_PS_ReadOnly                         0x0001
@@ -57,6 +57,11 @@ void ptp_send(uint8_t* packet, uint32_t length)
 {
 	usb_send(1, 64, packet, length, 0);
 }
+void ptp_send_stream(const uint8_t* packet, uint32_t length, uint8_t last)
+{
+    // only the last part of a container may end with a short (or zero length) packet
+    usb_send_async(1, 64, packet, length, last ? 0 : length, last);
+}
 
 void PTP_USB_Start(void)
 {
@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 void ptp_send(uint8_t* packet, uint32_t length);
+void ptp_send_stream(const uint8_t* packet, uint32_t length, uint8_t last);
 
 void PTP_USB_Start(void);
 void PTP_USB_Stop(void);
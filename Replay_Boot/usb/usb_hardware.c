@@ -14,6 +14,7 @@
  *
  */
 
+#include <string.h>
 #include "board.h"
 #include "usb_hardware.h"
 #include "messaging.h"
@@ -60,6 +61,11 @@ void usb_connect(usb_func _recv)
 }
 
 static uint8_t buffer[64] __attribute__((aligned(8)));     // 64 bytes == max endpoint size with USB 2.0 full-speed
+static const uint8_t pingpong_eps[8] = { 0, 1, 1, 0, 0,0,0,0 }; // which end-points support ping-pong
+
+// usb_send_async() state for the ping-pong IN endpoints
+static uint8_t tx_inflight[8];  // a bank has TXPKTRDY set and TXCOMP has not been seen yet
+static uint8_t tx_loaded[8];    // the other bank holds a packet, waiting for the first one to go out
 uint8_t usb_poll()
 {
     uint8_t ret = FALSE;
@@ -67,7 +73,6 @@ uint8_t usb_poll()
     const uint32_t num_eps = sizeof(AT91C_BASE_UDP->UDP_CSR) / sizeof(AT91C_BASE_UDP->UDP_CSR[0]);
 
     const uint8_t ctrl_ep = 0;
-    const  uint8_t pingpong_eps[8] = { 0, 1, 1, 0, 0,0,0,0 }; // which end-points support ping-pong
     static uint8_t recvbank_eps[8] = { AT91C_UDP_RXSETUP, AT91C_UDP_RX_DATA_BK0, AT91C_UDP_RX_DATA_BK0, AT91C_UDP_RX_DATA_BK0, 0,0,0,0 };
     static uint16_t current_config = 0;
     (void)current_config;
@@ -103,6 +108,10 @@ uint8_t usb_poll()
             }
         }
 
+        // the reset dropped anything usb_send_async() left in the FIFOs
+        memset(tx_inflight, 0, sizeof(tx_inflight));
+        memset(tx_loaded, 0, sizeof(tx_loaded));
+
         current_config = 0;
 
         ret = 1;
@@ -178,10 +187,53 @@ void usb_disconnect()
 
 #define min(a, b) (((a) > (b)) ? (b) : (a))
 
+static uint8_t usb_wait_txcomp(uint8_t ep)
+{
+    AT91PS_UDP udp = AT91C_BASE_UDP;
+
+    while(!(udp->UDP_CSR[ep] & AT91C_UDP_TXCOMP)) {
+        if(udp->UDP_CSR[ep] & AT91C_UDP_RX_DATA_BK0) {
+            // host is writing to us; abandon the write
+            udp->UDP_CSR[ep] &= ~AT91C_UDP_RX_DATA_BK0;
+            return FALSE;
+        }
+        if (!CheckConnectedEP0())
+            return FALSE;
+    }
+    udp->UDP_CSR[ep] &= ~AT91C_UDP_TXCOMP;
+
+    while(udp->UDP_CSR[ep] & AT91C_UDP_TXCOMP)
+        if (!CheckConnectedEP0())
+            return FALSE;
+
+    return TRUE;
+}
+
+// Wait for all packets queued by usb_send_async() to be sent.
+static void usb_flush_async(uint8_t ep)
+{
+    AT91PS_UDP udp = AT91C_BASE_UDP;
+
+    while (tx_inflight[ep]) {
+        if (!usb_wait_txcomp(ep)) {
+            tx_inflight[ep] = tx_loaded[ep] = 0;
+            return;
+        }
+        if (tx_loaded[ep]) {
+            udp->UDP_CSR[ep] |= AT91C_UDP_TXPKTRDY;
+            tx_loaded[ep] = 0;
+        } else {
+            tx_inflight[ep] = 0;
+        }
+    }
+}
+
 void usb_send(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength)
 {
     AT91PS_UDP udp = AT91C_BASE_UDP;
 
+    usb_flush_async(ep);
+
     if (packet_length != 512 || 3<=debuglevel)
     DEBUG(2,"usb_send (ep = %d, wMaxPacketSize = %d, packet = %08x, packet_length = %d, wLength = %d)", ep, wMaxPacketSize, packet, packet_length, wLength);
 
@@ -233,9 +285,99 @@ void usb_send(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32
     }
 }
 
+// Like usb_send(), but both FIFO banks of a ping-pong endpoint are kept loaded, and the
+// function returns as soon as the last packet is in the FIFO. 'packet' may be reused
+// right away; the caller can prepare the next data while the final packets go out.
+// Set 'wait_done' on the last call of a transfer to wait for the FIFO to drain.
 void usb_send_async(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength, uint8_t wait_done)
 {
-    usb_send(ep, wMaxPacketSize, packet, packet_length, wLength);
+    AT91PS_UDP udp = AT91C_BASE_UDP;
+
+    if (!pingpong_eps[ep]) {
+        usb_send(ep, wMaxPacketSize, packet, packet_length, wLength);
+        return;
+    }
+
+    int i, thisTime;
+    int len = wLength ? min(packet_length, wLength) : packet_length;
+    uint8_t sendzlp = (((len & (wMaxPacketSize-1)) == 0) && len != wLength) || packet == 0;
+
+    while(len > 0 || sendzlp) {
+        thisTime = min(len, wMaxPacketSize);
+
+        if (tx_loaded[ep]) {
+            // both banks busy; wait for the first one before releasing the second
+            if (!usb_wait_txcomp(ep)) {
+                tx_inflight[ep] = tx_loaded[ep] = 0;
+                return;
+            }
+            udp->UDP_CSR[ep] |= AT91C_UDP_TXPKTRDY;
+            tx_loaded[ep] = 0;
+        }
+
+        for(i = 0; i < thisTime; i++) {
+            udp->UDP_FDR[ep] = packet[i];
+        }
+
+        if (tx_inflight[ep]) {
+            tx_loaded[ep] = 1;
+        } else {
+            udp->UDP_CSR[ep] |= AT91C_UDP_TXPKTRDY;
+            tx_inflight[ep] = 1;
+        }
+
+        if (!thisTime) {
+            sendzlp = 0;
+        }
+        len -= thisTime;
+        packet += thisTime;
+    }
+
+    if (wait_done) {
+        usb_flush_async(ep);
+    }
+}
+
+// Non-blocking part of usb_send_async(): loads whole packets only while a FIFO
+// bank is free and returns the number of bytes taken. The rest of the transfer
+// goes through usb_send_async().
+uint32_t usb_send_async_nb(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length)
+{
+    AT91PS_UDP udp = AT91C_BASE_UDP;
+    uint32_t sent = 0;
+
+    if (!pingpong_eps[ep]) {
+        return 0;
+    }
+
+    while (packet_length - sent >= wMaxPacketSize) {
+        if (tx_loaded[ep]) {
+            // both banks busy; release the second once the first is gone
+            if (!(udp->UDP_CSR[ep] & AT91C_UDP_TXCOMP)) {
+                break;
+            }
+            udp->UDP_CSR[ep] &= ~AT91C_UDP_TXCOMP;
+            while(udp->UDP_CSR[ep] & AT91C_UDP_TXCOMP)
+                ;
+            udp->UDP_CSR[ep] |= AT91C_UDP_TXPKTRDY;
+            tx_loaded[ep] = 0;
+        }
+
+        for(int i = 0; i < wMaxPacketSize; i++) {
+            udp->UDP_FDR[ep] = packet[sent + i];
+        }
+
+        if (tx_inflight[ep]) {
+            tx_loaded[ep] = 1;
+        } else {
+            udp->UDP_CSR[ep] |= AT91C_UDP_TXPKTRDY;
+            tx_inflight[ep] = 1;
+        }
+
+        sent += wMaxPacketSize;
+    }
+
+    return sent;
 }
 
 void usb_send_ep0_stall(void)
@@ -255,6 +397,9 @@ void usb_send_stall(uint8_t ep)
 {
     AT91PS_UDP udp = AT91C_BASE_UDP;
 
+    // let queued packets go out first; the stall ends the transfer
+    usb_flush_async(ep);
+
     udp->UDP_CSR[ep] |= AT91C_UDP_FORCESTALL;
     while(!(udp->UDP_CSR[ep] & AT91C_UDP_STALLSENT))
         ;
@@ -313,6 +458,9 @@ void usb_setup_endpoints(uint32_t* ep_types, uint32_t num_eps)
     AT91_REG global = 0, ep[3] = {0,0,0};
     AT91PS_UDP udp = AT91C_BASE_UDP;
 
+    memset(tx_inflight, 0, sizeof(tx_inflight));
+    memset(tx_loaded, 0, sizeof(tx_loaded));
+
     for (i = 0; i < min(num_eps, 3); ++i) {
         global |= ep_types[i];
         ep[i]   = ep_types[i];
@@ -341,7 +489,7 @@ void usb_setup_faddr(uint16_t wValue)
     udp->UDP_GLBSTATE  = (wValue) ? AT91C_UDP_FADDEN : 0;
 }
 
-#else
+#elif !defined(HOSTED)
 
 void usb_connect(usb_func _recv) {}
 uint8_t usb_poll() { return 0; }
@@ -352,6 +500,7 @@ void usb_send_async(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet,
 {
     usb_send(ep, wMaxPacketSize, packet, packet_length, wLength);
 }
+uint32_t usb_send_async_nb(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length) { return 0; }
 
 void usb_send_ep0_stall(void) {}
 void usb_send_stall(uint8_t ep) {}
@@ -75,6 +75,7 @@ void usb_disconnect();
 
 void usb_send(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength);
 void usb_send_async(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length, uint32_t wLength, uint8_t wait_done);
+uint32_t usb_send_async_nb(uint8_t ep, uint32_t wMaxPacketSize, const uint8_t* packet, uint32_t packet_length);
 
 void usb_send_ep0_stall(void);
 void usb_send_stall(uint8_t ep);
@@ -84,6 +85,11 @@ uint32_t usb_recv(uint8_t ep, uint8_t* packet, uint32_t length);
 void usb_setup_faddr(uint16_t wValue);
 void usb_setup_endpoints(uint32_t* ep_types, uint32_t num_eps);
 
+#if defined(HOSTED)
+// TRUE while a client is connected to the hosted USB socket (hardware_host/usb.c)
+uint8_t usb_attached(void);
+#endif
+
 // helpers
 //void usb_send_ep0(const uint8_t* packet, uint32_t packet_length, uint32_t wLength);
 #if 1
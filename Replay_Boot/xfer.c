@@ -0,0 +1,325 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+#include "xfer.h"
+#include "crc32.h"
+#include "fileio.h"
+#include "messaging.h"
+#include "hardware/timer.h"
+#include "hardware/usart.h"
+
+extern FF_IOMAN* pIoman;
+
+#define XFER_HEADER_SIZE    4       // type, seq, len
+#define XFER_CRC_SIZE       4
+#define XFER_OPEN_SIZE      9       // target, size, address
+#define XFER_TIMEOUT        2000    // ms without a frame before a transfer is dropped
+
+#define XFER_STATUS_NONE    0xff    // frame is dropped silently
+
+#define RX_SOF0             0
+#define RX_SOF1             1
+#define RX_FRAME            2
+
+static struct {
+    uint8_t state;
+    uint16_t pos;
+    uint16_t len;
+    uint8_t buf[XFER_HEADER_SIZE + 4 + XFER_MAX_DATA + XFER_CRC_SIZE];
+} rx;
+
+static struct {
+    uint8_t active;
+    uint8_t target;
+    uint8_t resend;                 // RESEND was sent for the current gap
+    FF_FILE* file;
+    uint32_t address;
+    uint32_t size;
+    uint32_t offset;                // next expected byte
+    uint32_t crc;
+    HARDWARE_TICK timeout;
+} xfer;
+
+static inline uint32_t GetLE32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void PutLE32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void XFER_SendAck(uint8_t seq, uint8_t status)
+{
+    uint8_t frame[2 + XFER_HEADER_SIZE + 7 + XFER_CRC_SIZE];
+    uint8_t* p = &frame[2];
+
+    frame[0] = XFER_SOF0;
+    frame[1] = XFER_SOF1;
+    p[0] = XFER_ACK;
+    p[1] = seq;
+    p[2] = 7;
+    p[3] = 0;
+    p[4] = status;
+    PutLE32(&p[5], xfer.offset);
+    p[9] = (uint8_t)XFER_WINDOW;
+    p[10] = XFER_WINDOW >> 8;
+    PutLE32(&p[11], CRC32_Update(CRC32_INIT, p, XFER_HEADER_SIZE + 7));
+
+    USART_Write(frame, sizeof(frame));
+}
+
+static void XFER_End(void)
+{
+    if (xfer.file) {
+        FF_Close(xfer.file);
+        xfer.file = NULL;
+    }
+
+    xfer.active = FALSE;
+}
+
+static uint8_t XFER_Open(const uint8_t* payload, uint16_t len)
+{
+    XFER_End();
+
+    if (len < XFER_OPEN_SIZE) {
+        return XFER_STATUS_FAILED;
+    }
+
+    xfer.target = payload[0];
+    xfer.size = GetLE32(&payload[1]);
+    xfer.address = GetLE32(&payload[5]);
+    xfer.offset = 0;
+    xfer.crc = CRC32_INIT;
+    xfer.resend = FALSE;
+
+    if (xfer.target == XFER_TARGET_FILE) {
+        char path[FF_MAX_PATH];
+        uint16_t n = len - XFER_OPEN_SIZE;
+
+        if (!pIoman || n == 0 || n >= sizeof(path)) {
+            return XFER_STATUS_FAILED;
+        }
+
+        memcpy(path, &payload[XFER_OPEN_SIZE], n);
+        path[n] = '\0';
+
+        xfer.file = FF_Open(pIoman, path, FF_MODE_WRITE | FF_MODE_CREATE | FF_MODE_TRUNCATE, NULL);
+
+        if (!xfer.file) {
+            WARNING("XFER:Could not create %s", path);
+            return XFER_STATUS_FAILED;
+        }
+
+        INFO("XFER:Receiving %s (%lu bytes)", path, xfer.size);
+
+    } else if (xfer.target == XFER_TARGET_DRAM) {
+        INFO("XFER:Receiving %lu bytes to DRAM @ $%08lx", xfer.size, xfer.address);
+
+    } else {
+        return XFER_STATUS_FAILED;
+    }
+
+    xfer.active = TRUE;
+    return XFER_STATUS_OK;
+}
+
+static uint8_t XFER_Data(uint8_t* payload, uint16_t len)
+{
+    if (!xfer.active || len <= 4) {
+        return XFER_STATUS_FAILED;
+    }
+
+    uint32_t offset = GetLE32(payload);
+    uint8_t* data = payload + 4;
+    len -= 4;
+
+    if (offset < xfer.offset) {
+        // a resend of something we already have; just tell where we are
+        return XFER_STATUS_OK;
+
+    } else if (offset > xfer.offset) {
+        // we lost a frame; ask for it once, drop everything until it arrives
+        if (xfer.resend) {
+            return XFER_STATUS_NONE;
+        }
+
+        xfer.resend = TRUE;
+        return XFER_STATUS_RESEND;
+    }
+
+    if (offset + len > xfer.size) {
+        XFER_End();
+        return XFER_STATUS_FAILED;
+    }
+
+    if (xfer.target == XFER_TARGET_FILE) {
+        if (FF_Write(xfer.file, 1, len, data) != len) {
+            WARNING("XFER:Write failed");
+            XFER_End();
+            return XFER_STATUS_FAILED;
+        }
+
+    } else if (FileIO_MCh_BufToMem(data, xfer.address + offset, len) != 0) {
+        WARNING("XFER:DRAM write failed");
+        XFER_End();
+        return XFER_STATUS_FAILED;
+    }
+
+    xfer.crc = CRC32_Update(xfer.crc, data, len);
+    xfer.offset += len;
+    xfer.resend = FALSE;
+    return XFER_STATUS_OK;
+}
+
+static uint8_t XFER_Close(const uint8_t* payload, uint16_t len)
+{
+    uint8_t status = XFER_STATUS_FAILED;
+
+    if (!xfer.active || len != 4) {
+        return status;
+    }
+
+    if (xfer.offset != xfer.size) {
+        WARNING("XFER:Short transfer (%lu of %lu)", xfer.offset, xfer.size);
+
+    } else if (GetLE32(payload) != xfer.crc) {
+        WARNING("XFER:CRC32 mismatch $%08lx vs $%08lx", xfer.crc, GetLE32(payload));
+
+    } else {
+        INFO("XFER:Done (%lu bytes)", xfer.size);
+        status = XFER_STATUS_OK;
+    }
+
+    XFER_End();
+    return status;
+}
+
+static void XFER_Frame(void)
+{
+    const uint8_t type = rx.buf[0];
+    const uint8_t seq = rx.buf[1];
+    uint8_t* payload = &rx.buf[XFER_HEADER_SIZE];
+    uint8_t status;
+
+    if (CRC32_Update(CRC32_INIT, rx.buf, XFER_HEADER_SIZE + rx.len) != GetLE32(&payload[rx.len])) {
+        DEBUG(2, "XFER:Bad frame CRC");
+
+        // a damaged data frame is a missing frame
+        if (xfer.active && !xfer.resend) {
+            xfer.resend = TRUE;
+            XFER_SendAck(seq, XFER_STATUS_RESEND);
+        }
+
+        return;
+    }
+
+    xfer.timeout = Timer_Get(XFER_TIMEOUT);
+
+    switch (type) {
+        case XFER_OPEN:
+            status = XFER_Open(payload, rx.len);
+            break;
+
+        case XFER_DATA:
+            status = XFER_Data(payload, rx.len);
+            break;
+
+        case XFER_CLOSE:
+            status = XFER_Close(payload, rx.len);
+            break;
+
+        case XFER_ABORT:
+            WARNING("XFER:Aborted at %lu", xfer.offset);
+            XFER_End();
+            status = XFER_STATUS_OK;
+            break;
+
+        default:
+            status = XFER_STATUS_FAILED;
+            break;
+    }
+
+    if (status != XFER_STATUS_NONE) {
+        XFER_SendAck(seq, status);
+    }
+}
+
+uint8_t XFER_Active(void)
+{
+    return xfer.active || rx.state != RX_SOF0 || USART_Peekc() == XFER_SOF0;
+}
+
+void XFER_Update(void)
+{
+    if ((xfer.active || rx.state != RX_SOF0) && Timer_Check(xfer.timeout)) {
+        WARNING("XFER:Timeout");
+        XFER_End();
+        rx.state = RX_SOF0;
+    }
+
+    while (USART_GetValid()) {
+        // outside of a transfer only a frame start is ours; the rest are keys
+        if (!xfer.active && rx.state == RX_SOF0 && USART_Peekc() != XFER_SOF0) {
+            return;
+        }
+
+        uint8_t c = USART_Getc();
+
+        switch (rx.state) {
+            case RX_SOF0:
+                if (c == XFER_SOF0) {
+                    rx.state = RX_SOF1;
+                    xfer.timeout = Timer_Get(XFER_TIMEOUT);
+                }
+
+                break;
+
+            case RX_SOF1:
+                if (c == XFER_SOF1) {
+                    rx.state = RX_FRAME;
+                    rx.pos = 0;
+
+                } else if (c != XFER_SOF0) {
+                    rx.state = RX_SOF0;
+                }
+
+                break;
+
+            case RX_FRAME:
+                rx.buf[rx.pos++] = c;
+
+                if (rx.pos == XFER_HEADER_SIZE) {
+                    rx.len = rx.buf[2] | (rx.buf[3] << 8);
+
+                    if (rx.len > sizeof(rx.buf) - XFER_HEADER_SIZE - XFER_CRC_SIZE) {
+                        rx.state = RX_SOF0;
+                    }
+
+                } else if (rx.pos == XFER_HEADER_SIZE + rx.len + XFER_CRC_SIZE) {
+                    rx.state = RX_SOF0;
+                    XFER_Frame();
+                }
+
+                break;
+        }
+    }
+}
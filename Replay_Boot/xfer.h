@@ -0,0 +1,75 @@
+/*--------------------------------------------------------------------
+ *                       Replay Firmware
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+/** @file xfer.h */
+
+#ifndef XFER_H_INCLUDED
+#define XFER_H_INCLUDED
+
+#include "board.h"
+
+/*
+ Serial (USART / CDC) file transfer to the SD card or to DRAM.
+
+ Every frame is
+
+    A5 5A | type | seq | len (16 bit) | payload[len] | crc32 (type .. payload)
+
+ with all multi-byte values little endian. Anything outside a frame is ignored
+ while a transfer is active, so debug output on the same port is harmless.
+
+ host -> replay
+    XFER_OPEN   target (0 = file, 1 = DRAM), size (32), address (32), path (zero terminated, file only)
+    XFER_DATA   offset (32), data[1..XFER_MAX_DATA]
+    XFER_CLOSE  crc32 of all data (32)
+    XFER_ABORT
+
+ replay -> host
+    XFER_ACK    status, offset (32), window (16)
+
+ DATA frames must arrive in order. Every accepted frame is acknowledged with the
+ next expected offset; a missing or damaged frame is answered (once) with
+ XFER_STATUS_RESEND and that offset, and the host goes back to it. The host may
+ have up to 'window' bytes of data unacknowledged.
+
+ tools/xfersend implements the host side.
+*/
+
+#define XFER_SOF0           0xA5
+#define XFER_SOF1           0x5A
+
+#define XFER_OPEN           0x01
+#define XFER_DATA           0x02
+#define XFER_CLOSE          0x03
+#define XFER_ABORT          0x04
+#define XFER_ACK            0x81
+
+#define XFER_TARGET_FILE    0
+#define XFER_TARGET_DRAM    1
+
+#define XFER_STATUS_OK      0
+#define XFER_STATUS_RESEND  1
+#define XFER_STATUS_FAILED  2
+
+#define XFER_MAX_DATA       256
+#define XFER_WINDOW         (3 * XFER_MAX_DATA)     // must fit the USART RX ring with framing
+
+// Call once per main loop iteration (before the USART is read for keys)
+void XFER_Update(void);
+// TRUE while a transfer owns the USART input
+uint8_t XFER_Active(void);
+
+#endif
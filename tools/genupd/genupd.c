@@ -22,28 +22,57 @@
 #endif
 #include<stdio.h>
 #include<stdint.h>
+#include<stdlib.h>
 
-// reset with data = 0x00000000; length = 0xffffffff
-static unsigned int feed_crc32(uint8_t* data, uint32_t length)
+#include "../../Replay_Boot/crc32.h"
+#include "../../Replay_Boot/fwcontainer.h"
+
+static void put_le32(uint8_t* p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// wraps a raw binary into a firmware container that the loader can flash directly
+static int write_container(const char* binname, const char* fwname, uint32_t address)
 {
-    static uint32_t crc;
+    FILE *in, *out;
+    uint8_t *data;
+    uint8_t header[sizeof(flash_fw_header_t)] = { 0 };
+    long size;
 
-    if (data == 0 && length == 0xffffffff) {
-        crc = length;
-        length = 0;
+    in = fopen(binname, "rb");
+    if (!in) return 1;
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    data = malloc(size ? size : 1);
+    if (!data || fread(data, 1, size, in) != (size_t)size) {
+        free(data);
+        fclose(in);
+        return 1;
     }
+    fclose(in);
 
-    for (uint32_t i = 0; i < length; ++i) {
-        uint32_t byte = *data++;
-        crc = crc ^ byte;
+    put_le32(&header[0],  FLASH_FW_MAGIC);
+    put_le32(&header[4],  FLASH_FW_VERSION);
+    put_le32(&header[8],  address);
+    put_le32(&header[12], size);
+    put_le32(&header[16], CRC32_Update(CRC32_INIT, data, size));
+    put_le32(&header[20], CRC32_Update(CRC32_INIT, header, 20));
 
-        for (int j = 7; j >= 0; j--) {    // Do eight times.
-            uint32_t mask = -(crc & 1);
-            crc = (crc >> 1) ^ (0xEDB88320 & mask);
-        }
+    out = fopen(fwname, "wb");
+    if (!out) {
+        free(data);
+        return 1;
     }
+    fwrite(header, 1, sizeof(header), out);
+    fwrite(data, 1, size, out);
+    fclose(out);
+    free(data);
 
-    return ~crc;
+    printf("# %s written (%ld bytes @ 0x%08x)\n", fwname, size, address);
+    return 0;
 }
 
 int main() {
@@ -59,11 +88,10 @@ int main() {
         printf("# bootrom file not readable\n");
         ++ret;
     } else {
-      feed_crc32(0x0,0xffffffff);
       while (!feof(binFile)) {
         if (fread(&val,sizeof(val),1,binFile)) {
           len+=4;
-          sum=feed_crc32(&val, sizeof(val));
+          sum=CRC32_Update(sum, &val, sizeof(val));
         };
       }
       fclose(binFile);
@@ -80,11 +108,10 @@ int main() {
         printf("# main loader file not readable\n");
         ++ret;
     } else {
-      feed_crc32(0x0,0xffffffff);
       while (!feof(binFile)) {
         if (fread(&val,sizeof(val),1,binFile)) {
           len+=4;
-          sum=feed_crc32(&val, sizeof(val));
+          sum=CRC32_Update(sum, &val, sizeof(val));
         };
       }
       fclose(binFile);
@@ -93,6 +120,11 @@ int main() {
       printf("DATA = 0x00,0x20,0x10,0x00, 0x%02X,0x%02X,0x%02X,0x%02X, 0x%02X,0x%02X,0x%02X,0x%02X, 0x000FFE0C,12\n",
              (len&0xFF),((len>>8)&0xFF),((len>>16)&0xFF),((len>>24)&0xFF),
              (sum&0xFF),((sum>>8)&0xFF),((sum>>16)&0xFF),((sum>>24)&0xFF) );
+      // binary alternative to main.s19 for the loader's "flash firmware" menu
+      if (write_container("main.bin", "main.fw", 0x00102000)) {
+        printf("# main.fw could not be written\n");
+        ++ret;
+      }
     }
 
     sum=0;len=0;
@@ -0,0 +1,484 @@
+/*--------------------------------------------------------------------
+ *                            msctest
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * USB mass storage test driver for the hosted build. Talks to the USB
+ * socket of Replay_Boot/hardware_host/usb.c, runs the enumeration and
+ * SCSI command sequence a host would, and measures READ(10) / WRITE(10)
+ * throughput.
+ *
+ *   msctest [-i sdcard.bin] [-l lun] [-n MB] [-b blocks] [-w] [host:port]
+ *
+ * With -i the LUN 0 data is compared against the card image. -w writes
+ * back the data it has just read, so the card contents do not change.
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define USB_HOSTED_STALL    0x01
+#define USB_FRAME_MAX       2048
+
+#define CBW_SIGNATURE       0x43425355
+#define CSW_SIGNATURE       0x53425355
+#define CBW_SIZE            31
+#define CSW_SIZE            13
+
+#define CSW_PASSED          0
+#define CSW_FAILED          1
+#define CSW_PHASE_ERROR     2
+#define CSW_STALLED         0x100   // set when the data phase ended in a stall
+
+static int fd = -1;
+static uint32_t tag;
+static int failures;
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t get32be(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put32be(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(int ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static int open_port(const char* name)
+{
+    const char* colon = strrchr(name, ':');
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* res;
+    char host[256];
+    int s;
+
+    if (!colon) {
+        return -1;
+    }
+
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - name), name);
+
+    if (getaddrinfo(host, colon + 1, &hints, &res)) {
+        return -1;
+    }
+
+    s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+    if (s >= 0 && connect(s, res->ai_addr, res->ai_addrlen)) {
+        close(s);
+        s = -1;
+    }
+
+    if (s >= 0) {
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &(int) {1}, sizeof(int));
+    }
+
+    freeaddrinfo(res);
+    return s;
+}
+
+static void read_all(uint8_t* p, uint32_t len)
+{
+    while (len) {
+        ssize_t n = read(fd, p, len);
+
+        if (n <= 0) {
+            fprintf(stderr, "connection lost\n");
+            exit(1);
+        }
+
+        p += n;
+        len -= n;
+    }
+}
+
+static void send_frame(uint8_t ep, const uint8_t* data, uint16_t len)
+{
+    uint8_t header[4] = { ep, 0, len, len >> 8 };
+
+    if (write(fd, header, 4) != 4 || (len && write(fd, data, len) != len)) {
+        perror("write");
+        exit(1);
+    }
+}
+
+// Returns the payload length; 'flags' tells a stall
+static uint16_t read_frame(uint8_t* ep, uint8_t* flags, uint8_t* data)
+{
+    uint8_t header[4];
+
+    read_all(header, 4);
+    *ep = header[0];
+    *flags = header[1];
+
+    uint16_t len = header[2] | (header[3] << 8);
+
+    if (len > USB_FRAME_MAX) {
+        fprintf(stderr, "bad frame (%u bytes)\n", len);
+        exit(1);
+    }
+
+    read_all(data, len);
+    return len;
+}
+
+// A control transfer; returns the number of bytes received or -1 on a stall
+static int control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, uint16_t length, uint8_t* data)
+{
+    uint8_t setup[8] = { type, request, value, value >> 8, index, index >> 8, length, length >> 8 };
+    uint8_t frame[USB_FRAME_MAX];
+    uint8_t ep, flags;
+
+    send_frame(0, setup, sizeof(setup));
+
+    uint16_t len = read_frame(&ep, &flags, frame);
+
+    if (ep != 0 || (flags & USB_HOSTED_STALL)) {
+        return -1;
+    }
+
+    if (data) {
+        memcpy(data, frame, len);
+    }
+
+    return len;
+}
+
+// One bulk-only transport command; returns the CSW status (| CSW_STALLED)
+static int scsi(uint8_t lun, const uint8_t* cdb, uint8_t cdb_len, int in, uint8_t* data, uint32_t length)
+{
+    uint8_t cbw[CBW_SIZE] = { 0 };
+    uint8_t frame[USB_FRAME_MAX];
+    uint8_t ep, flags;
+    uint32_t done = 0;
+    int stalled = 0;
+
+    put32(&cbw[0], CBW_SIGNATURE);
+    put32(&cbw[4], ++tag);
+    put32(&cbw[8], length);
+    cbw[12] = in ? 0x80 : 0x00;
+    cbw[13] = lun;
+    cbw[14] = cdb_len;
+    memcpy(&cbw[15], cdb, cdb_len);
+    send_frame(2, cbw, sizeof(cbw));
+
+    if (!in) {
+        while (done < length) {
+            uint16_t n = length - done > USB_FRAME_MAX ? USB_FRAME_MAX : length - done;
+            send_frame(2, &data[done], n);
+            done += n;
+        }
+    }
+
+    for (;;) {
+        uint16_t len = read_frame(&ep, &flags, frame);
+
+        if (flags & USB_HOSTED_STALL) {
+            stalled = CSW_STALLED;
+            continue;
+        }
+
+        if (ep != 1) {
+            fprintf(stderr, "unexpected frame on ep %u\n", ep);
+            exit(1);
+        }
+
+        // the status wrapper; a short data phase should end in a stall, but
+        // the firmware may also just stop sending
+        if (len == CSW_SIZE && get32(&frame[0]) == CSW_SIGNATURE && get32(&frame[4]) == tag) {
+            if (in && done != length && !stalled) {
+                printf("  short data phase (%u of %u bytes) without a stall\n", done, length);
+            }
+
+            return frame[12] | stalled;
+        }
+
+        if (!in || done == length) {
+            fprintf(stderr, "bad CSW\n");
+            exit(1);
+        }
+
+        if (done + len > length) {
+            fprintf(stderr, "data overrun\n");
+            exit(1);
+        }
+
+        memcpy(&data[done], frame, len);
+        done += len;
+    }
+}
+
+static void request_sense(uint8_t lun, uint8_t* key, uint8_t* asc)
+{
+    const uint8_t cdb[6] = { 0x03, 0, 0, 0, 18, 0 };
+    uint8_t sense[18] = { 0 };
+
+    scsi(lun, cdb, sizeof(cdb), 1, sense, sizeof(sense));
+    *key = sense[2] & 0x0f;
+    *asc = sense[12];
+}
+
+static int test_unit_ready(uint8_t lun)
+{
+    const uint8_t cdb[6] = { 0x00 };
+    uint8_t key, asc;
+
+    // a pending UNIT ATTENTION is reported once
+    for (int retry = 0; retry < 3; retry++) {
+        if (scsi(lun, cdb, sizeof(cdb), 0, NULL, 0) == CSW_PASSED) {
+            return 1;
+        }
+
+        request_sense(lun, &key, &asc);
+        printf("  TEST UNIT READY: sense %x/%02x\n", key, asc);
+
+        if (key != 0x6) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+static int read_write(uint8_t lun, int write, uint32_t lba, uint16_t blocks, uint8_t* data)
+{
+    uint8_t cdb[10] = { write ? 0x2a : 0x28 };
+
+    put32be(&cdb[2], lba);
+    cdb[7] = blocks >> 8;
+    cdb[8] = blocks;
+
+    return scsi(lun, cdb, sizeof(cdb), !write, data, blocks * 512);
+}
+
+int main(int argc, char** argv)
+{
+    const char* port = "localhost:1235";
+    const char* image = NULL;
+    uint32_t megabytes = 4;
+    uint32_t blocks = 64;
+    uint8_t lun = 0;
+    int write_back = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:l:n:b:w")) != -1) {
+        switch (opt) {
+            case 'i': image = optarg; break;
+            case 'l': lun = atoi(optarg); break;
+            case 'n': megabytes = atoi(optarg); break;
+            case 'b': blocks = atoi(optarg); break;
+            case 'w': write_back = 1; break;
+
+            default:
+                fprintf(stderr, "usage: %s [-i sdcard.bin] [-l lun] [-n MB] [-b blocks] [-w] [host:port]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc) {
+        port = argv[optind];
+    }
+
+    if (!blocks || blocks > 0xffff) {
+        fprintf(stderr, "blocks must be 1..65535\n");
+        return 1;
+    }
+
+    fd = open_port(port);
+
+    if (fd < 0) {
+        perror(port);
+        return 1;
+    }
+
+    // enumeration
+    uint8_t desc[18];
+    uint8_t max_lun = 0;
+
+    check(control(0x80, 6, 0x0100, 0, sizeof(desc), desc) == sizeof(desc) && desc[1] == 1, "GET_DESCRIPTOR(device)");
+    printf("device %04x:%04x\n", desc[8] | (desc[9] << 8), desc[10] | (desc[11] << 8));
+    check(control(0x00, 9, 1, 0, 0, NULL) == 0, "SET_CONFIGURATION");
+    check(control(0xa1, 0xfe, 0, 0, 1, &max_lun) == 1, "GET_MAX_LUN");
+    printf("%u LUN(s)\n", max_lun + 1);
+
+    // per LUN identification
+    uint32_t capacity = 0;
+
+    for (uint8_t l = 0; l <= max_lun; l++) {
+        const uint8_t inquiry[6] = { 0x12, 0, 0, 0, 36, 0 };
+        const uint8_t read_capacity[10] = { 0x25 };
+        uint8_t data[36];
+
+        printf("LUN %u\n", l);
+        check(scsi(l, inquiry, sizeof(inquiry), 1, data, 36) == CSW_PASSED, "INQUIRY");
+        printf("  %.8s %.16s %.4s\n", &data[8], &data[16], &data[32]);
+
+        if (!test_unit_ready(l)) {
+            printf("  not ready\n");
+            continue;
+        }
+
+        check(scsi(l, read_capacity, sizeof(read_capacity), 1, data, 8) == CSW_PASSED, "READ CAPACITY(10)");
+        printf("  %u blocks of %u bytes\n", get32be(&data[0]) + 1, get32be(&data[4]));
+
+        if (l == lun) {
+            capacity = get32be(&data[0]) + 1;
+        }
+    }
+
+    if (!capacity) {
+        fprintf(stderr, "LUN %u has no medium\n", lun);
+        return 1;
+    }
+
+    // reading past the end must fail with LOGICAL BLOCK ADDRESS OUT OF RANGE
+    {
+        uint8_t data[512], key, asc;
+        int status = read_write(lun, 0, capacity, 1, data);
+
+        request_sense(lun, &key, &asc);
+        check((status & 0xff) == CSW_FAILED && key == 0x5 && asc == 0x21, "READ(10) out of range");
+    }
+
+    // a LUN past GET_MAX_LUN must fail with LOGICAL UNIT NOT SUPPORTED, with
+    // the data phase finished in both directions
+    {
+        uint8_t data[1024], key, asc;
+        int status;
+
+        memset(data, 0xff, sizeof(data));
+        status = read_write(max_lun + 1, 0, 0, 2, data);
+        request_sense(lun, &key, &asc);
+        check((status & 0xff) == CSW_FAILED && key == 0x5 && asc == 0x25 && !data[0] && !data[1023], "READ(10) unsupported LUN");
+
+        status = read_write(max_lun + 1, 1, 0, 2, data);
+        request_sense(lun, &key, &asc);
+        check((status & 0xff) == CSW_FAILED && key == 0x5 && asc == 0x25, "WRITE(10) unsupported LUN");
+    }
+
+    // an UNMAP beyond the advertised MAXIMUM UNMAP LBA COUNT must be refused as a whole
+    if (lun == 0) {
+        uint8_t cdb[10] = { 0x42 };
+        uint8_t list[8 + 16] = { 0 };
+        uint8_t key, asc;
+
+        cdb[8] = sizeof(list);
+        list[1] = sizeof(list) - 2;
+        list[3] = 16;
+        put32be(&list[8 + 8], 0x10000);     // NUMBER OF LOGICAL BLOCKS, from LBA 0
+
+        int status = scsi(lun, cdb, sizeof(cdb), 0, list, sizeof(list));
+        request_sense(lun, &key, &asc);
+        check((status & 0xff) == CSW_FAILED && key == 0x5 && asc == 0x26, "UNMAP over the limit");
+    }
+
+    // throughput
+    uint32_t total = megabytes * 2048;
+
+    if (total > capacity) {
+        total = capacity;
+    }
+
+    uint8_t* data = malloc(total * 512);
+    FILE* f = image && lun == 0 ? fopen(image, "rb") : NULL;
+
+    if (!data || (image && lun == 0 && !f)) {
+        fprintf(stderr, "could not open %s\n", image);
+        return 1;
+    }
+
+    double t = now();
+
+    for (uint32_t lba = 0; lba < total; lba += blocks) {
+        uint32_t n = total - lba < blocks ? total - lba : blocks;
+
+        if (read_write(lun, 0, lba, n, &data[lba * 512]) != CSW_PASSED) {
+            check(0, "READ(10)");
+            break;
+        }
+    }
+
+    t = now() - t;
+    printf("READ(10)  %u KB in %.3f s, %.1f KB/s\n", total / 2, t, total / 2 / t);
+
+    if (f) {
+        uint8_t* ref = malloc(total * 512);
+        check(ref && fread(ref, 512, total, f) == total && !memcmp(ref, data, total * 512), "data matches image");
+        free(ref);
+        fclose(f);
+    }
+
+    if (write_back) {
+        t = now();
+
+        for (uint32_t lba = 0; lba < total; lba += blocks) {
+            uint32_t n = total - lba < blocks ? total - lba : blocks;
+
+            if (read_write(lun, 1, lba, n, &data[lba * 512]) != CSW_PASSED) {
+                uint8_t key, asc;
+                request_sense(lun, &key, &asc);
+                printf("  WRITE(10): sense %x/%02x\n", key, asc);
+                check(0, "WRITE(10)");
+                break;
+            }
+        }
+
+        t = now() - t;
+        printf("WRITE(10) %u KB in %.3f s, %.1f KB/s\n", total / 2, t, total / 2 / t);
+    }
+
+    free(data);
+    close(fd);
+
+    printf(failures ? "%d failure(s)\n" : "all passed\n", failures);
+    return failures != 0;
+}
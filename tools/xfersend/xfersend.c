@@ -0,0 +1,332 @@
+/*--------------------------------------------------------------------
+ *                            xfersend
+ *                      www.fpgaarcade.com
+ *                     All rights reserved.
+ *
+ *                     admin@fpgaarcade.com
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *--------------------------------------------------------------------
+ *
+ * Sends a file to the Replay over its serial port (USART or USB CDC),
+ * either onto the SD card or into DRAM. See Replay_Boot/xfer.h.
+ *
+ *   xfersend <port> <file> <sd card path>
+ *   xfersend <port> <file> -d <dram address>
+ *
+ * <port> is a tty device (/dev/ttyUSB0, /dev/ttyACM0) or host:port
+ * for the hosted build.
+ *
+ * Copyright (c) 2020, The FPGAArcade community (see AUTHORS.txt)
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#include "../../Replay_Boot/crc32.h"
+
+#define XFER_SOF0           0xA5
+#define XFER_SOF1           0x5A
+
+#define XFER_OPEN           0x01
+#define XFER_DATA           0x02
+#define XFER_CLOSE          0x03
+#define XFER_ABORT          0x04
+#define XFER_ACK            0x81
+
+#define XFER_TARGET_FILE    0
+#define XFER_TARGET_DRAM    1
+
+#define XFER_STATUS_OK      0
+#define XFER_STATUS_RESEND  1
+#define XFER_STATUS_FAILED  2
+
+#define XFER_MAX_DATA       256
+
+#define ACK_TIMEOUT         500     // ms
+#define MAX_RETRIES         10
+
+static int fd = -1;
+static uint8_t seq;
+
+static void put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int open_port(const char* name)
+{
+    const char* colon = strrchr(name, ':');
+
+    if (name[0] != '/' && colon) {
+        char host[256];
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        struct addrinfo* res;
+        int s;
+
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - name), name);
+
+        if (getaddrinfo(host, colon + 1, &hints, &res)) {
+            return -1;
+        }
+
+        s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+        if (s >= 0 && connect(s, res->ai_addr, res->ai_addrlen)) {
+            close(s);
+            s = -1;
+        }
+
+        freeaddrinfo(res);
+        return s;
+    }
+
+    int s = open(name, O_RDWR | O_NOCTTY);
+
+    if (s >= 0 && isatty(s)) {
+        struct termios tio;
+        tcgetattr(s, &tio);
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~CRTSCTS;
+        tcsetattr(s, TCSANOW, &tio);
+        tcflush(s, TCIOFLUSH);
+    }
+
+    return s;
+}
+
+static void send_frame(uint8_t type, const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[2 + 4 + 4 + XFER_MAX_DATA + 4];
+
+    frame[0] = XFER_SOF0;
+    frame[1] = XFER_SOF1;
+    frame[2] = type;
+    frame[3] = seq++;
+    frame[4] = len;
+    frame[5] = len >> 8;
+    memcpy(&frame[6], payload, len);
+    put32(&frame[6 + len], CRC32_Update(CRC32_INIT, &frame[2], 4 + len));
+
+    if (write(fd, frame, 6 + len + 4) != 6 + len + 4) {
+        perror("write");
+        exit(1);
+    }
+}
+
+// Waits for an ACK frame; everything else on the line (debug output) is skipped.
+// Returns 0 on timeout.
+static int read_ack(uint8_t* status, uint32_t* offset, uint16_t* window)
+{
+    static uint8_t frame[4 + 7 + 4];
+    static int state, pos;
+
+    for (;;) {
+        struct timeval tv = { 0, ACK_TIMEOUT * 1000 };
+        fd_set set;
+        uint8_t c;
+
+        FD_ZERO(&set);
+        FD_SET(fd, &set);
+
+        if (select(fd + 1, &set, NULL, NULL, &tv) <= 0) {
+            state = 0;
+            return 0;
+        }
+
+        if (read(fd, &c, 1) != 1) {
+            fprintf(stderr, "connection lost\n");
+            exit(1);
+        }
+
+        switch (state) {
+            case 0:
+                state = (c == XFER_SOF0);
+                break;
+
+            case 1:
+                state = (c == XFER_SOF1) ? 2 : (c == XFER_SOF0);
+                pos = 0;
+                break;
+
+            case 2:
+                frame[pos++] = c;
+
+                if (pos == 4 && (frame[0] != XFER_ACK || frame[2] != 7 || frame[3] != 0)) {
+                    state = 0;
+
+                } else if (pos == sizeof(frame)) {
+                    state = 0;
+
+                    if (CRC32_Update(CRC32_INIT, frame, 4 + 7) == get32(&frame[4 + 7])) {
+                        *status = frame[4];
+                        *offset = get32(&frame[5]);
+                        *window = frame[9] | (frame[10] << 8);
+                        return 1;
+                    }
+                }
+
+                break;
+        }
+    }
+}
+
+// Sends a control frame until it is acknowledged
+static int command(uint8_t type, const uint8_t* payload, uint16_t len, uint16_t* window)
+{
+    for (int retry = 0; retry < MAX_RETRIES; retry++) {
+        uint8_t status;
+        uint32_t offset;
+
+        send_frame(type, payload, len);
+
+        if (read_ack(&status, &offset, window)) {
+            return status == XFER_STATUS_OK;
+        }
+    }
+
+    fprintf(stderr, "no response\n");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t open[9 + 256];
+    uint16_t openlen = 9;
+    uint8_t target = XFER_TARGET_FILE;
+    uint32_t address = 0;
+
+    if (argc == 5 && !strcmp(argv[3], "-d")) {
+        target = XFER_TARGET_DRAM;
+        address = strtoul(argv[4], NULL, 0);
+
+    } else if (argc == 4 && strlen(argv[3]) < 256) {
+        memcpy(&open[9], argv[3], strlen(argv[3]));
+        openlen += strlen(argv[3]);
+
+    } else {
+        fprintf(stderr, "usage: %s <port> <file> <sd card path>\n", argv[0]);
+        fprintf(stderr, "       %s <port> <file> -d <dram address>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* f = fopen(argv[2], "rb");
+
+    if (!f) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    uint32_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = malloc(size ? size : 1);
+
+    if (!data || fread(data, 1, size, f) != size) {
+        fprintf(stderr, "could not read %s\n", argv[2]);
+        return 1;
+    }
+
+    fclose(f);
+
+    fd = open_port(argv[1]);
+
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint16_t window;
+    open[0] = target;
+    put32(&open[1], size);
+    put32(&open[5], address);
+
+    if (!command(XFER_OPEN, open, openlen, &window)) {
+        fprintf(stderr, "open rejected\n");
+        return 1;
+    }
+
+    // go-back-n: keep up to 'window' bytes in flight, restart from the
+    // acknowledged offset on RESEND or silence
+    uint32_t acked = 0, sent = 0;
+    int retries = 0;
+
+    while (acked < size) {
+        while (sent < size && sent - acked < window) {
+            uint8_t frame[4 + XFER_MAX_DATA];
+            uint32_t n = size - sent;
+
+            if (n > XFER_MAX_DATA) {
+                n = XFER_MAX_DATA;
+            }
+
+            put32(frame, sent);
+            memcpy(&frame[4], &data[sent], n);
+            send_frame(XFER_DATA, frame, 4 + n);
+            sent += n;
+        }
+
+        uint8_t status;
+        uint32_t offset;
+
+        if (!read_ack(&status, &offset, &window)) {
+            if (++retries > MAX_RETRIES) {
+                fprintf(stderr, "\nno response at %u\n", acked);
+                return 1;
+            }
+
+            sent = acked;
+            continue;
+        }
+
+        if (status == XFER_STATUS_FAILED) {
+            fprintf(stderr, "\ntransfer failed at %u\n", offset);
+            return 1;
+        }
+
+        if (offset > acked) {
+            acked = offset;
+            retries = 0;
+        }
+
+        if (status == XFER_STATUS_RESEND) {
+            sent = acked;
+        }
+
+        fprintf(stderr, "\r%u / %u", acked, size);
+    }
+
+    uint8_t close_crc[4];
+    put32(close_crc, CRC32_Update(CRC32_INIT, data, size));
+
+    if (!command(XFER_CLOSE, close_crc, 4, &window)) {
+        fprintf(stderr, "\nverify failed\n");
+        return 1;
+    }
+
+    fprintf(stderr, "\ndone\n");
+    return 0;
+}